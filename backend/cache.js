@@ -1,8 +1,13 @@
 const logger = require("./logger").getLogger("cache");
 const db = require("./database");
 const events = require("./events");
+const GeoGrid = require("./geo_grid");
 
 let unit_cache = {}
+// the positions of the units, in a grid for each status, so a query for some statuses doesn't even see the others
+let unit_grids = {};
+let unit_grid_of = {}; // unit -> the status of the grid it's in
+let loaded = false;
 
 const pipe_last_records = [
     { $sort: { unit: 1, time: -1 } },
@@ -11,32 +16,68 @@ const pipe_last_records = [
 ];
 
 
-function upsert_location(u) {
-    if (!(u.unit in unit_cache)) {
-        unit_cache[u.unit] = {
+function place(c) {
+    if ((typeof(c.lat) !== "number") || (typeof(c.lon) !== "number")) {
+        return;
+    }
+    let status = String(c.status);
+    let old = unit_grid_of[c.unit];
+    if ((old !== undefined) && (old !== status)) {
+        unit_grids[old].remove(c.unit);
+    }
+    if (!(status in unit_grids)) {
+        unit_grids[status] = new GeoGrid();
+    }
+    unit_grids[status].update(c.unit, c.lat, c.lon, c);
+    unit_grid_of[c.unit] = status;
+}
+
+// the grids of @statuses, or all of them
+function grids_of(statuses) {
+    return (statuses || Object.keys(unit_grids)).filter(s => s in unit_grids).map(s => unit_grids[s]);
+}
+
+function entry_of(unit) {
+    if (!(unit in unit_cache)) {
+        unit_cache[unit] = {
             type: "unit",
-            unit: u.unit,
+            unit,
         };
     }
+    return unit_cache[unit];
+}
+
+// the records loaded at startup may be older than the ones that arrived meanwhile
+function is_stale(last_time, u) {
+    return (last_time !== undefined) && (u.time < last_time);
+}
+
+function upsert_location(u) {
+    if (is_stale(entry_of(u.unit).location_time, u)) {
+        return false;
+    }
     let changed = 
         (unit_cache[u.unit].location_time != u.time) ||
         (unit_cache[u.unit].lat != u.lat) ||
         (unit_cache[u.unit].lon != u.lon) ||
         (unit_cache[u.unit].azi != u.azi) ||
-        (unit_cache[u.unit].spd != u.spd);
+        (unit_cache[u.unit].spd != u.spd) ||
+        (unit_cache[u.unit].acc != u.acc);
 
     unit_cache[u.unit].location_time = u.time;
     unit_cache[u.unit].lat = u.lat;
     unit_cache[u.unit].lon = u.lon;
     unit_cache[u.unit].azi = u.azi;
     unit_cache[u.unit].spd = u.spd;
+    unit_cache[u.unit].acc = u.acc;
+    place(unit_cache[u.unit]);
 
     return changed;
 }
 
 function upsert_status(u) {
-    if (!(u.unit in unit_cache)) {
-        unit_cache[u.unit] = {};
+    if (is_stale(entry_of(u.unit).status_time, u)) {
+        return false;
     }
     let changed =
         (unit_cache[u.unit].status_time != u.time) ||
@@ -46,13 +87,14 @@ function upsert_status(u) {
     unit_cache[u.unit].status_time = u.time;
     unit_cache[u.unit].status = u.status;
     unit_cache[u.unit].user = u.user;
+    place(unit_cache[u.unit]);
 
     return changed;
 }
 
 function upsert_battery(u) {
-    if (!(u.unit in unit_cache)) {
-        unit_cache[u.unit] = {};
+    if (is_stale(entry_of(u.unit).battery_time, u)) {
+        return false;
     }
     let changed =
         (unit_cache[u.unit].battery_time != u.time) ||
@@ -92,16 +134,63 @@ let handler = (etype, data) => {
     }
 };
 
+// the fields of a unit as get_units() in rest.client returns them
+const VIEW_FIELDS = [ "unit", "status", "user", "status_time", "location_time", "lat", "lon", "azi", "spd", "acc", "battery_time", "bat" ];
+
+function view(c) {
+    let result = {};
+    for (let f of VIEW_FIELDS) {
+        if (c[f] !== undefined) {
+            result[f] = c[f];
+        }
+    }
+    return result;
+}
+
+/* The cache entries with one of @statuses (or any), for which @filter(entry) is true, if there is a filter
+ * If there is a @bbox = { south, west, north, east }, only the ones within that, looked up by the grids
+ */
+function select(filter = null, bbox = null, statuses = null) {
+    if (bbox) {
+        return [].concat(...grids_of(statuses).map(g => g.within(bbox.south, bbox.west, bbox.north, bbox.east, filter)));
+    }
+    return Object.values(unit_cache).filter(c => (!statuses || statuses.includes(c.status)) && (!filter || filter(c)));
+}
+
+// the units that have a status, as get_units() in rest.client returns them
+function units(filter = null, bbox = null, statuses = null) {
+    return select(c => (c.status !== undefined) && (!filter || filter(c)), bbox, statuses).map(view);
+}
+
+// the @num units nearest to @lat, @lon, within @max_dist metres, like units() does, closest first, with their distance
+function units_near(lat, lon, num, filter = null, statuses = null, max_dist = Infinity) {
+    let f = c => (c.status !== undefined) && (!filter || filter(c));
+    let found = [].concat(...grids_of(statuses).map(g => g.nearest(lat, lon, num, f, max_dist)));
+    found.sort((a, b) => a.dist - b.dist);
+    return found.slice(0, num).map(x => Object.assign(view(x.value), { dist: Math.round(x.dist) }));
+}
+
 function start() {
-    db.unit_location().aggregate(pipe_last_records).forEach(upsert_location);
-    db.unit_status().aggregate(pipe_last_records).forEach(upsert_status);
-    db.unit_battery().aggregate(pipe_last_records).forEach(upsert_battery);
+    // the updates are listened to already while loading, the stale records of the loading are then skipped
     events.emitter.addListener("sendit", handler);
+    return Promise.all([
+        db.unit_location().aggregate(pipe_last_records, { allowDiskUse: true }).forEach(upsert_location),
+        db.unit_status().aggregate(pipe_last_records, { allowDiskUse: true }).forEach(upsert_status),
+        db.unit_battery().aggregate(pipe_last_records, { allowDiskUse: true }).forEach(upsert_battery),
+    ]).then(() => {
+        loaded = true;
+        logger.info("Unit cache loaded, " + Object.keys(unit_cache).length + " units");
+    });
 }
 
 module.exports = {
     start,
     unit: unit_cache,
+    is_loaded: () => loaded,
+    select,
+    units,
+    units_near,
+    view,
 }
 
 // vim: set sw=4 ts=4 et:
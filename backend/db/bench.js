@@ -0,0 +1,244 @@
+// Benchmark of the log-like collections, with and without the schema of database.js
+//
+// node db/bench.js [options]
+//
+// Fills a scratch database with a synthetic fleet history, then times the queries of the backend on it: the last
+// records of all the units (the startup of the cache), the last record of one unit (get_units() in rest.client), the
+// trace of a unit and the recent status of all the units (rest.admin). It does it first on the bare collections, then
+// after database.bootstrap() has built the indexes. Then it compares the unit list of the clients as get_units() reads
+// it from the db with the same from the unit cache, with and without a bounding box, and finally times a retention pass.
+
+const MongoClient = require("mongodb").MongoClient;
+const database = require("../database");
+
+function usage() {
+    console.error("Usage: node db/bench.js [options]");
+    console.error("  --uri <uri>        the MongoDB to use (default: mongodb://localhost:27017)");
+    console.error("  --db <name>        the scratch database, it's dropped first (default: gps_tracker_bench)");
+    console.error("  --records <n>      number of location records, plus a tenth of it battery ones (default: 10000000)");
+    console.error("  --units <n>        number of units (default: 1000)");
+    console.error("  --days <n>         the span of the history (default: 3)");
+    console.error("  --sample <n>       the per-unit queries are done for this many units (default: 20)");
+    console.error("  --fill <0|1>       generate the data, 0 to reuse the last one (default: 1)");
+    process.exit(1);
+}
+
+function parse_args(argv) {
+    let opts = { uri: "mongodb://localhost:27017", db: "gps_tracker_bench", records: 10000000, units: 1000, days: 3, sample: 20, fill: 1 };
+    for (let i = 0; i < argv.length; i += 2) {
+        let k = argv[i].startsWith("--") ? argv[i].substr(2) : null;
+        if (!k || !(k in opts) || (i + 1 >= argv.length)) {
+            usage();
+        }
+        opts[k] = ((k === "uri") || (k === "db")) ? argv[i + 1] : parseFloat(argv[i + 1]);
+        if (Number.isNaN(opts[k])) {
+            usage();
+        }
+    }
+    return opts;
+}
+
+// cache.js: pipe_last_records
+const pipe_last_records = [
+    { $sort: { unit: 1, time: -1 } },
+    { $group: {_id: "$unit", lastrec: { $first: "$$CURRENT" } } },
+    { $replaceWith: "$lastrec" },
+];
+
+async function timed(label, f) {
+    let started = process.hrtime.bigint();
+    let result = await f();
+    let ms = Number(process.hrtime.bigint() - started) / 1e6;
+    console.log(label.padEnd(48) + ms.toFixed(1).padStart(12) + " ms" + ((result !== undefined) ? ("   (" + result + ")") : ""));
+    return ms;
+}
+
+async function fill(db, opts, now) {
+    let per_unit = Math.ceil(opts.records / opts.units);
+    let step = opts.days * 24 * 3600 / per_unit;
+    let location = db.collection("unit_location");
+    let battery = db.collection("unit_battery");
+    let status = db.collection("unit_status");
+
+    // the units report in turns, like they would do, and not one after the other
+    const BATCH = 10000;
+    const PARALLEL = 4;
+    let inflight = [];
+    let buf = [];
+    let bats = [];
+    for (let i = 0; i < per_unit; ++i) {
+        for (let u = 1; u <= opts.units; ++u) {
+            let time = Math.round(now - opts.days * 24 * 3600 + i * step + u * step / opts.units);
+            buf.push({ unit: "Unit " + u, time, lat: 25 + (u % 100) / 1000 + i / 1e6, lon: 55 + Math.floor(u / 100) / 1000, azi: i % 360, spd: 12.5, acc: 4.2 });
+            if ((i % 10) == 0) {
+                bats.push({ unit: "Unit " + u, time, bat: 3300 - i % 300 });
+            }
+            if (buf.length >= BATCH) {
+                inflight.push(location.insertMany(buf, { ordered: false }));
+                buf = [];
+            }
+            if (bats.length >= BATCH) {
+                inflight.push(battery.insertMany(bats, { ordered: false }));
+                bats = [];
+            }
+            if (inflight.length >= PARALLEL) {
+                await Promise.all(inflight);
+                inflight = [];
+            }
+        }
+    }
+    if (buf.length) {
+        inflight.push(location.insertMany(buf, { ordered: false }));
+    }
+    if (bats.length) {
+        inflight.push(battery.insertMany(bats, { ordered: false }));
+    }
+    let statuses = [];
+    for (let u = 1; u <= opts.units; ++u) {
+        statuses.push({ unit: "Unit " + u, time: now - opts.days * 24 * 3600, status: "available", user: null });
+    }
+    inflight.push(status.insertMany(statuses));
+    await Promise.all(inflight);
+    return per_unit * opts.units;
+}
+
+async function queries(db, opts, now) {
+    let location = db.collection("unit_location");
+    let sample = [];
+    for (let i = 0; i < opts.sample; ++i) {
+        sample.push("Unit " + (1 + Math.floor(i * opts.units / opts.sample)));
+    }
+
+    await timed("last records of all units (cache startup)", async () => (await location.aggregate(pipe_last_records, { allowDiskUse: true }).toArray()).length);
+    let ms = await timed("last record of a unit, " + opts.sample + " units", async () => {
+        for (let unit of sample) {
+            await location.aggregate([ { $match: { unit } }, { $sort: { time: -1 } }, { $limit: 1 } ]).next();
+        }
+    });
+    console.log("  per unit".padEnd(48) + (ms / opts.sample).toFixed(1).padStart(12) + " ms");
+    await timed("3 h trace of a unit, " + opts.sample + " units", async () => {
+        let n = 0;
+        for (let unit of sample) {
+            n += (await location.aggregate([
+                { $match: { unit, time: { $gte: now - 3 * 3600 } } },
+                { $sort: { unit: 1, time: 1 } },
+            ]).toArray()).length;
+        }
+        return n + " records";
+    });
+    await timed("last 5 min of all units", async () => (await location.aggregate([
+        { $match: { time: { $gte: now - 300 } } },
+        { $sort: { unit: 1, time: -1 } },
+        { $group: {_id: "$unit", lastrec: { $first: "$$CURRENT" } } },
+        { $replaceWith: "$lastrec" },
+    ], { allowDiskUse: true }).toArray()).length + " units");
+}
+
+// the unit list of rest.client, the db way: get_units() with the status filter of op_get_all(), 2N+1 queries
+async function get_units(db) {
+    let items = {};
+    let promises = [];
+    await db.collection("unit_status").aggregate([ { $match: { status: "available" } } ]).forEach(u => {
+        items[u.unit] = { unit: u.unit, status: u.status, user: u.user, status_time: u.time };
+        let pipe_last_entry_of_this_unit = [ { $match: { unit: u.unit } }, { $sort: { time: -1 } }, { $limit: 1 } ];
+        promises.push(Promise.all([
+            db.collection("unit_location").aggregate(pipe_last_entry_of_this_unit).next(),
+            db.collection("unit_battery").aggregate(pipe_last_entry_of_this_unit).next(),
+        ]));
+    });
+    let locbats = await Promise.all(promises);
+    locbats.forEach(([ loc, bat ]) => {
+        if (loc) {
+            Object.assign(items[loc.unit], { location_time: loc.time, lat: loc.lat, lon: loc.lon, azi: loc.azi, spd: loc.spd, acc: loc.acc });
+        }
+        if (bat) {
+            Object.assign(items[bat.unit], { battery_time: bat.time, bat: bat.bat });
+        }
+    });
+    return Object.values(items);
+}
+
+async function unit_list(db, opts) {
+    const ROUNDS = 100;
+    // the cache reads the collections through the getters of database.js
+    for (let name of [ "unit_location", "unit_battery", "unit_status" ]) {
+        database[name] = () => db.collection(name);
+    }
+    const cache = require("../cache");
+
+    let n = 0;
+    let ms = await timed("unit list from the db, " + opts.units + " units", async () => (n = (await get_units(db)).length) + " units");
+    console.log("  per query".padEnd(48) + (ms / (2 * n + 1)).toFixed(3).padStart(12) + " ms");
+    await timed("unit cache startup", () => cache.start().then(() => Object.keys(cache.unit).length + " units"));
+    let available = u => (u.status == "available");
+    ms = await timed("unit list from the cache, " + ROUNDS + " times", async () => {
+        for (let i = 0; i < ROUNDS; ++i) {
+            n = cache.units(available).length;
+        }
+        return n + " units";
+    });
+    console.log("  per list".padEnd(48) + (ms / ROUNDS).toFixed(3).padStart(12) + " ms");
+
+    // a box of about 1 km around a unit, looked up by the grid, and by filtering all of them
+    let center = cache.unit["Unit 1"];
+    let bbox = { south: center.lat - 0.0045, west: center.lon - 0.005, north: center.lat + 0.0045, east: center.lon + 0.005 };
+    let in_bbox = u => (bbox.south <= u.lat) && (u.lat <= bbox.north) && (bbox.west <= u.lon) && (u.lon <= bbox.east);
+    await timed("units in 1 km box by scanning, " + ROUNDS + " times", async () => {
+        for (let i = 0; i < ROUNDS; ++i) {
+            n = cache.units(u => available(u) && in_bbox(u)).length;
+        }
+        return n + " units";
+    });
+    await timed("units in 1 km box by the grid, " + ROUNDS + " times", async () => {
+        for (let i = 0; i < ROUNDS; ++i) {
+            n = cache.units(available, bbox).length;
+        }
+        return n + " units";
+    });
+}
+
+async function main() {
+    let opts = parse_args(process.argv.slice(2));
+    let client = new MongoClient(opts.uri, { useNewUrlParser: true, useUnifiedTopology: true });
+    await client.connect();
+    let db = client.db(opts.db);
+    let now = Math.round(new Date().getTime() / 1000);
+
+    if (opts.fill) {
+        await db.dropDatabase();
+        await timed("fill " + opts.records + " records", () => fill(db, opts, now).then(n => n + " locations"));
+    }
+    else {
+        let last = await db.collection("unit_location").find().sort({ time: -1 }).limit(1).next();
+        now = last ? last.time : now;
+        await Promise.all([ "unit_location", "unit_battery", "unit_startup", "unit_status" ].map(name => db.collection(name).dropIndexes().catch(() => null)));
+    }
+
+    console.log("\n--- bare collections");
+    await queries(db, opts, now);
+
+    console.log("\n--- with the schema");
+    await timed("bootstrap (index build)", () => database.bootstrap(db).then(() => undefined));
+    await timed("bootstrap again (startup)", () => database.bootstrap(db).then(() => undefined));
+    await queries(db, opts, now);
+
+    console.log("\n--- unit list");
+    await unit_list(db, opts);
+
+    console.log("\n--- retention");
+    let s = database.schema.unit_location;
+    // as if the history were older by that much, so all of it gets downsampled
+    let later = now + s.downsample_after;
+    await timed("expire, " + opts.days + " days to downsample", async () => JSON.stringify(await database.expire(db, later)));
+    await timed("expire again, nothing to do", async () => JSON.stringify(await database.expire(db, later)));
+
+    await client.close();
+    process.exit(0); // the keepalive timer of the events would keep it running
+}
+
+main().catch(err => {
+    console.error(err);
+    process.exit(1);
+});
+
+// vim: set sw=4 ts=4 et:
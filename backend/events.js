@@ -54,9 +54,225 @@ function dispatcher(req, res, filter = null) {
 }
 
 
-function fetch_dispatcher(req, res, filter = null) {
+/* The stream of the unit updates for the clients (fetch_event)
+ *
+ * The cache emits the whole entry of a unit when it changes, and one listener here fans it out to all the streams,
+ * so it isn't one listener per client, each serializing the same entry.
+ *
+ * Every client gets only the units that pass its filter and are within its bbox, if it has one. The first message
+ * of a unit is the whole entry, the later ones only the fields that changed since the last one it got, with
+ * "delta": true, and when a unit leaves its view, it gets { type, unit, gone: true }. The updates are collected for
+ * a window of time per client, and a unit that changed many times meanwhile is sent only once.
+ *
+ * Every version of a unit is serialized only once for each kind of message (whole, delta from a given earlier
+ * version, gone), and the same buffer is written to all the clients that need that one.
+ */
+const FETCH_WINDOW = 250; // ms, if the client doesn't ask for another one
+const MAX_FETCH_WINDOW = 10000; // ms
+const FETCH_HISTORY = 8; // the last versions of a unit that a delta can be made from
+
+let fetch_streams = new Set();
+let fetch_units = new Map(); // unit -> { seq, fields, history: Map(seq -> fields), encoded: Map(base -> Buffer), gone }
+let fetch_seq = 0;
+
+const fetch_metrics = {
+    updates: 0,
+    encoded: 0,
+    encoded_bytes: 0,
+    messages: 0,
+    written_bytes: 0,
+    coalesced: 0,
+};
+
+function publish(data) {
+    let u = fetch_units.get(data.unit);
+    if (!u) {
+        u = { history: new Map(), gone: null };
+        fetch_units.set(data.unit, u);
+    }
+    u.seq = ++fetch_seq;
+    u.fields = Object.assign({}, data);
+    delete u.fields.mark_for_sending;
+    u.history.set(u.seq, u.fields);
+    if (u.history.size > FETCH_HISTORY) {
+        u.history.delete(u.history.keys().next().value);
+    }
+    u.encoded = new Map();
+    ++fetch_metrics.updates;
+    return u;
+}
+
+function encode(msg) {
+    let buf = Buffer.from(JSON.stringify(msg) + "\n");
+    ++fetch_metrics.encoded;
+    fetch_metrics.encoded_bytes += buf.length;
+    return buf;
+}
+
+// the message that brings a client from version @base of the unit to the current one
+function encoded(u, base) {
+    let key = u.history.has(base) ? base : 0;
+    let buf = u.encoded.get(key);
+    if (!buf) {
+        let msg = u.fields;
+        if (key) {
+            let old = u.history.get(key);
+            msg = { type: u.fields.type, unit: u.fields.unit, delta: true };
+            for (let f in u.fields) {
+                if (u.fields[f] !== old[f]) {
+                    msg[f] = u.fields[f];
+                }
+            }
+        }
+        buf = encode(msg);
+        u.encoded.set(key, buf);
+    }
+    return buf;
+}
+
+function in_bbox(fields, bbox) {
+    return (bbox.south <= fields.lat) && (fields.lat <= bbox.north) && (bbox.west <= fields.lon) && (fields.lon <= bbox.east);
+}
+
+class FetchStream {
+    constructor(req, res, filter, bbox, window) {
+        this.req = req;
+        this.res = res;
+        this.filter = filter;
+        this.bbox = bbox;
+        this.window = window;
+        this.known = new Map(); // unit -> the version it got last
+        this.pending = new Set(); // the units changed since the last flush
+        this.other = []; // the buffers of the messages that aren't units
+        this.timer = null;
+        this.waiting = false; // for the client to read what it got so far
+        this.ending = false;
+        this.closed = false;
+    }
+
+    visible(fields) {
+        return (!this.filter || this.filter(fields)) && (!this.bbox || in_bbox(fields, this.bbox));
+    }
+
+    offer(unit, u) {
+        if (!this.known.has(unit) && !this.visible(u.fields)) {
+            return;
+        }
+        if (this.pending.has(unit)) {
+            ++fetch_metrics.coalesced;
+        }
+        this.pending.add(unit);
+        this.schedule();
+    }
+
+    send(buf) {
+        this.other.push(buf);
+        this.schedule();
+    }
+
+    end() {
+        this.ending = true;
+        this.schedule(true);
+    }
+
+    schedule(now = false) {
+        if (this.closed || this.waiting || (this.timer && !now)) {
+            return;
+        }
+        this.cancel();
+        this.timer = (now || !this.window) ? setImmediate(() => this.flush()) : setTimeout(() => this.flush(), this.window);
+    }
+
+    flush() {
+        this.timer = null;
+        let res = this.res;
+        res.cork();
+        for (let buf of this.other) {
+            this.write(buf);
+        }
+        this.other = [];
+        for (let unit of this.pending) {
+            let u = fetch_units.get(unit);
+            if (this.visible(u.fields)) {
+                if (this.known.get(unit) !== u.seq) {
+                    this.write(encoded(u, this.known.get(unit)));
+                    this.known.set(unit, u.seq);
+                }
+            }
+            else if (this.known.has(unit)) {
+                if (!u.gone) {
+                    u.gone = encode({ type: u.fields.type, unit, gone: true });
+                }
+                this.write(u.gone);
+                this.known.delete(unit);
+            }
+        }
+        this.pending.clear();
+        if (this.ending) {
+            res.write("null\n");
+            res.end();
+            this.close();
+            return;
+        }
+        res.uncork();
+        // a slow client gets the updates that piled up meanwhile coalesced, and not all of them
+        if (res.writableNeedDrain) {
+            this.waiting = true;
+            res.once("drain", () => {
+                this.waiting = false;
+                if (this.pending.size || this.other.length) {
+                    this.schedule();
+                }
+            });
+        }
+    }
+
+    write(buf) {
+        ++fetch_metrics.messages;
+        fetch_metrics.written_bytes += buf.length;
+        this.res.write(buf);
+    }
+
+    cancel() {
+        // it's either a timeout or an immediate, clearing it as the other one does nothing
+        clearTimeout(this.timer);
+        clearImmediate(this.timer);
+        this.timer = null;
+    }
+
+    close() {
+        this.closed = true;
+        this.cancel();
+        fetch_streams.delete(this);
+    }
+}
+
+fetch_emitter.addListener("sendit", data => {
+    if (data === null) {
+        fetch_streams.forEach(s => s.end());
+        return;
+    }
+    if ((data.type == "unit") && (data.unit !== undefined)) {
+        let u = publish(data);
+        fetch_streams.forEach(s => s.offer(data.unit, u));
+        return;
+    }
+    let buf = null;
+    fetch_streams.forEach(s => {
+        if (!s.filter || s.filter(data)) {
+            s.send(buf || (buf = encode(data)));
+        }
+    });
+});
+
+/* @options:
+ * - bbox: { south, west, north, east }, only the units within it are sent
+ * - window: the coalescing window in ms
+ */
+function fetch_dispatcher(req, res, filter = null, options = {}) {
     utils.require_client(req);
     logger.debug("fetch_event for " + req.session.email + ": start");
+    let window = Math.min(Math.max(0, (options.window !== undefined) ? options.window : FETCH_WINDOW), MAX_FETCH_WINDOW);
 
     // NOTE: to prevent client-side from further reconnecting, send 204
     // "Also, there will be no reconnection if the response has an incorrect Content-Type or its HTTP status differs from 301, 307, 200 and 204."
@@ -66,38 +282,41 @@ function fetch_dispatcher(req, res, filter = null) {
     utils.add_cors_response_headers(res, req.headers.origin);
     res.flushHeaders(); // flush the headers to establish SSE with client
 
-    let handler = (data) => {
-        logger.debug("fetch_event for " + req.session.email + ", data=" + JSON.stringify(data));
-        if (data == null) {
-            fetch_emitter.removeListener("sendit", handler);
-        }
-        if (!filter || filter(data)) {
-            setImmediate(() => {
-                logger.debug("fetch_event sending " + req.session.email + ", data=" + JSON.stringify(data));
-                res.write(JSON.stringify(data) + "\n");
-                if (data === null) {
-                    res.end();
-                }
-            });
-        }
-    };
-
-    fetch_emitter.addListener("sendit", handler);
+    let stream = new FetchStream(req, res, filter, options.bbox || null, window);
+    fetch_streams.add(stream);
 
     // If client closes connection, stop sending events
     res.on("close", () => {
-        logger.debug("event for " + req.session.email + ": client dropped me");
-        fetch_emitter.removeListener("sendit", handler);
+        logger.debug("fetch_event for " + req.session.email + ": client dropped me");
+        stream.close();
         res.end();
     });
 }
 
+// the @options of fetch_dispatcher() from the query: ?bbox=<lat>,<lon>,<lat>,<lon>, ?window=<ms>; throws 400 if invalid
+function fetch_options(req) {
+    let window;
+    if (req.query.window) {
+        if ((typeof(req.query.window) !== "string") || !/^\d+$/.test(req.query.window)) {
+            throw utils.error(400, "Invalid window");
+        }
+        window = parseInt(req.query.window);
+    }
+    return { bbox: utils.get_bbox(req), window };
+}
+
+function fetch_stats() {
+    return Object.assign({ streams: fetch_streams.size, units: fetch_units.size }, fetch_metrics);
+}
+
 
 module.exports = {
     emitter,
     fetch_emitter,
     dispatcher,
     fetch_dispatcher,
+    fetch_options,
+    fetch_stats,
 }
 
 // vim: set sw=4 ts=4 et:
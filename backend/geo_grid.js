@@ -0,0 +1,215 @@
+/* Uniform grid over lat/lon, for finding the units by their position without scanning all of them
+ *
+ * The cells are cell_deg by cell_deg degrees, every item is in the one that contains its position, so a query visits
+ * only the cells it overlaps. (Towards the poles the cells get narrower in metres, at the latitude of a city it's
+ * all the same.)
+ */
+
+const M_PER_DEG = 111319.5;
+
+// the distance in metres from the first point, good enough within a city
+function distance(lat1, lon1, lat2, lon2) {
+    let dn = (lat2 - lat1) * M_PER_DEG;
+    let de = (lon2 - lon1) * M_PER_DEG * Math.cos(lat1 * Math.PI / 180);
+    return Math.hypot(dn, de);
+}
+
+class GeoGrid {
+    constructor(cell_deg = 0.01) {
+        this.cell_deg = cell_deg;
+        this.cells = new Map(); // cell key -> Map(id -> item)
+        this.items = new Map(); // id -> { id, lat, lon, key, value }
+        // the rows and columns that have ever had an item, the nearest search doesn't go beyond them
+        this.bounds = null;
+    }
+
+    get size() {
+        return this.items.size;
+    }
+
+    row(lat) {
+        return Math.floor(lat / this.cell_deg);
+    }
+
+    col(lon) {
+        return Math.floor(lon / this.cell_deg);
+    }
+
+    static key(row, col) {
+        return row + ":" + col;
+    }
+
+    // puts @id at @lat, @lon, with @value for the queries to return
+    update(id, lat, lon, value) {
+        let key = GeoGrid.key(this.row(lat), this.col(lon));
+        let item = this.items.get(id);
+        if (item && (item.key !== key)) {
+            this.remove(id);
+            item = undefined;
+        }
+        if (!item) {
+            item = { id, key };
+            this.items.set(id, item);
+            let cell = this.cells.get(key);
+            if (!cell) {
+                cell = new Map();
+                cell.row = this.row(lat);
+                cell.col = this.col(lon);
+                this.cells.set(key, cell);
+                this.extend(this.row(lat), this.col(lon));
+            }
+            cell.set(id, item);
+        }
+        item.lat = lat;
+        item.lon = lon;
+        item.value = value;
+    }
+
+    extend(row, col) {
+        if (!this.bounds) {
+            this.bounds = { row_min: row, row_max: row, col_min: col, col_max: col };
+            return;
+        }
+        let b = this.bounds;
+        b.row_min = Math.min(b.row_min, row);
+        b.row_max = Math.max(b.row_max, row);
+        b.col_min = Math.min(b.col_min, col);
+        b.col_max = Math.max(b.col_max, col);
+    }
+
+    remove(id) {
+        let item = this.items.get(id);
+        if (!item) {
+            return;
+        }
+        this.items.delete(id);
+        let cell = this.cells.get(item.key);
+        cell.delete(id);
+        if (cell.size == 0) {
+            this.cells.delete(item.key);
+        }
+    }
+
+    /* The values within the box, for which @filter(value) is true, if there is a filter
+     *
+     * Only the cells within the bounds are looked up, and if the box has more of them than there are cells with items
+     * in them, it's those that are checked instead, so a box of half the world costs no more than scanning the items.
+     */
+    within(south, west, north, east, filter = null) {
+        let result = [];
+        if (!this.bounds) {
+            return result;
+        }
+        let b = this.bounds;
+        let row_from = Math.max(this.row(south), b.row_min), row_to = Math.min(this.row(north), b.row_max);
+        let col_from = Math.max(this.col(west), b.col_min), col_to = Math.min(this.col(east), b.col_max);
+        if ((row_from > row_to) || (col_from > col_to)) {
+            return result;
+        }
+        let add = cell => {
+            for (let item of cell.values()) {
+                if ((south <= item.lat) && (item.lat <= north) && (west <= item.lon) && (item.lon <= east) &&
+                    (!filter || filter(item.value))) {
+                    result.push(item.value);
+                }
+            }
+        };
+        if ((row_to - row_from + 1) * (col_to - col_from + 1) > this.cells.size) {
+            for (let cell of this.cells.values()) {
+                if ((row_from <= cell.row) && (cell.row <= row_to) && (col_from <= cell.col) && (cell.col <= col_to)) {
+                    add(cell);
+                }
+            }
+            return result;
+        }
+        for (let row = row_from; row <= row_to; ++row) {
+            for (let col = col_from; col <= col_to; ++col) {
+                let cell = this.cells.get(GeoGrid.key(row, col));
+                if (cell) {
+                    add(cell);
+                }
+            }
+        }
+        return result;
+    }
+
+    /* The @k nearest values to @lat, @lon, for which @filter(value) is true, if there is a filter, as [ { value, dist } ]
+     * closest first, dist in metres, not farther than @max_dist, if given
+     *
+     * It visits the cells in rings around the one of the position, until the ones outside can't be closer than the
+     * k-th found so far, so its cost depends on k and the density around, and not on the number of the items.
+     */
+    nearest(lat, lon, k, filter = null, max_dist = Infinity) {
+        let best = []; // sorted by dist, at most k long
+        if (!this.bounds || (k <= 0)) {
+            return best;
+        }
+        let row0 = this.row(lat), col0 = this.col(lon);
+        let b = this.bounds;
+        let m_per_col = M_PER_DEG * Math.cos(lat * Math.PI / 180);
+        // the rings that have cells within the bounds
+        let first_ring = Math.max(0, b.row_min - row0, row0 - b.row_max, b.col_min - col0, col0 - b.col_max);
+        let last_ring = Math.max(row0 - b.row_min, b.row_max - row0, col0 - b.col_min, b.col_max - col0);
+
+        let visit = (row, col) => {
+            if ((row < b.row_min) || (b.row_max < row) || (col < b.col_min) || (b.col_max < col)) {
+                return;
+            }
+            let cell = this.cells.get(GeoGrid.key(row, col));
+            if (!cell) {
+                return;
+            }
+            for (let item of cell.values()) {
+                let dist = distance(lat, lon, item.lat, item.lon);
+                if ((dist > max_dist) || ((best.length == k) && (dist >= best[k - 1].dist)) || (filter && !filter(item.value))) {
+                    continue;
+                }
+                let i = best.length;
+                while ((i > 0) && (best[i - 1].dist > dist)) {
+                    --i;
+                }
+                best.splice(i, 0, { value: item.value, dist });
+                if (best.length > k) {
+                    best.pop();
+                }
+            }
+        };
+
+        for (let ring = first_ring; ring <= last_ring; ++ring) {
+            if (ring > 0) {
+                // everything not visited yet is outside the square of the rings before, at least this far
+                let outside = Math.min(
+                    (lat - (row0 - ring + 1) * this.cell_deg) * M_PER_DEG,
+                    ((row0 + ring) * this.cell_deg - lat) * M_PER_DEG,
+                    (lon - (col0 - ring + 1) * this.cell_deg) * m_per_col,
+                    ((col0 + ring) * this.cell_deg - lon) * m_per_col);
+                if ((outside > max_dist) || ((best.length == k) && (outside >= best[k - 1].dist))) {
+                    break;
+                }
+            }
+            if (ring == 0) {
+                visit(row0, col0);
+            }
+            else {
+                // only the part of the ring that is within the bounds
+                let col_from = Math.max(col0 - ring, b.col_min), col_to = Math.min(col0 + ring, b.col_max);
+                let row_from = Math.max(row0 - ring + 1, b.row_min), row_to = Math.min(row0 + ring - 1, b.row_max);
+                for (let col = col_from; col <= col_to; ++col) {
+                    visit(row0 - ring, col);
+                    visit(row0 + ring, col);
+                }
+                for (let row = row_from; row <= row_to; ++row) {
+                    visit(row, col0 - ring);
+                    visit(row, col0 + ring);
+                }
+            }
+        }
+        return best;
+    }
+}
+
+GeoGrid.distance = distance;
+
+module.exports = GeoGrid;
+
+// vim: set sw=4 ts=4 et:
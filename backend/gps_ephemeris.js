@@ -0,0 +1,118 @@
+/*
+ * GPS ephemeris from the UBX AID-EPH messages, see IS-GPS-200 20.3.3.4
+ *
+ * Only as much of it is evaluated as needed to tell whether a satellite is above the horizon at some place and time,
+ * so we can send the units only the ephemerides they can use.
+ */
+
+const MU = 3.986005e14;                 // m^3/s^2, WGS84 gravitational constant
+const OMEGA_E = 7.2921151467e-5;        // rad/s, WGS84 earth rotation rate
+const GPS_PI = 3.1415926535898;         // the value of pi used in the orbit parameters
+const WGS84_A = 6378137.0;              // m
+const WGS84_E2 = 6.69437999014e-3;
+const HALF_WEEK = 302400;               // s
+
+const AID_EPH_PAYLOAD_LEN = 104;
+
+// the 24 data bits of a word, @sf: subframe 1..3, @n: word 3..10
+function word(payload, sf, n) {
+    return payload.readUInt32LE(8 + 32 * (sf - 1) + 4 * (n - 3)) & 0xffffff;
+}
+
+// @from: the first bit as in the spec, 1 = msb of the 24 data bits
+function bits(w, from, len) {
+    return (w >>> (24 - from - len + 1)) & ((1 << len) - 1);
+}
+
+function signed(x, len) {
+    return (x >= 2 ** (len - 1)) ? (x - 2 ** len) : x;
+}
+
+// a 32-bit field split into the last 8 bits of one word and the 24 bits of the next one
+function split32(payload, sf, n) {
+    return bits(word(payload, sf, n), 17, 8) * 0x1000000 + word(payload, sf, n + 1);
+}
+
+/*
+ * Decode the payload of an AID-EPH message, null if it contains no ephemeris
+ */
+function decode(payload) {
+    if ((payload.length != AID_EPH_PAYLOAD_LEN) || (payload.readUInt32LE(4) == 0)) {
+        return null;
+    }
+    return {
+        svid:       payload.readUInt32LE(0),
+        crs:        signed(bits(word(payload, 2, 3), 9, 16), 16) * 2 ** -5,
+        delta_n:    signed(bits(word(payload, 2, 4), 1, 16), 16) * 2 ** -43 * GPS_PI,
+        m0:         signed(split32(payload, 2, 4), 32) * 2 ** -31 * GPS_PI,
+        cuc:        signed(bits(word(payload, 2, 6), 1, 16), 16) * 2 ** -29,
+        e:          split32(payload, 2, 6) * 2 ** -33,
+        cus:        signed(bits(word(payload, 2, 8), 1, 16), 16) * 2 ** -29,
+        sqrt_a:     split32(payload, 2, 8) * 2 ** -19,
+        toe:        bits(word(payload, 2, 10), 1, 16) * 2 ** 4,
+        cic:        signed(bits(word(payload, 3, 3), 1, 16), 16) * 2 ** -29,
+        omega0:     signed(split32(payload, 3, 3), 32) * 2 ** -31 * GPS_PI,
+        cis:        signed(bits(word(payload, 3, 5), 1, 16), 16) * 2 ** -29,
+        i0:         signed(split32(payload, 3, 5), 32) * 2 ** -31 * GPS_PI,
+        crc:        signed(bits(word(payload, 3, 7), 1, 16), 16) * 2 ** -5,
+        omega:      signed(split32(payload, 3, 7), 32) * 2 ** -31 * GPS_PI,
+        omega_dot:  signed(word(payload, 3, 9), 24) * 2 ** -43 * GPS_PI,
+        idot:       signed(bits(word(payload, 3, 10), 9, 14), 14) * 2 ** -43 * GPS_PI,
+    };
+}
+
+/*
+ * ECEF position of the satellite in metres, @tow: gps time of week in seconds
+ */
+function position(eph, tow) {
+    let a = eph.sqrt_a * eph.sqrt_a;
+    let tk = tow - eph.toe;
+    if (tk > HALF_WEEK) {
+        tk -= 2 * HALF_WEEK;
+    }
+    else if (tk < -HALF_WEEK) {
+        tk += 2 * HALF_WEEK;
+    }
+    let n = Math.sqrt(MU / (a * a * a)) + eph.delta_n;
+    let m = eph.m0 + n * tk;
+    let ea = m;
+    for (let i = 0; i < 10; ++i) {
+        ea = m + eph.e * Math.sin(ea);
+    }
+    let nu = Math.atan2(Math.sqrt(1 - eph.e * eph.e) * Math.sin(ea), Math.cos(ea) - eph.e);
+    let phi = nu + eph.omega;
+    let s2 = Math.sin(2 * phi), c2 = Math.cos(2 * phi);
+    let u = phi + eph.cus * s2 + eph.cuc * c2;
+    let r = a * (1 - eph.e * Math.cos(ea)) + eph.crs * s2 + eph.crc * c2;
+    let inc = eph.i0 + eph.idot * tk + eph.cis * s2 + eph.cic * c2;
+    let xp = r * Math.cos(u), yp = r * Math.sin(u);
+    let om = eph.omega0 + (eph.omega_dot - OMEGA_E) * tk - OMEGA_E * eph.toe;
+    return [
+        xp * Math.cos(om) - yp * Math.cos(inc) * Math.sin(om),
+        xp * Math.sin(om) + yp * Math.cos(inc) * Math.cos(om),
+        yp * Math.sin(inc),
+    ];
+}
+
+/*
+ * Elevation of the satellite in degrees as seen from @lat, @lon (degrees, on the ellipsoid)
+ */
+function elevation(eph, tow, lat, lon) {
+    let phi = lat * Math.PI / 180, lambda = lon * Math.PI / 180;
+    let up = [ Math.cos(phi) * Math.cos(lambda), Math.cos(phi) * Math.sin(lambda), Math.sin(phi) ];
+    let n = WGS84_A / Math.sqrt(1 - WGS84_E2 * Math.sin(phi) * Math.sin(phi));
+    let rx = [ n * up[0], n * up[1], n * (1 - WGS84_E2) * up[2] ];
+    let sat = position(eph, tow);
+    let d = [ sat[0] - rx[0], sat[1] - rx[1], sat[2] - rx[2] ];
+    let dist = Math.sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+    return Math.asin((d[0] * up[0] + d[1] * up[1] + d[2] * up[2]) / dist) * 180 / Math.PI;
+}
+
+module.exports = {
+    AID_EPH_PAYLOAD_LEN,
+    decode,
+    position,
+    elevation,
+};
+
+// vim: set sw=4 ts=4 et:
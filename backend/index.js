@@ -8,6 +8,14 @@ process.on("uncaughtException", (err) => {
 const utils = require("./utils");
 const db = require("./database");
 const cache = require("./cache");
+const ingest = require("./ingest");
+
+try {
+    ingest.configure(ingest.env_options(process.env));
+} catch (err) {
+    logger.fatal(err.message);
+    process.exit(1);
+}
 
 // Set up the Express engine
 const express = require("express");
@@ -42,6 +50,7 @@ app.use(session({
 const bodyParser = require("body-parser");
 app.use(bodyParser.json());
 app.use(bodyParser.urlencoded({extended: false}));
+app.use(bodyParser.raw({type: require("./report_codec").MIME_TYPE}));
 
 app.disable("etag"); // Don't want "304 Not Modified" responses when the underlying data has actually changed
 
@@ -145,8 +154,8 @@ server.on("listening", () => {
     // Register handlers for external kill signals
     function cleanup() {
         logger.info("Closing server;");
-        server.close();
-        process.exit(0);
+        // the queued reports are written before exiting
+        server.close().then(() => process.exit(0));
     }
     process.on("SIGINT", () => { cleanup(); });
     process.on("SIGTERM", () => { cleanup(); });
@@ -166,12 +175,13 @@ server.close = function(callback) {
     });
     
     return session_close
+        .then(() => ingest.drain())
         .then(() => db.close())
         .then(() => this.orig_close(callback));
 };
 
 db.open().then(() => {
-    cache.start();
+    cache.start().catch(err => logger.error("Loading the unit cache failed: " + err.message));
     server.listen(port, addr);
 });
 
@@ -0,0 +1,308 @@
+const db = require("./database");
+const logger = require("./logger").getLogger("ingest");
+const utils = require("./utils");
+
+/* Write-behind queue of the log-like collections
+ *
+ * The records of all the units are collected per collection and written by one insertMany when a batch is full, or
+ * when its oldest record has waited max_delay, whichever comes first.
+ *
+ * The ack setting tells when push() resolves:
+ * - "flush": when the records are in the db, so if they couldn't be written, the unit gets an error and sends them again
+ * - "enqueue": right away, a failed write is retried here, but the queued records are lost if the process dies
+ *
+ * If there are more than max_queue records waiting or being written, push() fails with 503, the units keep their
+ * records and retry later.
+ *
+ * The records that fail one by one (and not as a duplicate of a retried write) are tried once more here, then in
+ * "flush" mode their request fails. The records of the reports have their _id from the unit and the time, so when the
+ * unit sends a failed request again, the part of it that had been written is a duplicate too, and is not written twice.
+ *
+ * The settings may be set in the environment, see ENV_SETTINGS.
+ */
+const settings = {
+    ack: "flush",
+    max_batch: 1000,
+    max_delay: 100, // ms
+    max_queue: 50000,
+    max_inflight: 4, // parallel insertMany per collection
+    retry_delay: 1000, // ms, after a failed write in "enqueue" mode
+};
+
+// the environment variables of the settings
+const ENV_SETTINGS = {
+    INGEST_ACK: "ack",
+    INGEST_MAX_BATCH: "max_batch",
+    INGEST_MAX_DELAY_MS: "max_delay",
+    INGEST_MAX_QUEUE: "max_queue",
+    INGEST_MAX_INFLIGHT: "max_inflight",
+    INGEST_RETRY_DELAY_MS: "retry_delay",
+};
+
+const LATENCY_SAMPLES = 1024;
+
+const metrics = {
+    enqueued: 0,
+    rejected: 0,
+    flushes: 0,
+    flushed: 0,
+    failures: 0,
+    lost: 0,
+    max_depth: 0,
+};
+
+// the last LATENCY_SAMPLES of the insertMany durations, and of the enqueue-to-written times, in ms
+const flush_ms = [];
+const wait_ms = [];
+
+let queues = {};
+let depth = 0;
+let draining = false;
+let drain_waiters = [];
+
+
+function configure(options) {
+    if (("ack" in options) && !["flush", "enqueue"].includes(options.ack)) {
+        throw new Error("Invalid ingest ack mode: " + options.ack);
+    }
+    Object.assign(settings, options);
+    logger.info("Ingest settings: " + JSON.stringify(settings));
+}
+
+// the settings that are set in @env, for configure()
+function env_options(env) {
+    let options = {};
+    for (let name in ENV_SETTINGS) {
+        if (!(name in env)) {
+            continue;
+        }
+        let key = ENV_SETTINGS[name];
+        if (key === "ack") {
+            options[key] = env[name];
+            continue;
+        }
+        let value = Number(env[name]);
+        if (!Number.isInteger(value) || (value <= 0)) {
+            throw new Error("Invalid " + name + ": " + env[name]);
+        }
+        options[key] = value;
+    }
+    return options;
+}
+
+function queue_of(name) {
+    if (!(name in queues)) {
+        queues[name] = {
+            name,
+            segments: [], // { records, time, resolve, reject }, one for each push()
+            length: 0,
+            inflight: 0,
+            timer: null,
+            retry_at: 0,
+        };
+    }
+    return queues[name];
+}
+
+function sample(list, value) {
+    list.push(value);
+    if (list.length > LATENCY_SAMPLES) {
+        list.shift();
+    }
+}
+
+function percentiles(list) {
+    if (list.length == 0) {
+        return null;
+    }
+    let sorted = Float64Array.from(list).sort();
+    let pct = p => sorted[Math.min(sorted.length - 1, Math.floor(p * sorted.length))];
+    return { p50: pct(0.5), p90: pct(0.9), p99: pct(0.99), max: sorted[sorted.length - 1] };
+}
+
+function schedule(q) {
+    if (q.timer) {
+        clearTimeout(q.timer);
+        q.timer = null;
+    }
+    while ((q.length > 0) && (q.inflight < settings.max_inflight)) {
+        let now = Date.now();
+        let wait = Math.max(q.retry_at - now, (draining || (q.length >= settings.max_batch)) ? 0 : (q.segments[0].time + settings.max_delay - now));
+        if (wait > 0) {
+            q.timer = setTimeout(() => schedule(q), wait);
+            return;
+        }
+        flush(q);
+    }
+}
+
+// the indexes of the records that an unordered insertMany failed to write; the duplicate keys don't count, those are
+// of a retried batch or a resent request that had been partially written already (the records keep their _id);
+// throws if it can't be told
+function failed_records(err, count) {
+    // the driver gives a single write error as the error itself
+    let write_errors = err.writeErrors ? [].concat(err.writeErrors) : ((err.result && ("index" in err)) ? [ err ] : []);
+    if (write_errors.length == 0) {
+        throw err;
+    }
+    let failed = write_errors.filter(e => e.code !== 11000).map(e => e.index);
+    let inserted = err.result && (("insertedCount" in err.result) ? err.result.insertedCount : err.result.nInserted);
+    if ((typeof inserted !== "number") || (inserted + write_errors.length != count)) {
+        // e.g. a write concern error too: what got written is unknown
+        throw err;
+    }
+    return failed;
+}
+
+function retry_later(q, segments) {
+    let count = segments.reduce((sum, s) => sum + s.records.length, 0);
+    q.segments = segments.concat(q.segments);
+    q.length += count;
+    q.retry_at = Date.now() + settings.retry_delay;
+}
+
+function flush(q) {
+    let segments = [];
+    let records = [];
+    while ((q.segments.length > 0) && (records.length < settings.max_batch)) {
+        let s = q.segments.shift();
+        segments.push(s);
+        records = records.concat(s.records);
+    }
+    q.length -= records.length;
+    ++q.inflight;
+
+    let started = process.hrtime.bigint();
+    // unordered, so one bad record doesn't stop the rest; the order is in the time field anyway
+    db[q.name]().insertMany(records, { ordered: false }).then(() => [], err => failed_records(err, records.length)).then(failed => {
+        let now = Date.now();
+        depth -= records.length - failed.length;
+        ++metrics.flushes;
+        metrics.flushed += records.length - failed.length;
+        sample(flush_ms, Number(process.hrtime.bigint() - started) / 1e6);
+        sample(wait_ms, now - segments[0].time);
+        if (failed.length == 0) {
+            segments.forEach(s => s.resolve && s.resolve());
+            return;
+        }
+
+        // only the failed records are tried again, the rest of their requests is written
+        ++metrics.failures;
+        logger.error("Writing " + failed.length + " of " + records.length + " records to " + q.name + " failed");
+        let bad = new Set(failed);
+        let retry = [];
+        let pos = 0;
+        segments.forEach(s => {
+            let left = s.records.filter((r, i) => bad.has(pos + i));
+            pos += s.records.length;
+            if (left.length == 0) {
+                s.resolve && s.resolve();
+            }
+            else if ((settings.ack === "flush") && (s.retried || draining)) {
+                // the unit sends the whole request again
+                depth -= left.length;
+                s.reject(utils.error(503, "Ingest failed"));
+            }
+            else if (draining) {
+                depth -= left.length;
+                metrics.lost += left.length;
+            }
+            else {
+                retry.push(Object.assign({}, s, { records: left, retried: true }));
+            }
+        });
+        if (retry.length > 0) {
+            retry_later(q, retry);
+        }
+    }).catch(err => {
+        ++metrics.failures;
+        logger.error("Writing " + records.length + " records to " + q.name + " failed: " + err.message);
+        if (settings.ack === "flush") {
+            depth -= records.length;
+            segments.forEach(s => s.reject(utils.error(503, "Ingest failed")));
+        }
+        else if (draining) {
+            depth -= records.length;
+            metrics.lost += records.length;
+        }
+        else {
+            retry_later(q, segments);
+        }
+    }).then(() => {
+        --q.inflight;
+        schedule(q);
+        check_drained();
+    });
+}
+
+// queues @batches = { collection: [ records ] } for writing, all or nothing
+function push(batches) {
+    let count = 0;
+    for (let name in batches) {
+        count += batches[name].length;
+    }
+    if (depth + count > settings.max_queue) {
+        ++metrics.rejected;
+        throw utils.error(503, "Ingest queue full");
+    }
+
+    let now = Date.now();
+    let promises = [];
+    for (let name in batches) {
+        if (batches[name].length == 0) {
+            continue;
+        }
+        let q = queue_of(name);
+        let s = { records: batches[name], time: now };
+        if (settings.ack === "flush") {
+            promises.push(new Promise((resolve, reject) => {
+                s.resolve = resolve;
+                s.reject = reject;
+            }));
+        }
+        q.segments.push(s);
+        q.length += s.records.length;
+        schedule(q);
+    }
+    depth += count;
+    metrics.enqueued += count;
+    metrics.max_depth = Math.max(metrics.max_depth, depth);
+    return Promise.all(promises).then(() => null);
+}
+
+function check_drained() {
+    if (!draining || Object.values(queues).some(q => (q.length > 0) || (q.inflight > 0))) {
+        return;
+    }
+    draining = false;
+    drain_waiters.splice(0).forEach(resolve => resolve());
+}
+
+// writes everything that is queued, without waiting for the batches to fill up
+function drain() {
+    let promise = new Promise(resolve => drain_waiters.push(resolve));
+    draining = true;
+    Object.values(queues).forEach(schedule);
+    check_drained();
+    return promise;
+}
+
+function stats() {
+    let result = Object.assign({ ack: settings.ack, depth, queues: {} }, metrics);
+    for (let name in queues) {
+        result.queues[name] = { depth: queues[name].length, inflight: queues[name].inflight };
+    }
+    result.flush_ms = percentiles(flush_ms);
+    result.wait_ms = percentiles(wait_ms);
+    return result;
+}
+
+module.exports = {
+    configure,
+    env_options,
+    push,
+    drain,
+    stats,
+};
+
+// vim: set sw=4 ts=4 et:
@@ -0,0 +1,148 @@
+/*
+ * Binary report format, see unit/components/location_reporter/report_codec.h
+ *
+ * Decoded reports are in the same form and units as the JSON ones:
+ * { time, lat, lon, azi, spd, acc, bat }, where lat/lon are in degrees, azi in degrees, spd in km/h, acc in m, bat in mV,
+ * and time is in seconds, with a fraction if the unit sent the milliseconds as well
+ */
+
+const MIME_TYPE = "application/vnd.gpsunit.report";
+const VERSION = 3;
+const VERSION_MIN = 1;
+const COUNT_MAX = 255;
+
+const HAS_FIX = 0x01;
+const HAS_MS = 0x02;    // since version 2
+const ACC_UNKNOWN = 0xffff;
+
+class DecodeError extends Error {
+}
+
+class UnsupportedVersionError extends DecodeError {
+}
+
+function decode(buf) {
+    let pos = 0;
+
+    function get_u8() {
+        if (pos >= buf.length) {
+            throw new DecodeError("Truncated report");
+        }
+        return buf[pos++];
+    }
+
+    function get_delta(prev) {
+        let x = 0;
+        for (let shift = 0; ; shift += 7) {
+            if (shift > 28) {
+                throw new DecodeError("Varint too long");
+            }
+            let b = get_u8();
+            x += (b & 0x7f) * (2 ** shift);
+            if (!(b & 0x80)) {
+                break;
+            }
+        }
+        let d = (x >>> 1) ^ -(x & 1); // zigzag -> int32
+        return (prev + d) | 0;
+    }
+
+    let version = get_u8();
+    if ((version < VERSION_MIN) || (VERSION < version)) {
+        throw new UnsupportedVersionError("Unsupported version " + version);
+    }
+    let count = get_u8();
+
+    let prev = { time: 0, lat: 0, lon: 0, azi: 0, spd: 0, acc: 0, bat: 0 };
+    let result = [];
+    for (let i = 0; i < count; ++i) {
+        let flags = get_u8();
+        prev.time = get_delta(prev.time) >>> 0;
+        let report = { time: prev.time };
+        if ((version >= 2) && (flags & HAS_MS)) {
+            report.time += get_delta(0) / 1000;
+        }
+        if (flags & HAS_FIX) {
+            prev.lat = get_delta(prev.lat);
+            prev.lon = get_delta(prev.lon);
+            prev.azi = get_delta(prev.azi) & 0xffff;
+            prev.spd = get_delta(prev.spd) & 0xffff;
+            report.lat = prev.lat / 1e7;
+            report.lon = prev.lon / 1e7;
+            report.azi = prev.azi / 1e2;
+            report.spd = prev.spd * 0.036; // cm/s -> km/h
+            if (version >= 3) {
+                prev.acc = get_delta(prev.acc) & 0xffff;
+                if (prev.acc != ACC_UNKNOWN) {
+                    report.acc = prev.acc / 10; // dm -> m
+                }
+            }
+        }
+        prev.bat = get_delta(prev.bat) & 0xffff;
+        report.bat = prev.bat;
+        result.push(report);
+    }
+    if (pos != buf.length) {
+        throw new DecodeError("Trailing garbage after " + count + " reports");
+    }
+    return result;
+}
+
+function encode(reports) {
+    if (reports.length > COUNT_MAX) {
+        throw new RangeError("Too many reports");
+    }
+    let bytes = [ VERSION, reports.length ];
+
+    function put_delta(x, prev) {
+        let d = (x - prev) | 0;
+        let z = ((d << 1) ^ (d >> 31)) >>> 0;
+        while (z >= 0x80) {
+            bytes.push((z & 0x7f) | 0x80);
+            z >>>= 7;
+        }
+        bytes.push(z);
+    }
+
+    let prev = { time: 0, lat: 0, lon: 0, azi: 0, spd: 0, acc: 0, bat: 0 };
+    for (let r of reports) {
+        let ms = Math.round((r.time % 1) * 1000);
+        let cur = {
+            time: (Math.floor(r.time) + Math.floor(ms / 1000)) >>> 0,
+            bat: Math.round(r.bat || 0),
+        };
+        ms %= 1000;
+        let has_fix = ("lat" in r) && ("lon" in r);
+        bytes.push((has_fix ? HAS_FIX : 0) | (ms ? HAS_MS : 0));
+        put_delta(cur.time, prev.time);
+        if (ms) {
+            put_delta(ms, 0);
+        }
+        if (has_fix) {
+            cur.lat = Math.round(r.lat * 1e7);
+            cur.lon = Math.round(r.lon * 1e7);
+            cur.azi = Math.round((r.azi || 0) * 1e2);
+            cur.spd = Math.round((r.spd || 0) / 0.036);
+            cur.acc = ("acc" in r) ? Math.min(Math.round(r.acc * 10), ACC_UNKNOWN - 1) : ACC_UNKNOWN;
+            put_delta(cur.lat, prev.lat);
+            put_delta(cur.lon, prev.lon);
+            put_delta(cur.azi, prev.azi);
+            put_delta(cur.spd, prev.spd);
+            put_delta(cur.acc, prev.acc);
+        }
+        put_delta(cur.bat, prev.bat);
+        Object.assign(prev, cur);
+    }
+    return Buffer.from(bytes);
+}
+
+module.exports = {
+    MIME_TYPE,
+    VERSION,
+    DecodeError,
+    UnsupportedVersionError,
+    decode,
+    encode,
+}
+
+// vim: set sw=4 ts=4 et:
@@ -4,6 +4,7 @@ const db = require("../database");
 const logger = require("../logger").getLogger("admin");
 const utils = require("../utils");
 const events = require("../events");
+const ingest = require("../ingest");
 
 const fba = require("firebase-admin");
 
@@ -29,6 +30,20 @@ function op_whoami(req) {
 }
 
 
+function op_ingest(req) {
+    logger.debug("GET ingest");
+    utils.require_admin(req);
+    return ingest.stats();
+}
+
+
+function op_fetch_event(req) {
+    logger.debug("GET fetch_event");
+    utils.require_admin(req);
+    return events.fetch_stats();
+}
+
+
 function op_logout(req) {
     logger.debug("GET logout");
     req.session.destroy();
@@ -43,6 +58,12 @@ router.get("/healthz",          (req, res, next) => utils.mwrap(req, res, next,
 router.get("/whoami",           (req, res, next) => utils.mwrap(req, res, next, () => op_whoami(req)));
 router.get("/logout",           (req, res, next) => utils.mwrap(req, res, next, () => op_logout(req)));
 
+// queue depth and write latency of the reports
+router.get("/ingest",           (req, res, next) => utils.mwrap(req, res, next, () => op_ingest(req)));
+
+// streams and message counts of the unit updates of the clients
+router.get("/fetch_event",      (req, res, next) => utils.mwrap(req, res, next, () => op_fetch_event(req)));
+
 /* administration of units
  * 1. Where are the units? -> List of units: id, name, last location, status, charge, user
  * Narrowing: 
@@ -3,6 +3,7 @@ const router = express.Router();
 const db = require("../database");
 const logger = require("../logger").getLogger("unit");
 const utils = require("../utils");
+const cache = require("../cache");
 
 
 function get_time_filter(req) {
@@ -107,11 +108,33 @@ function filtered_pipeline(req) {
 }
 
 
+/* The last records of all the units are the current state, that's in the cache, so no need to query the db
+ * @time is the field of the cache entry that tells if it has such a record, @fields are copied from it as they are
+ * The status filter applies to the current status of the unit.
+ */
+function from_cache(req, time, fields) {
+    const tf = get_time_filter(req);
+    if (req.params.name || tf.from || tf.until || tf.duration || !cache.is_loaded()) {
+        return null;
+    }
+    const sf = get_status_filter(req);
+    return cache.select(c => (c[time] !== undefined) && (!sf || sf.includes(c.status))).map(c => {
+        let record = { unit: c.unit, time: c[time] };
+        fields.forEach(f => { record[f] = c[f]; });
+        return record;
+    });
+}
+
+
 function op_get_status(req) {
     logger.debug("op_get_status()");
     if (!req.session || !req.session.is_technician) {
         throw utils.error(401, "must be technician");
     }
+    const cached = from_cache(req, "status_time", [ "status", "user" ]);
+    if (cached) {
+        return cached;
+    }
     const pipe = filtered_pipeline(req);
     return db.cursor_all(db.unit_status().aggregate(pipe));
 }
@@ -123,6 +146,10 @@ function op_get_trace(req) {
     if (!req.session || !req.session.is_technician) {
         throw utils.error(401, "must be technician");
     }
+    const cached = from_cache(req, "location_time", [ "lat", "lon", "azi", "spd", "acc" ]);
+    if (cached) {
+        return cached;
+    }
     const pipe = filtered_pipeline(req);
     logger.debug("pipeline: " + JSON.stringify(pipe));
     return db.cursor_all(db.unit_location().aggregate(pipe));
@@ -134,8 +161,12 @@ function op_get_battery(req) {
     if (!req.session || !req.session.is_technician) {
         throw utils.error(401, "must be technician");
     }
+    const cached = from_cache(req, "battery_time", [ "bat" ]);
+    if (cached) {
+        return cached;
+    }
     const pipe = filtered_pipeline(req);
-    return db.cursor_all(db.unit_location().aggregate(pipe));
+    return db.cursor_all(db.unit_battery().aggregate(pipe));
 }
 
 
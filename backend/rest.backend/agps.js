@@ -4,10 +4,16 @@ const fs = require("fs");
 const db = require("../database");
 const logger = require("../logger").getLogger("agps");
 const utils = require("../utils");
+const ephemeris = require("../gps_ephemeris");
 
 const GPSTIME_START = 315964800; // unix timestamp of 1980-01-06T00:00:00Z
 const SECONDS_IN_A_WEEK = 7 * 24 * 60 * 60;
 const UBX_MAGIC = new Uint8Array([0xb5, 0x62]);
+// satellites this far below the horizon are still sent, as they'll rise while the ephemeris is valid
+const ELEVATION_MASK = -10; // deg
+// with a position less accurate than this it's no use filtering the satellites
+const FILTER_ACC_MAX = 1000000; // m
+const EARTH_RADIUS = 6371000; // m
 
 function ubx_message(m_class, m_id, payload) {
     let buffer = Buffer.alloc(8 + payload.length);
@@ -30,15 +36,34 @@ function ubx_message(m_class, m_id, payload) {
 }
 
 
-function AID_INI() {
+function gps_now() {
     // time: seconds since unix epoch 1970-01-01T00:00:00Z
-    let gnow = Math.round(new Date().getTime() / 1000)- GPSTIME_START;
+    return Math.round(new Date().getTime() / 1000) - GPSTIME_START;
+}
+
+// the last known position of the unit, if it has sent it: lat and lon in deg*1e7, acc in m
+function get_position(query) {
+    if ((query.lat === undefined) || (query.lon === undefined)) {
+        return null;
+    }
+    let pos = {
+        lat: parseInt(query.lat),
+        lon: parseInt(query.lon),
+        acc: parseInt(query.acc || FILTER_ACC_MAX),
+    };
+    if (isNaN(pos.lat) || isNaN(pos.lon) || isNaN(pos.acc) || (Math.abs(pos.lat) > 900000000) || (Math.abs(pos.lon) > 1800000000) || (pos.acc <= 0)) {
+        throw utils.error(400, "Invalid position");
+    }
+    return pos;
+}
+
+function AID_INI(gnow, pos) {
     let payload = Buffer.alloc(48);
 
-    payload.writeInt32LE(0, 0);                                     // .lat, deg*1e-7
-    payload.writeInt32LE(0, 4);                                     // .lon, deg*1e-7
-    payload.writeInt32LE(0, 8);                                     // .alt, cm
-    payload.writeUInt32LE(0, 12);                                   // .posAcc, cm
+    payload.writeInt32LE(pos ? pos.lat : 0, 0);                     // .lat, deg*1e-7
+    payload.writeInt32LE(pos ? pos.lon : 0, 4);                     // .lon, deg*1e-7
+    payload.writeInt32LE(0, 8);                                     // .alt, cm, unknown, should be within posAcc
+    payload.writeUInt32LE(pos ? Math.min(100 * pos.acc, 0xffffffff) : 0, 12); // .posAcc, cm
     payload.writeUInt16LE(0x01, 16);                                // .tmCfg
     payload.writeUInt16LE(gnow / SECONDS_IN_A_WEEK, 18);            // .wn 
     payload.writeUInt32LE(1000 * (gnow % SECONDS_IN_A_WEEK), 20);   // .tow, ms
@@ -47,7 +72,7 @@ function AID_INI() {
     payload.writeUInt32LE(0, 32);                                   // .tAccNs, ns
     payload.writeInt32LE(0, 36);                                    // .clkD
     payload.writeUInt32LE(0, 40);                                   // .clkDAcc
-    payload.writeUInt32LE(0x0a, 44);                                // .flags, 0x0a = tp + time
+    payload.writeUInt32LE(pos ? 0x2b : 0x0a, 44);                   // .flags, 0x0a = tp + time, 0x21 = pos in lla
 
     return ubx_message(0x0b, 0x01, payload);
 }
@@ -67,16 +92,35 @@ function update_agps(req, res) {
     }).then(() => null);
 }
 
+// is the satellite of an AID-EPH message possibly visible from @pos
+function is_visible(message, tow, pos) {
+    let eph = ephemeris.decode(message.subarray(6, message.length - 2));
+    if (!eph) {
+        return false;
+    }
+    let acc_deg = (pos.acc / EARTH_RADIUS) * 180 / Math.PI;
+    return ephemeris.elevation(eph, tow, pos.lat * 1e-7, pos.lon * 1e-7) >= (ELEVATION_MASK - acc_deg);
+}
+
 function get_agps(req, res) {
+    let gnow = gps_now();
+    let pos = get_position(req.query);
+    let filter = pos && (pos.acc < FILTER_ACC_MAX);
     let msgs = [
-        AID_INI(),
+        AID_INI(gnow, pos),
     ];
+    let skipped = 0;
 
     return db.agps().find({}).forEach(m => { 
-        msgs.push(Buffer.from(m.message.buffer));
+        let message = Buffer.from(m.message.buffer);
+        if (filter && (m.type == "EPH") && !is_visible(message, gnow % SECONDS_IN_A_WEEK, pos)) {
+            ++skipped;
+            return;
+        }
+        msgs.push(message);
     }).then(() => {
         let result =  Buffer.concat(msgs);
-        logger.debug("get_agps(), length=" + result.length);
+        logger.debug("get_agps(), length=" + result.length + ", skipped EPH=" + skipped);
         res.set("Content-Type", "application/ubx"); // this is how the u-blox servers send it too
         return result;
     });
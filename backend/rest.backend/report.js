@@ -1,13 +1,28 @@
 const express = require("express");
 const router = express.Router();
-const db = require("../database");
 const logger = require("../logger").getLogger("report");
 const utils = require("../utils");
 const events = require("../events");
+const codec = require("../report_codec");
+const ingest = require("../ingest");
 
 const re_extract_cn = /\bCN=([^,]*)/i;
 
-function op_report(req) {
+// reports queued on the unit while it was offline arrive with their own timestamp
+const MAX_REPORT_AGE = 30 * 24 * 60 * 60;
+const MAX_CLOCK_SKEW = 60;
+
+const MAX_BATCH_LENGTH = 256;
+
+function report_time(body, now) {
+    let t = body.time;
+    if ((typeof(t) !== "number") || (t < (now - MAX_REPORT_AGE)) || ((now + MAX_CLOCK_SKEW) < t)) {
+        return now;
+    }
+    return t;
+}
+
+function get_unit(req) {
     let unit_dn = req.get("X-SSL-Subject-DN");
     if (!unit_dn) {
         throw utils.error(400, "Missing SSL subject DN");
@@ -16,37 +31,138 @@ function op_report(req) {
     if (!unit_cn) {
         throw utils.error(400, "SSL subject DN has no CN");
     }
-    let unit = unit_cn[1];
-    let now = Math.round(new Date().getTime() / 1000);
+    return unit_cn[1];
+}
 
-    logger.debug("op_report, unit='" + unit + "', report:" + JSON.stringify(req.body));
-    let promises = [];
-    if (("lat" in req.body) && ("lon" in req.body)) {
-        let record = {
+// a report sent again gets the same _id, so the records that were written the first time are duplicate keys, which
+// ingest takes as written (e.g. after a 503 for the batteries, when the locations were already in); the collection
+// tells the kind, and two records of a unit in the same second are the same record anyway
+function record_id(unit, time) {
+    return unit + "/" + time;
+}
+
+function is_number(x) {
+    return (typeof(x) === "number") && Number.isFinite(x);
+}
+
+function get_records(unit, body, now) {
+    if ((typeof(body) !== "object") || (body === null) || Array.isArray(body)) {
+        throw utils.error(400, "Invalid batch element");
+    }
+    if ((("lat" in body) && !is_number(body.lat)) || (("lon" in body) && !is_number(body.lon)) ||
+        (("bat" in body) && !is_number(body.bat))) {
+        throw utils.error(400, "Invalid report field");
+    }
+    let time = report_time(body, now);
+    let result = {};
+    if (("lat" in body) && ("lon" in body)) {
+        result.location = {
+            _id: record_id(unit, time),
             unit,
-            time: now,
-            lat: req.body.lat,
-            lon: req.body.lon,
-            azi: req.body.azi,
-            spd: req.body.spd,
+            time,
+            lat: body.lat,
+            lon: body.lon,
+            azi: body.azi,
+            spd: body.spd,
+        };
+        if (typeof(body.acc) === "number") {
+            // the estimated horizontal error in m, the fixes of older units don't have it
+            result.location.acc = body.acc;
         }
-        events.emitter.emit("sendit", "unit_location", record);
-        promises.push(db.unit_location().insertOne(record));
     }
-    if ("bat" in req.body) {
-        let record = {
+    if ("bat" in body) {
+        result.battery = {
+            _id: record_id(unit, time),
             unit,
-            time: now,
-            bat: req.body.bat,
+            time,
+            bat: body.bat,
+        };
+    }
+    return result;
+}
+
+function decode_body(req) {
+    try {
+        return codec.decode(req.body);
+    }
+    catch (err) {
+        if (err instanceof codec.UnsupportedVersionError) {
+            throw utils.error(415, err);
+        }
+        if (err instanceof codec.DecodeError) {
+            throw utils.error(400, err);
         }
-        events.emitter.emit("sendit", "unit_battery", record);
-        promises.push(db.unit_battery().insertOne(record));
+        throw err;
     }
+}
+
+function op_report(req) {
+    if (Buffer.isBuffer(req.body)) {
+        // a binary report is always a batch, even if it contains only one record
+        return op_report_batch(req);
+    }
+    let unit = get_unit(req);
+    let now = Math.round(new Date().getTime() / 1000);
+
+    logger.debug("op_report, unit='" + unit + "', report:" + JSON.stringify(req.body));
+    let records = get_records(unit, req.body, now);
+    let written = ingest.push({
+        unit_location: records.location ? [ records.location ] : [],
+        unit_battery: records.battery ? [ records.battery ] : [],
+    });
+    // the cache and the clients see only what is written
+    return written.then(() => {
+        if (records.location) {
+            events.emitter.emit("sendit", "unit_location", records.location);
+        }
+        if (records.battery) {
+            events.emitter.emit("sendit", "unit_battery", records.battery);
+        }
+        return null;
+    });
+}
 
-    return Promise.all(promises).then(() => null);
+function op_report_batch(req) {
+    let unit = get_unit(req);
+    let now = Math.round(new Date().getTime() / 1000);
+
+    let batch = Buffer.isBuffer(req.body) ? decode_body(req) : req.body;
+    if (!Array.isArray(batch)) {
+        throw utils.error(400, "Batch must be an array");
+    }
+    if (batch.length > MAX_BATCH_LENGTH) {
+        throw utils.error(413, "Batch too long");
+    }
+    logger.debug("op_report_batch, unit='" + unit + "', length=" + batch.length);
+
+    let locations = [];
+    let batteries = [];
+    batch.forEach(body => {
+        let records = get_records(unit, body, now);
+        if (records.location) {
+            locations.push(records.location);
+        }
+        if (records.battery) {
+            batteries.push(records.battery);
+        }
+    });
+
+    let written = ingest.push({ unit_location: locations, unit_battery: batteries });
+    // the cache is interested only in the latest state, and only when it is written
+    let latest = (a, b) => (b.time >= a.time) ? b : a;
+    return written.then(() => {
+        if (locations.length > 0) {
+            events.emitter.emit("sendit", "unit_location", locations.reduce(latest));
+        }
+        if (batteries.length > 0) {
+            events.emitter.emit("sendit", "unit_battery", batteries.reduce(latest));
+        }
+        return null;
+    });
 }
 
 router.post("/",                (req, res, next) => utils.mwrap(req, res, next, () => op_report(req)));
+router.post("/batch",           (req, res, next) => utils.mwrap(req, res, next, () => op_report_batch(req)));
 
 module.exports = router;
 
@@ -4,10 +4,11 @@ const db = require("../database");
 const logger = require("../logger").getLogger("startup");
 const utils = require("../utils");
 const events = require("../events");
+const codec = require("../report_codec");
 
 const re_extract_cn = /\bCN=([^,]*)/i;
 
-function op_startup(req) {
+function op_startup(req, res) {
     let unit_dn = req.get("X-SSL-Subject-DN");
     if (!unit_dn) {
         throw utils.error(400, "Missing SSL subject DN");
@@ -23,10 +24,12 @@ function op_startup(req) {
     let now = Math.round(new Date().getTime() / 1000);
     let record = { nonce, unit: unit_cn[1], time: now };
     logger.debug("startup(" + JSON.stringify(record) + ")");
+    // let the unit know which report encodings we understand
+    res.set("Accept-Post", "application/json, " + codec.MIME_TYPE);
     return db.unit_startup().insertOne(record).then(() => null);
 }
 
-router.post("/",                (req, res, next) => utils.mwrap(req, res, next, () => op_startup(req)));
+router.post("/",                (req, res, next) => utils.mwrap(req, res, next, () => op_startup(req, res)));
 
 module.exports = router;
 
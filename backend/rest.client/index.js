@@ -81,7 +81,15 @@ function fevent_filter(session, u) {
     return false; // strict policy: all blocked unless permitted explicitely
 }
 
-router.get("/fetch_event", (req, res) => events.fetch_dispatcher(req, res, u => fevent_filter(req.session, u)));
+// ?bbox=<lat>,<lon>,<lat>,<lon>: only the units within the box, ?window=<ms>: collect the updates for that long
+router.get("/fetch_event", (req, res, next) => {
+    try {
+        events.fetch_dispatcher(req, res, u => fevent_filter(req.session, u), events.fetch_options(req));
+    } catch (err) {
+        // the stream hasn't started yet, a bad query or a missing login is answered like on the other routes
+        utils.mwrap(req, res, next, Promise.reject(err));
+    }
+});
 
 // test for debugging cookie deep voodoo magic
 router.get("/test",          (req, res, next) => utils.mwrap(req, res, next, () => {
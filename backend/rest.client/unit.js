@@ -3,6 +3,12 @@ const router = express.Router();
 const db = require("../database");
 const logger = require("../logger").getLogger("unit");
 const utils = require("../utils");
+const cache = require("../cache");
+const GeoGrid = require("../geo_grid");
+
+// the nearest units are listed up to this many, if no num is given, and up to this far (m)
+const MAX_NEAREST = 100;
+const MAX_NEAREST_DIST = 50000;
 
 
 function get_units(pipe) {
@@ -36,6 +42,7 @@ function get_units(pipe) {
                 items[loc.unit].lon = loc.lon;
                 items[loc.unit].azi = loc.azi;
                 items[loc.unit].spd = loc.spd;
+                items[loc.unit].acc = loc.acc;
             }
             if (bat) {
                 items[bat.unit].battery_time = bat.time;
@@ -47,9 +54,69 @@ function get_units(pipe) {
 }
 
 
+// ?lat=<lat>&lon=<lon>: list the units nearest to there first
+function get_near(req) {
+    if (!req.query.lat || !req.query.lon) {
+        return null;
+    }
+    let near = { lat: parseFloat(req.query.lat), lon: parseFloat(req.query.lon) };
+    if (isNaN(near.lat) || isNaN(near.lon)) {
+        throw utils.error(400, "Invalid lat or lon");
+    }
+    return near;
+}
+
+function get_num(req) {
+    if (!req.query.num) {
+        return null;
+    }
+    let num = parseInt(req.query.num);
+    if (isNaN(num) || (num < 1)) {
+        throw utils.error(400, "Invalid num");
+    }
+    return num;
+}
+
+// the statuses that can pass the status filter, only the grids of those are searched
+const FILTER_STATUSES = {
+    "": [ "available", "in_use" ],
+    "in_use": [ "in_use" ],
+    "available": [ "available" ],
+};
+
+// the same as the $match of the filter in op_get_all() and op_get()
+function status_filter(req, status) {
+    const email = req.session.email;
+    if (!status) {
+        return u => (u.status == "available") || ((u.status == "in_use") && (u.user == email));
+    }
+    if (status == "in_use") {
+        return u => (u.status == "in_use") && (u.user == email);
+    }
+    if (status == "available") {
+        return u => (u.status == "available");
+    }
+    throw utils.error(400, "Invalid status filter");
+}
+
+
 function op_get_all(req) {
     logger.debug("op_get_all()");
     const status = req.query.status;
+    const bbox = utils.get_bbox(req);
+    const near = get_near(req);
+    const num = get_num(req);
+    if (cache.is_loaded()) {
+        const filter = status_filter(req, status);
+        const statuses = FILTER_STATUSES[status || ""];
+        if (near) {
+            const f = bbox ? (u => filter(u) && in_bbox(u, bbox)) : filter;
+            return cache.units_near(near.lat, near.lon, num || MAX_NEAREST, f, statuses, MAX_NEAREST_DIST);
+        }
+        const units = cache.units(filter, bbox, statuses);
+        return num ? units.slice(0, num) : units;
+    }
+
     let filter;
     if (!status) {
         filter = {
@@ -82,13 +149,37 @@ function op_get_all(req) {
     const pipe = [
         { $match: filter },
     ];
-    return get_units(pipe);
+    return get_units(pipe).then(units => narrow(units, bbox, near, num));
+}
+
+// what the cache does with the query, for the result of get_units()
+function narrow(units, bbox, near, num) {
+    if (bbox) {
+        units = units.filter(u => in_bbox(u, bbox));
+    }
+    if (near) {
+        units = units.filter(u => (typeof(u.lat) === "number") && (typeof(u.lon) === "number"));
+        units.forEach(u => { u.dist = Math.round(GeoGrid.distance(near.lat, near.lon, u.lat, u.lon)); });
+        units = units.filter(u => u.dist <= MAX_NEAREST_DIST);
+        units.sort((a, b) => a.dist - b.dist);
+        num = num || MAX_NEAREST;
+    }
+    return num ? units.slice(0, num) : units;
+}
+
+function in_bbox(u, bbox) {
+    return (bbox.south <= u.lat) && (u.lat <= bbox.north) && (bbox.west <= u.lon) && (u.lon <= bbox.east);
 }
 
 
 function op_get(req) {
     const unit = req.params.unit;
     logger.debug("op_get('" + unit + "')");
+    if (cache.is_loaded()) {
+        const u = cache.unit[unit];
+        const visible = u && (u.status !== undefined) && ((u.status != "in_use") || (u.user == req.session.email));
+        return visible ? [ cache.view(u) ] : [];
+    }
     const filter = {
         unit,
         $or: [
@@ -0,0 +1,111 @@
+const chai          = require("chai");
+const expect        = chai.expect;
+const codec         = require("../report_codec");
+
+// the vectors were produced by the encoder of the unit (report_codec.c)
+const vectors = {
+    batch: {
+        hex: "03040180c49fd50cb6f2c1ef01beefc28e04dcd002c204feff079c330114930aa3078c011700030014010114fd0ba50727a904001e",
+        reports: [
+            { time: 1700000000, lat: 25.1149467, lon: 55.2098783, azi: 215.5, spd: 289 * 0.036, bat: 3278 },
+            { time: 1700000010, lat: 25.1148817, lon: 55.2098317, azi: 216.2, spd: 277 * 0.036, bat: 3276 },
+            { time: 1700000020, bat: 3275 },
+            { time: 1700000030, lat: 25.1148050, lon: 55.2097850, azi: 216.0, spd: 0, bat: 3290 },
+        ],
+    },
+    bat_only: {
+        hex: "03010080c49fd50cf02e",
+        reports: [
+            { time: 1700000000, bat: 3000 },
+        ],
+    },
+    extremes: {
+        hex: "03020180c49fd50cfda3a7da06fdc7ceb40d0000feff07000113fcc7ceb40d83f0e29605beb204feff0700feff07",
+        reports: [
+            { time: 1700000000, lat: -89.9999999, lon: -179.9999999, azi: 0, spd: 0, bat: 0 },
+            { time: 1699999990, lat: 89.9999999, lon: 179.9999999, azi: 359.99, spd: 65535 * 0.036, bat: 65535 },
+        ],
+    },
+    millis: {
+        hex: "03030380c49fd50c9003b6f2c1ef01beefc28e04dcd002c204feff079c330300a0065d41140200000302ce0fef01c70114020001",
+        reports: [
+            { time: 1700000000.2, lat: 25.1149467, lon: 55.2098783, azi: 215.5, spd: 289 * 0.036, bat: 3278 },
+            { time: 1700000000.4, lat: 25.1149420, lon: 55.2098750, azi: 215.6, spd: 290 * 0.036, bat: 3278 },
+            { time: 1700000001.999, lat: 25.1149300, lon: 55.2098650, azi: 215.7, spd: 291 * 0.036, bat: 3277 },
+        ],
+    },
+    accuracy: {
+        hex: "03040380c49fd50c9003b6f2c1ef01beefc28e04dcd002c204329c33030290035d411402f2120000020103029003ef01c7011402e51200",
+        reports: [
+            { time: 1700000000.2, lat: 25.1149467, lon: 55.2098783, azi: 215.5, spd: 289 * 0.036, acc: 2.5, bat: 3278 },
+            { time: 1700000001.2, lat: 25.1149420, lon: 55.2098750, azi: 215.6, spd: 290 * 0.036, acc: 123.4, bat: 3278 },
+            { time: 1700000002, bat: 3277 },
+            { time: 1700000003.2, lat: 25.1149300, lon: 55.2098650, azi: 215.7, spd: 291 * 0.036, acc: 3.1, bat: 3277 },
+        ],
+    },
+};
+
+// the same reports in the formats of older units
+const old_versions = {
+    1: {
+        hex: "01040180c49fd50cb6f2c1ef01beefc28e04dcd002c2049c330114930aa3078c0117030014010114fd0ba50727a9041e",
+        reports: vectors.batch.reports,
+    },
+    2: {
+        hex: "02030380c49fd50c9003b6f2c1ef01beefc28e04dcd002c2049c330300a0065d411402000302ce0fef01c701140201",
+        reports: vectors.millis.reports,
+    },
+};
+
+function expect_reports(actual, expected) {
+    expect(actual).to.have.lengthOf(expected.length);
+    actual.forEach((r, i) => {
+        let e = expected[i];
+        expect(Object.keys(r).sort()).to.deep.equal(Object.keys(e).sort());
+        for (let k in e) {
+            expect(r[k], i + "." + k).to.be.closeTo(e[k], 1e-9);
+        }
+    });
+}
+
+describe("Binary report codec", function() {
+
+    for (let name in vectors) {
+        let v = vectors[name];
+
+        it("decode " + name, function() {
+            expect_reports(codec.decode(Buffer.from(v.hex, "hex")), v.reports);
+        });
+
+        it("encode " + name, function() {
+            expect(codec.encode(v.reports).toString("hex")).to.equal(v.hex);
+        });
+    }
+
+    for (let version in old_versions) {
+        let v = old_versions[version];
+
+        it("decode version " + version, function() {
+            expect_reports(codec.decode(Buffer.from(v.hex, "hex")), v.reports);
+        });
+    }
+
+    it("unsupported version", function() {
+        let buf = Buffer.from(vectors.bat_only.hex, "hex");
+        buf[0] = codec.VERSION + 1;
+        expect(() => codec.decode(buf)).to.throw(codec.UnsupportedVersionError);
+    });
+
+    it("truncated", function() {
+        let buf = Buffer.from(vectors.batch.hex, "hex");
+        expect(() => codec.decode(buf.slice(0, buf.length - 1))).to.throw(codec.DecodeError);
+    });
+
+    it("trailing garbage", function() {
+        let buf = Buffer.concat([ Buffer.from(vectors.bat_only.hex, "hex"), Buffer.from([ 0 ]) ]);
+        expect(() => codec.decode(buf)).to.throw(codec.DecodeError);
+    });
+
+});
+
+// vim: set sw=4 ts=4 et:
@@ -0,0 +1,119 @@
+const chai          = require("chai");
+const expect        = chai.expect;
+const ephemeris     = require("../gps_ephemeris");
+
+const GPS_PI = 3.1415926535898;
+
+// pack the orbit parameters into an AID-EPH payload, the inverse of ephemeris.decode()
+function encode(p) {
+    let payload = Buffer.alloc(ephemeris.AID_EPH_PAYLOAD_LEN);
+    payload.writeUInt32LE(p.svid, 0);
+    payload.writeUInt32LE(0x123456, 4); // .how: non-zero, so there is ephemeris
+
+    function field(value, scale, len) {
+        let x = Math.round(value / scale);
+        return (x < 0) ? (x + 2 ** len) : x;
+    }
+    function set_word(sf, n, w) {
+        payload.writeUInt32LE(w, 8 + 32 * (sf - 1) + 4 * (n - 3));
+    }
+    function set_split(sf, n, hi16, x32) {
+        set_word(sf, n, (hi16 << 8) | Math.floor(x32 / 0x1000000));
+        set_word(sf, n + 1, x32 % 0x1000000);
+    }
+
+    set_word(2, 3, field(p.crs, 2 ** -5, 16));
+    set_split(2, 4, field(p.delta_n / GPS_PI, 2 ** -43, 16), field(p.m0 / GPS_PI, 2 ** -31, 32));
+    set_split(2, 6, field(p.cuc, 2 ** -29, 16), field(p.e, 2 ** -33, 32));
+    set_split(2, 8, field(p.cus, 2 ** -29, 16), field(p.sqrt_a, 2 ** -19, 32));
+    set_word(2, 10, field(p.toe, 2 ** 4, 16) << 8);
+    set_split(3, 3, field(p.cic, 2 ** -29, 16), field(p.omega0 / GPS_PI, 2 ** -31, 32));
+    set_split(3, 5, field(p.cis, 2 ** -29, 16), field(p.i0 / GPS_PI, 2 ** -31, 32));
+    set_split(3, 7, field(p.crc, 2 ** -5, 16), field(p.omega / GPS_PI, 2 ** -31, 32));
+    set_word(3, 9, field(p.omega_dot / GPS_PI, 2 ** -43, 24));
+    set_word(3, 10, field(p.idot / GPS_PI, 2 ** -43, 14) << 2);
+    return payload;
+}
+
+// a typical GPS orbit
+const params = {
+    svid: 7,
+    crs: -41.5,
+    delta_n: 4.6e-9,
+    m0: -1.2,
+    cuc: -2.1e-6,
+    e: 0.0123,
+    cus: 8.3e-6,
+    sqrt_a: 5153.7,
+    toe: 388800,
+    cic: 1.1e-7,
+    omega0: 2.3,
+    cis: -5.6e-8,
+    i0: 0.96,
+    crc: 212.3,
+    omega: -1.7,
+    omega_dot: -8.1e-9,
+    idot: 2.5e-10,
+};
+
+const resolution = {
+    svid: 0, toe: 16, crs: 2 ** -5, crc: 2 ** -5, e: 2 ** -33, sqrt_a: 2 ** -19,
+    cuc: 2 ** -29, cus: 2 ** -29, cic: 2 ** -29, cis: 2 ** -29,
+    m0: 2 ** -31 * GPS_PI, omega0: 2 ** -31 * GPS_PI, i0: 2 ** -31 * GPS_PI, omega: 2 ** -31 * GPS_PI,
+    delta_n: 2 ** -43 * GPS_PI, omega_dot: 2 ** -43 * GPS_PI, idot: 2 ** -43 * GPS_PI,
+};
+
+// an equatorial circular orbit, directly above lat=0, lon=0 at toe=0
+const overhead = Object.assign({}, params, {
+    crs: 0, crc: 0, cuc: 0, cus: 0, cic: 0, cis: 0,
+    delta_n: 0, m0: 0, e: 0, omega: 0, omega0: 0, omega_dot: 0, i0: 0, idot: 0, toe: 0,
+});
+
+describe("GPS ephemeris", function() {
+
+    it("decodes the orbit parameters", function() {
+        let eph = ephemeris.decode(encode(params));
+        for (let k in params) {
+            // within the resolution of the fields
+            expect(eph[k], k).to.be.closeTo(params[k], resolution[k] / 2 + 1e-15);
+        }
+    });
+
+    it("skips the messages without ephemeris", function() {
+        let payload = encode(params);
+        payload.writeUInt32LE(0, 4);
+        expect(ephemeris.decode(payload)).to.be.null;
+        expect(ephemeris.decode(Buffer.alloc(8))).to.be.null;
+    });
+
+    it("puts the satellite on its orbit", function() {
+        let eph = ephemeris.decode(encode(params));
+        [ params.toe - 7200, params.toe, params.toe + 7200 ].forEach(tow => {
+            let p = ephemeris.position(eph, tow);
+            let r = Math.sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+            // 26560 km +- the eccentricity
+            expect(r).to.be.within(26560e3 * (1 - 0.013), 26560e3 * (1 + 0.013));
+        });
+    });
+
+    it("tells the elevation", function() {
+        let eph = ephemeris.decode(encode(overhead));
+        expect(ephemeris.elevation(eph, 0, 0, 0)).to.be.closeTo(90, 1e-6);
+        expect(ephemeris.elevation(eph, 0, 0, 180)).to.be.closeTo(-90, 1e-6);
+        expect(ephemeris.elevation(eph, 0, 0, 60)).to.be.above(0);
+        expect(ephemeris.elevation(eph, 0, 0, 90)).to.be.below(0);
+        // the earth turns below it: 6 hours later it's above lon=-90 (minus its own movement)
+        expect(ephemeris.elevation(eph, 6 * 3600, 0, 0)).to.be.below(0);
+    });
+
+    it("handles the week rollover", function() {
+        let eph = ephemeris.decode(encode(Object.assign({}, overhead, { toe: 604784 })));
+        let before = ephemeris.position(eph, 604784 - 10);
+        let after = ephemeris.position(eph, (604784 + 10) - 604800);
+        let d = Math.sqrt(before.reduce((acc, x, i) => acc + (x - after[i]) ** 2, 0));
+        expect(d).to.be.below(20 * 4000); // 20 s at ~3.9 km/s
+    });
+
+});
+
+// vim: set sw=4 ts=4 et:
@@ -0,0 +1,273 @@
+const chai          = require("chai");
+const expect        = chai.expect;
+const db            = require("../database");
+const ingest        = require("../ingest");
+
+// a collection that records the insertMany calls, and lets them be finished or failed one by one
+class FakeCollection {
+    constructor() {
+        this.calls = [];
+        this.auto = true;
+    }
+
+    insertMany(records, options) {
+        return new Promise((resolve, reject) => {
+            let call = { records, options, resolve, reject };
+            this.calls.push(call);
+            if (this.auto) {
+                setImmediate(resolve);
+            }
+        });
+    }
+
+    get sizes() {
+        return this.calls.map(c => c.records.length);
+    }
+}
+
+function sleep(ms) {
+    return new Promise(r => setTimeout(r, ms));
+}
+
+function records(n, unit = "Unit 1") {
+    let result = [];
+    for (let i = 0; i < n; ++i) {
+        result.push({ unit, time: 1700000000 + i, lat: 25.1, lon: 55.2 });
+    }
+    return result;
+}
+
+// the error of an unordered insertMany of @count records, with @errors = [ { index, code } ], and @inserted of them written
+function bulk_error(count, errors, inserted = count - errors.length) {
+    return Object.assign(new Error("BulkWriteError"), {
+        code: errors[0].code,
+        writeErrors: errors.map(e => Object.assign(new Error("WriteError"), e)),
+        result: { nInserted: inserted },
+    });
+}
+
+const defaults = { ack: "flush", max_batch: 10, max_delay: 20, max_queue: 100, max_inflight: 4, retry_delay: 20 };
+
+describe("Ingest queue", function() {
+    let location, battery;
+
+    beforeEach(function() {
+        location = new FakeCollection();
+        battery = new FakeCollection();
+        db.unit_location = () => location;
+        db.unit_battery = () => battery;
+        ingest.configure(defaults);
+    });
+
+    afterEach(function() {
+        location.auto = battery.auto = true;
+        location.calls.forEach(c => c.resolve());
+        battery.calls.forEach(c => c.resolve());
+        return ingest.drain();
+    });
+
+    it("flushes full batches at once", async function() {
+        let pushes = [];
+        for (let i = 0; i < 5; ++i) {
+            pushes.push(ingest.push({ unit_location: records(5, "Unit " + i) }));
+        }
+        expect(location.sizes).to.deep.equal([ 10, 10 ]);
+        await Promise.all(pushes);
+        expect(location.sizes).to.deep.equal([ 10, 10, 5 ]);
+        expect(location.calls[0].options).to.deep.equal({ ordered: false });
+    });
+
+    it("flushes the rest by the deadline", async function() {
+        ingest.push({ unit_location: records(1) });
+        ingest.push({ unit_location: records(2, "Unit 2"), unit_battery: [ { unit: "Unit 2", time: 1700000000, bat: 3000 } ] });
+        expect(location.calls).to.be.empty;
+        await sleep(defaults.max_delay + 10);
+        expect(location.sizes).to.deep.equal([ 3 ]);
+        expect(battery.sizes).to.deep.equal([ 1 ]);
+    });
+
+    it("coalesces the records of many requests", async function() {
+        let pushes = [];
+        for (let i = 0; i < 7; ++i) {
+            pushes.push(ingest.push({ unit_location: records(3, "Unit " + i) }));
+        }
+        await Promise.all(pushes);
+        // a request is never split, so a batch may be a bit longer than max_batch
+        expect(location.sizes).to.deep.equal([ 12, 9 ]);
+    });
+
+    it("acknowledges after the flush", async function() {
+        location.auto = false;
+        let acked = false;
+        let written = ingest.push({ unit_location: records(10) }).then(() => { acked = true; });
+        await sleep(5);
+        expect(location.calls).to.have.lengthOf(1);
+        expect(acked).to.be.false;
+        location.calls[0].resolve();
+        await written;
+        expect(acked).to.be.true;
+    });
+
+    it("fails the request if the flush fails", async function() {
+        location.auto = false;
+        let written = ingest.push({ unit_location: records(10) });
+        location.calls[0].reject(new Error("connection lost"));
+        let err = await written.then(() => null, err => err);
+        expect(err).to.have.property("status", 503);
+        expect(ingest.stats().depth).to.equal(0);
+    });
+
+    it("acknowledges after enqueue and retries the failed flush", async function() {
+        ingest.configure({ ack: "enqueue" });
+        location.auto = false;
+        await ingest.push({ unit_location: records(10) });
+        expect(location.calls).to.have.lengthOf(1);
+        location.calls[0].reject(new Error("connection lost"));
+        await sleep(5);
+        expect(ingest.stats().depth).to.equal(10);
+        await sleep(defaults.retry_delay + 10);
+        expect(location.calls).to.have.lengthOf(2);
+        expect(location.calls[1].records).to.have.lengthOf(10);
+        location.calls[1].resolve();
+        await sleep(5);
+        expect(ingest.stats().depth).to.equal(0);
+    });
+
+    it("takes duplicates of a retried batch as written", async function() {
+        location.auto = false;
+        let written = ingest.push({ unit_location: records(10) });
+        location.calls[0].reject(bulk_error(10, [ { index: 2, code: 11000 }, { index: 7, code: 11000 } ]));
+        await written;
+        expect(location.calls).to.have.lengthOf(1);
+        expect(ingest.stats().depth).to.equal(0);
+
+        // a single one comes as the error itself
+        written = ingest.push({ unit_location: records(10) });
+        location.calls[1].reject(Object.assign(new Error("E11000 duplicate key error"), { code: 11000, index: 4, result: { nInserted: 9 } }));
+        await written;
+    });
+
+    it("doesn't take a duplicate key error alone as written", async function() {
+        location.auto = false;
+        let written = ingest.push({ unit_location: records(10) });
+        // no write errors: it's unknown which ones were written
+        location.calls[0].reject(Object.assign(new Error("E11000 duplicate key error"), { code: 11000 }));
+        let err = await written.then(() => null, err => err);
+        expect(err).to.have.property("status", 503);
+        written = ingest.push({ unit_location: records(10) });
+        // nor if the counts don't add up
+        location.calls[1].reject(bulk_error(10, [ { index: 2, code: 11000 } ], 5));
+        err = await written.then(() => null, err => err);
+        expect(err).to.have.property("status", 503);
+    });
+
+    it("writes again only the records that failed among the duplicates", async function() {
+        location.auto = false;
+        let first = records(4, "Unit 1"), second = records(6, "Unit 2");
+        let acked = [ false, false ];
+        let written = [
+            ingest.push({ unit_location: first }).then(() => { acked[0] = true; }),
+            ingest.push({ unit_location: second }).then(() => { acked[1] = true; }),
+        ];
+        await sleep(defaults.max_delay + 10);
+        expect(location.sizes).to.deep.equal([ 10 ]);
+        location.calls[0].reject(bulk_error(10, [ { index: 1, code: 11000 }, { index: 6, code: 121 }, { index: 8, code: 121 } ]));
+        await sleep(5);
+        // the first request is written, the second one waits for its two records
+        expect(acked).to.deep.equal([ true, false ]);
+        expect(ingest.stats().depth).to.equal(2);
+        await sleep(defaults.retry_delay + 10);
+        expect(location.calls).to.have.lengthOf(2);
+        expect(location.calls[1].records).to.deep.equal([ second[2], second[4] ]);
+        location.calls[1].resolve();
+        await Promise.all(written);
+        expect(ingest.stats().depth).to.equal(0);
+    });
+
+    it("fails the request if its records fail again", async function() {
+        location.auto = false;
+        let written = ingest.push({ unit_location: records(10) });
+        location.calls[0].reject(bulk_error(10, [ { index: 3, code: 121 } ]));
+        await sleep(defaults.retry_delay + 10);
+        expect(location.calls).to.have.lengthOf(2);
+        location.calls[1].reject(bulk_error(1, [ { index: 0, code: 121 } ]));
+        let err = await written.then(() => null, err => err);
+        expect(err).to.have.property("status", 503);
+        expect(ingest.stats().depth).to.equal(0);
+    });
+
+    it("takes a request sent again after a partial failure as written", async function() {
+        battery.auto = false;
+        let locations = records(3).map(r => Object.assign({ _id: r.unit + "/" + r.time }, r));
+        let batteries = records(3).map(r => ({ _id: r.unit + "/" + r.time, unit: r.unit, time: r.time, bat: 3000 }));
+        let written = ingest.push({ unit_location: locations, unit_battery: batteries });
+        await sleep(defaults.max_delay + 10);
+        battery.calls[0].reject(bulk_error(3, [ { index: 0, code: 121 } ]));
+        await sleep(defaults.retry_delay + 10);
+        battery.calls[1].reject(bulk_error(1, [ { index: 0, code: 121 } ]));
+        let err = await written.then(() => null, err => err);
+        expect(err).to.have.property("status", 503);
+        expect(location.calls).to.have.lengthOf(1);
+
+        // the locations are there already, only the battery record is written this time
+        location.auto = false;
+        written = ingest.push({ unit_location: locations, unit_battery: batteries });
+        await sleep(defaults.max_delay + 10);
+        location.calls[1].reject(bulk_error(3, [ 0, 1, 2 ].map(index => ({ index, code: 11000 }))));
+        battery.calls[2].reject(bulk_error(3, [ { index: 1, code: 11000 }, { index: 2, code: 11000 } ]));
+        await written;
+        expect(ingest.stats().depth).to.equal(0);
+    });
+
+    it("rejects when the queue is full", async function() {
+        location.auto = false;
+        let before = ingest.stats().rejected;
+        ingest.configure({ max_inflight: 1 });
+        ingest.push({ unit_location: records(60) });
+        ingest.push({ unit_location: records(30) });
+        expect(() => ingest.push({ unit_location: records(5), unit_battery: records(6) })).to.throw().with.property("status", 503);
+        expect(ingest.stats().rejected).to.equal(before + 1);
+        // all or nothing
+        expect(ingest.stats().queues.unit_battery.depth).to.equal(0);
+        ingest.push({ unit_location: records(10) });
+        expect(ingest.stats().depth).to.equal(100);
+    });
+
+    it("reports the depth and the flush latency", async function() {
+        location.auto = false;
+        for (let i = 0; i < 3; ++i) {
+            ingest.push({ unit_location: records(5, "Unit " + i) });
+        }
+        // the records being written count too
+        let s = ingest.stats();
+        expect(s.depth).to.equal(15);
+        expect(s.queues.unit_location).to.deep.equal({ depth: 5, inflight: 1 });
+        expect(s.max_depth).to.be.at.least(15);
+        await sleep(10);
+        location.calls[0].resolve();
+        await sleep(5);
+        s = ingest.stats();
+        expect(s.depth).to.equal(5);
+        expect(s.flush_ms.max).to.be.at.least(9);
+        expect(s.wait_ms.max).to.be.at.least(9);
+    });
+
+    it("takes its settings from the environment", function() {
+        expect(ingest.env_options({ PATH: "/bin", INGEST_ACK: "enqueue", INGEST_MAX_DELAY_MS: "250", INGEST_MAX_QUEUE: "20000" }))
+            .to.deep.equal({ ack: "enqueue", max_delay: 250, max_queue: 20000 });
+        expect(ingest.env_options({})).to.deep.equal({});
+        expect(() => ingest.env_options({ INGEST_MAX_BATCH: "0" })).to.throw(/INGEST_MAX_BATCH/);
+        expect(() => ingest.env_options({ INGEST_RETRY_DELAY_MS: "1s" })).to.throw(/INGEST_RETRY_DELAY_MS/);
+        expect(() => ingest.configure(ingest.env_options({ INGEST_ACK: "never" }))).to.throw(/ack mode/);
+    });
+
+    it("drains everything before the shutdown", async function() {
+        ingest.configure({ max_delay: 60000 });
+        ingest.push({ unit_location: records(3), unit_battery: records(2) });
+        await ingest.drain();
+        expect(location.sizes).to.deep.equal([ 3 ]);
+        expect(battery.sizes).to.deep.equal([ 2 ]);
+    });
+});
+
+// vim: set sw=4 ts=4 et:
@@ -0,0 +1,148 @@
+const chai          = require("chai");
+const expect        = chai.expect;
+const db            = require("../database");
+
+// just enough of a mongodb Db to see what bootstrap() does with it
+class FakeDb {
+    constructor(existing, progress = null, surplus = [], lasts = []) {
+        this.existing = existing;
+        this.created = [];
+        this.indexes = {};
+        this.deleted = {};
+        this.progress = progress; // of the downsampling, in the maintenance collection
+        this.surplus = surplus; // what the downsampling aggregation gives for each chunk
+        this.lasts = lasts; // the last record of the units that are silent for longer than the retention
+        this.aggregations = 0;
+        this.chunks = [];
+        this.updates = [];
+    }
+
+    listCollections() {
+        return { toArray: () => Promise.resolve(this.existing.map(name => ({ name, type: "collection" }))) };
+    }
+
+    createCollection(name) {
+        this.created.push(name);
+        return Promise.resolve();
+    }
+
+    collection(name) {
+        let empty = { sort: () => empty, limit: () => empty, next: () => Promise.resolve(null) };
+        return {
+            createIndexes: specs => {
+                this.indexes[name] = specs.map(s => s.key);
+                return Promise.resolve();
+            },
+            find: () => empty,
+            findOne: () => Promise.resolve(((name === "maintenance") && this.progress) ? Object.assign({ _id: "unit_location" }, this.progress) : null),
+            updateOne: (filter, update) => {
+                this.updates.push(update.$set);
+                return Promise.resolve();
+            },
+            aggregate: pipeline => {
+                if (pipeline[0].$sort) {
+                    return { toArray: () => Promise.resolve(this.lasts.map(last => ({ _id: "Unit " + last, last, time: 0 }))) };
+                }
+                let results = this.surplus.slice();
+                ++this.aggregations;
+                this.chunks.push(pipeline[0].$match.time);
+                return { hasNext: () => Promise.resolve(results.length > 0), next: () => Promise.resolve(results.shift()) };
+            },
+            deleteMany: filter => {
+                (this.deleted[name] = this.deleted[name] || []).push(filter);
+                return Promise.resolve({ deletedCount: (filter._id && filter._id.$in) ? filter._id.$in.length : 0 });
+            },
+        };
+    }
+}
+
+describe("Database schema", function() {
+    it("creates the missing collections only", async function() {
+        let fake = new FakeDb([ "unit_location", "stations", "sessions" ]);
+        await db.bootstrap(fake);
+        expect(fake.created).to.not.include("unit_location");
+        expect(fake.created).to.not.include("stations");
+        expect(fake.created).to.include("unit_battery");
+        expect(fake.created).to.include("maintenance");
+    });
+
+    it("indexes the logs by unit and by time", async function() {
+        let fake = new FakeDb([]);
+        await db.bootstrap(fake);
+        for (let name of [ "unit_location", "unit_battery", "unit_startup", "unit_status" ]) {
+            expect(fake.indexes[name]).to.deep.equal([ { unit: 1, time: -1 }, { time: -1, unit: 1 } ]);
+        }
+        expect(fake.indexes.stations).to.deep.equal([ { lonlat: "2d" } ]);
+        expect(fake.indexes).to.not.have.property("users");
+    });
+
+    it("expires the old records", async function() {
+        let fake = new FakeDb([]);
+        let now = 1700000000;
+        let result = await db.expire(fake, now);
+        expect(fake.deleted.unit_location).to.deep.equal([ { time: { $lt: now - db.schema.unit_location.retain } } ]);
+        expect(fake.deleted.unit_battery).to.deep.equal([ { time: { $lt: now - db.schema.unit_battery.retain } } ]);
+        // the current status of a unit is its last record, however old it is
+        expect(fake.deleted).to.not.have.property("unit_status");
+        expect(result["unit_location.downsampled"]).to.equal(0);
+    });
+
+    it("keeps the last location of the units that are silent for longer than the retention", async function() {
+        let fake = new FakeDb([], null, [], [ 17, 42 ]);
+        let now = 1700000000;
+        await db.expire(fake, now);
+        expect(fake.deleted.unit_location).to.deep.equal([ { time: { $lt: now - db.schema.unit_location.retain }, _id: { $nin: [ 17, 42 ] } } ]);
+        // only the locations
+        expect(fake.deleted.unit_battery).to.deep.equal([ { time: { $lt: now - db.schema.unit_battery.retain } } ]);
+    });
+
+    it("thins the late arrivals behind the downsampled range once a day", async function() {
+        let now = 1700000000;
+        let s = db.schema.unit_location;
+        let until = Math.floor((now - s.downsample_after) / s.downsample) * s.downsample;
+        let day = 24 * 3600;
+        // rechecked less than a day ago: only the new hour
+        let fake = new FakeDb([], { downsampled: until - 3600, rechecked: now - day + 60 });
+        await db.expire(fake, now);
+        expect(fake.chunks).to.deep.equal([ { $gte: until - 3600, $lt: until } ]);
+        expect(fake.updates.filter(u => "rechecked" in u)).to.be.empty;
+
+        // a day later: also what may have arrived since then, at most late_max old
+        fake = new FakeDb([], { downsampled: until - 3600, rechecked: now - day });
+        await db.expire(fake, now);
+        let late_from = Math.floor((now - day - s.late_max) / s.downsample) * s.downsample;
+        expect(fake.chunks[0]).to.deep.equal({ $gte: until - 3600, $lt: until });
+        expect(fake.chunks[1]).to.deep.equal({ $gte: late_from, $lt: late_from + 3600 });
+        expect(fake.chunks[fake.chunks.length - 1].$lt).to.equal(until - 3600);
+        expect(fake.chunks).to.have.lengthOf(1 + Math.ceil((until - 3600 - late_from) / 3600));
+        expect(fake.updates.filter(u => "rechecked" in u)).to.deep.equal([ { rechecked: now } ]);
+
+        // never rechecked: the whole retention
+        fake = new FakeDb([], { downsampled: until - 3600 });
+        await db.expire(fake, now);
+        expect(fake.chunks[1].$gte).to.equal(Math.floor((now - s.retain) / s.downsample) * s.downsample);
+    });
+
+    it("deletes the downsampled records in bounded batches", async function() {
+        let now = 1700000000;
+        let s = db.schema.unit_location;
+        let until = Math.floor((now - s.downsample_after) / s.downsample) * s.downsample;
+        // two chunks of an hour, each with 3 units * 60 minutes * 80 surplus records
+        let surplus = [];
+        for (let i = 0; i < 3 * 60; ++i) {
+            surplus.push({ _id: { unit: "Unit " + (i % 3), bucket: i }, drop: Array.from({ length: 80 }, (x, j) => i * 100 + j) });
+        }
+        let fake = new FakeDb([], { downsampled: until - 2 * 3600, rechecked: now }, surplus);
+        let result = await db.expire(fake, now);
+        expect(fake.aggregations).to.equal(2);
+        let batches = fake.deleted.unit_location.filter(f => f._id).map(f => f._id.$in.length);
+        // 14400 per chunk, at most 10000 in a deleteMany
+        expect(batches).to.deep.equal([ 10000, 4400, 10000, 4400 ]);
+        expect(result["unit_location.downsampled"]).to.equal(2 * 14400);
+        let ids = fake.deleted.unit_location[0]._id.$in;
+        expect(ids[0]).to.equal(0);
+        expect(ids[80]).to.equal(100);
+    });
+});
+
+// vim: set sw=4 ts=4 et:
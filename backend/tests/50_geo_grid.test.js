@@ -0,0 +1,110 @@
+const chai          = require("chai");
+const expect        = chai.expect;
+const GeoGrid       = require("../geo_grid");
+
+function ids(values) {
+    return values.map(v => v.id).sort();
+}
+
+describe("Geo grid", function() {
+    it("finds the items within a box", function() {
+        let g = new GeoGrid(0.01);
+        g.update("a", 25.1005, 55.2005, { id: "a" });
+        g.update("b", 25.1095, 55.2095, { id: "b" }); // same cell, outside the box
+        g.update("c", 25.0995, 55.1995, { id: "c" }); // neighbour cell, inside
+        g.update("d", 25.2, 55.3, { id: "d" });
+        expect(ids(g.within(25.099, 55.199, 25.101, 55.201))).to.deep.equal([ "a", "c" ]);
+        expect(ids(g.within(25, 55, 26, 56))).to.deep.equal([ "a", "b", "c", "d" ]);
+        expect(g.within(24, 54, 24.5, 54.5)).to.deep.equal([]);
+    });
+
+    it("moves the items between the cells", function() {
+        let g = new GeoGrid(0.01);
+        g.update("a", 25.1005, 55.2005, { id: "a" });
+        g.update("a", 25.1505, 55.2505, { id: "a", moved: true });
+        expect(g.size).to.equal(1);
+        expect(g.cells.size).to.equal(1);
+        expect(g.within(25.1, 55.2, 25.101, 55.201)).to.deep.equal([]);
+        expect(g.within(25.15, 55.25, 25.151, 55.251)).to.deep.equal([ { id: "a", moved: true } ]);
+    });
+
+    it("filters the values", function() {
+        let g = new GeoGrid(0.01);
+        g.update("a", 25.1005, 55.2005, { id: "a", status: "available" });
+        g.update("b", 25.1006, 55.2006, { id: "b", status: "in_use" });
+        expect(ids(g.within(25, 55, 26, 56, v => v.status == "available"))).to.deep.equal([ "a" ]);
+    });
+
+    it("handles the negative coordinates", function() {
+        let g = new GeoGrid(0.01);
+        g.update("a", -33.8688, 151.2093, { id: "a" });
+        g.update("b", 40.7128, -74.0060, { id: "b" });
+        expect(ids(g.within(-33.87, 151.20, -33.86, 151.21))).to.deep.equal([ "a" ]);
+        expect(ids(g.within(40.71, -74.01, 40.72, -74.00))).to.deep.equal([ "b" ]);
+        g.remove("a");
+        g.remove("x");
+        expect(g.size).to.equal(1);
+    });
+
+    it("finds the items of a huge box without visiting all its cells", function() {
+        let g = new GeoGrid(0.01);
+        let items = [];
+        for (let i = 0; i < 1000; ++i) {
+            // in a few cities far apart
+            let v = { id: "u" + i, lat: [ 25.1, -33.9, 51.5 ][i % 3] + Math.random() * 0.3, lon: [ 55.2, 151.2, -0.1 ][i % 3] + Math.random() * 0.3 };
+            items.push(v);
+            g.update(v.id, v.lat, v.lon, v);
+        }
+        let started = Date.now();
+        expect(ids(g.within(-90, -180, 90, 180))).to.deep.equal(ids(items));
+        expect(ids(g.within(-10, 50, 60, 110))).to.deep.equal(ids(items.filter(v => (v.lat > 0) && (v.lon > 50))));
+        expect(Date.now() - started).to.be.below(100);
+        // and a box off the bounds is no work at all
+        expect(g.within(60, -180, 90, 180)).to.deep.equal([]);
+        expect(new GeoGrid().within(-90, -180, 90, 180)).to.deep.equal([]);
+    });
+
+    it("finds the nearest items like a full scan does", function() {
+        let g = new GeoGrid(0.01);
+        let items = [];
+        for (let i = 0; i < 2000; ++i) {
+            let v = { id: "u" + i, lat: 25 + Math.random() * 0.2, lon: 55 + Math.random() * 0.2, available: (i % 3) != 0 };
+            items.push(v);
+            g.update(v.id, v.lat, v.lon, v);
+        }
+        for (let q of [ [ 25.1, 55.1 ], [ 25.0001, 55.1999 ], [ 24.9, 55.3 ] ]) {
+            let scan = items.filter(v => v.available)
+                .map(v => ({ value: v, dist: GeoGrid.distance(q[0], q[1], v.lat, v.lon) }))
+                .sort((a, b) => a.dist - b.dist);
+            let found = g.nearest(q[0], q[1], 10, v => v.available);
+            expect(found.map(x => x.value.id)).to.deep.equal(scan.slice(0, 10).map(x => x.value.id));
+            expect(found[0].dist).to.be.closeTo(scan[0].dist, 1e-6);
+        }
+    });
+
+    it("visits only the cells around", function() {
+        let g = new GeoGrid(0.01);
+        for (let i = 0; i < 100; ++i) {
+            for (let j = 0; j < 100; ++j) {
+                g.update(i + ":" + j, 25 + i * 0.01 + 0.005, 55 + j * 0.01 + 0.005, { id: i + ":" + j });
+            }
+        }
+        let visited = 0;
+        let found = g.nearest(25.505, 55.505, 5, () => { ++visited; return true; });
+        expect(found).to.have.lengthOf(5);
+        expect(found[0].value.id).to.equal("50:50");
+        expect(visited).to.be.below(25);
+    });
+
+    it("stops at the edge of the items and at the max distance", function() {
+        let g = new GeoGrid(0.01);
+        expect(g.nearest(25, 55, 3)).to.deep.equal([]);
+        g.update("a", 25.1005, 55.2005, { id: "a" });
+        g.update("b", 25.5, 55.5, { id: "b" });
+        expect(ids(g.nearest(25.1, 55.2, 3).map(x => x.value))).to.deep.equal([ "a", "b" ]);
+        expect(ids(g.nearest(25.1, 55.2, 3, null, 1000).map(x => x.value))).to.deep.equal([ "a" ]);
+        expect(g.nearest(40, 70, 1)[0].value.id).to.equal("b");
+    });
+});
+
+// vim: set sw=4 ts=4 et:
@@ -0,0 +1,164 @@
+const chai          = require("chai");
+const expect        = chai.expect;
+const EventEmitter  = require("events");
+const events        = require("../events");
+const utils         = require("../utils");
+
+// a response that keeps what was written to it, as the parsed lines
+class FakeResponse extends EventEmitter {
+    constructor() {
+        super();
+        this.chunks = [];
+        this.ended = false;
+        this.writableNeedDrain = false;
+    }
+
+    setHeader() {}
+    header() {}
+    flushHeaders() {}
+    cork() {}
+    uncork() {}
+
+    write(chunk) {
+        this.chunks.push(chunk);
+        return true;
+    }
+
+    end() {
+        this.ended = true;
+    }
+
+    get messages() {
+        return this.chunks.join("").split("\n").filter(l => l.length).map(l => JSON.parse(l));
+    }
+}
+
+function sleep(ms) {
+    return new Promise(r => setTimeout(r, ms));
+}
+
+function connect(filter = null, options = {}) {
+    let req = { session: { email: "user@example.com" }, headers: {} };
+    let res = new FakeResponse();
+    events.fetch_dispatcher(req, res, filter, Object.assign({ window: 0 }, options));
+    return res;
+}
+
+function update(unit, fields) {
+    events.fetch_emitter.emit("sendit", Object.assign({ type: "unit", unit, status: "available", lat: 25.1, lon: 55.2 }, fields));
+}
+
+describe("Fetch event stream", function() {
+    let clients = [];
+
+    afterEach(function() {
+        clients.forEach(res => res.emit("close"));
+        clients = [];
+    });
+
+    function client(filter, options) {
+        let res = connect(filter, options);
+        clients.push(res);
+        return res;
+    }
+
+    it("sends the whole unit first, then only the changes", async function() {
+        let res = client();
+        update("Unit F1", { bat: 3300 });
+        await sleep(5);
+        update("Unit F1", { bat: 3200 });
+        await sleep(5);
+        expect(res.messages).to.deep.equal([
+            { type: "unit", unit: "Unit F1", status: "available", lat: 25.1, lon: 55.2, bat: 3300 },
+            { type: "unit", unit: "Unit F1", delta: true, bat: 3200 },
+        ]);
+    });
+
+    it("sends only the units within the bbox, and tells when one has left it", async function() {
+        let res = client(null, { bbox: { south: 25, west: 55, north: 25.5, east: 55.5 } });
+        update("Unit F2", { lat: 26 });
+        update("Unit F3", {});
+        await sleep(5);
+        update("Unit F3", { lat: 26 });
+        await sleep(5);
+        expect(res.messages.map(m => [ m.unit, !!m.gone ])).to.deep.equal([ [ "Unit F3", false ], [ "Unit F3", true ] ]);
+    });
+
+    it("applies the filter of the client", async function() {
+        let res = client(u => (u.status == "available"));
+        update("Unit F4", { status: "in_use" });
+        await sleep(5);
+        expect(res.messages).to.be.empty;
+    });
+
+    it("coalesces the updates within the window", async function() {
+        let res = client(null, { window: 30 });
+        update("Unit F5", { bat: 3000 });
+        await sleep(5);
+        update("Unit F5", { bat: 2900 });
+        update("Unit F5", { bat: 2800 });
+        expect(res.messages).to.be.empty;
+        await sleep(40);
+        expect(res.messages.map(m => m.bat)).to.deep.equal([ 2800 ]);
+    });
+
+    it("serializes an update once for all the clients", async function() {
+        let a = client(), b = client(), c = client();
+        update("Unit F6", { bat: 3000 });
+        await sleep(5);
+        update("Unit F6", { bat: 2900 });
+        await sleep(5);
+        let before = events.fetch_stats().encoded;
+        update("Unit F6", { bat: 2800 });
+        await sleep(5);
+        expect(events.fetch_stats().encoded).to.equal(before + 1);
+        expect(a.chunks[2]).to.equal(b.chunks[2]);
+        expect(b.chunks[2]).to.equal(c.chunks[2]);
+        expect(c.messages[2]).to.deep.equal({ type: "unit", unit: "Unit F6", delta: true, bat: 2800 });
+    });
+
+    it("sends the whole unit to a client that hasn't seen it yet", async function() {
+        let a = client();
+        update("Unit F7", { bat: 3000 });
+        await sleep(5);
+        let b = client();
+        update("Unit F7", { bat: 2900 });
+        await sleep(5);
+        expect(a.messages[1]).to.have.property("delta", true);
+        expect(b.messages).to.deep.equal([ { type: "unit", unit: "Unit F7", status: "available", lat: 25.1, lon: 55.2, bat: 2900 } ]);
+    });
+
+    it("stops sending to a client that has dropped", async function() {
+        let res = client();
+        let streams = events.fetch_stats().streams;
+        res.emit("close");
+        expect(events.fetch_stats().streams).to.equal(streams - 1);
+        update("Unit F8", {});
+        await sleep(5);
+        expect(res.chunks).to.be.empty;
+    });
+
+    it("takes its options from the query, and refuses the invalid ones with 400", async function() {
+        let options = events.fetch_options({ query: { bbox: "25.3,55.4,25.1,55.2", window: "500" } });
+        expect(options).to.deep.equal({ bbox: { south: 25.1, west: 55.2, north: 25.3, east: 55.4 }, window: 500 });
+        expect(events.fetch_options({ query: {} })).to.deep.equal({ bbox: null, window: undefined });
+        for (let query of [ { bbox: "25.1,55.2,25.3" }, { bbox: "25.1,x,25.3,55.4" }, { window: "-5" }, { window: "1s" },
+            { bbox: "95,55.2,25.3,55.4" }, { bbox: "-10,-180,60,180" },
+            { bbox: [ "25.1,55.2,25.3,55.4", "25.1,55.2,25.3,55.4" ] }, { bbox: { south: "25.1" } }, { window: [ "5" ] } ]) {
+            expect(() => events.fetch_options({ query })).to.throw().with.property("status", 400);
+        }
+
+        // and the route answers it like the others do
+        let answered = new Promise(resolve => {
+            let res = { status(code) { this.code = code; return this; }, end() { resolve(this.code); } };
+            try {
+                events.fetch_options({ query: { bbox: "nowhere" } });
+            } catch (err) {
+                utils.mwrap({}, res, () => resolve("next"), Promise.reject(err));
+            }
+        });
+        expect(await answered).to.equal(400);
+    });
+});
+
+// vim: set sw=4 ts=4 et:
@@ -172,6 +172,34 @@ function dump_request(req) {
     }
 }
 
+const MAX_BBOX_DEG = 10; // the span of a bbox on either axis, a region at most
+
+// ?bbox=<lat>,<lon>,<lat>,<lon>: two opposite corners of the box
+function get_bbox(req) {
+    if (!req.query.bbox) {
+        return null;
+    }
+    if (typeof(req.query.bbox) !== "string") {
+        // repeated, or in the bracket syntax
+        throw error(400, "Invalid bbox");
+    }
+    let c = req.query.bbox.split(",").map(parseFloat);
+    if ((c.length != 4) || c.some(isNaN) || (Math.abs(c[0]) > 90) || (Math.abs(c[2]) > 90) ||
+        (Math.abs(c[1]) > 180) || (Math.abs(c[3]) > 180)) {
+        throw error(400, "Invalid bbox");
+    }
+    let bbox = {
+        south: Math.min(c[0], c[2]),
+        west: Math.min(c[1], c[3]),
+        north: Math.max(c[0], c[2]),
+        east: Math.max(c[1], c[3]),
+    };
+    if (((bbox.north - bbox.south) > MAX_BBOX_DEG) || ((bbox.east - bbox.west) > MAX_BBOX_DEG)) {
+        throw error(400, "Bbox too large");
+    }
+    return bbox;
+}
+
 module.exports = {
     HTTPError,
     error,
@@ -182,6 +210,7 @@ module.exports = {
     require_technician,
     require_admin,
     require_body,
+    get_bbox,
     av,
     s2bool,
     add_cors_response_headers,
@@ -0,0 +1,48 @@
+#!/bin/bash
+#
+# gen_certs.sh <count> [dir]
+#
+# Generates a local CA and <count> unit credentials signed by it, for the load generator. The keys are EC, because
+# thousands of RSA keys would take ages, and everything is PEM, because that's what node reads.
+# The units are called "Load 1" .. "Load <count>", their files are <dir>/load_00001.{key,crt} and so on.
+
+set -e
+
+COUNT="$1"
+DIR="${2:-pki}"
+
+if [ -z "$COUNT" ]; then
+    echo "Usage: $0 <count> [dir]" >&2
+    exit 1
+fi
+
+mkdir -p "$DIR"
+cd "$DIR"
+
+CA_BASE="loadgen_ca"
+CA_SUBJECT="/C=AE/ST=Dubai/L=MotorCity/O=wodeewa/CN=loadgen"
+CA_DAYS=3650
+
+function gen_ca() {
+    echo "Generating CA credentials $CA_BASE.* ..."
+    [ -s "$CA_BASE.key" -a -s "$CA_BASE.crt" ] || openssl req -nodes -days $CA_DAYS -x509 -extensions v3_ca -newkey ec -pkeyopt ec_paramgen_curve:prime256v1 -subj "$CA_SUBJECT" -keyout "$CA_BASE.key" -out "$CA_BASE.crt"
+    [ -s "$CA_BASE.srl" ] || openssl rand -hex 16 >"$CA_BASE.srl"
+}
+
+
+UNIT_SUBJECT_BASEDN="/C=AE/ST=Dubai/L=MotorCity/O=wodeewa/OU=iot"
+UNIT_DAYS=365
+
+function gen_unit_credentials() {
+    local UNIT_CN="$1"
+    local UNIT_BASE="$2"
+
+    [ -s "$UNIT_BASE.key" ] || openssl genpkey -algorithm ec -pkeyopt ec_paramgen_curve:prime256v1 -out "$UNIT_BASE.key" 2>/dev/null
+    [ -s "$UNIT_BASE.crt" -a "$UNIT_BASE.crt" -nt "$UNIT_BASE.key" ] || openssl req -new -key "$UNIT_BASE.key" -subj "$UNIT_SUBJECT_BASEDN/CN=$UNIT_CN" | openssl x509 -req -CAkey "$CA_BASE.key" -CA "$CA_BASE.crt" -CAserial "$CA_BASE.srl" -days $UNIT_DAYS -out "$UNIT_BASE.crt" 2>/dev/null
+}
+
+gen_ca
+echo "Generating $COUNT unit credentials in $DIR ..."
+for ((i = 1; i <= COUNT; ++i)); do
+    gen_unit_credentials "Load $i" "$(printf "load_%05d" $i)"
+done
@@ -0,0 +1,468 @@
+// Load generator: a fleet of simulated units against the backend
+//
+// node index.js [options] [track.gpx ...]
+//
+// Every unit does what the firmware does: POST /startup with a nonce, GET /agps, then it reports its position at every
+// interval, one by one or in batches, and keeps what it couldn't send for the next try. Each unit follows its own track,
+// one of the GPX files from a random offset, or a random walk if there are none, and has its own identity: over https
+// its own client certificate from gen_certs.sh, over plain http (straight to the backend, without the nginx front) the
+// X-SSL-Subject-DN header that the front would set from that certificate.
+//
+// It prints the throughput, the latency percentiles and the errors per endpoint at every --stats seconds, and the
+// totals at the end.
+
+const fs = require("fs");
+const path = require("path");
+const http = require("http");
+const https = require("https");
+const crypto = require("crypto");
+const codec = require("../../backend/report_codec");
+
+const M_PER_DEG = 111319.5;
+const QUEUE_MAX = 1024; // the unit keeps this many reports while the backend is unreachable
+const BATCH_MAX = 256; // rest.backend/report.js: MAX_BATCH_LENGTH
+const ENDPOINTS = [ "startup", "agps", "report", "batch" ];
+const CENTER = { lat: 25.12, lon: 55.21 }; // the random walks start around here
+
+function usage() {
+    console.error("Usage: node index.js [options] [track.gpx ...]");
+    console.error("  --url <url>        the backend api (default: http://127.0.0.1:8080/backend/v0)");
+    console.error("  --units <n>        number of units (default: 100)");
+    console.error("  --duration <sec>   run this long after the last unit has started (default: 60)");
+    console.error("  --ramp <sec>       start the units evenly during this time (default: 10)");
+    console.error("  --interval <sec>   a unit takes a position this often (default: 5)");
+    console.error("  --batch <n>        send the positions in batches of this many, 1 for /report (default: 1)");
+    console.error("  --binary <0|1>     send the batches in the binary encoding, if the backend accepts it (default: 0)");
+    console.error("  --agps <0|1>       get the AGPS data after startup (default: 1)");
+    console.error("  --pki <dir>        the unit credentials from gen_certs.sh (default: none, the CN is 'Load <n>')");
+    console.error("  --ca <file>        the CA of the server certificate, for https (default: the system ones)");
+    console.error("  --timeout <ms>     request timeout (default: 10000)");
+    console.error("  --stats <sec>      print the statistics this often (default: 10)");
+    console.error("  --json <file>      write the totals to this file too (default: none)");
+    process.exit(1);
+}
+
+function parse_args(argv) {
+    let opts = {
+        url: "http://127.0.0.1:8080/backend/v0", units: 100, duration: 60, ramp: 10, interval: 5, batch: 1, binary: 0,
+        agps: 1, pki: null, ca: null, timeout: 10000, stats: 10, json: null, gpx: [],
+    };
+    const strings = [ "url", "pki", "ca", "json" ];
+    for (let i = 0; i < argv.length; ++i) {
+        let a = argv[i];
+        if (a.startsWith("--")) {
+            let k = a.substr(2);
+            if (!(k in opts) || (k === "gpx") || (i + 1 >= argv.length)) {
+                usage();
+            }
+            opts[k] = strings.includes(k) ? argv[++i] : parseFloat(argv[++i]);
+            if (Number.isNaN(opts[k])) {
+                usage();
+            }
+        }
+        else {
+            opts.gpx.push(a);
+        }
+    }
+    if ((opts.units < 1) || (opts.interval <= 0) || (opts.batch < 1) || (opts.batch > BATCH_MAX) || (opts.stats <= 0)) {
+        usage();
+    }
+    return opts;
+}
+
+function sleep(ms) {
+    return new Promise(r => setTimeout(r, Math.max(ms, 0)));
+}
+
+function gauss() {
+    let u = 1 - Math.random(), v = Math.random();
+    return Math.sqrt(-2 * Math.log(u)) * Math.cos(2 * Math.PI * v);
+}
+
+
+// the track points of a GPX file, times in ms from the first one
+function load_gpx(file) {
+    let track = [];
+    let re = /<trkpt\s+lat="([-\d.]+)"\s+lon="([-\d.]+)"\s*>(.*?)<\/trkpt>/gs;
+    let gpx = fs.readFileSync(file, "utf8");
+    let m;
+    while ((m = re.exec(gpx)) !== null) {
+        let t = /<time>([^<]+)<\/time>/.exec(m[3]);
+        if (!t) {
+            continue;
+        }
+        let p = { time: new Date(t[1]).getTime(), lat: parseFloat(m[1]), lon: parseFloat(m[2]) };
+        if ((track.length === 0) || (p.time > track[track.length - 1].time)) {
+            track.push(p);
+        }
+    }
+    if (track.length < 2) {
+        console.error("There are less than 2 timed track points in " + file);
+        process.exit(1);
+    }
+    let t0 = track[0].time;
+    track.forEach(p => { p.time -= t0; });
+    return track;
+}
+
+function position_at(track, t) {
+    let lo = 0, hi = track.length - 1;
+    while (hi - lo > 1) {
+        let mid = (lo + hi) >> 1;
+        if (track[mid].time <= t) {
+            lo = mid;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    let a = track[lo], b = track[hi];
+    let f = Math.min(Math.max((t - a.time) / (b.time - a.time), 0), 1);
+    let dn = (b.lat - a.lat) * M_PER_DEG;
+    let de = (b.lon - a.lon) * M_PER_DEG * Math.cos(a.lat * Math.PI / 180);
+    return {
+        lat: a.lat + (b.lat - a.lat) * f,
+        lon: a.lon + (b.lon - a.lon) * f,
+        spd: Math.hypot(dn, de) / (b.time - a.time) * 3600, // km/h
+        azi: (Math.atan2(de, dn) * 180 / Math.PI + 360) % 360,
+    };
+}
+
+// follows a GPX track in a loop, from a random offset
+class TrackMotion {
+    constructor(track) {
+        this.track = track;
+        this.length = track[track.length - 1].time;
+        this.offset = Math.random() * this.length - Date.now();
+    }
+
+    position(now) {
+        return position_at(this.track, (now + this.offset) % this.length);
+    }
+}
+
+// wanders around: standing or moving, turning a bit at every step
+class RandomWalk {
+    constructor() {
+        this.lat = CENTER.lat + gauss() * 0.03;
+        this.lon = CENTER.lon + gauss() * 0.03;
+        this.azi = Math.random() * 360;
+        this.spd = 0;
+        this.last = Date.now();
+    }
+
+    position(now) {
+        let dt = (now - this.last) / 1000;
+        this.last = now;
+        if (Math.random() < 0.05) {
+            this.spd = (this.spd > 0) ? 0 : 10 + Math.random() * 15;
+        }
+        if (this.spd > 0) {
+            this.azi = (this.azi + gauss() * 20 + 360) % 360;
+            let d = this.spd / 3.6 * dt;
+            this.lat += d * Math.cos(this.azi * Math.PI / 180) / M_PER_DEG;
+            this.lon += d * Math.sin(this.azi * Math.PI / 180) / (M_PER_DEG * Math.cos(this.lat * Math.PI / 180));
+        }
+        return { lat: this.lat, lon: this.lon, spd: this.spd, azi: this.azi };
+    }
+}
+
+
+// the credentials of the units in @dir, in the order of their names
+function load_pki(dir, count) {
+    let files = fs.readdirSync(dir).filter(f => f.endsWith(".crt") && fs.existsSync(path.join(dir, f.replace(/\.crt$/, ".key"))));
+    files.sort();
+    if (files.length < count) {
+        console.error("There are only " + files.length + " unit credentials in " + dir + ", run gen_certs.sh " + count);
+        process.exit(1);
+    }
+    return files.slice(0, count).map(f => {
+        let cert = fs.readFileSync(path.join(dir, f));
+        let subject = new crypto.X509Certificate(cert).subject;
+        return {
+            cert,
+            key: fs.readFileSync(path.join(dir, f.replace(/\.crt$/, ".key"))),
+            // the way nginx puts $ssl_client_s_dn
+            dn: subject.split("\n").reverse().join(","),
+        };
+    });
+}
+
+
+class Stats {
+    constructor() {
+        this.started = Date.now();
+        this.total = this.new_window();
+        this.window = this.new_window();
+        this.running = 0;
+        this.lost = 0;
+    }
+
+    new_window() {
+        let w = { since: Date.now(), records: 0, endpoints: {} };
+        ENDPOINTS.forEach(e => { w.endpoints[e] = { requests: 0, errors: 0, latency: [], status: {} }; });
+        return w;
+    }
+
+    // @result is a http status or an error code
+    add(endpoint, result, ms, records) {
+        for (let w of [ this.total, this.window ]) {
+            let e = w.endpoints[endpoint];
+            ++e.requests;
+            e.status[result] = (e.status[result] || 0) + 1;
+            if ((typeof(result) === "number") && (result < 400)) {
+                e.latency.push(ms);
+                w.records += records;
+            }
+            else {
+                ++e.errors;
+            }
+        }
+    }
+
+    static summary(w) {
+        let secs = (Date.now() - w.since) / 1000;
+        let result = { seconds: Math.round(secs), records: w.records, records_per_sec: w.records / secs, endpoints: {} };
+        for (let name of ENDPOINTS) {
+            let e = w.endpoints[name];
+            if (e.requests === 0) {
+                continue;
+            }
+            let lat = Float64Array.from(e.latency).sort();
+            let pct = p => lat.length ? lat[Math.min(lat.length - 1, Math.floor(p * lat.length))] : null;
+            result.endpoints[name] = {
+                requests: e.requests,
+                requests_per_sec: e.requests / secs,
+                errors: e.errors,
+                error_rate: e.errors / e.requests,
+                latency_ms: { p50: pct(0.5), p90: pct(0.9), p99: pct(0.99), max: lat.length ? lat[lat.length - 1] : null },
+                status: e.status,
+            };
+        }
+        return result;
+    }
+
+    print_window() {
+        let s = Stats.summary(this.window);
+        let line = "t=" + Math.round((Date.now() - this.started) / 1000) + "s units=" + this.running + " rec/s=" + s.records_per_sec.toFixed(1);
+        for (let [ name, e ] of Object.entries(s.endpoints)) {
+            line += " | " + name + " " + e.requests_per_sec.toFixed(1) + "/s";
+            if (e.latency_ms.p50 !== null) {
+                line += " p50=" + e.latency_ms.p50.toFixed(1) + " p99=" + e.latency_ms.p99.toFixed(1) + " ms";
+            }
+            if (e.errors) {
+                line += " err=" + (100 * e.error_rate).toFixed(1) + "%";
+            }
+        }
+        console.log(line);
+        this.window = this.new_window();
+    }
+
+    print_total() {
+        let s = Stats.summary(this.total);
+        console.log("Total: " + s.seconds + " s, " + s.records + " records, " + s.records_per_sec.toFixed(1) + " records/s, " + this.lost + " dropped from full queues");
+        console.log("endpoint   requests     req/s  errors      p50      p90      p99      max (ms)");
+        let ms = x => ((x === null) ? "-" : x.toFixed(1)).padStart(8);
+        for (let [ name, e ] of Object.entries(s.endpoints)) {
+            console.log(name.padEnd(8) + String(e.requests).padStart(10) + e.requests_per_sec.toFixed(1).padStart(10) +
+                (100 * e.error_rate).toFixed(1).padStart(7) + "%" +
+                ms(e.latency_ms.p50) + ms(e.latency_ms.p90) + ms(e.latency_ms.p99) + ms(e.latency_ms.max));
+            let failed = Object.entries(e.status).filter(([ k, v ]) => !(Number(k) < 400));
+            if (failed.length) {
+                console.log("          errors: " + failed.map(([ k, v ]) => k + "=" + v).join(", "));
+            }
+        }
+        return s;
+    }
+}
+
+
+const opts = parse_args(process.argv.slice(2));
+const base = new URL(opts.url.replace(/\/+$/, ""));
+const secure = (base.protocol === "https:");
+const transport = secure ? https : http;
+const ca = opts.ca ? fs.readFileSync(opts.ca) : undefined;
+const stats = new Stats();
+let running = true;
+
+// resolves to the response, or null if there was none
+function request(unit, method, endpoint, url_path, body, type, records) {
+    return new Promise(resolve => {
+        let headers = {};
+        if (!secure) {
+            headers["X-SSL-Subject-DN"] = unit.dn;
+        }
+        if (body) {
+            headers["Content-Type"] = type;
+            headers["Content-Length"] = body.length;
+        }
+        let started = process.hrtime.bigint();
+        let elapsed = () => Number(process.hrtime.bigint() - started) / 1e6;
+        let req = transport.request({
+            protocol: base.protocol,
+            hostname: base.hostname,
+            port: base.port,
+            path: base.pathname + url_path,
+            method,
+            headers,
+            agent: unit.agent,
+            timeout: opts.timeout,
+        }, res => {
+            let chunks = [];
+            res.on("data", chunk => chunks.push(chunk));
+            res.on("end", () => {
+                stats.add(endpoint, res.statusCode, elapsed(), records || 0);
+                resolve({ status: res.statusCode, headers: res.headers, body: Buffer.concat(chunks) });
+            });
+            res.on("aborted", () => {
+                stats.add(endpoint, "ECONNRESET", elapsed(), 0);
+                resolve(null);
+            });
+        });
+        req.on("timeout", () => req.destroy(Object.assign(new Error("Request timeout"), { code: "ETIMEDOUT" })));
+        req.on("error", err => {
+            stats.add(endpoint, err.code || err.message, elapsed(), 0);
+            resolve(null);
+        });
+        req.end(body);
+    });
+}
+
+class Unit {
+    constructor(idx, ident, motion) {
+        this.idx = idx;
+        this.dn = ident.dn;
+        this.motion = motion;
+        this.queue = [];
+        this.binary = false;
+        let agent_opts = { keepAlive: true, maxSockets: 1 };
+        // one connection per unit, like the firmware has, and the tls sessions are resumed
+        this.agent = secure ? new https.Agent(Object.assign(agent_opts, { key: ident.key, cert: ident.cert, ca })) : new http.Agent(agent_opts);
+    }
+
+    sample(now) {
+        let pos = this.motion.position(now);
+        return {
+            time: Math.round(now) / 1000,
+            lat: Math.round(pos.lat * 1e7) / 1e7,
+            lon: Math.round(pos.lon * 1e7) / 1e7,
+            azi: Math.round(pos.azi * 100) / 100,
+            spd: Math.round(pos.spd * 10) / 10,
+            acc: Math.round((3 + Math.random() * 5) * 10) / 10,
+            bat: 2900 + (now % 200),
+        };
+    }
+
+    async startup() {
+        while (running) {
+            let body = Buffer.from(JSON.stringify({ nonce: crypto.randomInt(0x7fffffff) }));
+            let res = await request(this, "POST", "startup", "/startup", body, "application/json");
+            if (res && (res.status < 300)) {
+                this.binary = opts.binary && (res.headers["accept-post"] || "").includes(codec.MIME_TYPE);
+                return true;
+            }
+            await sleep(opts.interval * 1000);
+        }
+        return false;
+    }
+
+    async send() {
+        let n = Math.min(this.queue.length, BATCH_MAX);
+        let records = this.queue.slice(0, n);
+        let res;
+        if (this.binary) {
+            res = await request(this, "POST", "batch", "/report/batch", codec.encode(records), codec.MIME_TYPE, n);
+        }
+        else if (opts.batch > 1) {
+            res = await request(this, "POST", "batch", "/report/batch", Buffer.from(JSON.stringify(records)), "application/json", n);
+        }
+        else {
+            res = await request(this, "POST", "report", "/report", Buffer.from(JSON.stringify(records[0])), "application/json", 1);
+            n = 1;
+        }
+        if (res && ((res.status < 300) || (res.status == 400) || (res.status == 413) || (res.status == 415))) {
+            // the rejected ones wouldn't be accepted at the next try either
+            this.queue.splice(0, n);
+        }
+    }
+
+    async run() {
+        ++stats.running;
+        if (await this.startup()) {
+            if (opts.agps) {
+                await request(this, "GET", "agps", "/agps");
+            }
+            let next = Date.now() + Math.random() * opts.interval * 1000;
+            while (running) {
+                await sleep(next - Date.now());
+                if (!running) {
+                    break;
+                }
+                next += opts.interval * 1000;
+                this.queue.push(this.sample(Date.now()));
+                if (this.queue.length > QUEUE_MAX) {
+                    this.queue.shift();
+                    ++stats.lost;
+                }
+                if (this.queue.length >= opts.batch) {
+                    await this.send();
+                }
+            }
+        }
+        this.agent.destroy();
+        --stats.running;
+    }
+}
+
+
+async function main() {
+    let tracks = opts.gpx.map(load_gpx);
+    let idents;
+    if (opts.pki) {
+        idents = load_pki(opts.pki, opts.units);
+    }
+    else if (secure) {
+        console.error("An https backend needs the unit certificates, see --pki");
+        process.exit(1);
+    }
+    else {
+        idents = [];
+        for (let i = 1; i <= opts.units; ++i) {
+            idents.push({ dn: "CN=Load " + i + ",OU=iot,O=wodeewa,L=MotorCity,ST=Dubai,C=AE" });
+        }
+    }
+    console.log("Starting " + opts.units + " units against " + base.href + " in " + opts.ramp + " s, for " + opts.duration + " s, " +
+        (tracks.length ? (tracks.length + " tracks") : "random walks"));
+
+    let timer = setInterval(() => stats.print_window(), opts.stats * 1000);
+    process.on("SIGINT", () => { running = false; });
+
+    let units = [];
+    let t0 = Date.now();
+    for (let i = 0; (i < opts.units) && running; ++i) {
+        await sleep(t0 + i * opts.ramp * 1000 / opts.units - Date.now());
+        let motion = tracks.length ? new TrackMotion(tracks[i % tracks.length]) : new RandomWalk();
+        let unit = new Unit(i + 1, idents[i], motion);
+        units.push(unit.run());
+    }
+    let deadline = Date.now() + opts.duration * 1000;
+    while (running && (Date.now() < deadline)) {
+        await sleep(Math.min(deadline - Date.now(), 250));
+    }
+    running = false;
+    // the requests in flight are waited for, they finish within the timeout
+    await Promise.all(units);
+    clearInterval(timer);
+
+    stats.print_window();
+    let total = stats.print_total();
+    if (opts.json) {
+        total.units = opts.units;
+        total.dropped = stats.lost;
+        fs.writeFileSync(opts.json, JSON.stringify(total, null, 4) + "\n");
+    }
+}
+
+main();
+
+// vim: set sw=4 ts=4 et:
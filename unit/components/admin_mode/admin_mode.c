@@ -928,6 +928,66 @@ httpd_uri_t uri_post_server_distance_threshold = {
 };
 
 
+// ------------------------------------------------------------------------------
+static esp_err_t
+http_get_server_time_min(httpd_req_t *req) {
+    log_req(req);
+    return attr_from_nvs_u16(req, "time_min", "server", "time_min");
+}
+
+static const
+httpd_uri_t uri_get_server_time_min = {
+    .uri       = "/rest/server/time_min",
+    .method    = HTTP_GET,
+    .handler   = http_get_server_time_min,
+};
+
+
+// ------------------------------------------------------------------------------
+static esp_err_t
+http_post_server_time_min(httpd_req_t *req) {
+    log_req(req);
+    return nvs_u16_from_attr(req, "time_min", "server", "time_min");
+}
+
+static const
+httpd_uri_t uri_post_server_time_min = {
+    .uri       = "/rest/server/time_min",
+    .method    = HTTP_POST,
+    .handler   = http_post_server_time_min,
+};
+
+
+// ------------------------------------------------------------------------------
+static esp_err_t
+http_get_server_time_max(httpd_req_t *req) {
+    log_req(req);
+    return attr_from_nvs_u16(req, "time_max", "server", "time_max");
+}
+
+static const
+httpd_uri_t uri_get_server_time_max = {
+    .uri       = "/rest/server/time_max",
+    .method    = HTTP_GET,
+    .handler   = http_get_server_time_max,
+};
+
+
+// ------------------------------------------------------------------------------
+static esp_err_t
+http_post_server_time_max(httpd_req_t *req) {
+    log_req(req);
+    return nvs_u16_from_attr(req, "time_max", "server", "time_max");
+}
+
+static const
+httpd_uri_t uri_post_server_time_max = {
+    .uri       = "/rest/server/time_max",
+    .method    = HTTP_POST,
+    .handler   = http_post_server_time_max,
+};
+
+
 /*******************************************************************************
  * Event handlers
  */
@@ -951,7 +1011,7 @@ event_handler(void *ctx, system_event_t *event) {
                 ESP_LOGI(TAG, "Starting http server;");
                 httpd_config_t conf = HTTPD_DEFAULT_CONFIG();
                 conf.max_open_sockets = 15;
-                conf.max_uri_handlers = 24;
+                conf.max_uri_handlers = 28;
                 conf.max_resp_headers = 8;
                 esp_err_t res = httpd_start(&http_server, &conf);
                 if (res != ESP_OK) {
@@ -989,6 +1049,12 @@ event_handler(void *ctx, system_event_t *event) {
                     
                     httpd_register_uri_handler(http_server, &uri_get_server_distance_threshold );
                     httpd_register_uri_handler(http_server, &uri_post_server_distance_threshold );
+
+                    httpd_register_uri_handler(http_server, &uri_get_server_time_min );
+                    httpd_register_uri_handler(http_server, &uri_post_server_time_min );
+
+                    httpd_register_uri_handler(http_server, &uri_get_server_time_max );
+                    httpd_register_uri_handler(http_server, &uri_post_server_time_max );
                     ESP_LOGI(TAG, "Started http server;");
                 }
             }
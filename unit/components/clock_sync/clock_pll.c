@@ -0,0 +1,67 @@
+#include "clock_pll.h"
+
+#include <string.h>
+
+
+static int64_t
+clamp(int64_t x, int64_t limit) {
+    return (x < -limit) ? -limit : (limit < x) ? limit : x;
+}
+
+
+void
+clock_pll_init(clock_pll_t *self, int32_t freq_ppb) {
+    memset(self, 0, sizeof(*self));
+    self->freq_ppb = clamp(freq_ppb, CLOCK_PLL_FREQ_MAX_PPB);
+}
+
+
+bool
+clock_pll_sample(clock_pll_t *self, int64_t offset_ns, int64_t now_us) {
+    int64_t dt_us = self->has_sample ? (now_us - self->last_sample_us) : 0;
+    self->last_sample_us = now_us;
+    self->has_sample = true;
+
+    if ((offset_ns < -CLOCK_PLL_STEP_NS) || (CLOCK_PLL_STEP_NS < offset_ns)) {
+        // the offset says nothing about the frequency, it's just wrong
+        self->phase_ns = 0;
+        self->slew_ppb = 0;
+        return true;
+    }
+
+    // while the slewing is saturated, the offset comes from the past and not from the frequency error (anti-windup)
+    bool saturated = (self->slew_ppb == CLOCK_PLL_SLEW_MAX_PPB) || (self->slew_ppb == -CLOCK_PLL_SLEW_MAX_PPB);
+    if ((dt_us > 0) && !saturated) {
+        if (dt_us > CLOCK_PLL_DT_MAX_US) {
+            dt_us = CLOCK_PLL_DT_MAX_US;
+        }
+        // ns * us / (s^2 * 1e6) = ns/s = ppb
+        int64_t d_freq = clamp(offset_ns, CLOCK_PLL_FREQ_OFFSET_MAX_NS) * dt_us / (CLOCK_PLL_TI_SEC * CLOCK_PLL_TI_SEC * 1000000LL);
+        self->freq_ppb = clamp(self->freq_ppb + d_freq, CLOCK_PLL_FREQ_MAX_PPB);
+    }
+
+    // the offset already contains whatever is left of the previous one, so it replaces that
+    self->phase_ns = offset_ns;
+    self->slew_ppb = clamp(offset_ns / CLOCK_PLL_TP_SEC, CLOCK_PLL_SLEW_MAX_PPB);
+    return false;
+}
+
+
+int32_t
+clock_pll_tick(clock_pll_t *self, int64_t elapsed_us) {
+    if (elapsed_us <= 0) {
+        return 0;
+    }
+    int64_t slew_ns = self->slew_ppb * elapsed_us / 1000000;
+    if (((self->phase_ns >= 0) && (slew_ns > self->phase_ns)) || ((self->phase_ns < 0) && (slew_ns < self->phase_ns))) {
+        // don't overshoot if the next sample is late
+        slew_ns = self->phase_ns;
+    }
+    self->phase_ns -= slew_ns;
+    self->frac_ns += (self->freq_ppb * elapsed_us / 1000000) + slew_ns;
+    int32_t adj_us = self->frac_ns / 1000;
+    self->frac_ns -= adj_us * 1000LL;
+    return adj_us;
+}
+
+// vim: set sw=4 ts=4 indk= et si:
@@ -0,0 +1,40 @@
+#ifndef CLOCK_PLL_H
+#define CLOCK_PLL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* PI loop that disciplines the local clock to a reference, without touching the cpu frequency.
+ *
+ * The P part slews out the measured offset in about CLOCK_PLL_TP_SEC, the I part learns the frequency error of the
+ * local clock from what remains of the offset. Both are applied as an adjustment rate, and clock_pll_tick() tells how
+ * many whole usecs that amounts to after some time, the fractions are carried over to the next tick.
+ *
+ * No platform dependencies, so it can be tested on the host as well.
+ */
+
+#define CLOCK_PLL_TP_SEC        16
+#define CLOCK_PLL_TI_SEC        32          // 2 * TP: critically damped
+#define CLOCK_PLL_STEP_NS       100000000LL // if off by more than this, step the clock instead of slewing
+#define CLOCK_PLL_SLEW_MAX_PPB  500000
+#define CLOCK_PLL_FREQ_MAX_PPB  200000      // way beyond any crystal, it's only a sanity limit
+#define CLOCK_PLL_FREQ_OFFSET_MAX_NS 1000000LL // the frequency learns from at most this much offset at a time
+#define CLOCK_PLL_DT_MAX_US     64000000LL  // after a longer gap a sample counts only this much for the frequency
+
+typedef struct {
+    int32_t freq_ppb;       // the frequency error, positive: the local clock is slow
+    int32_t slew_ppb;       // the rate the phase is being slewed out with
+    int64_t phase_ns;       // what is still to be slewed out of the last offset
+    int64_t frac_ns;        // the adjustment that doesn't yet make a whole usec
+    int64_t last_sample_us;
+    bool has_sample;
+} clock_pll_t;
+
+void clock_pll_init(clock_pll_t *self, int32_t freq_ppb);
+// @offset_ns: reference - local, measured at @now_us (monotonic); returns true if the clock must be stepped by it
+bool clock_pll_sample(clock_pll_t *self, int64_t offset_ns, int64_t now_us);
+// the usecs to add to the local clock after @elapsed_us
+int32_t clock_pll_tick(clock_pll_t *self, int64_t elapsed_us);
+
+#endif // CLOCK_PLL_H
+// vim: set sw=4 ts=4 indk= et si:
@@ -0,0 +1,207 @@
+#include "clock_sync.h"
+#include "clock_pll.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_timer.h>
+#include <nvs.h>
+
+#undef LOG_LOCAL_LEVEL
+#define LOG_LOCAL_LEVEL ESP_LOG_DEBUG
+#include <esp_log.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/time.h>
+
+static const char *TAG = "clock";
+
+#define TICK_USEC               1000000
+#define LOCK_USEC               500     // locked if the offset stays within this
+#define LOCK_SAMPLES            60      // for this many samples
+#define SAVE_DELTA_PPB          100     // save the frequency if it has changed by more than this
+#define SAVE_PERIOD_SEC         3600    // but not more often than this, for the sake of the flash
+#define STATS_PERIOD_SEC        600
+
+static clock_pll_t pll;
+static esp_timer_handle_t tick_timer = NULL;
+static int64_t last_tick_us;
+static uint32_t in_range;       // consecutive samples within LOCK_USEC
+static int32_t saved_ppb;
+static int64_t saved_us, stats_since_us;
+static clock_sync_stats_t stats;
+static int32_t offset_min_us, offset_max_us; // in the current stats period
+static uint64_t offset_sqsum;
+static uint32_t offset_n;
+
+
+static void
+adjust_time(int64_t delta_usec) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+
+    tv.tv_sec += delta_usec / 1000000L;
+    tv.tv_usec += delta_usec % 1000000L;
+
+    if (tv.tv_usec < 0) {
+        tv.tv_usec += 1000000;
+        --tv.tv_sec;
+    }
+    else if (1000000 <= tv.tv_usec) {
+        tv.tv_usec -= 1000000;
+        ++tv.tv_sec;
+    }
+
+    settimeofday(&tv, NULL);
+}
+
+
+static void
+tick(void *arg) {
+    int64_t now = esp_timer_get_time();
+    taskENTER_CRITICAL();
+    int32_t adj_us = clock_pll_tick(&pll, now - last_tick_us);
+    taskEXIT_CRITICAL();
+    last_tick_us = now;
+    if (adj_us != 0) {
+        adjust_time(adj_us);
+    }
+}
+
+
+static int32_t
+load_freq(void) {
+    int32_t freq_ppb = 0;
+    nvs_handle nvs;
+    if (nvs_open("clock", NVS_READONLY, &nvs) == ESP_OK) {
+        nvs_get_i32(nvs, "freq", &freq_ppb);
+        nvs_close(nvs);
+    }
+    return freq_ppb;
+}
+
+
+static void
+save_freq(int32_t freq_ppb) {
+    nvs_handle nvs;
+    esp_err_t res = nvs_open("clock", NVS_READWRITE, &nvs);
+    if (res != ESP_OK) {
+        ESP_LOGE(TAG, "Cannot open NVS for the frequency: %d", res);
+        return;
+    }
+    res = nvs_set_i32(nvs, "freq", freq_ppb);
+    if (res == ESP_OK) {
+        res = nvs_commit(nvs);
+    }
+    if (res != ESP_OK) {
+        ESP_LOGE(TAG, "Cannot save the frequency: %d", res);
+    }
+    nvs_close(nvs);
+}
+
+
+static void
+update_stats(int64_t offset_usec, int64_t now) {
+    int32_t off = (offset_usec < INT32_MIN) ? INT32_MIN : (INT32_MAX < offset_usec) ? INT32_MAX : offset_usec;
+    if ((offset_n == 0) || (off < offset_min_us)) {
+        offset_min_us = off;
+    }
+    if ((offset_n == 0) || (off > offset_max_us)) {
+        offset_max_us = off;
+    }
+    offset_sqsum += (uint64_t)((int64_t)off * off);
+    ++offset_n;
+
+    if ((now - stats_since_us) < (STATS_PERIOD_SEC * 1000000LL)) {
+        return;
+    }
+    stats_since_us = now;
+    stats.offset_min_us = offset_min_us;
+    stats.offset_max_us = offset_max_us;
+    stats.offset_rms_us = sqrt((double)offset_sqsum / offset_n);
+    ESP_LOGI(TAG, "Stats: locked=%d, freq=%d ppb, samples=%u, steps=%u, offset=[%d..%d] us, rms=%d us",
+        stats.locked, stats.freq_ppb, stats.samples, stats.steps, stats.offset_min_us, stats.offset_max_us, stats.offset_rms_us);
+    offset_sqsum = offset_n = 0;
+}
+
+
+void
+clock_sync_init(void) {
+    if (tick_timer) {
+        return;
+    }
+    saved_ppb = load_freq();
+    clock_pll_init(&pll, saved_ppb);
+    ESP_LOGI(TAG, "Frequency error %d ppb", pll.freq_ppb);
+
+    esp_timer_create_args_t args = {
+        .callback = tick,
+        .name = "clock",
+    };
+    esp_err_t res = esp_timer_create(&args, &tick_timer);
+    if (res != ESP_OK) {
+        ESP_LOGE(TAG, "Cannot create timer: %d", res);
+        tick_timer = NULL;
+        return;
+    }
+    last_tick_us = stats_since_us = esp_timer_get_time();
+    esp_timer_start_periodic(tick_timer, TICK_USEC);
+}
+
+
+bool
+clock_sync_sample(uint64_t utc_usec, int64_t at_us) {
+    // the system time at @at_us
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    int64_t now = esp_timer_get_time();
+    int64_t local_usec = ((int64_t)tv.tv_sec) * 1000000LL + tv.tv_usec - (now - at_us);
+    int64_t offset_usec = ((int64_t)utc_usec) - local_usec;
+
+    taskENTER_CRITICAL();
+    bool step = clock_pll_sample(&pll, offset_usec * 1000, at_us);
+    int32_t freq_ppb = pll.freq_ppb;
+    taskEXIT_CRITICAL();
+
+    ++stats.samples;
+    stats.freq_ppb = freq_ppb;
+    if (step) {
+        adjust_time(offset_usec);
+        ESP_LOGI(TAG, "System time set to %lu (delta_usec=%f)", (unsigned long)(utc_usec / 1000000), (double)offset_usec);
+        ++stats.steps;
+        stats.locked = false;
+        in_range = 0;
+        return true;
+    }
+    ESP_LOGD(TAG, "Offset %d us, freq=%d ppb", (int)offset_usec, freq_ppb);
+    update_stats(offset_usec, now);
+
+    if ((-LOCK_USEC <= offset_usec) && (offset_usec <= LOCK_USEC)) {
+        if (in_range < LOCK_SAMPLES) {
+            ++in_range;
+        }
+    }
+    else {
+        in_range = 0;
+    }
+    stats.locked = (in_range == LOCK_SAMPLES);
+
+    // only a settled frequency is worth remembering
+    if (stats.locked && (abs(freq_ppb - saved_ppb) > SAVE_DELTA_PPB) &&
+        ((saved_us == 0) || ((now - saved_us) >= (SAVE_PERIOD_SEC * 1000000LL)))) {
+        ESP_LOGI(TAG, "Saving frequency error %d ppb", freq_ppb);
+        save_freq(freq_ppb);
+        saved_ppb = freq_ppb;
+        saved_us = now;
+    }
+    return false;
+}
+
+
+void
+clock_sync_get_stats(clock_sync_stats_t *result) {
+    *result = stats;
+}
+
+// vim: set sw=4 ts=4 indk= et si:
@@ -0,0 +1,22 @@
+#ifndef CLOCK_SYNC_H
+#define CLOCK_SYNC_H
+
+#include <esp_system.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct {
+    bool locked;            // the offset has been within CLOCK_SYNC_LOCK_USEC for a while
+    int32_t freq_ppb;       // the learned frequency error of the local clock, positive: it's slow
+    uint32_t samples, steps;
+    int32_t offset_min_us, offset_max_us, offset_rms_us; // in the last stats period
+} clock_sync_stats_t;
+
+// load the frequency error learned before, and start slewing the system time
+void clock_sync_init(void);
+// the reference time was @utc_usec at @at_us (esp_timer); returns true if the system time was stepped
+bool clock_sync_sample(uint64_t utc_usec, int64_t at_us);
+void clock_sync_get_stats(clock_sync_stats_t *result);
+
+#endif // CLOCK_SYNC_H
+// vim: set sw=4 ts=4 indk= et si:
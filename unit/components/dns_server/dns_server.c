@@ -54,7 +54,7 @@ dns_buf_destroy(dns_buf_t *self) {
 
 void
 dns_buf_log(dns_buf_t *self, const char *prefix) {
-    ESP_LOGD(TAG, "%s; rdpos=0x%04x, wrpos=0x%04x, alloc_length=0x%04x, owns_data=%d", prefix, self->rdpos, self->wrpos, self->alloc_length, self->owns_data);
+    ESP_LOGD(TAG, "%s; rdpos=0x%04x, wrpos=0x%04x, alloc_length=0x%04x, owns_data=%d", prefix, (unsigned)self->rdpos, (unsigned)self->wrpos, (unsigned)self->alloc_length, self->owns_data);
     if (self->wrpos > 0) {
         ESP_LOG_BUFFER_HEXDUMP(TAG, self->data, self->wrpos, ESP_LOG_DEBUG);
     }
@@ -276,7 +276,7 @@ dns_server_task(void *pvParameters) {
                 ESP_LOGE(TAG, "recvfrom failed: errno %d", errno);
                 break;
             }
-            ESP_LOGI(TAG, "Received %d bytes from 0x%08x:", rx_length, ((struct sockaddr_in *)&source_addr)->sin_addr.s_addr);
+            ESP_LOGI(TAG, "Received %d bytes from 0x%08x:", (int)rx_length, ((struct sockaddr_in *)&source_addr)->sin_addr.s_addr);
 
             dns_buf_init_use_data(&in, rx_buffer, rx_length);
             dns_buf_log(&in, "Input");
@@ -403,7 +403,7 @@ dns_server_task(void *pvParameters) {
                 dns_write_u16be(&out, 0);
             }
 
-            ESP_LOGD(TAG, "Sending response; len=%d", out.wrpos);
+            ESP_LOGD(TAG, "Sending response; len=%d", (int)out.wrpos);
             dns_buf_log(&out, "Output");
             int err = sendto(sock, out.data, out.wrpos, 0, (struct sockaddr *)&source_addr, sizeof(source_addr));
             if (err < 0) {
@@ -1,7 +1,11 @@
 #include "gps.h"
+#include "gps_framer.h"
+#include "gps_kalman.h"
 #include "oled_stdout.h"
 #include "main.h"
 #include "misc.h"
+#include "power_mgmt.h"
+#include "clock_sync.h"
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
@@ -9,6 +13,8 @@
 #include <freertos/event_groups.h>
 #include <freertos/semphr.h>
 #include <driver/uart.h>
+#include <nvs.h>
+#include <esp_timer.h>
 
 #undef LOG_LOCAL_LEVEL
 #define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE
@@ -16,13 +22,13 @@
 #include <esp_log.h>
 #include <stdio.h>
 #include <string.h>
+#include <ctype.h>
 #include <time.h>
 #include <sys/time.h>
 #include <endian.h>
 
 static const char *TAG = "gps";
 
-void ets_update_cpu_frequency(uint32_t ticks_per_us);
 extern uint64_t g_esp_os_us;
 
 //#define USE_NMEA
@@ -31,11 +37,33 @@ extern uint64_t g_esp_os_us;
 #define TIMEOUT_SEND_CMD_MS         250
 #define TIMEOUT_RECV_ANYTHING_SEC   2
 
-// if the system time is off by more than this, it'll be just set, and not adjusted gradually
-#define TIME_SET_GRADUAL_MAX_USEC   1000000
+#define UART_RX_BUF_SIZE            1024    // ~45 ms of data at 230400 baud
+#define GPS_BAUD_RATE               230400
+#define NAV_RATE_MAX                5       // Hz, the Neo-6 can't do more
+// the uart driver posts UART_DATA when this many bytes are in the rx fifo, or after this many char times of silence
+// (the defaults of uart_driver_install())
+#define UART_RXFIFO_FULL_THRESH     120
+#define UART_RX_TOUT_THRESH         10
+#define UART_CHAR_NS                (10 * 1000000000LL / GPS_BAUD_RATE) // 8n1 is 10 bits per char
+#define STATS_PERIOD_SEC            60
+
+// fix quality thresholds, may be overridden in the nvs
+#define ACC_OK_M                    25      // the fix is good if its hAcc is within this
+#define ACC_MAX_M                   200     // beyond this it's not even coarse, it's dropped
+#define DOP_MAX                     50      // * 0.1, the fix is coarse if its hDOP is above this
 
 static SemaphoreHandle_t sem_running = NULL;
+// the commands come from both the gps and the lrep task, their bytes mustn't be interleaved on the uart
+static SemaphoreHandle_t tx_mutex = NULL;
 static bool keep_running = false;
+static bool power_save = false;
+static uint16_t nav_rate = 1; // Hz
+static uint32_t acc_ok_mm = ACC_OK_M * 1000, acc_max_mm = ACC_MAX_M * 1000;
+static uint16_t dop_max = DOP_MAX * 10; // * 0.01, as in the UBX messages
+static gps_stats_t stats;
+static uint32_t latency_sum_us, latency_max_us, latency_n; // in the current stats period
+static uint32_t last_iTOW;
+static bool has_last_iTOW;
 gps_fix_t gps_fix;
 gps_status_t gps_status;
 const char* gps_status_names[] = {
@@ -51,8 +79,13 @@ static QueueHandle_t uart0_queue;
 
 static int baud_rates[] = { 9600, 230400, /* 38400, 57600, 115200, */ }; // possible baud rates that may initially happen
 
-static uint8_t buf[BUF_SIZE + 1], *wr = buf;
-static struct timeval recv_tv;
+static uint8_t buf[BUF_SIZE];
+static gps_framer_t framer;
+static gps_kalman_t kalman;
+static int64_t recv_us; // esp_timer, when the last uart event was taken from the queue
+static int64_t frame_us; // esp_timer, when the first byte of the current frame arrived
+static uint32_t time_iTOW; // of the last valid NAV-TIMEUTC, for the utc time of the other messages
+static bool has_time_iTOW;
 
 #ifdef USE_NMEA
 static time_t last_GPRMC_time;
@@ -62,19 +95,61 @@ static time_t last_GPRMC_time;
 static time_t last_NAV_POSLLH_time;
 static time_t last_NAV_TIMEUTC_time;
 static time_t last_NAV_VELNED_time;
+static time_t last_NAV_SOL_time;
+static time_t last_NAV_DOP_time;
+
+// the position of the epoch, waiting for its quality in NAV-DOP and NAV-SOL, then for its velocity in NAV-VELNED
+static struct {
+    bool valid;
+    uint32_t iTOW;
+    int32_t lat, lon;
+    uint32_t hAcc;          // mm
+    int64_t rx_us;
+    bool has_dop;
+    uint16_t hDOP, pDOP;    // * 0.01
+    // accepted by NAV-SOL, to be published when the velocity of the epoch is in the filter as well
+    bool ready;
+    bool coarse;
+    uint64_t fix_usec;
+} epoch;
+static uint32_t vel_iTOW; // of the last NAV-VELNED
+static bool has_vel_iTOW;
 #endif // USE_UBX
 
 
 static void got_ACK(bool is_ack, uint8_t clsID, uint8_t msgID);
 
+#ifdef USE_AGPS
+// the AGPS messages are sent at most this many ahead of their acks
+#define AGPS_WINDOW                 4
+#define AGPS_ACK_TIMEOUT_MS         1000
+// without acks: the time the receiver needs to process one AID message after it has been sent out
+#define AGPS_GAP_MS                 20
+
+typedef struct {
+    uint8_t cls, id;
+    bool is_ack;
+} ubx_ack_t;
+
+// the acks for the AGPS injection, from the gps task to the one that does the injection
+static QueueHandle_t ack_queue = NULL;
+#endif // USE_AGPS
+
 static esp_err_t
 send_ubx(const uint8_t *msg, unsigned int timeout_ms) {
     size_t len = 8 + le16dec(msg + 4);
-    ESP_LOGV(TAG, "Sending UBX %d bytes", len);
+    ESP_LOGV(TAG, "Sending UBX %d bytes", (int)len);
     hexdump(msg, len);
+    // NOTE: only the write is locked, not any wait for an ack, as the acks are received by the gps task
+    if (tx_mutex) {
+        xSemaphoreTake(tx_mutex, portMAX_DELAY);
+    }
     int res = uart_write_bytes(UART_NUM_0, msg, len);
+    if (tx_mutex) {
+        xSemaphoreGive(tx_mutex);
+    }
     if (res != len) {
-        ESP_LOGE(TAG, "Failed to send complete message, sent=%d, len=%d", res, len);
+        ESP_LOGE(TAG, "Failed to send complete message, sent=%d, len=%d", res, (int)len);
         return ESP_FAIL;
     }
     /*if (msg[2] == 0x0b) { // AID-* generates no ACK -> fake it
@@ -91,14 +166,77 @@ send_ubx(const uint8_t *msg, unsigned int timeout_ms) {
 }
 
 
+// assemble an UBX message with checksum and send it
+static esp_err_t
+send_ubx_msg(uint8_t cls, uint8_t id, const uint8_t *payload, uint16_t payload_len, unsigned int timeout_ms) {
+    uint8_t msg[8 + 64];
+    if (payload_len > (sizeof(msg) - 8)) {
+        ESP_LOGE(TAG, "UBX payload too long: %u", payload_len);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    msg[0] = 0xb5;
+    msg[1] = 0x62;
+    msg[2] = cls;
+    msg[3] = id;
+    le16enc(msg + 4, payload_len);
+    memcpy(msg + 6, payload, payload_len);
+    uint8_t ck_a = 0, ck_b = 0;
+    for (size_t i = 2; i < (6 + payload_len); ++i) {
+        ck_a += msg[i];
+        ck_b += ck_a;
+    }
+    msg[6 + payload_len] = ck_a;
+    msg[7 + payload_len] = ck_b;
+    return send_ubx(msg, timeout_ms);
+}
+
+
 static void
 process_new_fix(void) {
-    ESP_LOGD(TAG, "New fix; lat=%f, lng=%f, spd=%f, azm=%f", gps_fix.latitude, gps_fix.longitude, gps_fix.speed_kph, gps_fix.azimuth);
+    ESP_LOGD(TAG, "New fix; lat=%d, lng=%d, spd=%u, azm=%d", gps_fix.lat, gps_fix.lon, gps_fix.speed, gps_fix.heading);
+
+    // from the first byte of the position until the fix is published
+    gps_fix.pub_us = esp_timer_get_time();
+    uint32_t latency_us = gps_fix.pub_us - gps_fix.rx_us;
+    ++stats.fixes;
+    latency_sum_us += latency_us;
+    ++latency_n;
+    if (latency_us > latency_max_us) {
+        latency_max_us = latency_us;
+    }
+
+    // the last thing, so a waiter that wakes up on it sees the complete fix
     xEventGroupSetBits(main_event_group, GOT_GPS_FIX_BIT);
     //xEventGroupClearBits(main_event_group, GOT_GPS_FIX_BIT);
 }
 
 
+// count the navigation epochs that were lost on the way, by the gaps in their iTOW
+static void
+check_epoch(uint32_t iTOW) {
+    uint32_t period = 1000 / nav_rate;
+    if (has_last_iTOW && (iTOW > last_iTOW)) {
+        uint32_t missed = (iTOW - last_iTOW + period / 2) / period - 1;
+        stats.dropped += missed;
+    }
+    last_iTOW = iTOW;
+    has_last_iTOW = true;
+}
+
+
+static void
+log_stats(void) {
+    stats.bad_frames = framer.ck_errors + framer.oversized;
+    stats.latency_avg_us = latency_n ? (latency_sum_us / latency_n) : 0;
+    stats.latency_max_us = latency_max_us;
+    ESP_LOGI(TAG, "Stats: rate=%u Hz, fixes=%u, coarse=%u, poor=%u, dropped=%u, uart_overflows=%u, bad_frames=%u, latency avg=%u us, max=%u us",
+        nav_rate, stats.fixes, stats.coarse_fixes, stats.poor_fixes, stats.dropped, stats.uart_overflows, stats.bad_frames,
+        stats.latency_avg_us, stats.latency_max_us);
+    ESP_LOGI(TAG, "Filter: updates=%u, rejected=%u, resets=%u, holds=%u", kalman.updates, kalman.rejected, kalman.resets, kalman.holds);
+    latency_sum_us = latency_max_us = latency_n = 0;
+}
+
+
 static bool
 process_new_time(uint64_t time_usec) {
     if ((time_usec / 1e6) <= source_date_epoch) {
@@ -112,71 +250,12 @@ process_new_time(uint64_t time_usec) {
         return false;
     }
 
-    bool systime_changed = false;
-
     gps_fix.time_usec = time_usec;
     ESP_LOGD(TAG, "New time %lu", (unsigned long)(time_usec / 1e6));
 
-#ifdef TIME_DRIFT_STATS
-    static int64_t drift_total = 0;
-    static int drift_n = 0;
-    static int drift_max = 0, drift_min = 0;
-#endif // TIME_DRIFT_STATS
-
-    static int current_freq = 160;
-
-    int64_t recv_usec = ((int64_t)recv_tv.tv_sec) * 1000000ULL + recv_tv.tv_usec;
-    int64_t delta_usec = ((int64_t)time_usec) - recv_usec;
-
-    if ((delta_usec < -TIME_SET_GRADUAL_MAX_USEC) || (TIME_SET_GRADUAL_MAX_USEC < delta_usec)) {
-        struct timeval tv;
-        gettimeofday(&tv, NULL);
-
-        tv.tv_sec += delta_usec / 1000000L;
-        tv.tv_usec += delta_usec % 1000000L;
-
-        if (tv.tv_usec < 0) {
-            tv.tv_usec += 1000000;
-            --tv.tv_sec;
-        }
-        else if (1000000 <= tv.tv_usec) {
-            tv.tv_usec -= 1000000;
-            ++tv.tv_sec;
-        }
-
-        settimeofday(&tv, NULL);
-        ESP_LOGI(TAG, "System time set to %lu (delta_usec=%f)", tv.tv_sec, (double)delta_usec);
-        systime_changed = true;
-    }
-    else {
-        int freq;
-        if (delta_usec > 500) {
-            freq = 159;
-        }
-        else if (delta_usec < -500) {
-            freq = 161;
-        }
-        else {
-            freq = 160;
-        }
-        if (freq != current_freq) {
-            current_freq = freq;
-            ets_update_cpu_frequency(freq);
-        }
-
-#ifdef TIME_DRIFT_STATS
-        drift_total += delta_usec;
-        drift_n++;
-        if (delta_usec > drift_max) {
-            drift_max = delta_usec;
-        }
-        if (delta_usec < drift_min) {
-            drift_min = delta_usec;
-        }
-        ESP_LOGD(TAG, "Drift stat, dt=%.0lf, drift=%.lf, avg_drift=[%d..%lf..%d], n=%d", (double)time_usec, (double)delta_usec, drift_min, (double)drift_total/drift_n, drift_max, drift_n);
-#endif // TIME_DRIFT_STATS
+    // the message was valid when its first byte arrived
+    bool systime_changed = clock_sync_sample(time_usec, frame_us);
 
-    }
     xEventGroupSetBits(main_event_group, GOT_GPS_TIME_BIT);
     //xEventGroupClearBits(main_event_group, GOT_GPS_TIME_BIT);
     return systime_changed;
@@ -208,20 +287,52 @@ enable_NAV_VELNED(void) {
 
 static void
 enable_NAV_TIMEUTC(void) {
-    send_ubx("\xb5\x62\x06\x01\x03\x00\x01\x21\x01\x2d\x85", TIMEOUT_SEND_CMD_MS); // enable NAV-TIMEUTC
+    uint8_t msg[3] = { 0x01, 0x21, nav_rate }; // only once a second, as it's for the clock only
+    send_ubx_msg(0x06, 0x01, msg, sizeof(msg), TIMEOUT_SEND_CMD_MS); // enable NAV-TIMEUTC
     time(&last_NAV_TIMEUTC_time);
     gps_status = GPS_INIT;
 }
+
+static void
+enable_NAV_SOL(void) {
+    uint8_t msg[3] = { 0x01, 0x06, 1 };
+    send_ubx_msg(0x06, 0x01, msg, sizeof(msg), TIMEOUT_SEND_CMD_MS); // enable NAV-SOL
+    time(&last_NAV_SOL_time);
+    gps_status = GPS_INIT;
+}
+
+static void
+enable_NAV_DOP(void) {
+    uint8_t msg[3] = { 0x01, 0x04, 1 };
+    send_ubx_msg(0x06, 0x01, msg, sizeof(msg), TIMEOUT_SEND_CMD_MS); // enable NAV-DOP
+    time(&last_NAV_DOP_time);
+    gps_status = GPS_INIT;
+}
 #endif // !USE_UBX
 
+// set port1 to 230400,8n1, and at higher nav rates output only UBX, as there is no bandwidth to waste on NMEA
+static void
+config_port(void) {
+    uint8_t prt[20] = { 0x01 }; // portID
+    le32enc(prt + 4, 0x000008c0); // mode: 8n1
+    le32enc(prt + 8, GPS_BAUD_RATE);
+    le16enc(prt + 12, 0x0003); // inProtoMask: UBX + NMEA
+    le16enc(prt + 14, (nav_rate > 1) ? 0x0001 : 0x0003); // outProtoMask
+    send_ubx_msg(0x06, 0x00, prt, sizeof(prt), TIMEOUT_SEND_CMD_MS); // CFG-PRT
+}
+
+
 static void
 reinit_gps(void) {
     gps_status = GPS_INIT;
+    has_last_iTOW = false;
+    has_time_iTOW = false;
+    gps_kalman_init(&kalman);
     for (int baud_rate_idx = 0; baud_rate_idx < (sizeof(baud_rates) / sizeof(baud_rates[0])); ++baud_rate_idx) {
         ESP_LOGI(TAG, "Setting baud rate %d", baud_rates[baud_rate_idx]);
         uart_flush_input(UART_NUM_0);
         uart_set_baudrate(UART_NUM_0, baud_rates[baud_rate_idx]);
-        send_ubx("\xb5\x62\x06\x00\x14\x00\x01\x00\x00\x00\xc0\x08\x00\x00\x00\x84\x03\x00\x03\x00\x03\x00\x00\x00\x00\x00\x70\xc8", TIMEOUT_SEND_CMD_MS); // set port1 to 230400,8n1
+        config_port();
         // send_ubx("\xb5\x62\x06\x00\x14\x00\x01\x00\x00\x00\xc0\x08\x00\x00\x80\x25\x00\x00\x03\x00\x03\x00\x00\x00\x00\x00\x8e\x95", TIMEOUT_SEND_CMD_MS); // set port1 to 9600,8n1
         // send_ubx("\xb5\x62\x06\x00\x14\x00\x01\x00\x00\x00\xc0\x08\x00\x00\x00\x96\x00\x00\x03\x00\x03\x00\x00\x00\x00\x00\x7f\x70", TIMEOUT_SEND_CMD_MS); // set port1 to 34800,8n1
         // send_ubx("\xb5\x62\x06\x00\x14\x00\x01\x00\x00\x00\xc0\x08\x00\x00\x00\xe1\x00\x00\x03\x00\x03\x00\x00\x00\x00\x00\xca\xa9", TIMEOUT_SEND_CMD_MS); // set port1 to 57600,8n1
@@ -231,15 +342,37 @@ reinit_gps(void) {
     enable_GPRMC();
 #endif // USE_NMEA
 
+    {
+        uint8_t rate[6];
+        le16enc(rate + 0, 1000 / nav_rate); // measRate, ms
+        le16enc(rate + 2, 1); // navRate, cycles
+        le16enc(rate + 4, 1); // timeRef: GPS time
+        send_ubx_msg(0x06, 0x08, rate, sizeof(rate), TIMEOUT_SEND_CMD_MS); // CFG-RATE
+    }
+
 #ifdef USE_UBX
+    epoch.valid = epoch.ready = false;
+    has_vel_iTOW = false;
     enable_NAV_POSLLH();
     enable_NAV_VELNED();
     enable_NAV_TIMEUTC();
+    enable_NAV_SOL();
+    enable_NAV_DOP();
 #endif // !USE_UBX
-}
 
+    // power save mode parameters, used only when it gets enabled by CFG-RXM
+    {
+        uint8_t pm2[44] = { 0x01 }; // version
+        le32enc(pm2 + 4, (1 << 17) | (1 << 12) | (1 << 8)); // flags: cyclic tracking, update ephemeris, limit peak current
+        le32enc(pm2 + 8, 1000); // updatePeriod, ms: keep the 1 Hz nav messages coming
+        le32enc(pm2 + 12, 10000); // searchPeriod, ms
+        send_ubx_msg(0x06, 0x3b, pm2, sizeof(pm2), TIMEOUT_SEND_CMD_MS); // CFG-PM2
+    }
+    gps_set_power_save(power_save);
+}
 
 
+#ifdef USE_NMEA
 static bool
 split_by_comma(char *msg, char **field, int last_idx) {
     for (int idx = 0; idx <= last_idx; ++idx) {
@@ -260,11 +393,46 @@ split_by_comma(char *msg, char **field, int last_idx) {
 }
 
 
-#ifdef USE_NMEA
+// parse a "dddmm.mmmmm" coordinate into deg * 1e7
+static bool
+parse_coord(const char *s, int deg_digits, int32_t *result) {
+    int32_t deg = 0, min_e5 = 0;
+    for (int i = 0; i < deg_digits; ++i, ++s) {
+        if (!isdigit((unsigned char)*s)) {
+            return false;
+        }
+        deg = 10 * deg + (*s - '0');
+    }
+    for (int i = 0; i < 2; ++i, ++s) {
+        if (!isdigit((unsigned char)*s)) {
+            return false;
+        }
+        min_e5 = 10 * min_e5 + (*s - '0');
+    }
+    int frac_digits = 0;
+    if (*s == '.') {
+        for (++s; isdigit((unsigned char)*s); ++s) {
+            if (frac_digits < 5) {
+                min_e5 = 10 * min_e5 + (*s - '0');
+                ++frac_digits;
+            }
+        }
+    }
+    for (; frac_digits < 5; ++frac_digits) {
+        min_e5 *= 10;
+    }
+    // minutes * 1e5 -> deg * 1e7 is * 100 / 60
+    *result = deg * 10000000 + (min_e5 * 5 + 1) / 3;
+    return true;
+}
+
+
 static bool
 got_GPRMC(char *msg) {
     char * field[13];
-    float latitude, longitude, speed_kph, azimuth;
+    int32_t lat, lon, heading;
+    uint32_t speed;
+    float f;
 
     ESP_LOGV(TAG, "%s", msg);
     if (!split_by_comma(msg, field, 12)) {
@@ -290,47 +458,46 @@ got_GPRMC(char *msg) {
     }
 
     // parse the location
-    int degree;
-    float minute;
-    if (2 == sscanf(field[3], "%02d%f", &degree, &minute)) {
-        latitude = degree + (minute / 60.0);
+    if (parse_coord(field[3], 2, &lat)) {
         if (field[4][0] == 'S')
-            latitude = -latitude;
+            lat = -lat;
         gps_status = GPS_OK;
     }
     else {
-        latitude = gps_fix.latitude;
+        lat = gps_fix.lat;
     }
-    if (2 == sscanf(field[5], "%03d%f", &degree, &minute)) {
-        longitude = degree + (minute / 60.0);
+    if (parse_coord(field[5], 3, &lon)) {
         if (field[6][0] == 'W')
-            longitude = -longitude;
+            lon = -lon;
         gps_status = GPS_OK;
     }
     else {
-        longitude = gps_fix.longitude;
+        lon = gps_fix.lon;
     }
 
     // parse speed
-    if (1 == sscanf(field[7], "%f", &speed_kph)) {
-        speed_kph *= 1.852; // knots to kph. don't... please just don't. i also would've preferred earth radius per lunar phase cycle as a speed unit...
+    if (1 == sscanf(field[7], "%f", &f)) {
+        speed = f * 514.444f; // knots to mm/s. don't... please just don't. i also would've preferred earth radius per lunar phase cycle as a speed unit...
     }
     else {
-        speed_kph = gps_fix.speed_kph;
+        speed = gps_fix.speed;
     }
 
     // parse azimuth
-    if (1 != sscanf(field[8], "%f", &azimuth)) {
+    if (1 == sscanf(field[8], "%f", &f)) {
+        heading = f * 1e5f;
+    }
+    else {
         // valid if missing (eg. when standing still), use the last one in this case
-        azimuth = gps_fix.azimuth;
+        heading = gps_fix.heading;
     }
 
     if (is_valid) {
         taskENTER_CRITICAL();
-        gps_fix.latitude  = latitude;
-        gps_fix.longitude = longitude;
-        gps_fix.speed_kph = speed_kph;
-        gps_fix.azimuth   = azimuth;
+        gps_fix.lat     = lat;
+        gps_fix.lon     = lon;
+        gps_fix.speed   = speed;
+        gps_fix.heading = heading;
         taskEXIT_CRITICAL();
         process_new_fix();
     }
@@ -394,6 +561,28 @@ got_nmea(const uint8_t *msg, size_t len) {
 
 
 #ifdef USE_UBX
+// the fix of the epoch from the filter, with the position and the velocity of the epoch both in it
+static void
+publish_epoch(void) {
+    epoch.ready = false;
+    int32_t lat, lon;
+    uint32_t speed;
+    int32_t heading;
+    gps_kalman_get(&kalman, &lat, &lon, &speed, &heading);
+    taskENTER_CRITICAL();
+    gps_fix.lat = lat;
+    gps_fix.lon = lon;
+    gps_fix.speed = speed;
+    gps_fix.heading = heading;
+    gps_fix.acc = epoch.hAcc;
+    gps_fix.coarse = epoch.coarse;
+    gps_fix.fix_usec = epoch.fix_usec;
+    gps_fix.rx_us = epoch.rx_us;
+    taskEXIT_CRITICAL();
+    process_new_fix();
+}
+
+
 static void
 got_NAV_POSLLH(const uint8_t *payload) {
     uint32_t iTOW   = le32dec(payload +  0);
@@ -405,22 +594,101 @@ got_NAV_POSLLH(const uint8_t *payload) {
     uint32_t vAcc   = le32dec(payload + 24);
     ESP_LOGV(TAG, "NAV-POSLLH iTOW=%u, lon=%d, lat=%d, height=%d, hMSL=%d, hAcc=%u, vAcc=%u",
         iTOW, lon, lat, height, hMSL, hAcc, vAcc);
+    check_epoch(iTOW);
+    if (epoch.ready) {
+        // the NAV-VELNED of the last epoch was lost, it won't get any better
+        publish_epoch();
+    }
 
-    if (hAcc < 0xffffffff) { // mm
-        gps_status = (hAcc < 1000000) ? GPS_OK : GPS_COARSE;
-        taskENTER_CRITICAL();
-        gps_fix.latitude  = lat * 1e-7;
-        gps_fix.longitude = lon * 1e-7;
-        taskEXIT_CRITICAL();
-        process_new_fix();
+    // it's judged by NAV-SOL, and published when both it and NAV-VELNED of the epoch are in, whichever comes last
+    epoch.valid = (hAcc < 0xffffffff);
+    epoch.iTOW = iTOW;
+    epoch.lat = lat;
+    epoch.lon = lon;
+    epoch.hAcc = hAcc;
+    epoch.rx_us = frame_us;
+    epoch.has_dop = false;
+    time(&last_NAV_POSLLH_time);
+}
+
+
+static void
+got_NAV_DOP(const uint8_t *payload) {
+    uint32_t iTOW   = le32dec(payload +  0);
+    uint16_t pDOP   = le16dec(payload +  6);
+    uint16_t hDOP   = le16dec(payload + 12);
+    ESP_LOGV(TAG, "NAV-DOP iTOW=%u, pDOP=%u, hDOP=%u", iTOW, pDOP, hDOP);
+
+    if (epoch.iTOW == iTOW) {
+        epoch.has_dop = true;
+        epoch.hDOP = hDOP;
+        epoch.pDOP = pDOP;
     }
-    else if (gps_status >= GPS_TIME) {
-        gps_status = GPS_TIME;
+    time(&last_NAV_DOP_time);
+}
+
+
+static void
+got_NAV_SOL(const uint8_t *payload) {
+    uint32_t iTOW   = le32dec(payload +  0);
+    uint8_t  gpsFix = payload[10];
+    uint8_t  flags  = payload[11];
+    uint32_t pAcc   = le32dec(payload + 24);
+    uint16_t pDOP   = le16dec(payload + 44);
+    uint8_t  numSV  = payload[47];
+    ESP_LOGV(TAG, "NAV-SOL iTOW=%u, gpsFix=%u, flags=0x%02x, pAcc=%u, pDOP=%u, numSV=%u", iTOW, gpsFix, flags, pAcc, pDOP, numSV);
+    time(&last_NAV_SOL_time);
+
+    if (!epoch.valid || (epoch.iTOW != iTOW)) {
+        // no position in this epoch
+        if (gps_status >= GPS_TIME) {
+            gps_status = GPS_TIME;
+        }
+        else {
+            gps_status = GPS_NOFIX;
+        }
+        return;
     }
-    else {
-        gps_status = GPS_NOFIX;
+    epoch.valid = false;
+
+    // 2D, 3D or GPS + dead reckoning, and within the DOP and accuracy masks
+    bool fix_ok = (flags & 0x01) && (2 <= gpsFix) && (gpsFix <= 4);
+    uint16_t dop = epoch.has_dop ? epoch.hDOP : pDOP;
+    if (!fix_ok) {
+        // no position after all, only the time (if that)
+        ESP_LOGD(TAG, "No fix; gpsFix=%u, flags=0x%02x, numSV=%u", gpsFix, flags, numSV);
+        gps_status = (gps_status >= GPS_TIME) ? GPS_TIME : GPS_NOFIX;
+        return;
+    }
+    if (epoch.hAcc > acc_max_mm) {
+        ESP_LOGD(TAG, "Fix dropped; gpsFix=%u, hAcc=%u, dop=%u, numSV=%u", gpsFix, epoch.hAcc, dop, numSV);
+        gps_status = GPS_COARSE;
+        ++stats.poor_fixes;
+        return;
+    }
+    bool coarse = (epoch.hAcc > acc_ok_mm) || (dop > dop_max);
+    gps_status = coarse ? GPS_COARSE : GPS_OK;
+    if (coarse) {
+        ++stats.coarse_fixes;
+    }
+
+    uint64_t fix_usec = 0;
+    int32_t since_time_ms = iTOW - time_iTOW;
+    if (has_time_iTOW && (-60000 < since_time_ms) && (since_time_ms < 60000)) {
+        fix_usec = gps_fix.time_usec + 1000LL * since_time_ms;
+    }
+    // smoothed, and held still while standing; a diluted fix counts less than its hAcc would say
+    uint32_t hAcc = epoch.hAcc;
+    if (dop > dop_max) {
+        hAcc = (uint64_t)hAcc * dop / dop_max;
+    }
+    gps_kalman_position(&kalman, iTOW, epoch.lat, epoch.lon, hAcc);
+    epoch.ready = true;
+    epoch.coarse = coarse;
+    epoch.fix_usec = fix_usec;
+    if (has_vel_iTOW && (vel_iTOW == iTOW)) {
+        publish_epoch();
     }
-    time(&last_NAV_POSLLH_time);
 }
 
 
@@ -453,7 +721,14 @@ got_NAV_TIMEUTC(const uint8_t *payload) {
             .tm_isdst = 0,
         };
         time_t time_sec = timegm(&dt);
-        if (process_new_time((1000000ULL * time_sec) + (nano / 1000))) {
+        uint64_t time_usec = (1000000ULL * time_sec) + (nano / 1000);
+        bool systime_changed = process_new_time(time_usec);
+        if (gps_fix.time_usec == time_usec) {
+            // accepted
+            time_iTOW = iTOW;
+            has_time_iTOW = true;
+        }
+        if (systime_changed) {
             time(&last_NAV_POSLLH_time);
             time(&last_NAV_VELNED_time);
         }
@@ -480,12 +755,15 @@ got_NAV_VELNED(const uint8_t *payload) {
         if (gps_status < GPS_NOFIX) {
             gps_status = GPS_NOFIX;
         }
-        float speed_kph = speed * 0.036; // cm/s to km/h
-        float azimuth = heading * 1e-5;
-        taskENTER_CRITICAL();
-        gps_fix.speed_kph = speed_kph;
-        gps_fix.azimuth   = azimuth;
-        taskEXIT_CRITICAL();
+    }
+    if (sAcc < 1000) {
+        // the speed and heading of the fix come from the filter, cAcc doesn't matter for the velocity vector
+        gps_kalman_velocity(&kalman, iTOW, velN, velE, sAcc);
+    }
+    vel_iTOW = iTOW;
+    has_vel_iTOW = true;
+    if (epoch.ready && (epoch.iTOW == iTOW)) {
+        publish_epoch();
     }
     time(&last_NAV_VELNED_time);
 }
@@ -499,27 +777,23 @@ got_ACK(bool is_ack, uint8_t clsID, uint8_t msgID) {
     else {
         ESP_LOGW(TAG, "UBX ACK-NAK for %02x,%02x", clsID, msgID);
     }
+#ifdef USE_AGPS
+    if (ack_queue && ((clsID == 0x0b) || ((clsID == 0x06) && (msgID == 0x24)))) { // AID-* or CFG-NAVX5
+        ubx_ack_t ack = { .cls = clsID, .id = msgID, .is_ack = is_ack };
+        xQueueSend(ack_queue, &ack, 0);
+    }
+#endif // USE_AGPS
 }
 
 static int
 got_ubx(const uint8_t *msg, size_t payload_len) {
     void
     dump_generic(void) {
-        ESP_LOGV(TAG, "UBX: class=0x%02x, id=0x%02x, payload_len=0x%04x", msg[2], msg[3], payload_len);
+        ESP_LOGV(TAG, "UBX: class=0x%02x, id=0x%02x, payload_len=0x%04x", msg[2], msg[3], (unsigned)payload_len);
         hexdump(msg + 6, payload_len);
     }
 
-    uint8_t ck_a = 0, ck_b = 0;
-    for (int i = 2; i < (payload_len + 6); ++i) {
-           ck_a = ck_a + msg[i];
-           ck_b = ck_b + ck_a;
-    }
-    if ((msg[payload_len + 6] != ck_a) || (msg[payload_len + 7] != ck_b)) {
-        ESP_LOGW(TAG, "UBX checksum error: is=[%02x, %02x], shouldbe=[%02x, %02x]", msg[payload_len + 6], msg[payload_len + 7], ck_a, ck_b);
-        dump_generic();
-        return false;
-    }
-
+    // NOTE: the checksum has already been checked by the framer
     switch (msg[2]) {
         case 0x05: // ACK-*
             got_ACK(msg[3] == 0x01, msg[6], msg[7]);
@@ -532,6 +806,20 @@ got_ubx(const uint8_t *msg, size_t payload_len) {
                     got_NAV_POSLLH(msg + 6);
 #else
                     send_ubx("\xb5\x62\x06\x01\x03\x00\x01\x02\x00\x0d\x46", 0); // disable NAV-POSLLH
+#endif // USE_UBX
+                    break;
+                case 0x04:
+#ifdef USE_UBX
+                    got_NAV_DOP(msg + 6);
+#else
+                    send_ubx("\xb5\x62\x06\x01\x03\x00\x01\x04\x00\x0f\x4a", 0); // disable NAV-DOP
+#endif // USE_UBX
+                    break;
+                case 0x06:
+#ifdef USE_UBX
+                    got_NAV_SOL(msg + 6);
+#else
+                    send_ubx("\xb5\x62\x06\x01\x03\x00\x01\x06\x00\x11\x4e", 0); // disable NAV-SOL
 #endif // USE_UBX
                     break;
                 case 0x12:
@@ -566,92 +854,50 @@ static void
 got_data(size_t available) {
     //ESP_LOGV(TAG, "UART_DATA %d bytes", available);
 
-    while (available > 0) {
+    // the event may have waited in the queue for the task: the bytes that have arrived since then are already in the
+    // ring buffer, after the ones of this event, and they came one char time apart, so the last of this event arrived at
+    // least that long before now
+    size_t buffered = 0;
+    uart_get_buffered_data_len(UART_NUM_0, &buffered);
+    size_t later = (buffered > available) ? (buffered - available) : 0;
 
-        size_t rdlen =  buf + BUF_SIZE - wr;
-        if (rdlen == 0) {
-            ESP_LOGE(TAG, "Buffer overflow");
-            hexdump(buf, BUF_SIZE);
-            wr = buf;
-            rdlen = BUF_SIZE;
-        }
+    // the arrival of the bytes is modelled backwards from that: the event is posted either on the fifo threshold, when
+    // the last byte has just arrived, or on the rx timeout, some char times after it, and the bytes came one char time
+    // apart
+    int64_t last_ns = recv_us * 1000 - later * UART_CHAR_NS -
+        ((available < UART_RXFIFO_FULL_THRESH) ? (UART_RX_TOUT_THRESH * UART_CHAR_NS) : 0);
+    size_t after = available; // the number of bytes that arrived after the current one
 
-        if (rdlen > available) {
-            rdlen = available;
+    while (available > 0) {
+        size_t rdlen = (available < BUF_SIZE) ? available : BUF_SIZE;
+        int res = uart_read_bytes(UART_NUM_0, buf, rdlen, portMAX_DELAY);
+        if (res <= 0) {
+            ESP_LOGE(TAG, "Failed to read UART: %d", res);
+            return;
         }
-
-        // read some
-        //ESP_LOGV(TAG, "Reading max 0x%x to 0x%x", rdlen, wr - buf);
-        uart_read_bytes(UART_NUM_0, wr, rdlen, portMAX_DELAY);
-        wr += rdlen;
-        available -= rdlen;
-        //hexdump(buf, wr - buf);
-
-        // process it
-        uint8_t *rd = buf;
-        while (rd < wr) {
-            //ESP_LOGV(TAG, "Msg loop, wr=0x%x, rd=0x%x", wr - buf, rd - buf);
-            //hexdump(rd, wr - rd);
-
-            if (rd[0] == '$') { // nmea message at the beginning (may be incomplete/invalid)
-                uint8_t *pos_crlf = memmem(rd, wr - rd, "\r\n", 2);
-                if (pos_crlf == NULL) { // incomplete
-                    break;
-                }
-                // complete
-                *pos_crlf = 0;
-                got_nmea(rd, pos_crlf - rd);
-                rd = pos_crlf + 2;
-            }
-            else if ((rd[0] == 0xb5) && (rd[1] == 0x62)) { // ubx message at the beginning (may be incomplete/invalid)
-                if ((rd + 5) < wr) { // long enough to already contain the length field
-                    uint16_t m_len = le16dec(rd + 4);
-                    if ((rd + 8 + m_len) <= wr) { // complete
-                        got_ubx(rd, m_len);
-                        rd += 8 + m_len;
-                        continue;
-                    }
-                }
-                // incomplete
-                break;
+        available -= res;
+
+        // every byte is processed only once, the incomplete frame is kept in the framer
+        for (int i = 0; i < res; ++i) {
+            --after;
+            gps_frame_t frame = gps_framer_push(&framer, buf[i]);
+            if ((frame == GPS_FRAME_NONE) && (framer.len == 1)) {
+                // this byte has just started a frame
+                frame_us = (last_ns - after * UART_CHAR_NS) / 1000;
             }
-            else { // junk at the beginning
-                // try to find the beginning of a recognized message
-                uint8_t *pos_nmea = (uint8_t*)memchr(rd, '$', wr - rd);
-                uint8_t *pos_ubx = (uint8_t*)memmem(rd, wr - rd, "\xb5\x62", 2);
-
-                if (pos_nmea == NULL) {
-                    rd = pos_ubx;
-                }
-                else if (pos_ubx == NULL) {
-                    rd = pos_nmea;
-                }
-                else if (pos_ubx < pos_nmea) {
-                    rd = pos_ubx;
-                }
-                else {
-                    rd = pos_nmea;
-                }
+            switch (frame) {
+                case GPS_FRAME_NMEA:
+                    got_nmea(framer.buf, framer.len);
+                    break;
 
-                if (rd == NULL) { // all junk, skip it
-                    rd = wr;
+                case GPS_FRAME_UBX:
+                    got_ubx(framer.buf, framer.len - 8);
                     break;
-                }
-            }
-        } // while (rd < wr)
 
-        if (rd < wr) {
-            //ESP_LOGV(TAG, "Keeping incomplete 0x%x bytes", wr - rd);
-            if (rd != buf) {
-                memmove(buf, rd, wr - rd);
-                wr = buf + (wr - rd);
+                default:
+                    break;
             }
         }
-        else {
-            //ESP_LOGV(TAG, "All processed");
-            wr = buf;
-        }
-
     } // while (available > 0)
 }
 
@@ -659,12 +905,15 @@ got_data(size_t available) {
 static void
 uart_event_task(void *pvParameters) {
     xSemaphoreTake(sem_running, portMAX_DELAY);
-    esp_err_t res = uart_driver_install(UART_NUM_0, UART_FIFO_LEN + 1, 0, 100, &uart0_queue, 0);
+    esp_err_t res = uart_driver_install(UART_NUM_0, UART_RX_BUF_SIZE, 0, 100, &uart0_queue, 0);
     if (res != ESP_OK) {
         ESP_LOGE(TAG, "Failed to install uart driver: %d", res);
         goto install_failed;
     }
 
+    time_t last_stats_time;
+    time(&last_stats_time);
+    gps_framer_init(&framer);
     reinit_gps();
     ESP_LOGI(TAG, "Serial receiver start");
     for (keep_running = true; keep_running; ) {
@@ -678,19 +927,25 @@ uart_event_task(void *pvParameters) {
         else {
             switch (event.type) {
                 case UART_DATA:
-                    ESP_LOGD(TAG, "Got data: %d bytes", event.size);
-                    gettimeofday(&recv_tv, NULL);
+                    ESP_LOGD(TAG, "Got data: %d bytes", (int)event.size);
+                    recv_us = esp_timer_get_time();
                     got_data(event.size);
                     break;
 
                 case UART_FIFO_OVF:
                     ESP_LOGE(TAG, "Hw fifo overflow");
+                    ++stats.uart_overflows;
                     uart_flush_input(UART_NUM_0);
+                    // the rest of the frame in progress is gone
+                    gps_framer_reset(&framer);
                     continue;
 
                 case UART_BUFFER_FULL:
                     ESP_LOGE(TAG, "Ring buffer full");
+                    ++stats.uart_overflows;
                     uart_flush_input(UART_NUM_0);
+                    // the rest of the frame in progress is gone
+                    gps_framer_reset(&framer);
                     continue;
 
                 case UART_PARITY_ERR:
@@ -723,7 +978,17 @@ uart_event_task(void *pvParameters) {
                 if ((now - last_NAV_TIMEUTC_time) > TIMEOUT_RECV_ANYTHING_SEC) {
                     enable_NAV_TIMEUTC();
                 }
+                if ((now - last_NAV_SOL_time) > TIMEOUT_RECV_ANYTHING_SEC) {
+                    enable_NAV_SOL();
+                }
+                if ((now - last_NAV_DOP_time) > TIMEOUT_RECV_ANYTHING_SEC) {
+                    enable_NAV_DOP();
+                }
 #endif // USE_UBX
+                if ((now - last_stats_time) >= STATS_PERIOD_SEC) {
+                    log_stats();
+                    last_stats_time = now;
+                }
             }
         }
     }
@@ -739,6 +1004,9 @@ gps_start(void) {
         sem_running = xSemaphoreCreateBinary();
         xSemaphoreGive(sem_running);
     }
+    if (!tx_mutex) {
+        tx_mutex = xSemaphoreCreateMutex();
+    }
     uart_config_t uart_config = {
         .baud_rate = 9600,
         .data_bits = UART_DATA_8_BITS,
@@ -747,6 +1015,59 @@ gps_start(void) {
         .flow_ctrl = UART_HW_FLOWCTRL_DISABLE
     };
     uart_param_config(UART_NUM_0, &uart_config);
+
+    nvs_handle nvs;
+    if (nvs_open("gps", NVS_READONLY, &nvs) == ESP_OK) {
+        if ((nvs_get_u16(nvs, "rate", &nav_rate) != ESP_OK) || (nav_rate < 1)) {
+            nav_rate = 1;
+        }
+        else if (nav_rate > NAV_RATE_MAX) {
+            nav_rate = NAV_RATE_MAX;
+        }
+        // a zero would drop or dilute every fix, and dop_max is a divisor too; such values are ignored
+        uint16_t x;
+        if (nvs_get_u16(nvs, "acc_ok", &x) == ESP_OK) {
+            if (x > 0) {
+                acc_ok_mm = x * 1000;
+            }
+            else {
+                ESP_LOGW(TAG, "Invalid acc_ok=%u, using %u m", (unsigned)x, (unsigned)(acc_ok_mm / 1000));
+            }
+        }
+        if (nvs_get_u16(nvs, "acc_max", &x) == ESP_OK) {
+            if (x > 0) {
+                acc_max_mm = x * 1000;
+            }
+            else {
+                ESP_LOGW(TAG, "Invalid acc_max=%u, using %u m", (unsigned)x, (unsigned)(acc_max_mm / 1000));
+            }
+        }
+        if (acc_max_mm < acc_ok_mm) {
+            acc_max_mm = acc_ok_mm;
+        }
+        if (nvs_get_u16(nvs, "dop_max", &x) == ESP_OK) {
+            if (x > 0) {
+                // the DOPs of the UBX messages are 16 bits
+                dop_max = (x < (UINT16_MAX / 10)) ? (x * 10) : UINT16_MAX;
+            }
+            else {
+                ESP_LOGW(TAG, "Invalid dop_max=%u, using %u.%u", (unsigned)x, (unsigned)(dop_max / 100), (unsigned)(dop_max / 10 % 10));
+            }
+        }
+        nvs_close(nvs);
+    }
+    ESP_LOGI(TAG, "Navigation rate %u Hz", nav_rate);
+    ESP_LOGI(TAG, "Fix quality masks: acc_ok=%u m, acc_max=%u m, dop_max=%u.%02u", acc_ok_mm / 1000, acc_max_mm / 1000, dop_max / 100, dop_max % 100);
+    clock_sync_init();
+    if (nav_rate > 1) {
+        // the per-message logs would take more time than the processing itself
+        esp_log_level_set(TAG, ESP_LOG_INFO);
+    }
+#ifdef USE_AGPS
+    if (!ack_queue) {
+        ack_queue = xQueueCreate(2 * AGPS_WINDOW, sizeof(ubx_ack_t));
+    }
+#endif // USE_AGPS
     BaseType_t res = xTaskCreate(uart_event_task, "gps", 2048, NULL, 12, NULL);
     if (res != pdPASS) {
         ESP_LOGE(TAG, "Failed to create task; res=%d", res);
@@ -756,39 +1077,183 @@ gps_start(void) {
     return ESP_OK;
 }
 
+#ifdef USE_AGPS
+// wait for the next AID ack, false on timeout
+static bool
+agps_wait_ack(gps_agps_feeder_t *self, unsigned int timeout_ms) {
+    ubx_ack_t ack;
+    while (xQueueReceive(ack_queue, &ack, pdMS_TO_TICKS(timeout_ms))) {
+        if (ack.cls != 0x0b) {
+            continue;
+        }
+        if (!ack.is_ack) {
+            ++self->naks;
+        }
+        if (self->in_flight > 0) {
+            --self->in_flight;
+        }
+        return true;
+    }
+    return false;
+}
+
+
+static void
+agps_send(gps_agps_feeder_t *self, const uint8_t *msg) {
+    while (self->acked && (self->in_flight >= AGPS_WINDOW)) {
+        if (!agps_wait_ack(self, AGPS_ACK_TIMEOUT_MS)) {
+            // it claimed to support ackAiding, but doesn't ack: fall back to the timed pacing
+            ESP_LOGW(TAG, "No AGPS ack, %u in flight", (unsigned)self->in_flight);
+            self->acked = false;
+            self->in_flight = 0;
+        }
+    }
+    send_ubx(msg, TIMEOUT_SEND_CMD_MS);
+    if (self->acked) {
+        ++self->in_flight;
+    }
+    else {
+        vTaskDelay(pdMS_TO_TICKS(AGPS_GAP_MS));
+    }
+    ++self->count;
+}
+#endif // USE_AGPS
+
+
+void
+gps_agps_feed_init(gps_agps_feeder_t *self) {
+    self->len = 0;
+    self->offset = 0;
+    self->count = 0;
+    self->acked = false;
+    self->in_flight = self->naks = 0;
+    self->started = xTaskGetTickCount();
+#ifdef USE_AGPS
+    if (!ack_queue) {
+        return;
+    }
+    // ask for acks for the AID messages, only protocol version 15+ (u-blox 7 and up) can do that, the older ones NAK it
+    xQueueReset(ack_queue);
+    uint8_t navx5[40] = { 0x02, 0x00 }; // version
+    le16enc(navx5 + 2, 1 << 10); // mask1: only ackAid
+    navx5[17] = 1; // ackAiding
+    send_ubx_msg(0x06, 0x24, navx5, sizeof(navx5), TIMEOUT_SEND_CMD_MS); // CFG-NAVX5
+    ubx_ack_t ack;
+    while (xQueueReceive(ack_queue, &ack, pdMS_TO_TICKS(TIMEOUT_SEND_CMD_MS))) {
+        if ((ack.cls == 0x06) && (ack.id == 0x24)) {
+            self->acked = ack.is_ack;
+            break;
+        }
+    }
+    ESP_LOGI(TAG, "AGPS pacing by %s", self->acked ? "acks" : "time");
+#endif // USE_AGPS
+}
+
+
 esp_err_t
-gps_add_agps(const uint8_t *data, size_t datalen) {
+gps_agps_feed(gps_agps_feeder_t *self, const uint8_t *data, size_t datalen) {
     // NOTE: this is called from the lrep task
-    ESP_LOGI(TAG, "Processing AGPS data %d bytes", datalen);
-
 #ifdef USE_AGPS
-    // split data into UBX command list, only validate and count the commands first
-    const uint8_t *rd = data, *end = data + datalen;
-    while (rd < end) {
-        if (end < (rd + 8)) {
-            ESP_LOGE(TAG, "Incomplete UBX message at the end of AGPS data, offset=%u", rd - data);
-            return ESP_FAIL;
+    while (datalen > 0) {
+        if (self->len == 0) {
+            // at a message boundary: the messages that are complete in this chunk are sent right from there
+            if ((datalen >= 6) && ((data[0] != 0xb5) || (data[1] != 0x62))) {
+                ESP_LOGE(TAG, "Invalid UBX signature in AGPS data, offset=%u", (unsigned)self->offset);
+                return ESP_FAIL;
+            }
+            if (datalen >= 6) {
+                size_t m_len = 8 + le16dec(data + 4);
+                if (m_len <= datalen) {
+                    agps_send(self, data);
+                    data += m_len;
+                    datalen -= m_len;
+                    self->offset += m_len;
+                    continue;
+                }
+            }
+        }
+
+        // an incomplete message: collect it in the buffer
+        size_t need = (self->len < 6) ? (6 - self->len) : (8 + le16dec(self->buf + 4) - self->len);
+        if (need > datalen) {
+            need = datalen;
+        }
+        memcpy(self->buf + self->len, data, need);
+        self->len += need;
+        data += need;
+        datalen -= need;
+        if (self->len < 6) {
+            continue;
         }
-        if ((rd[0] != 0xb5) || (rd[1] != 0x62)) {
-            ESP_LOGE(TAG, "Invalid UBX signature in AGPS data, offset=%u", rd - data);
+        if ((self->buf[0] != 0xb5) || (self->buf[1] != 0x62)) {
+            ESP_LOGE(TAG, "Invalid UBX signature in AGPS data, offset=%u", (unsigned)self->offset);
             return ESP_FAIL;
         }
-        uint16_t m_len = le16dec(rd + 4);
-        if (end < (rd + 8 + m_len)) {
-            ESP_LOGE(TAG, "Incomplete UBX message at the end of AGPS data, offset=%u", rd - data);
+        size_t m_len = 8 + le16dec(self->buf + 4);
+        if (m_len > sizeof(self->buf)) {
+            ESP_LOGE(TAG, "Too long UBX message in AGPS data, offset=%u, len=%u", (unsigned)self->offset, (unsigned)m_len);
             return ESP_FAIL;
         }
+        if (self->len == m_len) {
+            agps_send(self, self->buf);
+            self->offset += m_len;
+            self->len = 0;
+        }
+    }
+#endif // USE_AGPS
+    return ESP_OK;
+}
 
-        send_ubx(rd, TIMEOUT_SEND_CMD_MS);
-        vTaskDelay(pdMS_TO_TICKS(500));
 
-        rd += 8 + m_len;
+esp_err_t
+gps_agps_feed_end(gps_agps_feeder_t *self) {
+    if (self->len > 0) {
+        ESP_LOGE(TAG, "Incomplete UBX message at the end of AGPS data, offset=%u", (unsigned)self->offset);
+        return ESP_FAIL;
+    }
+#ifdef USE_AGPS
+    while (self->acked && (self->in_flight > 0) && agps_wait_ack(self, AGPS_ACK_TIMEOUT_MS)) {
     }
-    ESP_LOGI(TAG, "AGPS data sent");
 #endif // USE_AGPS
+    ESP_LOGI(TAG, "AGPS data sent, %u messages, %u NAKs, %u ms", (unsigned)self->count, (unsigned)self->naks, (unsigned)((xTaskGetTickCount() - self->started) * portTICK_PERIOD_MS));
     return ESP_OK;
 }
 
+
+esp_err_t
+gps_add_agps(const uint8_t *data, size_t datalen) {
+    ESP_LOGI(TAG, "Processing AGPS data %d bytes", (int)datalen);
+    gps_agps_feeder_t feeder;
+    gps_agps_feed_init(&feeder);
+    esp_err_t res = gps_agps_feed(&feeder, data, datalen);
+    if (res != ESP_OK) {
+        return res;
+    }
+    return gps_agps_feed_end(&feeder);
+}
+
+esp_err_t
+gps_set_power_save(bool on) {
+    if (on && (nav_rate > 1)) {
+        // power save mode can't do more than 1 Hz
+        ESP_LOGD(TAG, "No power save at %u Hz", nav_rate);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    uint8_t rxm[2] = { 0x08, on ? 0x01 : 0x00 }; // reserved1, lpMode: 0 = continuous, 1 = power save
+    esp_err_t res = send_ubx_msg(0x06, 0x11, rxm, sizeof(rxm), TIMEOUT_SEND_CMD_MS); // CFG-RXM
+    if (res == ESP_OK) {
+        power_save = on;
+    }
+    return res;
+}
+
+void
+gps_get_stats(gps_stats_t *result) {
+    *result = stats;
+    result->bad_frames = framer.ck_errors + framer.oversized;
+}
+
+
 esp_err_t
 gps_stop(void) {
     if (keep_running) {
@@ -15,18 +15,62 @@ typedef enum {
     GPS_MAX
 } gps_status_t;
 
+// the units are the same as in the UBX messages, so no conversion is needed on the way from the receiver to the reports
 typedef struct {
-    uint64_t time_usec;
-    float latitude, longitude, speed_kph, azimuth;
+    uint64_t time_usec;     // utc, of the last NAV-TIMEUTC
+    uint64_t fix_usec;      // utc, of the position epoch, 0 if not known
+    int32_t lat, lon;       // deg * 1e7
+    uint32_t speed;         // mm/s
+    int32_t heading;        // deg * 1e5
+    uint32_t acc;           // mm, the hAcc of the receiver
+    bool coarse;            // beyond the accuracy or DOP thresholds, good only for a rough position
+    int64_t rx_us;          // esp_timer, when the first byte of the position arrived
+    int64_t pub_us;         // esp_timer, when the fix was published
 } gps_fix_t;
 
+// for display purposes only
+static inline float gps_fix_latitude(const gps_fix_t *self)  { return self->lat * 1e-7f; }
+static inline float gps_fix_longitude(const gps_fix_t *self) { return self->lon * 1e-7f; }
+static inline float gps_fix_speed_kph(const gps_fix_t *self) { return self->speed * 0.0036f; }
+static inline float gps_fix_azimuth(const gps_fix_t *self)   { return self->heading * 1e-5f; }
+
+typedef struct {
+    uint32_t fixes;
+    uint32_t coarse_fixes;      // of the fixes, how many were beyond the accuracy or DOP thresholds
+    uint32_t poor_fixes;        // not even published, as they were beyond the maximal inaccuracy
+    uint32_t dropped;           // navigation epochs that didn't get through
+    uint32_t uart_overflows;    // the uart buffers were full, data lost
+    uint32_t bad_frames;        // checksum errors and oversized frames
+    uint32_t latency_avg_us, latency_max_us; // from the first byte to the published fix, in the last stats period
+} gps_stats_t;
+
 extern gps_fix_t gps_fix;
 extern gps_status_t gps_status;
 extern const char* gps_status_names[];
 
 esp_err_t gps_start(void);
+// the longest AGPS message is AID-EPH with 104 bytes of payload
+#define GPS_AGPS_MSG_MAX    (8 + 104)
+
+// incremental AGPS processing: the data may be fed in chunks of any size, messages may straddle them
+typedef struct {
+    uint8_t buf[GPS_AGPS_MSG_MAX]; // the incomplete message at the end of the last chunk
+    size_t len;
+    size_t offset;  // of the message being processed, for the logs
+    size_t count;   // of the messages sent
+    bool acked;     // the receiver acks the AID messages (CFG-NAVX5 ackAiding), so they can be paced by that
+    size_t in_flight, naks;
+    uint32_t started; // ticks
+} gps_agps_feeder_t;
+
+void gps_agps_feed_init(gps_agps_feeder_t *self);
+esp_err_t gps_agps_feed(gps_agps_feeder_t *self, const uint8_t *data, size_t datalen);
+esp_err_t gps_agps_feed_end(gps_agps_feeder_t *self);
 esp_err_t gps_add_agps(const uint8_t *data, size_t datalen);
+// continuous tracking or the CFG-PM2 cyclic tracking, may be called from any task
+esp_err_t gps_set_power_save(bool on);
 esp_err_t gps_stop(void);
+void gps_get_stats(gps_stats_t *result);
 
 
 #endif // GPS_H
@@ -0,0 +1,164 @@
+#include "gps_framer.h"
+
+#include <string.h>
+
+enum {
+    S_SYNC,             // looking for the start of a frame
+    S_NMEA,
+    S_NMEA_LF,          // got the '\r'
+    S_UBX_SYNC2,        // got the 0xb5
+    S_UBX_CLASS,
+    S_UBX_ID,
+    S_UBX_LEN1,
+    S_UBX_LEN2,
+    S_UBX_PAYLOAD,
+    S_UBX_CK_A,
+    S_UBX_CK_B,
+};
+
+
+void
+gps_framer_init(gps_framer_t *self) {
+    memset(self, 0, sizeof(*self));
+    self->state = S_SYNC;
+}
+
+
+void
+gps_framer_reset(gps_framer_t *self) {
+    self->junk += self->len;
+    self->state = S_SYNC;
+    self->len = 0;
+}
+
+
+static void
+store(gps_framer_t *self, uint8_t c) {
+    self->buf[self->len++] = c;
+}
+
+
+// store a byte that is covered by the UBX checksum
+static void
+store_ck(gps_framer_t *self, uint8_t c) {
+    store(self, c);
+    self->ck_a += c;
+    self->ck_b += self->ck_a;
+}
+
+
+gps_frame_t
+gps_framer_push(gps_framer_t *self, uint8_t c) {
+    switch (self->state) {
+        case S_SYNC:
+            break;
+
+        case S_NMEA:
+            if (c == '\r') {
+                self->state = S_NMEA_LF;
+                return GPS_FRAME_NONE;
+            }
+            if ((0x20 <= c) && (c < 0x7f) && (c != '$')) {
+                if (self->len < GPS_FRAMER_NMEA_MAX) {
+                    self->buf[self->len++] = c;
+                    return GPS_FRAME_NONE;
+                }
+                ++self->oversized;
+            }
+            // broken message, but this byte may start the next one
+            self->junk += self->len;
+            break;
+
+        case S_NMEA_LF:
+            if (c == '\n') {
+                self->buf[self->len] = '\0';
+                self->state = S_SYNC;
+                ++self->frames;
+                return GPS_FRAME_NMEA;
+            }
+            self->junk += self->len + 1;
+            break;
+
+        case S_UBX_SYNC2:
+            if (c == 0x62) {
+                self->buf[self->len++] = c;
+                self->ck_a = self->ck_b = 0;
+                self->state = S_UBX_CLASS;
+                return GPS_FRAME_NONE;
+            }
+            self->junk += self->len;
+            break;
+
+        case S_UBX_CLASS:
+        case S_UBX_ID:
+            store_ck(self, c);
+            ++self->state;
+            return GPS_FRAME_NONE;
+
+        case S_UBX_LEN1:
+            store_ck(self, c);
+            self->payload_len = c;
+            self->state = S_UBX_LEN2;
+            return GPS_FRAME_NONE;
+
+        case S_UBX_LEN2:
+            self->payload_len |= ((uint16_t)c) << 8;
+            if (self->payload_len > (GPS_FRAMER_BUF_SIZE - 8)) {
+                // no such message is expected, it's a corrupted header: resync right after the sync chars, as the
+                // next frame may have started in it (the 4 bytes are too few to make one, so nothing is lost)
+                uint8_t hdr[4] = { self->buf[2], self->buf[3], self->buf[4], c };
+                ++self->oversized;
+                self->junk += 2;
+                self->state = S_SYNC;
+                self->len = 0;
+                for (int i = 0; i < 4; ++i) {
+                    gps_framer_push(self, hdr[i]);
+                }
+                return GPS_FRAME_NONE;
+            }
+            store_ck(self, c);
+            self->state = (self->payload_len > 0) ? S_UBX_PAYLOAD : S_UBX_CK_A;
+            return GPS_FRAME_NONE;
+
+        case S_UBX_PAYLOAD:
+            store_ck(self, c);
+            if (self->len == (6 + (size_t)self->payload_len)) {
+                self->state = S_UBX_CK_A;
+            }
+            return GPS_FRAME_NONE;
+
+        case S_UBX_CK_A:
+            store(self, c);
+            self->rx_ck_a = c;
+            self->state = S_UBX_CK_B;
+            return GPS_FRAME_NONE;
+
+        case S_UBX_CK_B:
+            store(self, c);
+            self->state = S_SYNC;
+            if ((self->rx_ck_a != self->ck_a) || (c != self->ck_b)) {
+                ++self->ck_errors;
+                return GPS_FRAME_NONE;
+            }
+            ++self->frames;
+            return GPS_FRAME_UBX;
+    }
+
+    // looking for the start of the next frame
+    self->state = S_SYNC;
+    self->len = 0;
+    if (c == '$') {
+        self->buf[self->len++] = c;
+        self->state = S_NMEA;
+    }
+    else if (c == 0xb5) {
+        self->buf[self->len++] = c;
+        self->state = S_UBX_SYNC2;
+    }
+    else {
+        ++self->junk;
+    }
+    return GPS_FRAME_NONE;
+}
+
+// vim: set sw=4 ts=4 indk= et si:
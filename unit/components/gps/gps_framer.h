@@ -0,0 +1,42 @@
+#ifndef GPS_FRAMER_H
+#define GPS_FRAMER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Single-pass framer for the mixed NMEA and UBX stream of the receiver.
+ *
+ * Each byte is processed once as it arrives, the UBX checksum is calculated on the way, so there is no rescanning
+ * and no moving of leftovers. A UBX length that wouldn't fit in the buffer can only come from a corrupted header, so
+ * it's dropped as oversized right there, and the framer looks for the next frame from the following byte on: a bad
+ * length can't swallow up to 64 kB of good frames.
+ *
+ * No platform dependencies, so it can be tested on the host as well.
+ */
+
+#define GPS_FRAMER_BUF_SIZE     512     // NAV-SVINFO with 32 channels is 400 bytes
+#define GPS_FRAMER_NMEA_MAX     128     // the standard says 82 with the "\r\n", but some receivers exceed it
+
+typedef enum {
+    GPS_FRAME_NONE,     // need more bytes
+    GPS_FRAME_NMEA,     // buf[0 .. len): from the '$' up to the "\r\n", NUL-terminated, checksum not yet checked
+    GPS_FRAME_UBX,      // buf[0 .. len): the complete frame with a valid checksum
+} gps_frame_t;
+
+typedef struct {
+    uint8_t state;
+    uint8_t ck_a, ck_b, rx_ck_a;
+    uint16_t payload_len;
+    size_t len;         // of the current frame so far
+    uint8_t buf[GPS_FRAMER_BUF_SIZE];
+    // statistics
+    uint32_t frames, ck_errors, oversized, junk;
+} gps_framer_t;
+
+void gps_framer_init(gps_framer_t *self);
+// drop the frame in progress, e.g. when the bytes following it have been lost, but keep the statistics
+void gps_framer_reset(gps_framer_t *self);
+gps_frame_t gps_framer_push(gps_framer_t *self, uint8_t c);
+
+#endif // GPS_FRAMER_H
+// vim: set sw=4 ts=4 indk= et si:
@@ -0,0 +1,210 @@
+#include "gps_kalman.h"
+
+#include <string.h>
+#include <math.h>
+
+#define M_PER_LAT       0.01113195f     // m per 1e-7 deg
+#define VEL_INIT_SIGMA  10.0f           // m/s, before the first velocity
+#define POS_SIGMA_MIN   0.5f            // m, the receivers tend to be optimistic
+#define VEL_SIGMA_MIN   0.05f           // m/s
+
+
+void
+gps_kalman_init(gps_kalman_t *self) {
+    memset(self, 0, sizeof(*self));
+}
+
+
+static void
+set_ref(gps_kalman_t *self, int32_t lat, int32_t lon) {
+    self->ref_lat = lat;
+    self->ref_lon = lon;
+    self->m_per_lat = M_PER_LAT;
+    self->m_per_lon = M_PER_LAT * cosf(lat * (float)(1e-7 * M_PI / 180));
+}
+
+
+static void
+reset(gps_kalman_t *self, uint32_t iTOW, int32_t lat, int32_t lon, float r) {
+    set_ref(self, lat, lon);
+    self->iTOW = iTOW;
+    self->n.pos = self->e.pos = 0;
+    self->n.vel = self->e.vel = 0;
+    self->p_pp = r;
+    self->p_pv = 0;
+    self->p_vv = VEL_INIT_SIGMA * VEL_INIT_SIGMA;
+    self->rejects = 0;
+    self->still = 0;
+    self->hold = false;
+    self->valid = true;
+    ++self->resets;
+}
+
+
+// false if @iTOW is too far from the state to predict to it
+static bool
+predict(gps_kalman_t *self, uint32_t iTOW) {
+    int32_t dt_ms = iTOW - self->iTOW;
+    if ((dt_ms < 0) || (GPS_KALMAN_GAP_MAX_MS < dt_ms)) {
+        return false;
+    }
+    if (dt_ms == 0) {
+        return true;
+    }
+    float dt = dt_ms * 1e-3f;
+    float q = GPS_KALMAN_ACCEL_SIGMA * GPS_KALMAN_ACCEL_SIGMA;
+    self->n.pos += self->n.vel * dt;
+    self->e.pos += self->e.vel * dt;
+    // P = F P F' + Q, with F = [1 dt; 0 1] and Q of a white noise acceleration
+    self->p_pp += dt * (2 * self->p_pv + dt * self->p_vv) + q * dt * dt * dt * dt / 4;
+    self->p_pv += dt * self->p_vv + q * dt * dt * dt / 2;
+    self->p_vv += q * dt * dt;
+    self->iTOW = iTOW;
+    return true;
+}
+
+
+static float
+speed(const gps_kalman_t *self) {
+    return sqrtf(self->n.vel * self->n.vel + self->e.vel * self->e.vel);
+}
+
+
+static void
+update_heading(gps_kalman_t *self) {
+    if (speed(self) < GPS_KALMAN_MOVE_SPD) {
+        // the direction of the noise is just noise
+        return;
+    }
+    float deg = atan2f(self->e.vel, self->n.vel) * (float)(180 / M_PI);
+    if (deg < 0) {
+        deg += 360;
+    }
+    self->heading = deg * 1e5f;
+}
+
+
+static void
+to_latlon(const gps_kalman_t *self, int32_t *lat, int32_t *lon) {
+    *lat = self->ref_lat + (int32_t)lroundf(self->n.pos / self->m_per_lat);
+    *lon = self->ref_lon + (int32_t)lroundf(self->e.pos / self->m_per_lon);
+}
+
+
+static void
+update_hold(gps_kalman_t *self) {
+    float spd = speed(self);
+    if (self->hold) {
+        int32_t lat, lon;
+        to_latlon(self, &lat, &lon);
+        float dn = (lat - self->hold_lat) * self->m_per_lat;
+        float de = (lon - self->hold_lon) * self->m_per_lon;
+        if ((spd > GPS_KALMAN_MOVE_SPD) || ((dn * dn + de * de) > (GPS_KALMAN_HOLD_RADIUS_M * GPS_KALMAN_HOLD_RADIUS_M))) {
+            self->hold = false;
+            self->still = 0;
+        }
+        return;
+    }
+    if (spd >= GPS_KALMAN_STILL_SPD) {
+        self->still = 0;
+        return;
+    }
+    if (++self->still >= GPS_KALMAN_STILL_EPOCHS) {
+        to_latlon(self, &self->hold_lat, &self->hold_lon);
+        self->hold = true;
+        ++self->holds;
+    }
+}
+
+
+void
+gps_kalman_position(gps_kalman_t *self, uint32_t iTOW, int32_t lat, int32_t lon, uint32_t hAcc) {
+    float sigma = hAcc * 1e-3f;
+    if (sigma < POS_SIGMA_MIN) {
+        sigma = POS_SIGMA_MIN;
+    }
+    float r = sigma * sigma;
+    if (!self->valid || !predict(self, iTOW)) {
+        reset(self, iTOW, lat, lon, r);
+        return;
+    }
+
+    float y_n = ((int64_t)lat - self->ref_lat) * self->m_per_lat - self->n.pos;
+    float y_e = ((int64_t)lon - self->ref_lon) * self->m_per_lon - self->e.pos;
+    float s = self->p_pp + r;
+    if ((y_n * y_n + y_e * y_e) > (GPS_KALMAN_GATE_SIGMA * GPS_KALMAN_GATE_SIGMA * s)) {
+        ++self->rejected;
+        if (++self->rejects >= GPS_KALMAN_REJECT_MAX) {
+            // it's not the fixes that are wrong
+            reset(self, iTOW, lat, lon, r);
+        }
+        return;
+    }
+    self->rejects = 0;
+
+    float k_p = self->p_pp / s, k_v = self->p_pv / s;
+    self->n.pos += k_p * y_n;
+    self->n.vel += k_v * y_n;
+    self->e.pos += k_p * y_e;
+    self->e.vel += k_v * y_e;
+    self->p_vv -= k_v * self->p_pv;
+    self->p_pv *= 1 - k_p;
+    self->p_pp *= 1 - k_p;
+    ++self->updates;
+
+    if ((fabsf(self->n.pos) > GPS_KALMAN_RECENTER_M) || (fabsf(self->e.pos) > GPS_KALMAN_RECENTER_M)) {
+        // keep the float precision
+        int32_t new_lat, new_lon;
+        to_latlon(self, &new_lat, &new_lon);
+        set_ref(self, new_lat, new_lon);
+        self->n.pos = self->e.pos = 0;
+    }
+    update_heading(self);
+    update_hold(self);
+}
+
+
+void
+gps_kalman_velocity(gps_kalman_t *self, uint32_t iTOW, int32_t velN, int32_t velE, uint32_t sAcc) {
+    if (!self->valid || !predict(self, iTOW)) {
+        // a velocity alone can't start the filter
+        return;
+    }
+    float sigma = sAcc * 1e-2f;
+    if (sigma < VEL_SIGMA_MIN) {
+        sigma = VEL_SIGMA_MIN;
+    }
+    float s = self->p_vv + sigma * sigma;
+    float y_n = velN * 1e-2f - self->n.vel;
+    float y_e = velE * 1e-2f - self->e.vel;
+    float k_p = self->p_pv / s, k_v = self->p_vv / s;
+    self->n.pos += k_p * y_n;
+    self->n.vel += k_v * y_n;
+    self->e.pos += k_p * y_e;
+    self->e.vel += k_v * y_e;
+    self->p_pp -= k_p * self->p_pv;
+    self->p_pv *= 1 - k_v;
+    self->p_vv *= 1 - k_v;
+    update_heading(self);
+}
+
+
+bool
+gps_kalman_get(const gps_kalman_t *self, int32_t *lat, int32_t *lon, uint32_t *speed_mms, int32_t *heading) {
+    if (!self->valid) {
+        return false;
+    }
+    if (self->hold) {
+        *lat = self->hold_lat;
+        *lon = self->hold_lon;
+        *speed_mms = 0;
+    }
+    else {
+        to_latlon(self, lat, lon);
+        *speed_mms = speed(self) * 1000;
+    }
+    *heading = self->heading;
+    return true;
+}
+
+// vim: set sw=4 ts=4 indk= et si:
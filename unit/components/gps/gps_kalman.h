@@ -0,0 +1,58 @@
+#ifndef GPS_KALMAN_H
+#define GPS_KALMAN_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Constant-velocity Kalman filter for the positions and velocities of the receiver.
+ *
+ * It works on a local plane around a reference point, in metres. The north and east axes are independent and get the
+ * same measurement noise (hAcc, sAcc), so they share one 2x2 covariance. Single-precision floats, no allocation.
+ *
+ * When the unit stands still for a few epochs, the position is held, so that the jitter of the fixes of a parked unit
+ * doesn't look like movement. The hold is released as soon as the speed or the position says otherwise.
+ *
+ * No platform dependencies, so it can be tested on the host as well.
+ */
+
+#define GPS_KALMAN_ACCEL_SIGMA      1.0f    // m/s^2, the process noise
+#define GPS_KALMAN_GAP_MAX_MS       10000   // start over after a longer gap
+#define GPS_KALMAN_RECENTER_M       1000.0f // move the reference point when the position is this far from it
+#define GPS_KALMAN_GATE_SIGMA       5.0f    // the position fixes further than this are rejected
+#define GPS_KALMAN_REJECT_MAX       3       // but after this many in a row the filter starts over
+#define GPS_KALMAN_STILL_SPD        0.3f    // m/s, below this it's standing
+#define GPS_KALMAN_STILL_EPOCHS     3       // for this many epochs before it's held
+#define GPS_KALMAN_MOVE_SPD         0.8f    // m/s, above this the hold is released
+#define GPS_KALMAN_HOLD_RADIUS_M    8.0f    // the hold is also released if the position is further than this
+
+typedef struct {
+    float pos, vel;     // m, m/s
+} gps_kalman_axis_t;
+
+typedef struct {
+    bool valid;
+    uint32_t iTOW;                  // ms, of the state
+    int32_t ref_lat, ref_lon;       // deg * 1e7, the origin of the local plane
+    float m_per_lat, m_per_lon;     // m per 1e-7 deg
+    gps_kalman_axis_t n, e;
+    float p_pp, p_pv, p_vv;         // covariance, the same for both axes
+    uint8_t rejects;
+    // static hold
+    uint8_t still;                  // consecutive epochs below GPS_KALMAN_STILL_SPD
+    bool hold;
+    int32_t hold_lat, hold_lon;
+    int32_t heading;                // deg * 1e5, the last one while moving
+    // statistics
+    uint32_t updates, rejected, resets, holds;
+} gps_kalman_t;
+
+void gps_kalman_init(gps_kalman_t *self);
+// @hAcc: mm
+void gps_kalman_position(gps_kalman_t *self, uint32_t iTOW, int32_t lat, int32_t lon, uint32_t hAcc);
+// @velN, @velE: cm/s, @sAcc: cm/s
+void gps_kalman_velocity(gps_kalman_t *self, uint32_t iTOW, int32_t velN, int32_t velE, uint32_t sAcc);
+// in the units of gps_fix_t: deg * 1e7, mm/s, deg * 1e5; false if there is no estimate yet
+bool gps_kalman_get(const gps_kalman_t *self, int32_t *lat, int32_t *lon, uint32_t *speed, int32_t *heading);
+
+#endif // GPS_KALMAN_H
+// vim: set sw=4 ts=4 indk= et si:
@@ -6,6 +6,9 @@
 #include <esp_log.h>
 
 #include <nvs.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
 
 #include <string.h>
 #include <ctype.h>
@@ -13,6 +16,108 @@
 
 static const char *TAG = "httpscli";
 
+/* The sessions of the last successful handshakes, one per server, so a reconnect can resume them (by session ticket
+ * or by session id), which needs neither the certificate verification nor the asymmetric key exchange.
+ * They are kept here and not in the connection context, so they survive the restart of the tasks as well.
+ */
+#define SESSION_CACHE_LEN   2
+
+typedef struct {
+    char server_name[64];
+    char server_port[8];
+    mbedtls_ssl_session session;
+    bool valid;
+    TickType_t last_used;
+} cached_session_t;
+
+static cached_session_t session_cache[SESSION_CACHE_LEN];
+static SemaphoreHandle_t session_cache_mutex = NULL;
+
+
+static cached_session_t *
+find_session(const char *server_name, const char *server_port) {
+    for (int i = 0; i < SESSION_CACHE_LEN; ++i) {
+        cached_session_t *cs = &session_cache[i];
+        if (cs->valid && !strcmp(cs->server_name, server_name) && !strcmp(cs->server_port, server_port)) {
+            return cs;
+        }
+    }
+    return NULL;
+}
+
+
+// @master receives the master secret of the offered session, so we can check later if it was resumed
+static void
+load_session(https_conn_context_t *ctx, const char *server_name, const char *server_port, unsigned char *master) {
+    xSemaphoreTake(session_cache_mutex, portMAX_DELAY);
+    cached_session_t *cs = find_session(server_name, server_port);
+    if (cs) {
+        int res = mbedtls_ssl_set_session(&ctx->ssl, &cs->session);
+        if (res != 0) {
+            ESP_LOGW(TAG, "mbedtls_ssl_set_session returned -0x%x", -res);
+        }
+        else {
+            ctx->session_offered = true;
+            memcpy(master, cs->session.master, sizeof(cs->session.master));
+            cs->last_used = xTaskGetTickCount();
+        }
+    }
+    xSemaphoreGive(session_cache_mutex);
+}
+
+
+static void
+store_session(https_conn_context_t *ctx, const char *server_name, const char *server_port) {
+    if ((strlen(server_name) >= sizeof(session_cache[0].server_name)) || (strlen(server_port) >= sizeof(session_cache[0].server_port))) {
+        return;
+    }
+    xSemaphoreTake(session_cache_mutex, portMAX_DELAY);
+    cached_session_t *cs = find_session(server_name, server_port);
+    for (int i = 0; !cs && (i < SESSION_CACHE_LEN); ++i) {
+        if (!session_cache[i].valid) {
+            cs = &session_cache[i];
+        }
+    }
+    if (!cs) {
+        // replace the least recently used one
+        cs = &session_cache[0];
+        for (int i = 1; i < SESSION_CACHE_LEN; ++i) {
+            if ((int32_t)(session_cache[i].last_used - cs->last_used) < 0) {
+                cs = &session_cache[i];
+            }
+        }
+    }
+    if (cs->valid) {
+        mbedtls_ssl_session_free(&cs->session);
+    }
+    mbedtls_ssl_session_init(&cs->session);
+    int res = mbedtls_ssl_get_session(&ctx->ssl, &cs->session);
+    if (res != 0) {
+        ESP_LOGW(TAG, "mbedtls_ssl_get_session returned -0x%x", -res);
+        mbedtls_ssl_session_free(&cs->session);
+        cs->valid = false;
+    }
+    else {
+        strcpy(cs->server_name, server_name);
+        strcpy(cs->server_port, server_port);
+        cs->last_used = xTaskGetTickCount();
+        cs->valid = true;
+    }
+    xSemaphoreGive(session_cache_mutex);
+}
+
+
+static void
+drop_session(const char *server_name, const char *server_port) {
+    xSemaphoreTake(session_cache_mutex, portMAX_DELAY);
+    cached_session_t *cs = find_session(server_name, server_port);
+    if (cs) {
+        mbedtls_ssl_session_free(&cs->session);
+        cs->valid = false;
+    }
+    xSemaphoreGive(session_cache_mutex);
+}
+
 static bool
 get_blob(nvs_handle h, const char *name, uint8_t **buf, size_t *buflen) {
     esp_err_t res = nvs_get_blob(h, name, NULL, buflen);
@@ -22,7 +127,7 @@ get_blob(nvs_handle h, const char *name, uint8_t **buf, size_t *buflen) {
     }
     *buf = (uint8_t*)malloc(*buflen);
     if (!*buf) {
-        ESP_LOGW(TAG, "Cannot allocate %u bytes for '%s'", *buflen, name);
+        ESP_LOGW(TAG, "Cannot allocate %u bytes for '%s'", (unsigned)*buflen, name);
         return false;
     }
     res = nvs_get_blob(h, name, *buf, buflen);
@@ -50,6 +155,14 @@ https_destroy(https_conn_context_t *ctx) {
 }
 
 
+void
+https_client_init(void) {
+    if (!session_cache_mutex) {
+        session_cache_mutex = xSemaphoreCreateMutex();
+    }
+}
+
+
 bool
 https_init(https_conn_context_t *ctx) {
     ctx->rdpos = ctx->wrpos = ctx->buf;
@@ -136,6 +249,9 @@ https_init(https_conn_context_t *ctx) {
     mbedtls_ssl_conf_rng(&ctx->conf, mbedtls_ctr_drbg_random, &ctx->ctr_drbg);
     mbedtls_ssl_conf_cert_profile(&ctx->conf, &mbedtls_x509_crt_profile_next);
     mbedtls_ssl_conf_own_cert(&ctx->conf, &ctx->client_cert, &ctx->client_pkey); // FIXME: if present
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+    mbedtls_ssl_conf_session_tickets(&ctx->conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#endif // MBEDTLS_SSL_SESSION_TICKETS
     return true;
 
 close_conn:
@@ -175,6 +291,11 @@ https_connect(https_conn_context_t *ctx, const char *server_name, const char *se
 
     mbedtls_ssl_set_bio(&ctx->ssl, &ctx->ssl_ctx, mbedtls_net_send, mbedtls_net_recv, NULL);
 
+    ctx->session_offered = false;
+    unsigned char offered_master[48];
+    load_session(ctx, server_name, server_port, offered_master);
+    TickType_t handshake_start = xTaskGetTickCount();
+
     // Until we get a GPS fix, we don't know the time, so we can't check cert expiry.
     // Either we reject all expired certs or we accept all of them.
     // For the sake of being able to do OTA without GPS, *HERE* we accept them,
@@ -190,10 +311,18 @@ https_connect(https_conn_context_t *ctx, const char *server_name, const char *se
         }
         if ((res != MBEDTLS_ERR_SSL_WANT_READ) && (res != MBEDTLS_ERR_SSL_WANT_WRITE)) {
             ESP_LOGE(TAG, "mbedtls_ssl_handshake returned -0x%x", -res);
+            if (ctx->session_offered) {
+                // maybe the server didn't like it, next time try without it
+                drop_session(server_name, server_port);
+            }
             goto close_conn;
         }
     }
 
+    // a resumed session keeps its master secret, a new one gets a fresh one
+    bool resumed = ctx->session_offered && !memcmp(ctx->ssl.session->master, offered_master, sizeof(offered_master));
+    ESP_LOGI(TAG, "Handshake done in %u ms, %s", (xTaskGetTickCount() - handshake_start) * portTICK_PERIOD_MS, resumed ? "resumed" : "full");
+
     res = mbedtls_ssl_get_verify_result(&ctx->ssl);
     if (no_valid_time) {
         res &= ~MBEDTLS_X509_BADCERT_FUTURE;
@@ -204,6 +333,8 @@ https_connect(https_conn_context_t *ctx, const char *server_name, const char *se
         goto close_conn;
     }
 
+    // even a resumed session may have got a new ticket
+    store_session(ctx, server_name, server_port);
     return true;
 
 close_conn:
@@ -220,7 +351,7 @@ send_buf(https_conn_context_t *ctx) {
             ctx->rdpos += res;
         }
         else if ((res != MBEDTLS_ERR_SSL_WANT_READ) && (res != MBEDTLS_ERR_SSL_WANT_WRITE)) {
-            ESP_LOGE(TAG, "mbedtls_ssl_write returned %d", res);
+            ESP_LOGE(TAG, "mbedtls_ssl_write returned %d", (int)res);
             return false;
         }
     }
@@ -243,7 +374,7 @@ read_some(https_conn_context_t *ctx) {
         }
 
         if (res < 0) {
-            ESP_LOGE(TAG, "mbedtls_ssl_read returned %d", res);
+            ESP_LOGE(TAG, "mbedtls_ssl_read returned %d", (int)res);
             return res;
         }
         return res;
@@ -281,7 +412,7 @@ https_send_data(https_conn_context_t *ctx, const uint8_t *data, size_t datalen)
             datalen -= res;
         }
         else if ((res != MBEDTLS_ERR_SSL_WANT_READ) && (res != MBEDTLS_ERR_SSL_WANT_WRITE)) {
-            ESP_LOGE(TAG, "mbedtls_ssl_write returned %d", res);
+            ESP_LOGE(TAG, "mbedtls_ssl_write returned %d", (int)res);
             return false;
         }
     }
@@ -321,7 +452,7 @@ http_readline(https_conn_context_t *ctx) {
     while (ctx->wrpos < (ctx->buf + HTTPS_CLIENT_BUFSIZE)) {
         ssize_t res = read_some(ctx);
         if (res <= 0) { // either error or eof before eol
-            ESP_LOGE(TAG, "Read error before EOL: %d", res);
+            ESP_LOGE(TAG, "Read error before EOL: %d", (int)res);
             return NULL;
         }
         eol = (unsigned char*)memchr(ctx->wrpos, '\n', res); // search only in the data we read now
@@ -330,7 +461,7 @@ http_readline(https_conn_context_t *ctx) {
             return terminate_line();
         }
     }
-    ESP_LOGE(TAG, "Line too long, rdpos=0x%x, wrpos=0x%x", ctx->rdpos - ctx->buf, ctx->wrpos - ctx->buf);
+    ESP_LOGE(TAG, "Line too long, rdpos=0x%x, wrpos=0x%x", (unsigned)(ctx->rdpos - ctx->buf), (unsigned)(ctx->wrpos - ctx->buf));
     hexdump(ctx->buf, HTTPS_CLIENT_BUFSIZE);
     return NULL; // haven't returned yet -> buffer was too short for a line
 }
@@ -420,6 +551,25 @@ https_read_body_chunk(https_conn_context_t *ctx, unsigned char **data, size_t *d
 }
 
 
+bool
+https_read_body(https_conn_context_t *ctx, https_body_cb_t consumer, void *arg) {
+    bool ok = true;
+    unsigned char *chunk;
+    size_t chunk_len;
+    while (https_read_body_chunk(ctx, &chunk, &chunk_len)) {
+        if (ok && consumer && !consumer(chunk, chunk_len, arg)) {
+            // consumer gave up, but the rest of the body must still be read to keep the connection usable
+            ok = false;
+        }
+    }
+    if (ctx->content_remaining != 0) {
+        ESP_LOGE(TAG, "Body truncated, %u bytes missing", (unsigned)ctx->content_remaining);
+        return false;
+    }
+    return ok;
+}
+
+
 bool
 https_split_url(char *url, char **server_name, char **server_port, char **path, char **resource) {
     if (strncmp("https://", url, 8)) {
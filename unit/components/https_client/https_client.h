@@ -20,8 +20,11 @@ typedef struct {
     unsigned char buf[HTTPS_CLIENT_BUFSIZE + 1];
     unsigned char *rdpos, *wrpos;
     size_t content_length, content_remaining;
+    bool session_offered;   // a cached session was offered to the server for resumption
 } https_conn_context_t;
 
+// once, before any task uses the client
+void https_client_init(void);
 bool https_init(https_conn_context_t *ctx);
 bool https_connect(https_conn_context_t *ctx, const char *server_name, const char *server_port);
 bool https_send_request(https_conn_context_t *ctx, const char *method, const char *server, const char *path, const char *resource, const char *extra_headers, ...);
@@ -29,6 +32,9 @@ bool https_send_data(https_conn_context_t *ctx, const uint8_t *data, size_t data
 int https_read_statusline(https_conn_context_t *ctx);
 bool https_read_header(https_conn_context_t *ctx, unsigned char **name, unsigned char **value);
 bool https_read_body_chunk(https_conn_context_t *ctx, unsigned char **data, size_t *datalen);
+// feed the body to @consumer chunk by chunk, as it arrives; if @consumer returns false, the rest is read but discarded
+typedef bool (*https_body_cb_t)(const uint8_t *data, size_t datalen, void *arg);
+bool https_read_body(https_conn_context_t *ctx, https_body_cb_t consumer, void *arg);
 void https_disconnect(https_conn_context_t *ctx);
 void https_destroy(https_conn_context_t *ctx);
 
@@ -0,0 +1,91 @@
+#include "distance_gate.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#define R_Earth 6.371009e6
+#define RAD_PER_E7 (M_PI / 180.0 / 1e7)
+#define M_PER_E7 (R_Earth * RAD_PER_E7)
+
+
+// the east-west difference, wrapped into [-180, 180) deg
+static int64_t
+delta_lon(int32_t lon, int32_t ref_lon) {
+    int64_t d = (int64_t)lon - ref_lon;
+    if (d >= 1800000000LL) {
+        d -= 3600000000LL;
+    }
+    else if (d < -1800000000LL) {
+        d += 3600000000LL;
+    }
+    return d;
+}
+
+
+static double
+haversine(int32_t lat1, int32_t lon1, int32_t lat2, int32_t lon2) {
+    double phi1 = lat1 * RAD_PER_E7, phi2 = lat2 * RAD_PER_E7;
+    double s_dphi = sin((phi2 - phi1) / 2);
+    double s_dlambda = sin(delta_lon(lon2, lon1) * RAD_PER_E7 / 2);
+    double a = s_dphi * s_dphi + cos(phi1) * cos(phi2) * s_dlambda * s_dlambda;
+    return 2 * R_Earth * asin(sqrt((a < 1) ? a : 1));
+}
+
+
+void
+distance_gate_init(distance_gate_t *self, uint32_t trshld_m) {
+    self->has_ref = false;
+    self->trshld_m = trshld_m;
+    if (trshld_m < (DISTANCE_GATE_FLAT_MAX * M_PER_E7)) {
+        int64_t trshld_e7 = trshld_m / M_PER_E7;
+        self->trshld_e7sq = trshld_e7 * trshld_e7;
+    }
+    else {
+        // the flat approximation won't be used for such distances anyway
+        self->trshld_e7sq = INT64_MAX;
+    }
+    self->cos_lat = 0;
+    self->cos_q16 = 1 << 16;
+}
+
+
+void
+distance_gate_set_ref(distance_gate_t *self, int32_t lat, int32_t lon) {
+    self->ref_lat = lat;
+    self->ref_lon = lon;
+    if (!self->has_ref || (abs(lat - self->cos_lat) > DISTANCE_GATE_COS_STEP)) {
+        self->cos_lat = lat;
+        self->cos_q16 = cos(lat * RAD_PER_E7) * (1 << 16);
+    }
+    self->has_ref = true;
+}
+
+
+uint32_t
+distance_gate_distance(distance_gate_t *self, int32_t lat, int32_t lon) {
+    int64_t dy = (int64_t)lat - self->ref_lat;
+    int64_t dx = delta_lon(lon, self->ref_lon);
+    if ((llabs(dy) > DISTANCE_GATE_FLAT_MAX) || (llabs(dx) > DISTANCE_GATE_FLAT_MAX)) {
+        return haversine(self->ref_lat, self->ref_lon, lat, lon) + 0.5;
+    }
+    dx = (dx * self->cos_q16) >> 16;
+    return sqrt((double)(dx * dx + dy * dy)) * M_PER_E7 + 0.5;
+}
+
+
+bool
+distance_gate_passed(distance_gate_t *self, int32_t lat, int32_t lon) {
+    if (!self->has_ref) {
+        return true;
+    }
+    int64_t dy = (int64_t)lat - self->ref_lat;
+    int64_t dx = delta_lon(lon, self->ref_lon);
+    if ((llabs(dy) > DISTANCE_GATE_FLAT_MAX) || (llabs(dx) > DISTANCE_GATE_FLAT_MAX)) {
+        return haversine(self->ref_lat, self->ref_lon, lat, lon) > self->trshld_m;
+    }
+    dx = (dx * self->cos_q16) >> 16;
+    return (dx * dx + dy * dy) > self->trshld_e7sq;
+}
+
+// vim: set sw=4 ts=4 indk= et si:
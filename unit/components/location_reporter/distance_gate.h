@@ -0,0 +1,36 @@
+#ifndef DISTANCE_GATE_H
+#define DISTANCE_GATE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Decides whether the unit has moved far enough from the last reported position.
+ *
+ * For short distances it's an equirectangular approximation (the east-west difference scaled by the cos of the
+ * reference latitude), all in integer deg * 1e7 units, like in gps_fix_t. The cos is cached with the reference point,
+ * and recalculated only if the reference latitude has changed by more than DISTANCE_GATE_COS_STEP.
+ *
+ * Beyond DISTANCE_GATE_FLAT_MAX the flat approximation isn't good enough, so it falls back to haversine.
+ */
+
+#define DISTANCE_GATE_COS_STEP  100000      // deg * 1e7, 0.01 deg ~ 1.1 km
+#define DISTANCE_GATE_FLAT_MAX  10000000    // deg * 1e7, 1 deg ~ 111 km
+
+typedef struct {
+    bool has_ref;
+    int32_t ref_lat, ref_lon;   // deg * 1e7
+    int32_t cos_lat;            // latitude of the cached cos
+    uint32_t cos_q16;           // cos(cos_lat) * 2**16
+    uint32_t trshld_m;
+    int64_t trshld_e7sq;        // (deg * 1e7)**2
+} distance_gate_t;
+
+void distance_gate_init(distance_gate_t *self, uint32_t trshld_m);
+void distance_gate_set_ref(distance_gate_t *self, int32_t lat, int32_t lon);
+// distance from the reference point in metres
+uint32_t distance_gate_distance(distance_gate_t *self, int32_t lat, int32_t lon);
+// true if there is no reference point yet, or the distance from it is more than the threshold
+bool distance_gate_passed(distance_gate_t *self, int32_t lat, int32_t lon);
+
+#endif // DISTANCE_GATE_H
+// vim: set sw=4 ts=4 indk= et si:
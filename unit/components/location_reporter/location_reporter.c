@@ -1,4 +1,10 @@
 #include "main.h"
+#include "report_queue.h"
+#include "report_codec.h"
+#include "distance_gate.h"
+#include "track_simplifier.h"
+#include "report_scheduler.h"
+#include "power_mgmt.h"
 #include "gps.h"
 #include "misc.h"
 #include "https_client.h"
@@ -9,6 +15,7 @@
 #include <freertos/semphr.h>
 
 #include <esp_spi_flash.h>
+#include <esp_timer.h>
 #include <esp_ota_ops.h>
 #include <nvs.h>
 #include <driver/adc.h>
@@ -21,12 +28,27 @@
 #include <ctype.h>
 #include <math.h>
 
-#define BODY_MAX 128
-#define R_Earth 6.371009e6
+#define RECORD_MAX 128
+#define BATCH_MAX 10
+#define BODY_MAX (BATCH_MAX * RECORD_MAX + 8)
+// max number of requests sent in one go, so the backlog after an outage won't starve the rest of the loop
+#define DRAIN_MAX 16
+#define JSON_MIME "application/json"
+// the last fix is kept for the AGPS request of the next startup, and it's rewritten only when moved this far from it
+#define LAST_FIX_SAVE_DIST 10000 // m
+// and only a good fix is saved, a wrong one would send the AGPS of the next startup to the wrong place
+#define LAST_FIX_SAVE_ACC 100 // m
+// the position accuracy claimed for the AGPS, it must cover the distance it may have been moved while turned off
+#define LAST_FIX_ACC 50000 // m
+#define STAGE_STATS_PERIOD_SEC 300
+// the gps sends a fix every second, but while standing they are looked at only this often
+#define STANDING_POLL_SEC 10
 
 static const char *TAG = "lrep";
 
-static char *DATA_SERVER_NAME, *DATA_SERVER_PORT, *DATA_PATH, *DATA_ENDPOINT;
+static char *DATA_SERVER_NAME, *DATA_SERVER_PORT, *DATA_PATH, *DATA_ENDPOINT, *DATA_BATCH_ENDPOINT;
+static uint16_t batch_num = 1, batch_time = 0;
+static bool use_binary = false; // the server has announced that it accepts REPORT_CODEC_MIME
 static uint32_t unit_nonce;
 static char unit_name[32] = "<unnamed>";
 static int unit_status = 0; // FIXME: not handled yet
@@ -38,10 +60,61 @@ static char * unit_status_str[] = {
     // ...
 };
 
+static distance_gate_t last_fix; // its reference point is the persisted fix
+
 static SemaphoreHandle_t sem_running = NULL;
 static bool keep_running = false;
 static uint16_t adc_mV;
 
+// latency of the stages of a fix from the gps to the server, esp_timer usecs
+typedef enum {
+    STAGE_WAKE,     // published by the gps -> the reporter woke up
+    STAGE_QUEUE,    // woke up -> queued
+    STAGE_ACK,      // queued -> acknowledged by the server
+    NUM_STAGES
+} stage_t;
+
+static const char *stage_names[NUM_STAGES] = { "wake", "queue", "ack" };
+
+typedef struct {
+    uint32_t n;
+    uint64_t sum_us;
+    uint32_t max_us;
+} stage_stats_t;
+
+static stage_stats_t stage_stats[NUM_STAGES];
+static int64_t newest_queued_us; // of the newest record in the queue, 0 if it has no fix
+
+
+static void
+stage_add(stage_t stage, int64_t from_us, int64_t to_us) {
+    if ((from_us == 0) || (to_us < from_us)) {
+        return;
+    }
+    stage_stats_t *st = &stage_stats[stage];
+    uint32_t d = to_us - from_us;
+    ++st->n;
+    st->sum_us += d;
+    if (st->max_us < d) {
+        st->max_us = d;
+    }
+}
+
+
+static void
+log_stage_stats(void) {
+    gps_stats_t gs;
+    gps_get_stats(&gs);
+    ESP_LOGI(TAG, "Latency gps: avg=%u us, max=%u us", gs.latency_avg_us, gs.latency_max_us);
+    for (int i = 0; i < NUM_STAGES; ++i) {
+        stage_stats_t *st = &stage_stats[i];
+        if (st->n > 0) {
+            ESP_LOGI(TAG, "Latency %s: n=%u, avg=%u us, max=%u us", stage_names[i], st->n, (uint32_t)(st->sum_us / st->n), st->max_us);
+        }
+    }
+    memset(stage_stats, 0, sizeof(stage_stats));
+}
+
 static void
 init_status(void) {
     lcd_clear();
@@ -71,9 +144,9 @@ show_status(void) {
 
     snprintf(buf, sizeof(buf), "GPS:%6s", gps_status_names[gps_status]);
     lcd_puts(11, 2, buf);
-    snprintf(buf, sizeof(buf), "%+10.5f", gps_fix.latitude);
+    snprintf(buf, sizeof(buf), "%+10.5f", gps_fix_latitude(&gps_fix));
     lcd_puts(11, 3, buf);
-    snprintf(buf, sizeof(buf), "%+10.5f", gps_fix.longitude);
+    snprintf(buf, sizeof(buf), "%+10.5f", gps_fix_longitude(&gps_fix));
     lcd_puts(11, 4, buf);
     snprintf(buf, sizeof(buf), "%04u-%02u-%02u", t.tm_year + 1900, t.tm_mon + 1, t.tm_mday);
     lcd_puts(11, 5, buf);
@@ -84,20 +157,27 @@ show_status(void) {
 }
 
 
-static void
-post_body(https_conn_context_t *ctx, bool *connected, const char *endpoint, const char *body, size_t bodylen) {
-    ESP_LOGD(TAG, "Body (len=%d):\n%s", bodylen, body);
+// returns -1 if the server is unreachable, otherwise the status of the response
+static int
+post_body(https_conn_context_t *ctx, bool *connected, const char *endpoint, const char *content_type, const char *body, size_t bodylen) {
+    if (!strcmp(content_type, JSON_MIME)) {
+        ESP_LOGD(TAG, "Body (len=%d):\n%s", (int)bodylen, body);
+    }
+    else {
+        ESP_LOGD(TAG, "Body (len=%d, type=%s)", (int)bodylen, content_type);
+    }
+    int status;
     do {
         if (!*connected) {
             ESP_LOGI(TAG, "Reconnecting to LRep server");
             if (!https_connect(ctx, DATA_SERVER_NAME, DATA_SERVER_PORT)) {
-                // couldn't connect: drop this report, try again with the next one
-                break;
+                // couldn't connect: keep this report, try again with the next one
+                return -1;
             }
             *connected = true;
         }
-        if (!https_send_request(ctx, "POST", DATA_SERVER_NAME, DATA_PATH, endpoint, "Connection: keep-alive\r\nContent-Type: application/json\r\nContent-Length: %d\r\n", bodylen)
-            || !https_send_data(ctx, body, bodylen)
+        if (!https_send_request(ctx, "POST", DATA_SERVER_NAME, DATA_PATH, endpoint, "Connection: keep-alive\r\nContent-Type: %s\r\nContent-Length: %d\r\n", content_type, bodylen)
+            || !https_send_data(ctx, (const uint8_t*)body, bodylen)
             ) {
             // couldn't send: conn closed?, reconnect, retry
             ESP_LOGW(TAG, "Send failed, reconnect");
@@ -105,10 +185,17 @@ post_body(https_conn_context_t *ctx, bool *connected, const char *endpoint, cons
             *connected = false;
             continue;
         }
-        int status = https_read_statusline(ctx);
+        status = https_read_statusline(ctx);
         ESP_LOGD(TAG, "Report status: %d", status);
-        while (https_read_header(ctx, NULL, NULL)) {
+        unsigned char *name, *value;
+        while (https_read_header(ctx, &name, &value)) {
             // FIXME: handle "Connection: close"
+            if (!strcasecmp((const char*)name, "Accept-Post") && strstr((const char*)value, REPORT_CODEC_MIME)) {
+                if (!use_binary) {
+                    ESP_LOGI(TAG, "Server accepts binary reports");
+                }
+                use_binary = true;
+            }
         }
         while (https_read_body_chunk(ctx, NULL, NULL)) {
         }
@@ -122,16 +209,186 @@ post_body(https_conn_context_t *ctx, bool *connected, const char *endpoint, cons
         else if ((200 <= status) && (status < 300)) {
             // success, done
         }
-        else if ((400 <= status) && (status < 600)) {
-            // 4xx: re-sending the same data wouldn't help
-            // 5xx: Theoretically it would make sense to re-send the same data, so when the server-side error is resolved, it could get
-            // through, but it would be obsolete then, so it's better just to drop this report and try again with the next one
+        else if ((400 <= status) && (status < 500)) {
+            // 4xx: re-sending the same data wouldn't help, the caller drops it
             ESP_LOGE(TAG, "Data report refused: %d", status);
         }
+        else if ((500 <= status) && (status < 600)) {
+            // 5xx: the server is busy (503) or couldn't store it, the caller keeps it and tries again later
+            ESP_LOGW(TAG, "Data report not taken: %d", status);
+        }
     } while (!*connected);
+    return status;
+}
+
+
+static size_t
+format_record(char *body, const report_record_t *rec) {
+    if (rec->flags & REPORT_HAS_FIX) {
+        char ms[8] = "", acc[16] = "";
+        if (rec->flags & REPORT_HAS_MS) {
+            snprintf(ms, sizeof(ms), ".%03u", report_ms(rec));
+        }
+        if (rec->acc != REPORT_ACC_UNKNOWN) {
+            snprintf(acc, sizeof(acc), ",\"acc\":%.1f", rec->acc * 0.1);
+        }
+        // Coordinate precision: https://xkcd.com/2170/
+        return snprintf(body, RECORD_MAX - 1, "{\"time\":%u%s,\"lat\":%.4f,\"lon\":%.4f,\"azi\":%.0f,\"spd\":%.0f%s,\"bat\":%u}",
+            rec->time, ms, rec->lat * 1e-7, rec->lon * 1e-7, rec->azi * 1e-2, rec->spd * 0.036, acc, rec->bat);
+    }
+    return snprintf(body, RECORD_MAX - 1, "{\"time\":%u,\"bat\":%u}", rec->time, rec->bat);
+}
+
+
+// format the oldest queued records into one request body, returns the number of records used
+static size_t
+format_batch(char *body, size_t *bodylen) {
+    report_record_t rec;
+    size_t n;
+    *bodylen = 0;
+    if (use_binary) {
+        report_encoder_t enc;
+        report_encoder_init(&enc, (uint8_t*)body, BODY_MAX);
+        for (n = 0; (n < batch_num) && report_queue_peek(n, &rec) && report_encoder_add(&enc, &rec); ++n) {
+        }
+        *bodylen = enc.len;
+        return n;
+    }
+    if (batch_num <= 1) {
+        if (!report_queue_peek(0, &rec)) {
+            return 0;
+        }
+        *bodylen = format_record(body, &rec);
+        return 1;
+    }
+    char *p = body;
+    *(p++) = '[';
+    for (n = 0; (n < batch_num) && report_queue_peek(n, &rec); ++n) {
+        if (n > 0) {
+            *(p++) = ',';
+        }
+        p += format_record(p, &rec);
+    }
+    *(p++) = ']';
+    *p = '\0';
+    *bodylen = p - body;
+    return n;
+}
+
+
+// is it time to send a (possibly partial) batch?
+static bool
+batch_due(time_t now) {
+    size_t n = report_queue_count();
+    if (n == 0) {
+        return false;
+    }
+    if (n >= batch_num) {
+        return true;
+    }
+    report_record_t oldest;
+    return report_queue_peek(0, &oldest) && ((oldest.time + batch_time) <= now);
+}
+
+
+// send the queued reports in order, stop at the first batch that couldn't get through
+static void
+drain_queue(https_conn_context_t *ctx, bool *connected, char *body, time_t now) {
+    power_enter(POWER_UPLINK);
+    for (int i = 0; (i < DRAIN_MAX) && batch_due(now); ++i) {
+        size_t bodylen;
+        size_t n = format_batch(body, &bodylen);
+        if (n == 0) {
+            break;
+        }
+        int status;
+        if (use_binary) {
+            status = post_body(ctx, connected, DATA_BATCH_ENDPOINT, REPORT_CODEC_MIME, body, bodylen);
+        }
+        else {
+            status = post_body(ctx, connected, (batch_num <= 1) ? DATA_ENDPOINT : DATA_BATCH_ENDPOINT, JSON_MIME, body, bodylen);
+        }
+        if (status < 0) {
+            ESP_LOGI(TAG, "Server unreachable, %u reports queued", (unsigned)report_queue_count());
+            break;
+        }
+        if (status >= 500) {
+            // the records are kept, and sent again in the next cycle
+            ESP_LOGI(TAG, "Server error %d, %u reports queued", status, (unsigned)report_queue_count());
+            break;
+        }
+        if (use_binary && (status == 415)) {
+            // the server doesn't understand our format version: send the same records again as json
+            ESP_LOGW(TAG, "Binary reports refused, falling back to json");
+            use_binary = false;
+            continue;
+        }
+        report_queue_pop(n);
+        power_count_reports(n);
+        if (report_queue_count() == 0) {
+            stage_add(STAGE_ACK, newest_queued_us, esp_timer_get_time());
+            newest_queued_us = 0;
+        }
+    }
+    power_enter(POWER_BUSY);
+}
+
+
+typedef struct {
+    int32_t lat, lon;       // deg * 1e7
+} last_fix_t;
+
+
+static void
+load_last_fix(void) {
+    distance_gate_init(&last_fix, LAST_FIX_SAVE_DIST);
+    nvs_handle nvs;
+    if (nvs_open("lrep", NVS_READONLY, &nvs) != ESP_OK) {
+        return;
+    }
+    last_fix_t lf;
+    size_t len = sizeof(lf);
+    if ((nvs_get_blob(nvs, "last_fix", &lf, &len) == ESP_OK) && (len == sizeof(lf))) {
+        distance_gate_set_ref(&last_fix, lf.lat, lf.lon);
+        ESP_LOGD(TAG, "Last fix: lat=%d, lon=%d", lf.lat, lf.lon);
+    }
+    nvs_close(nvs);
+}
+
+
+static void
+save_last_fix(const gps_fix_t *fix) {
+    if (fix->coarse || (fix->acc > (LAST_FIX_SAVE_ACC * 1000)) || !distance_gate_passed(&last_fix, fix->lat, fix->lon)) {
+        return;
+    }
+    int32_t lat = fix->lat, lon = fix->lon;
+    distance_gate_set_ref(&last_fix, lat, lon);
+    nvs_handle nvs;
+    esp_err_t res = nvs_open("lrep", NVS_READWRITE, &nvs);
+    if (res != ESP_OK) {
+        ESP_LOGE(TAG, "Cannot open NVS for the last fix: %d", res);
+        return;
+    }
+    last_fix_t lf = { .lat = lat, .lon = lon };
+    res = nvs_set_blob(nvs, "last_fix", &lf, sizeof(lf));
+    if (res == ESP_OK) {
+        res = nvs_commit(nvs);
+    }
+    if (res != ESP_OK) {
+        ESP_LOGE(TAG, "Cannot save the last fix: %d", res);
+    }
+    nvs_close(nvs);
 }
 
 
+#ifdef USE_AGPS
+static bool
+agps_body_cb(const uint8_t *data, size_t datalen, void *arg) {
+    return gps_agps_feed((gps_agps_feeder_t*)arg, data, datalen) == ESP_OK;
+}
+#endif // USE_AGPS
+
+
 void
 location_reporter_task(void * pvParameters __attribute__((unused))) {
         ESP_LOGD(TAG, "Checkpt in %s %s:%d", __FUNCTION__, __FILE__, __LINE__);
@@ -140,9 +397,10 @@ location_reporter_task(void * pvParameters __attribute__((unused))) {
     esp_err_t res;
     https_conn_context_t ctx;
     char *url = NULL;
-    uint16_t time_trshld = 0, dist_trshld = 0;
-    TickType_t time_trshld_ticks = portMAX_DELAY;
-    float dist_trshld_deg2 = 40; // > (2*pi)**2
+    uint16_t time_trshld = 0, time_min, time_max, dist_trshld = 0, simpl_err = 0;
+    distance_gate_t dist_gate;
+    track_simplifier_t simplifier;
+    report_scheduler_t scheduler;
 
     char *body = (char*)malloc(BODY_MAX);
     if (!body) {
@@ -152,6 +410,10 @@ location_reporter_task(void * pvParameters __attribute__((unused))) {
     }
     unsigned int bodylen = 0;
 
+    report_queue_init();
+    power_init();
+    load_last_fix();
+
     {
         nvs_handle nvs;
         res = nvs_open("server", NVS_READONLY, &nvs);
@@ -183,21 +445,45 @@ location_reporter_task(void * pvParameters __attribute__((unused))) {
             if (res != ESP_OK) {
                 ESP_LOGW(TAG, "Cannot read LRep time threshold: %d", res);
             }
-            else {
-                time_trshld_ticks = 1000UL * time_trshld / portTICK_PERIOD_MS;
-                ESP_LOGD(TAG, "Time threshold: %u sec = %u ticks", time_trshld, time_trshld_ticks);
+            // without the adaptive bounds it's the fixed time threshold
+            if (nvs_get_u16(nvs, "time_min", &time_min) != ESP_OK) {
+                time_min = time_trshld;
+            }
+            if (nvs_get_u16(nvs, "time_max", &time_max) != ESP_OK) {
+                time_max = time_trshld;
             }
+            report_scheduler_init(&scheduler, time_min, time_max);
+            ESP_LOGD(TAG, "Time threshold: %u .. %u sec", time_min, time_max);
             res = nvs_get_u16(nvs, "dist_trshld", &dist_trshld);
             if (res != ESP_OK) {
                 ESP_LOGW(TAG, "Cannot read LRep distance threshold: %d", res);
+                distance_gate_init(&dist_gate, UINT32_MAX);
             }
             else {
-                dist_trshld_deg2 = 180.0 / M_PI * dist_trshld / R_Earth;
-                dist_trshld_deg2 *= dist_trshld_deg2;
-                ESP_LOGD(TAG, "Distance threshold: %u m = %e deg", dist_trshld, dist_trshld_deg2);
+                distance_gate_init(&dist_gate, dist_trshld);
+                ESP_LOGD(TAG, "Distance threshold: %u m", dist_trshld);
+            }
+            res = nvs_get_u16(nvs, "simpl_err", &simpl_err);
+            if (res != ESP_OK) {
+                simpl_err = 0;
             }
+            track_simplifier_init(&simplifier, simpl_err);
+            ESP_LOGD(TAG, "Track simplification error: %u m", simpl_err);
 
-            ESP_LOGI(TAG, "URL (len=%d) '%s'", url_len, url);
+            res = nvs_get_u16(nvs, "batch_num", &batch_num);
+            if ((res != ESP_OK) || (batch_num < 1)) {
+                batch_num = 1;
+            }
+            else if (batch_num > BATCH_MAX) {
+                batch_num = BATCH_MAX;
+            }
+            res = nvs_get_u16(nvs, "batch_time", &batch_time);
+            if (res != ESP_OK) {
+                batch_time = 0;
+            }
+            ESP_LOGD(TAG, "Batch: max %u reports or %u sec", batch_num, batch_time);
+
+            ESP_LOGI(TAG, "URL (len=%d) '%s'", (int)url_len, url);
             nvs_close(nvs);
         }
     }
@@ -208,6 +494,13 @@ location_reporter_task(void * pvParameters __attribute__((unused))) {
         printf("LRep security error\n");
         goto error;
     }
+    DATA_BATCH_ENDPOINT = (char*)malloc(strlen(DATA_ENDPOINT) + 7);
+    if (!DATA_BATCH_ENDPOINT) {
+        ESP_LOGE(TAG, "Out of memory");
+        printf("LRep mem error\n");
+        goto error;
+    }
+    sprintf(DATA_BATCH_ENDPOINT, "%s/batch", DATA_ENDPOINT);
 
     {
         adc_config_t cfg = {
@@ -247,7 +540,7 @@ location_reporter_task(void * pvParameters __attribute__((unused))) {
             if ((nn->oid.len == 3) && (nn->oid.p[0] == 0x55) && (nn->oid.p[1] == 0x04) && (nn->oid.p[2] == 0x03)) {
                 size_t len = nn->val.len;
                 if (len >= sizeof(unit_name)) {
-                    ESP_LOGE(TAG, "Unit CN too long: %d", len);
+                    ESP_LOGE(TAG, "Unit CN too long: %d", (int)len);
                 }
                 memcpy(unit_name, nn->val.p, len);
                 unit_name[len] = '\0';
@@ -265,82 +558,88 @@ location_reporter_task(void * pvParameters __attribute__((unused))) {
     // send the nonce
     {
         bodylen = snprintf(body, BODY_MAX - 1, "{\"nonce\":%u}", unit_nonce);
-        post_body(&ctx, &connected, "startup", body, bodylen);
+        post_body(&ctx, &connected, "startup", JSON_MIME, body, bodylen);
     }
 
 #ifdef USE_AGPS
     // fetch the AGPS data and send it to gps
     printf("Syncing AGPS\n");
     ESP_LOGI(TAG, "Fetching AGPS data");
-    {
-        uint8_t *agps_data = NULL;
-        do {
-            if (!connected) {
-                ESP_LOGI(TAG, "Reconnecting to LRep server");
-                if (!https_connect(&ctx, DATA_SERVER_NAME, DATA_SERVER_PORT)) {
-                    continue;
-                }
-                connected = true;
-            }
-            if (!https_send_request(&ctx, "GET", DATA_SERVER_NAME, DATA_PATH, "agps", "Connection: keep-alive\r\n")) {
-                // couldn't send: conn closed?, reconnect, retry
-                ESP_LOGW(TAG, "Send failed, reconnect");
-                https_disconnect(&ctx);
-                connected = false;
+    // with a position the server can set up the AID-INI and send only the ephemerides of the visible satellites
+    char agps_resource[64];
+    if (last_fix.has_ref) {
+        snprintf(agps_resource, sizeof(agps_resource), "agps?lat=%d&lon=%d&acc=%u", last_fix.ref_lat, last_fix.ref_lon, LAST_FIX_ACC);
+    }
+    else {
+        strcpy(agps_resource, "agps");
+    }
+    ESP_LOGD(TAG, "AGPS request: %s", agps_resource);
+    do {
+        if (!connected) {
+            ESP_LOGI(TAG, "Reconnecting to LRep server");
+            if (!https_connect(&ctx, DATA_SERVER_NAME, DATA_SERVER_PORT)) {
                 continue;
             }
-            int status = https_read_statusline(&ctx);
-            while (https_read_header(&ctx, NULL, NULL)) {
-                // FIXME: handle "Connection: close"
-            }
-            ESP_LOGD(TAG, "AGPS data length: %d", ctx.content_length);
-
-            uint8_t *chunk, *p;
-            size_t chunk_len;
-            if ((200 <= status) && (status < 300)) {
-                agps_data = (uint8_t*)realloc(agps_data, ctx.content_length);
-                p = agps_data;
-            }
-            else {
-                p = NULL;
-            }
-            while (https_read_body_chunk(&ctx, &chunk, &chunk_len)) {
-                if (p) {
-                    memcpy(p, chunk, chunk_len);
-                    p += chunk_len;
-                }
+            connected = true;
+        }
+        if (!https_send_request(&ctx, "GET", DATA_SERVER_NAME, DATA_PATH, agps_resource, "Connection: keep-alive\r\n")) {
+            // couldn't send: conn closed?, reconnect, retry
+            ESP_LOGW(TAG, "Send failed, reconnect");
+            https_disconnect(&ctx);
+            connected = false;
+            continue;
+        }
+        int status = https_read_statusline(&ctx);
+        while (https_read_header(&ctx, NULL, NULL)) {
+            // FIXME: handle "Connection: close"
+        }
+        ESP_LOGD(TAG, "AGPS data length: %d", (int)ctx.content_length);
+
+        if ((200 <= status) && (status < 300)) {
+            // the messages are passed to gps as they arrive, no need to buffer the whole response
+            gps_agps_feeder_t feeder;
+            gps_agps_feed_init(&feeder);
+            if (https_read_body(&ctx, agps_body_cb, &feeder)) {
+                ESP_LOGI(TAG, "Got AGPS data, len=%u", (unsigned)ctx.content_length);
+                gps_agps_feed_end(&feeder);
             }
+        }
+        else {
+            https_read_body(&ctx, NULL, NULL);
+        }
 
-            if (status < 100) {
-                // couldn't receive: conn closed?, reconnect, retry
-                ESP_LOGW(TAG, "Recv failed, reconnect");
-                https_disconnect(&ctx);
-                connected = false;
-            }
-            else if ((200 <= status) && (status < 300)) {
-                // success, done
-                ESP_LOGI(TAG, "Got AGPS data, len=%u", ctx.content_length);
-                if (agps_data) {
-                    gps_add_agps(agps_data, ctx.content_length);
-                }
-            }
-            else if ((400 <= status) && (status < 600)) {
-                ESP_LOGE(TAG, "AGPS data refused: %d", status);
-            }
-        } while (!connected);
-        if (agps_data) {
-            free(agps_data);
-            agps_data = NULL;
+        if (status < 100) {
+            // couldn't receive: conn closed?, reconnect, retry
+            ESP_LOGW(TAG, "Recv failed, reconnect");
+            https_disconnect(&ctx);
+            connected = false;
         }
-    }
+        else if ((400 <= status) && (status < 600)) {
+            ESP_LOGE(TAG, "AGPS data refused: %d", status);
+        }
+    } while (!connected);
 #endif // USE_AGPS
 
-    float last_latitude = 90.0, last_longitude = 0;
-    time_t last_time = 0;
-
     init_status();
+    time_t last_stats = 0;
+    bool standing = false; // as of the last good fix
     for (keep_running = true; keep_running; ) {
-        EventBits_t uxBits = xEventGroupWaitBits(main_event_group, GOT_GPS_FIX_BIT | GOT_GPS_TIME_BIT, pdTRUE, pdFALSE, time_trshld_ticks);
+        uint32_t interval = report_scheduler_interval(&scheduler);
+        TickType_t wait_ticks = interval ? (1000UL * interval / portTICK_PERIOD_MS) : portMAX_DELAY;
+        power_enter(POWER_WAIT);
+        bool held = standing;
+        if (held) {
+            // sleep through the fixes of a parked unit, then take the newest one
+            TickType_t poll_ticks = 1000UL * STANDING_POLL_SEC / portTICK_PERIOD_MS;
+            if (poll_ticks > wait_ticks) {
+                poll_ticks = wait_ticks;
+            }
+            vTaskDelay(poll_ticks);
+            wait_ticks -= poll_ticks;
+        }
+        EventBits_t uxBits = xEventGroupWaitBits(main_event_group, GOT_GPS_FIX_BIT | GOT_GPS_TIME_BIT, pdTRUE, pdFALSE, wait_ticks);
+        int64_t wake_us = esp_timer_get_time();
+        power_enter(POWER_BUSY);
 
         {
             uint16_t raw_adc;
@@ -359,45 +658,96 @@ location_reporter_task(void * pvParameters __attribute__((unused))) {
 
         time_t tt;
         time(&tt);
-        bodylen = 0;
-        bool do_send = time_trshld && ((last_time + time_trshld) < tt);
+        bool do_queue = false;
+        report_record_t rec = {
+            .time = tt,
+            .bat = adc_mV,
+        };
+        if (uxBits & GOT_GPS_FIX_BIT) {
+            if (!held) {
+                stage_add(STAGE_WAKE, gps_fix.pub_us, wake_us);
+            }
+            if (gps_fix.fix_usec != 0) {
+                // the time of the measurement, not of its processing
+                rec.time = gps_fix.fix_usec / 1000000;
+                rec.flags |= REPORT_HAS_MS | (((gps_fix.fix_usec / 1000) % 1000) << REPORT_MS_SHIFT);
+            }
+            rec.lat = gps_fix.lat;
+            rec.lon = gps_fix.lon;
+            rec.azi = gps_fix.heading / 1000;
+            rec.spd = gps_fix.speed / 10;
+            rec.acc = (gps_fix.acc < (REPORT_ACC_UNKNOWN * 100)) ? (gps_fix.acc / 100) : (REPORT_ACC_UNKNOWN - 1);
+            rec.flags |= REPORT_HAS_FIX;
+            if (!gps_fix.coarse) {
+                standing = rec.spd < REPORT_SCHEDULER_MOVING_SPD;
+                power_set_moving(!standing);
+                save_last_fix(&gps_fix);
+            }
+        }
+        // a coarse fix may go out when a report is due anyway, but it says nothing about the movement
+        bool good_fix = (uxBits & GOT_GPS_FIX_BIT) && !gps_fix.coarse;
+        report_record_t timing = rec;
+        if (!good_fix) {
+            timing.flags &= ~REPORT_HAS_FIX;
+        }
+        // the time threshold adapts to the movement, and turns or speed changes make a report due right away
+        bool time_due = report_scheduler_due(&scheduler, &timing);
+        bool do_send = time_due;
         if (!do_send) {
-            ESP_LOGD(TAG, "Time trshld not reached, last_time=%lu, time_trshld=%u, tt=%lu", last_time, time_trshld, tt);
+            ESP_LOGD(TAG, "Time trshld not reached, interval=%u, tt=%lu", interval, tt);
         }
-        if (uxBits & GOT_GPS_FIX_BIT) {
+        if (good_fix) {
             // check if the time limit is exceeded
             if (!do_send) {
                 // check if the distance is more than the threshold
-                // NOTE: not the correct formula (https://en.wikipedia.org/wiki/Great-circle_distance#Computational_formulas)
-                // but only an approximation
-                float delta_lat = gps_fix.latitude - last_latitude;
-                float delta_lon = gps_fix.longitude - last_longitude;
-                float delta_square = delta_lat * delta_lat + delta_lon * delta_lon;
-                if (delta_square > dist_trshld_deg2) {
+                if (distance_gate_passed(&dist_gate, gps_fix.lat, gps_fix.lon)) {
                     do_send = true;
                 }
                 else {
-                    ESP_LOGD(TAG, "Not far enough; d2=%e, trshld=%e", delta_square, dist_trshld_deg2);
+                    ESP_LOGD(TAG, "Not far enough; d=%u m, trshld=%u m", distance_gate_distance(&dist_gate, gps_fix.lat, gps_fix.lon), dist_trshld);
                 }
             }
             if (do_send) {
-                // Coordinate precision: https://xkcd.com/2170/
-                // { unit: \"test-1\", time: 1608739445000, lat: 25.04, lon: 55.25, alt: 30.11, battery: 3278.123 }
-                last_latitude = gps_fix.latitude;
-                last_longitude = gps_fix.longitude;
-                bodylen = snprintf(body, BODY_MAX - 1, "{\"lat\":%.4f,\"lon\":%.4f,\"azi\":%.0f,\"spd\":%.0f,\"bat\":%u}",
-                    gps_fix.latitude, gps_fix.longitude, gps_fix.azimuth, gps_fix.speed_kph, adc_mV);
-                ESP_LOGD(TAG, "Sending fix (len=%d):\n%s", bodylen, body);
-                last_time = tt;
+                distance_gate_set_ref(&dist_gate, gps_fix.lat, gps_fix.lon);
+
+                // only the points needed to reproduce the track get reported, but the time threshold still forces one out
+                report_record_t out;
+                if (track_simplifier_add(&simplifier, &rec, &out)) {
+                    report_queue_push(&out);
+                    do_queue = true;
+                }
+                if (time_due && track_simplifier_flush(&simplifier, &out)) {
+                    report_queue_push(&out);
+                    do_queue = true;
+                }
             }
         }
         else if (do_send) {
-            ESP_LOGD(TAG, "No fix; uxBits=0x%u", uxBits);
-            bodylen = snprintf(body, BODY_MAX - 1, "{\"bat\":%u}", adc_mV);
+            ESP_LOGD(TAG, "No good fix; uxBits=0x%u, coarse=%d", uxBits, gps_fix.coarse);
+            report_queue_push(&rec);
+            do_queue = true;
+        }
+        if (do_queue) {
+            report_scheduler_sent(&scheduler, &timing);
+            if (rec.flags & REPORT_HAS_FIX) {
+                newest_queued_us = esp_timer_get_time();
+                stage_add(STAGE_QUEUE, wake_us, newest_queued_us);
+            }
+            else {
+                newest_queued_us = 0;
+            }
         }
 
-        if (bodylen > 0) {
-            post_body(&ctx, &connected, DATA_ENDPOINT, body, bodylen);
+        if ((do_queue || connected) && batch_due(tt)) {
+            // while offline, retry connecting only when there's something new to report
+            drain_queue(&ctx, &connected, body, tt);
+        }
+
+        if ((tt - last_stats) >= STAGE_STATS_PERIOD_SEC) {
+            if (last_stats != 0) {
+                log_stage_stats();
+            }
+            last_stats = tt;
         }
     }
     if (connected) {
@@ -413,6 +763,11 @@ error:
         body = NULL;
     }
 
+    if (DATA_BATCH_ENDPOINT) {
+        free(DATA_BATCH_ENDPOINT);
+        DATA_BATCH_ENDPOINT = NULL;
+    }
+
     if (url) {
         free(url);
         url = NULL;
@@ -0,0 +1,65 @@
+#include "report_codec.h"
+
+#include <string.h>
+
+static uint8_t *
+put_varint(uint8_t *p, uint32_t x) {
+    while (x >= 0x80) {
+        *(p++) = (x & 0x7f) | 0x80;
+        x >>= 7;
+    }
+    *(p++) = x;
+    return p;
+}
+
+
+static uint8_t *
+put_delta(uint8_t *p, uint32_t x, uint32_t prev) {
+    int32_t d = (int32_t)(x - prev); // wraps around, and so will the decoder
+    return put_varint(p, ((uint32_t)d << 1) ^ (uint32_t)(d >> 31));
+}
+
+
+void
+report_encoder_init(report_encoder_t *self, uint8_t *buf, size_t size) {
+    self->buf = buf;
+    self->size = size;
+    self->len = 2;
+    memset(&self->prev, 0, sizeof(self->prev));
+    buf[0] = REPORT_CODEC_VERSION;
+    buf[1] = 0;
+}
+
+
+bool
+report_encoder_add(report_encoder_t *self, const report_record_t *rec) {
+    if ((self->buf[1] == REPORT_CODEC_COUNT_MAX) || ((self->len + REPORT_CODEC_RECORD_MAX) > self->size)) {
+        return false;
+    }
+    uint8_t *p = self->buf + self->len;
+    *(p++) = rec->flags & REPORT_FLAGS_MASK;
+    p = put_delta(p, rec->time, self->prev.time);
+    if (rec->flags & REPORT_HAS_MS) {
+        p = put_delta(p, report_ms(rec), 0);
+    }
+    if (rec->flags & REPORT_HAS_FIX) {
+        p = put_delta(p, rec->lat, self->prev.lat);
+        p = put_delta(p, rec->lon, self->prev.lon);
+        p = put_delta(p, rec->azi, self->prev.azi);
+        p = put_delta(p, rec->spd, self->prev.spd);
+        p = put_delta(p, rec->acc, self->prev.acc);
+        self->prev.lat = rec->lat;
+        self->prev.lon = rec->lon;
+        self->prev.azi = rec->azi;
+        self->prev.spd = rec->spd;
+        self->prev.acc = rec->acc;
+    }
+    p = put_delta(p, rec->bat, self->prev.bat);
+    self->prev.time = rec->time;
+    self->prev.bat = rec->bat;
+    self->len = p - self->buf;
+    ++self->buf[1];
+    return true;
+}
+
+// vim: set sw=4 ts=4 indk= et si:
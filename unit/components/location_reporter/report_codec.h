@@ -0,0 +1,36 @@
+#ifndef REPORT_CODEC_H
+#define REPORT_CODEC_H
+
+#include "report_queue.h"
+
+/* Binary report format, version 3:
+ *
+ * u8 version, u8 count, then count records, each is
+ *   u8 flags (REPORT_* & REPORT_FLAGS_MASK),
+ *   varint time,
+ *   if flags & REPORT_HAS_MS: varint ms (since version 2)
+ *   if flags & REPORT_HAS_FIX: varint lat, varint lon, varint azi, varint spd, varint acc (since version 3),
+ *   varint bat
+ *
+ * Every varint is the zigzag-encoded 32-bit wrapping difference to the same field of the previous record (or to 0 for
+ * the first one), in LEB128 form, except ms, which is always the difference to 0. Units are the same as in
+ * report_record_t.
+ */
+
+#define REPORT_CODEC_MIME       "application/vnd.gpsunit.report"
+#define REPORT_CODEC_VERSION    3
+#define REPORT_CODEC_COUNT_MAX  255
+#define REPORT_CODEC_RECORD_MAX (1 + 8 * 5)
+
+typedef struct {
+    uint8_t *buf;
+    size_t size, len;
+    report_record_t prev;
+} report_encoder_t;
+
+void report_encoder_init(report_encoder_t *self, uint8_t *buf, size_t size);
+// returns false if there is no room for another record
+bool report_encoder_add(report_encoder_t *self, const report_record_t *rec);
+
+#endif // REPORT_CODEC_H
+// vim: set sw=4 ts=4 indk= et si:
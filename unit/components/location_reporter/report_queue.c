@@ -0,0 +1,410 @@
+#include "report_queue.h"
+
+#include <esp_partition.h>
+#include <esp_spi_flash.h>
+
+#undef LOG_LOCAL_LEVEL
+#define LOG_LOCAL_LEVEL ESP_LOG_DEBUG
+#include <esp_log.h>
+
+#include <string.h>
+#include <stddef.h>
+
+static const char *TAG = "lrepq";
+
+/* The flash spill area is a circular log of fixed-size slots.
+ *
+ * A slot is written only once after its sector has been erased, and the only further write to it is clearing the
+ * 'consumed' word when it was sent. Of a popped range only the last slot in each sector is marked, because the
+ * consumption is in-order anyway. So after a power loss the pending records are the valid ones newer than the newest
+ * consumed one. Every sector that has consumed slots carries its own mark, so no sector depends on the mark in another
+ * one that may be erased earlier.
+ *
+ * A torn slot write (power lost in the middle of it) is detected by the crc, such slots are zeroed and skipped.
+ */
+
+#define SLOT_SIZE           32
+#define SLOTS_PER_SECTOR    (SPI_FLASH_SEC_SIZE / SLOT_SIZE)
+#define SEQ_ERASED          0xffffffff
+
+typedef struct {
+    uint32_t seq;
+    // the fields of report_record_t
+    uint32_t time;
+    int32_t  lat, lon;
+    uint16_t azi, spd, bat, flags;
+    uint16_t crc;
+    uint16_t acc;           // it was a reserved 0xffff before, so it's covered by the crc only if it's not that
+    uint32_t consumed;      // 0xffffffff: pending, anything else: consumed
+} flash_slot_t;
+
+_Static_assert(sizeof(flash_slot_t) == SLOT_SIZE, "flash_slot_t size mismatch");
+
+static const esp_partition_t *part = NULL;
+static size_t num_slots;
+static size_t head;         // the slot to write next
+static size_t tail;         // the oldest pending slot
+static size_t flash_count;  // number of valid pending slots
+static uint32_t next_seq = 1;
+
+static report_record_t ram[REPORT_QUEUE_RAM_LEN];
+static size_t ram_rd, ram_count;
+static uint32_t dropped;
+
+
+static uint16_t
+crc16(uint16_t crc, const uint8_t *data, size_t len) {
+    while (len--) {
+        crc ^= ((uint16_t)*(data++)) << 8;
+        for (int i = 0; i < 8; ++i) {
+            crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+        }
+    }
+    return crc;
+}
+
+
+static uint16_t
+slot_crc(const flash_slot_t *slot) {
+    uint16_t crc = crc16(0xffff, (const uint8_t*)slot, offsetof(flash_slot_t, crc));
+    if (slot->acc != REPORT_ACC_UNKNOWN) {
+        crc = crc16(crc, (const uint8_t*)&slot->acc, sizeof(slot->acc));
+    }
+    return crc;
+}
+
+
+static void
+slot_to_record(const flash_slot_t *slot, report_record_t *rec) {
+    rec->time = slot->time;
+    rec->lat = slot->lat;
+    rec->lon = slot->lon;
+    rec->azi = slot->azi;
+    rec->spd = slot->spd;
+    rec->bat = slot->bat;
+    rec->flags = slot->flags;
+    rec->acc = slot->acc;
+}
+
+
+static void
+flash_disable(const char *op, esp_err_t res) {
+    ESP_LOGE(TAG, "Flash %s failed: %d, %u records lost", op, res, (unsigned)flash_count);
+    dropped += flash_count;
+    flash_count = 0;
+    part = NULL;
+}
+
+
+static bool
+read_slot(size_t pos, flash_slot_t *slot) {
+    esp_err_t res = esp_partition_read(part, pos * SLOT_SIZE, slot, SLOT_SIZE);
+    if (res != ESP_OK) {
+        flash_disable("read", res);
+        return false;
+    }
+    return true;
+}
+
+
+static bool
+is_valid(const flash_slot_t *slot) {
+    return (slot->seq != SEQ_ERASED) && (slot->crc == slot_crc(slot));
+}
+
+
+static bool
+is_erased(const flash_slot_t *slot) {
+    const uint8_t *p = (const uint8_t*)slot;
+    for (size_t i = 0; i < SLOT_SIZE; ++i) {
+        if (p[i] != 0xff) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+// find the next valid slot at or after @pos, but not beyond the head
+static bool
+next_valid(size_t *pos, flash_slot_t *slot) {
+    while (*pos != head) {
+        if (!read_slot(*pos, slot)) {
+            return false;
+        }
+        if (is_valid(slot)) {
+            return true;
+        }
+        *pos = (*pos + 1) % num_slots;
+    }
+    return false;
+}
+
+
+static void
+flash_recover(void) {
+    bool found = false, found_consumed = false;
+    uint32_t max_seq = 0, max_consumed_seq = 0;
+    size_t max_pos = 0;
+    flash_slot_t slot;
+
+    for (size_t pos = 0; pos < num_slots; ++pos) {
+        if (!read_slot(pos, &slot)) {
+            return;
+        }
+        if (!is_valid(&slot)) {
+            continue;
+        }
+        if (!found || (slot.seq > max_seq)) {
+            max_seq = slot.seq;
+            max_pos = pos;
+            found = true;
+        }
+        if ((slot.consumed != 0xffffffff) && (!found_consumed || (slot.seq > max_consumed_seq))) {
+            max_consumed_seq = slot.seq;
+            found_consumed = true;
+        }
+    }
+
+    if (!found) {
+        head = tail = flash_count = 0;
+        next_seq = 1;
+        ESP_LOGI(TAG, "Flash log empty, %u slots", (unsigned)num_slots);
+        return;
+    }
+
+    head = (max_pos + 1) % num_slots;
+    next_seq = max_seq + 1;
+
+    // the oldest pending one is the valid slot with the lowest seq above the last consumed one
+    bool found_tail = false;
+    uint32_t tail_seq = 0;
+    flash_count = 0;
+    for (size_t pos = 0; pos < num_slots; ++pos) {
+        if (!read_slot(pos, &slot)) {
+            return;
+        }
+        if (!is_valid(&slot) || (found_consumed && (slot.seq <= max_consumed_seq))) {
+            continue;
+        }
+        ++flash_count;
+        if (!found_tail || (slot.seq < tail_seq)) {
+            tail_seq = slot.seq;
+            tail = pos;
+            found_tail = true;
+        }
+    }
+    if (!found_tail) {
+        tail = head;
+    }
+
+    // a torn write may have left garbage where we'd write next: clear and skip it
+    while ((head % SLOTS_PER_SECTOR) != 0) {
+        if (!read_slot(head, &slot)) {
+            return;
+        }
+        if (is_erased(&slot)) {
+            break;
+        }
+        ESP_LOGW(TAG, "Skipping torn slot %u", (unsigned)head);
+        memset(&slot, 0, sizeof(slot));
+        esp_err_t res = esp_partition_write(part, head * SLOT_SIZE, &slot, SLOT_SIZE);
+        if (res != ESP_OK) {
+            flash_disable("write", res);
+            return;
+        }
+        head = (head + 1) % num_slots;
+    }
+
+    ESP_LOGI(TAG, "Flash log recovered, pending=%u, head=%u, tail=%u, next_seq=%u", (unsigned)flash_count, (unsigned)head, (unsigned)tail, (unsigned)next_seq);
+}
+
+
+static bool
+flash_push(const report_record_t *rec) {
+    if ((head % SLOTS_PER_SECTOR) == 0) {
+        size_t sector = head / SLOTS_PER_SECTOR;
+        if ((flash_count > 0) && ((tail / SLOTS_PER_SECTOR) == sector)) {
+            // wrapped around: the oldest sector gets sacrificed
+            size_t next_sector_start = ((sector + 1) * SLOTS_PER_SECTOR) % num_slots;
+            size_t lost = 0;
+            flash_slot_t slot;
+            for (size_t pos = tail; pos != next_sector_start; pos = (pos + 1) % num_slots) {
+                if (!read_slot(pos, &slot)) {
+                    return false;
+                }
+                if (is_valid(&slot)) {
+                    ++lost;
+                }
+            }
+            ESP_LOGW(TAG, "Flash log full, dropping %u records", (unsigned)lost);
+            dropped += lost;
+            flash_count -= lost;
+            tail = next_sector_start;
+            if (flash_count == 0) {
+                tail = head;
+            }
+        }
+        esp_err_t res = esp_partition_erase_range(part, sector * SPI_FLASH_SEC_SIZE, SPI_FLASH_SEC_SIZE);
+        if (res != ESP_OK) {
+            flash_disable("erase", res);
+            return false;
+        }
+    }
+
+    flash_slot_t slot = {
+        .seq = next_seq++,
+        .time = rec->time,
+        .lat = rec->lat,
+        .lon = rec->lon,
+        .azi = rec->azi,
+        .spd = rec->spd,
+        .bat = rec->bat,
+        .flags = rec->flags,
+        .acc = rec->acc,
+        .consumed = 0xffffffff,
+    };
+    slot.crc = slot_crc(&slot);
+    esp_err_t res = esp_partition_write(part, head * SLOT_SIZE, &slot, SLOT_SIZE);
+    if (res != ESP_OK) {
+        flash_disable("write", res);
+        return false;
+    }
+    if (flash_count == 0) {
+        tail = head;
+    }
+    head = (head + 1) % num_slots;
+    ++flash_count;
+    return true;
+}
+
+
+static bool
+mark_consumed(size_t pos) {
+    uint32_t consumed = 0;
+    esp_err_t res = esp_partition_write(part, pos * SLOT_SIZE + offsetof(flash_slot_t, consumed), &consumed, sizeof(consumed));
+    if (res != ESP_OK) {
+        flash_disable("write", res);
+        return false;
+    }
+    return true;
+}
+
+
+static void
+flash_pop(size_t n) {
+    if (n == 0) {
+        return;
+    }
+    flash_slot_t slot;
+    bool have_last = false;
+    size_t last = tail;
+    while ((n > 0) && (flash_count > 0)) {
+        if (!next_valid(&tail, &slot)) {
+            return;
+        }
+        if (have_last && ((last / SLOTS_PER_SECTOR) != (tail / SLOTS_PER_SECTOR)) && !mark_consumed(last)) {
+            return;
+        }
+        last = tail;
+        have_last = true;
+        tail = (tail + 1) % num_slots;
+        --flash_count;
+        --n;
+    }
+    if (have_last && !mark_consumed(last)) {
+        return;
+    }
+    if (flash_count == 0) {
+        tail = head;
+    }
+}
+
+
+bool
+report_queue_init(void) {
+    ram_rd = ram_count = 0;
+    dropped = 0;
+    part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, REPORT_QUEUE_PARTITION_SUBTYPE, REPORT_QUEUE_PARTITION_LABEL);
+    if (!part) {
+        ESP_LOGW(TAG, "No '%s' partition, queueing only %u records in RAM", REPORT_QUEUE_PARTITION_LABEL, REPORT_QUEUE_RAM_LEN);
+        return false;
+    }
+    num_slots = (part->size / SPI_FLASH_SEC_SIZE) * SLOTS_PER_SECTOR;
+    if (num_slots == 0) {
+        ESP_LOGE(TAG, "Partition '%s' too small: 0x%x", REPORT_QUEUE_PARTITION_LABEL, part->size);
+        part = NULL;
+        return false;
+    }
+    flash_recover();
+    return part != NULL;
+}
+
+
+bool
+report_queue_push(const report_record_t *rec) {
+    if (ram_count == REPORT_QUEUE_RAM_LEN) {
+        // no room in RAM: move the oldest one to flash, or drop it if that's not possible
+        if (!part || !flash_push(&ram[ram_rd])) {
+            ++dropped;
+            ESP_LOGW(TAG, "Queue full, dropped=%u", dropped);
+        }
+        ram_rd = (ram_rd + 1) % REPORT_QUEUE_RAM_LEN;
+        --ram_count;
+    }
+    ram[(ram_rd + ram_count) % REPORT_QUEUE_RAM_LEN] = *rec;
+    ++ram_count;
+    return true;
+}
+
+
+size_t
+report_queue_count(void) {
+    return (part ? flash_count : 0) + ram_count;
+}
+
+
+bool
+report_queue_peek(size_t idx, report_record_t *rec) {
+    if (part && (idx < flash_count)) {
+        // everything in flash is older than anything in RAM
+        flash_slot_t slot;
+        size_t pos = tail;
+        for (;;) {
+            if (!next_valid(&pos, &slot)) {
+                return false;
+            }
+            if (idx-- == 0) {
+                break;
+            }
+            pos = (pos + 1) % num_slots;
+        }
+        slot_to_record(&slot, rec);
+        return true;
+    }
+    if (part) {
+        idx -= flash_count;
+    }
+    if (idx >= ram_count) {
+        return false;
+    }
+    *rec = ram[(ram_rd + idx) % REPORT_QUEUE_RAM_LEN];
+    return true;
+}
+
+
+void
+report_queue_pop(size_t n) {
+    if (part && (flash_count > 0)) {
+        size_t from_flash = (n < flash_count) ? n : flash_count;
+        flash_pop(from_flash);
+        n -= from_flash;
+    }
+    if (n > ram_count) {
+        n = ram_count;
+    }
+    ram_rd = (ram_rd + n) % REPORT_QUEUE_RAM_LEN;
+    ram_count -= n;
+}
+
+// vim: set sw=4 ts=4 indk= et si:
@@ -0,0 +1,41 @@
+#ifndef REPORT_QUEUE_H
+#define REPORT_QUEUE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// the records that couldn't be sent yet are kept in RAM, and if that's full, the oldest ones are spilled to this partition
+#define REPORT_QUEUE_PARTITION_SUBTYPE  0x40
+#define REPORT_QUEUE_PARTITION_LABEL    "lrepq"
+
+#define REPORT_QUEUE_RAM_LEN            16
+
+#define REPORT_HAS_FIX                  0x0001
+#define REPORT_HAS_MS                   0x0002  // the millisecond part of the time is in the upper bits of the flags
+#define REPORT_FLAGS_MASK               0x003f
+#define REPORT_MS_SHIFT                 6
+#define REPORT_ACC_UNKNOWN              0xffff
+
+typedef struct {
+    uint32_t time;          // unix time, sec
+    int32_t  lat, lon;      // deg * 1e7
+    uint16_t azi;           // deg * 1e2
+    uint16_t spd;           // cm/s
+    uint16_t bat;           // mV
+    uint16_t flags;         // REPORT_*, and the ms above REPORT_MS_SHIFT
+    uint16_t acc;           // dm, the estimated horizontal error of the fix
+} report_record_t;
+
+static inline uint16_t report_ms(const report_record_t *rec) { return rec->flags >> REPORT_MS_SHIFT; }
+
+bool report_queue_init(void);
+bool report_queue_push(const report_record_t *rec);
+size_t report_queue_count(void);
+// @idx = 0 is the oldest record
+bool report_queue_peek(size_t idx, report_record_t *rec);
+// drop the oldest @n records (after they were sent)
+void report_queue_pop(size_t n);
+
+#endif // REPORT_QUEUE_H
+// vim: set sw=4 ts=4 indk= et si:
@@ -0,0 +1,67 @@
+#include "report_scheduler.h"
+
+#include <stdlib.h>
+
+
+static bool
+is_moving(const report_record_t *rec) {
+    return (rec->flags & REPORT_HAS_FIX) && (rec->spd >= REPORT_SCHEDULER_MOVING_SPD);
+}
+
+
+void
+report_scheduler_init(report_scheduler_t *self, uint16_t min_s, uint16_t max_s) {
+    self->min_s = min_s;
+    self->max_s = (max_s < min_s) ? min_s : max_s;
+    self->interval = min_s;
+    self->has_last = false;
+}
+
+
+bool
+report_scheduler_due(const report_scheduler_t *self, const report_record_t *rec) {
+    if (!self->has_last) {
+        return self->min_s != 0;
+    }
+    const report_record_t *last = &self->last;
+    if (is_moving(rec) && is_moving(last)) {
+        // the heading is meaningful only while moving
+        int d = abs((int)rec->azi - (int)last->azi);
+        if (d > 18000) {
+            d = 36000 - d;
+        }
+        if (d > REPORT_SCHEDULER_TURN_AZI) {
+            return true;
+        }
+    }
+    if ((rec->flags & REPORT_HAS_FIX) && (last->flags & REPORT_HAS_FIX) && (abs((int)rec->spd - (int)last->spd) > REPORT_SCHEDULER_SPD_CHANGE)) {
+        return true;
+    }
+    // without time-based reports only the turns and the speed changes above make one due
+    return (self->interval != 0) && ((last->time + self->interval) <= rec->time);
+}
+
+
+void
+report_scheduler_sent(report_scheduler_t *self, const report_record_t *rec) {
+    if (is_moving(rec) || !self->has_last) {
+        self->interval = self->min_s;
+    }
+    else {
+        // standing: back off exponentially
+        self->interval *= 2;
+        if (self->interval > self->max_s) {
+            self->interval = self->max_s;
+        }
+    }
+    self->last = *rec;
+    self->has_last = true;
+}
+
+
+uint32_t
+report_scheduler_interval(const report_scheduler_t *self) {
+    return self->interval;
+}
+
+// vim: set sw=4 ts=4 indk= et si:
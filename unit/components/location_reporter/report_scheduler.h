@@ -0,0 +1,35 @@
+#ifndef REPORT_SCHEDULER_H
+#define REPORT_SCHEDULER_H
+
+#include "report_queue.h"
+
+#include <time.h>
+
+/* Adaptive time threshold for the reports.
+ *
+ * While moving, a report is due after min_s seconds, or immediately on a turn or a sudden change of speed.
+ * While standing (or without a fix), the interval doubles after every report, up to max_s seconds.
+ * With min_s == 0 there are no time-based reports at all, only the ones on turns and speed changes.
+ */
+
+#define REPORT_SCHEDULER_MOVING_SPD     50      // cm/s
+#define REPORT_SCHEDULER_TURN_AZI       1500    // deg * 1e2
+#define REPORT_SCHEDULER_SPD_CHANGE     150     // cm/s
+
+typedef struct {
+    uint16_t min_s, max_s;
+    uint32_t interval;          // sec
+    bool has_last;
+    report_record_t last;       // the last reported one
+} report_scheduler_t;
+
+void report_scheduler_init(report_scheduler_t *self, uint16_t min_s, uint16_t max_s);
+// is it time to report @rec?
+bool report_scheduler_due(const report_scheduler_t *self, const report_record_t *rec);
+// @rec has been reported
+void report_scheduler_sent(report_scheduler_t *self, const report_record_t *rec);
+// the current interval in sec, 0 if there are no time-based reports
+uint32_t report_scheduler_interval(const report_scheduler_t *self);
+
+#endif // REPORT_SCHEDULER_H
+// vim: set sw=4 ts=4 indk= et si:
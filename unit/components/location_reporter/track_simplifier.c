@@ -0,0 +1,89 @@
+#include "track_simplifier.h"
+
+#include <math.h>
+
+#define R_Earth 6.371009e6
+#define M_PER_E7 ((float)(R_Earth * M_PI / 180.0 / 1e7))
+
+
+static void
+set_anchor(track_simplifier_t *self, const report_record_t *rec) {
+    self->anchor = *rec;
+    self->has_anchor = true;
+    self->m_per_e7_lon = M_PER_E7 * cosf(rec->lat * (float)(M_PI / 180.0 / 1e7));
+}
+
+
+// the time of @q since @a in ms, with the ms parts of both; 64 bits, as a parking of a few weeks would overflow 32
+static int64_t
+since_ms(const report_record_t *a, const report_record_t *q) {
+    int64_t ms = 1000LL * (int32_t)(q->time - a->time);
+    if (q->flags & REPORT_HAS_MS) {
+        ms += report_ms(q);
+    }
+    if (a->flags & REPORT_HAS_MS) {
+        ms -= report_ms(a);
+    }
+    return ms;
+}
+
+
+// is @q within max_err from where it would be at its time on the anchor -> @end segment?
+static bool
+is_close(const track_simplifier_t *self, const report_record_t *end, const report_record_t *q) {
+    const report_record_t *a = &self->anchor;
+    int64_t span_ms = since_ms(a, end);
+    float ratio = span_ms ? ((float)since_ms(a, q) / (float)span_ms) : 0;
+    float dy = ((float)(q->lat - a->lat) - ratio * (float)(end->lat - a->lat)) * M_PER_E7;
+    float dx = ((float)(q->lon - a->lon) - ratio * (float)(end->lon - a->lon)) * self->m_per_e7_lon;
+    float max_err = self->max_err_m;
+    return (dx * dx + dy * dy) <= (max_err * max_err);
+}
+
+
+void
+track_simplifier_init(track_simplifier_t *self, uint32_t max_err_m) {
+    self->max_err_m = max_err_m;
+    self->has_anchor = false;
+    self->len = 0;
+}
+
+
+bool
+track_simplifier_add(track_simplifier_t *self, const report_record_t *rec, report_record_t *out) {
+    if ((self->max_err_m == 0) || !self->has_anchor) {
+        set_anchor(self, rec);
+        *out = *rec;
+        return true;
+    }
+
+    bool fits = self->len < TRACK_SIMPLIFIER_WINDOW;
+    for (size_t i = 0; fits && (i < self->len); ++i) {
+        fits = is_close(self, rec, &self->win[i]);
+    }
+    if (fits) {
+        self->win[self->len++] = *rec;
+        return false;
+    }
+
+    // the previous end is needed: emit it, and restart the window from there
+    *out = self->win[self->len - 1];
+    set_anchor(self, out);
+    self->win[0] = *rec;
+    self->len = 1;
+    return true;
+}
+
+
+bool
+track_simplifier_flush(track_simplifier_t *self, report_record_t *out) {
+    if (self->len == 0) {
+        return false;
+    }
+    *out = self->win[self->len - 1];
+    set_anchor(self, out);
+    self->len = 0;
+    return true;
+}
+
+// vim: set sw=4 ts=4 indk= et si:
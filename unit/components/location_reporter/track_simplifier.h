@@ -0,0 +1,34 @@
+#ifndef TRACK_SIMPLIFIER_H
+#define TRACK_SIMPLIFIER_H
+
+#include "report_queue.h"
+
+/* Streaming line simplification of the reported track (opening window, Douglas-Peucker style).
+ *
+ * The last emitted point is the anchor, and the fixes after it are collected in a window. A new fix is accepted as the
+ * tentative end of the segment from the anchor if all the points in the window are within max_err of where they'd
+ * be on that segment at their own time (synchronous euclidean distance, so stops and speed changes are kept).
+ * If not, or the window is full, the previous end is emitted and becomes the new anchor.
+ *
+ * With max_err == 0 every fix is emitted as-is.
+ */
+
+#define TRACK_SIMPLIFIER_WINDOW 16
+
+typedef struct {
+    uint32_t max_err_m;
+    bool has_anchor;
+    report_record_t anchor;
+    report_record_t win[TRACK_SIMPLIFIER_WINDOW]; // the last one is the tentative end
+    size_t len;
+    float m_per_e7_lon;         // at the latitude of the anchor
+} track_simplifier_t;
+
+void track_simplifier_init(track_simplifier_t *self, uint32_t max_err_m);
+// returns true if @out is a point to report
+bool track_simplifier_add(track_simplifier_t *self, const report_record_t *rec, report_record_t *out);
+// returns true if there is a not yet reported end point, which is then moved to @out
+bool track_simplifier_flush(track_simplifier_t *self, report_record_t *out);
+
+#endif // TRACK_SIMPLIFIER_H
+// vim: set sw=4 ts=4 indk= et si:
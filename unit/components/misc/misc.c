@@ -66,7 +66,7 @@ hexdump(const uint8_t *data, ssize_t len) {
     while (len > 0) {
         int i;
         char *p = linebuf;
-        p += sprintf(p, "%04x:", offs);
+        p += sprintf(p, "%04x:", (unsigned)offs);
         for (i = 0; (i < len) && (i < 0x10); ++i) {
             p += sprintf(p, " %02x", data[i]);
         }
@@ -122,7 +122,7 @@ task_info(void) {
 
     ESP_LOGD(TAG, "Tasks:\n%s", buf);
     free(buf);
-    ESP_LOGD(TAG, "Heap free: %u", heap_available());
+    ESP_LOGD(TAG, "Heap free: %u", (unsigned)heap_available());
 
     /*struct mallinfo mi = mallinfo();
     ESP_LOGD(TAG, "mem heap=%u, hwm=%u, alloc=%u, free=%u", mi.arena, mi.usmblks, mi.uordblks, mi.fordblks);*/
@@ -0,0 +1,173 @@
+#include "power_mgmt.h"
+#include "gps.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <esp_wifi.h>
+#include <esp_timer.h>
+
+#include <string.h>
+
+#undef LOG_LOCAL_LEVEL
+#define LOG_LOCAL_LEVEL ESP_LOG_DEBUG
+#include <esp_log.h>
+
+static const char *TAG = "power";
+
+// the gps goes to power save mode only after standing for this long
+#define STANDING_SEC_MIN    60
+#define STATS_PERIOD_SEC    600
+
+// nominal currents from the datasheets, only for estimating the consumption
+#define MA_WAIT             15      // esp8266 modem sleep
+#define MA_BUSY             30
+#define MA_UPLINK           80      // esp8266 rx/tx average
+#define MA_GPS              40      // neo-6 continuous tracking
+#define MA_GPS_PS           12      // neo-6 cyclic tracking
+
+const char *power_state_names[] = {
+    "wait",
+    "busy",
+    "uplink",
+};
+
+static const uint16_t state_mA[POWER_STATE_MAX] = { MA_WAIT, MA_BUSY, MA_UPLINK };
+
+static power_state_t state = POWER_BUSY;
+static int cpu_mhz = 160;
+static int64_t state_since, standing_since, last_stats;
+static bool gps_ps = false;
+static power_stats_t stats;
+
+
+static void
+set_cpu(int mhz) {
+    if (mhz != cpu_mhz) {
+        esp_set_cpu_freq((mhz == 80) ? ESP_CPU_FREQ_80M : ESP_CPU_FREQ_160M);
+        cpu_mhz = mhz;
+    }
+}
+
+
+static void
+set_gps_ps(bool on) {
+    if (on == gps_ps) {
+        return;
+    }
+    if (gps_set_power_save(on) != ESP_OK) {
+        return;
+    }
+    ESP_LOGI(TAG, "GPS power save %s", on ? "on" : "off");
+    gps_ps = on;
+}
+
+
+static void
+log_stats(void) {
+    uint64_t total = 0;
+    uint64_t uAs = 0; // msec * mA
+    for (int i = 0; i < POWER_STATE_MAX; ++i) {
+        total += stats.state_usec[i];
+        uAs += (stats.state_usec[i] / 1000) * state_mA[i];
+        ESP_LOGI(TAG, "State %-6s: %llu sec", power_state_names[i], (unsigned long long)(stats.state_usec[i] / 1000000));
+    }
+    uAs += ((total - stats.gps_ps_usec) / 1000) * MA_GPS + (stats.gps_ps_usec / 1000) * MA_GPS_PS;
+    uint32_t uAh = uAs / 3600;
+    ESP_LOGI(TAG, "GPS power save: %llu sec of %llu, reports: %u, est. %u.%03u mAh, %u uAh/report",
+        (unsigned long long)(stats.gps_ps_usec / 1000000), (unsigned long long)(total / 1000000), stats.reports, uAh / 1000, uAh % 1000,
+        stats.reports ? (uAh / stats.reports) : 0);
+}
+
+
+static void
+account(int64_t now) {
+    int64_t dt = now - state_since;
+    stats.state_usec[state] += dt;
+    if (gps_ps) {
+        stats.gps_ps_usec += dt;
+    }
+    state_since = now;
+}
+
+
+void
+power_init(void) {
+    int64_t now = esp_timer_get_time();
+    state = POWER_BUSY;
+    state_since = standing_since = last_stats = now;
+    memset(&stats, 0, sizeof(stats));
+    esp_wifi_set_ps(WIFI_PS_MAX_MODEM);
+    set_cpu(160);
+}
+
+
+void
+power_enter(power_state_t new_state) {
+    if (new_state == state) {
+        return;
+    }
+    int64_t now = esp_timer_get_time();
+    taskENTER_CRITICAL();
+    account(now);
+    taskEXIT_CRITICAL();
+
+    switch (new_state) {
+        case POWER_WAIT:
+            set_cpu(80);
+            break;
+
+        case POWER_BUSY:
+            if (state == POWER_UPLINK) {
+                esp_wifi_set_ps(WIFI_PS_MAX_MODEM);
+            }
+            set_cpu(160);
+            break;
+
+        case POWER_UPLINK:
+            set_cpu(160);
+            esp_wifi_set_ps(WIFI_PS_NONE);
+            break;
+
+        default:
+            break;
+    }
+    state = new_state;
+
+    if ((now - last_stats) >= (STATS_PERIOD_SEC * 1000000LL)) {
+        last_stats = now;
+        log_stats();
+    }
+}
+
+
+void
+power_set_moving(bool moving) {
+    int64_t now = esp_timer_get_time();
+    if (moving) {
+        standing_since = now;
+        set_gps_ps(false);
+    }
+    else {
+        if ((now - standing_since) >= (STANDING_SEC_MIN * 1000000LL)) {
+            set_gps_ps(true);
+        }
+    }
+}
+
+
+void
+power_count_reports(uint32_t n) {
+    stats.reports += n;
+}
+
+
+void
+power_get_stats(power_stats_t *result) {
+    taskENTER_CRITICAL();
+    account(esp_timer_get_time());
+    *result = stats;
+    taskEXIT_CRITICAL();
+}
+
+// vim: set sw=4 ts=4 indk= et si:
@@ -0,0 +1,31 @@
+#ifndef POWER_MGMT_H
+#define POWER_MGMT_H
+
+#include <esp_system.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef enum {
+    POWER_WAIT,     // waiting for gps data: wifi in modem sleep, cpu at 80 MHz
+    POWER_BUSY,     // processing: wifi in modem sleep, cpu at 160 MHz
+    POWER_UPLINK,   // talking to the server: wifi awake, cpu at 160 MHz
+    POWER_STATE_MAX
+} power_state_t;
+
+typedef struct {
+    uint64_t state_usec[POWER_STATE_MAX];
+    uint64_t gps_ps_usec;   // of the total, how long the gps was in power save mode
+    uint32_t reports;
+} power_stats_t;
+
+extern const char *power_state_names[];
+
+void power_init(void);
+void power_enter(power_state_t state);
+// the unit is (not) moving, the gps may go to power save if it's standing for long enough
+void power_set_moving(bool moving);
+void power_count_reports(uint32_t n);
+void power_get_stats(power_stats_t *stats);
+
+#endif // POWER_MGMT_H
+// vim: set sw=4 ts=4 indk= et si:
@@ -7,6 +7,7 @@
 #include "location_reporter.h"
 #include "button.h"
 #include "misc.h"
+#include "https_client.h"
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
@@ -233,6 +234,7 @@ app_main()
     }
 
     main_event_group = xEventGroupCreate();
+    https_client_init();
     res = esp_event_loop_init(NULL, NULL);
     if (res != ESP_OK) {
         printf("EventLoop error %d\n", res);
@@ -0,0 +1,131 @@
+// A stand-in for the backend endpoints the unit talks to, on plain http, for the sim
+//
+// node backend_stub.js [options]
+//
+// It answers like rest.backend does, but keeps nothing: the records are printed to stdout as JSON lines, and the
+// counters to stderr. The knobs make the server slow or unreliable, to see how the unit copes with that.
+
+const http = require("http");
+const fs = require("fs");
+const codec = require("../../backend/report_codec");
+
+function usage() {
+    console.error("Usage: node backend_stub.js [options]");
+    console.error("  --port <n>       listen on this port (default: 8443)");
+    console.error("  --delay <ms>     answer this much later (default: 0)");
+    console.error("  --drop <p>       drop the connection instead of answering, with this probability (default: 0)");
+    console.error("  --keepalive <n>  close the connection after this many requests, 0 for never (default: 0)");
+    console.error("  --status <n>     the status of the report responses (default: 204)");
+    console.error("  --binary <0|1>   accept the binary reports (default: 1)");
+    console.error("  --agps <file>    the AGPS data to serve (default: none)");
+    process.exit(1);
+}
+
+function parse_args(argv) {
+    let opts = { port: 8443, delay: 0, drop: 0, keepalive: 0, status: 204, binary: 1, agps: null };
+    for (let i = 0; i < argv.length; i += 2) {
+        let k = argv[i].startsWith("--") ? argv[i].substr(2) : null;
+        if (!k || !(k in opts) || (i + 1 >= argv.length)) {
+            usage();
+        }
+        opts[k] = (k === "agps") ? argv[i + 1] : parseFloat(argv[i + 1]);
+        if (Number.isNaN(opts[k])) {
+            usage();
+        }
+    }
+    return opts;
+}
+
+const opts = parse_args(process.argv.slice(2));
+const agps = opts.agps ? fs.readFileSync(opts.agps) : Buffer.alloc(0);
+
+let stats = { connections: 0, requests: 0, dropped: 0, startups: 0, reports: 0, batches: 0, records: 0, bytes: 0, errors: 0 };
+
+function print_stats() {
+    console.error("stats: " + JSON.stringify(stats));
+}
+
+function records_of(req, body) {
+    let type = (req.headers["content-type"] || "").split(";")[0].trim();
+    if (type === codec.MIME_TYPE) {
+        return codec.decode(body);
+    }
+    let parsed = JSON.parse(body.toString("utf8"));
+    return Array.isArray(parsed) ? parsed : [parsed];
+}
+
+function handle(req, res, body) {
+    let path = req.url.split("?")[0];
+    if ((req.method === "POST") && (path === "/v0/startup")) {
+        ++stats.startups;
+        console.log(JSON.stringify({ startup: JSON.parse(body.toString("utf8")) }));
+        res.setHeader("Accept-Post", opts.binary ? ("application/json, " + codec.MIME_TYPE) : "application/json");
+        res.writeHead(204);
+        return res.end();
+    }
+    if ((req.method === "POST") && ((path === "/v0/report") || (path === "/v0/report/batch"))) {
+        let records;
+        try {
+            if (!opts.binary && ((req.headers["content-type"] || "").startsWith(codec.MIME_TYPE))) {
+                throw new codec.UnsupportedVersionError("binary reports are disabled");
+            }
+            records = records_of(req, body);
+        }
+        catch (err) {
+            ++stats.errors;
+            console.error("Bad report: " + err.message);
+            res.writeHead((err instanceof codec.UnsupportedVersionError) ? 415 : 400);
+            return res.end();
+        }
+        if (path === "/v0/report") {
+            ++stats.reports;
+        }
+        else {
+            ++stats.batches;
+        }
+        stats.records += records.length;
+        records.forEach(r => console.log(JSON.stringify(r)));
+        res.writeHead(opts.status);
+        return res.end();
+    }
+    if ((req.method === "GET") && (path === "/v0/agps")) {
+        res.writeHead(200, { "Content-Type": "application/octet-stream", "Content-Length": agps.length });
+        return res.end(agps);
+    }
+    res.writeHead(404);
+    res.end();
+}
+
+const server = http.createServer((req, res) => {
+    let chunks = [];
+    req.on("data", chunk => chunks.push(chunk));
+    req.on("end", () => {
+        let body = Buffer.concat(chunks);
+        ++stats.requests;
+        stats.bytes += body.length;
+        let socket = req.socket;
+        socket.served = (socket.served || 0) + 1;
+        setTimeout(() => {
+            if (Math.random() < opts.drop) {
+                ++stats.dropped;
+                return socket.destroy();
+            }
+            if (opts.keepalive && (socket.served >= opts.keepalive)) {
+                res.setHeader("Connection", "close");
+            }
+            handle(req, res, body);
+        }, opts.delay);
+    });
+});
+
+server.keepAliveTimeout = 0; // the unit decides when to close, like behind the real reverse proxy
+server.on("connection", () => ++stats.connections);
+server.listen(opts.port, () => console.error("Listening on port " + opts.port));
+
+setInterval(print_stats, 60000).unref();
+process.on("SIGINT", () => {
+    print_stats();
+    process.exit(0);
+});
+
+// vim: set sw=4 ts=4 et:
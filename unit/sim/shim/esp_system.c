@@ -0,0 +1,200 @@
+#include "sim.h"
+
+#include <esp_system.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_wifi.h>
+#include <driver/adc.h>
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+/*
+ * The system time
+ *
+ * Like on the target, it starts at the epoch when the sim starts, and it's the firmware that sets it from the gps.
+ * The calls of the components are redirected here by the linker (--wrap), so the host clock is never touched.
+ */
+
+static pthread_mutex_t time_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int64_t time_offset_us; // system time - esp_timer time
+
+
+int
+__wrap_gettimeofday(struct timeval *tv, void *tz) {
+    pthread_mutex_lock(&time_mutex);
+    int64_t now = esp_timer_get_time() + time_offset_us;
+    pthread_mutex_unlock(&time_mutex);
+    tv->tv_sec = now / 1000000;
+    tv->tv_usec = now % 1000000;
+    return 0;
+}
+
+
+int
+__wrap_settimeofday(const struct timeval *tv, const void *tz) {
+    pthread_mutex_lock(&time_mutex);
+    time_offset_us = tv->tv_sec * 1000000LL + tv->tv_usec - esp_timer_get_time();
+    pthread_mutex_unlock(&time_mutex);
+    return 0;
+}
+
+
+time_t
+__wrap_time(time_t *t) {
+    struct timeval tv;
+    __wrap_gettimeofday(&tv, NULL);
+    if (t) {
+        *t = tv.tv_sec;
+    }
+    return tv.tv_sec;
+}
+
+
+/*
+ * Logging
+ */
+
+#define MAX_TAG_LEVELS  16
+
+static struct {
+    const char *tag;
+    esp_log_level_t level;
+} tag_levels[MAX_TAG_LEVELS];
+static esp_log_level_t default_level = CONFIG_LOG_DEFAULT_LEVEL;
+static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+void
+esp_log_level_set(const char *tag, esp_log_level_t level) {
+    pthread_mutex_lock(&log_mutex);
+    if (!strcmp(tag, "*")) {
+        default_level = level;
+        memset(tag_levels, 0, sizeof(tag_levels));
+        pthread_mutex_unlock(&log_mutex);
+        return;
+    }
+    for (int i = 0; i < MAX_TAG_LEVELS; ++i) {
+        if (!tag_levels[i].tag || !strcmp(tag_levels[i].tag, tag)) {
+            tag_levels[i].tag = tag;
+            tag_levels[i].level = level;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&log_mutex);
+}
+
+
+static esp_log_level_t
+level_of(const char *tag) {
+    for (int i = 0; (i < MAX_TAG_LEVELS) && tag_levels[i].tag; ++i) {
+        if (!strcmp(tag_levels[i].tag, tag)) {
+            return tag_levels[i].level;
+        }
+    }
+    return default_level;
+}
+
+
+uint32_t
+esp_log_timestamp(void) {
+    return esp_timer_get_time() / 1000;
+}
+
+
+void
+esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...) {
+    pthread_mutex_lock(&log_mutex);
+    if (level <= level_of(tag)) {
+        va_list ap;
+        va_start(ap, format);
+        vfprintf(stderr, format, ap);
+        va_end(ap);
+    }
+    pthread_mutex_unlock(&log_mutex);
+}
+
+
+void
+esp_log_buffer_hexdump_internal(const char *tag, const void *buffer, uint16_t buff_len, esp_log_level_t level) {
+    const uint8_t *p = (const uint8_t*)buffer;
+    for (uint16_t offs = 0; offs < buff_len; offs += 16) {
+        char line[16 * 3 + 1], *q = line;
+        for (uint16_t i = offs; (i < buff_len) && (i < offs + 16); ++i) {
+            q += sprintf(q, " %02x", p[i]);
+        }
+        esp_log_write(level, tag, "%c (%u) %s: 0x%04x:%s\n", "NEWIDV"[level], esp_log_timestamp(), tag, offs, line);
+    }
+}
+
+
+/*
+ * The rest of the system
+ */
+
+static uint16_t adc_raw = 1000; // ~3 V, a charged battery
+static wifi_ps_type_t wifi_ps = WIFI_PS_NONE;
+
+
+void
+esp_set_cpu_freq(esp_cpu_freq_t freq) {
+}
+
+
+uint32_t
+esp_random(void) {
+    static bool seeded = false;
+    if (!seeded) {
+        srandom(esp_timer_get_time() ^ getpid());
+        seeded = true;
+    }
+    return ((uint32_t)random() << 16) ^ (uint32_t)random();
+}
+
+
+void
+esp_restart(void) {
+    fprintf(stderr, "esp_restart() called, exiting\n");
+    exit(2);
+}
+
+
+esp_err_t
+esp_wifi_set_ps(wifi_ps_type_t type) {
+    wifi_ps = type;
+    return ESP_OK;
+}
+
+
+esp_err_t
+esp_wifi_get_ps(wifi_ps_type_t *type) {
+    *type = wifi_ps;
+    return ESP_OK;
+}
+
+
+void
+sim_adc_set_raw(uint16_t raw) {
+    adc_raw = raw;
+}
+
+
+esp_err_t
+adc_init(adc_config_t *config) {
+    return ESP_OK;
+}
+
+
+esp_err_t
+adc_read(uint16_t *data) {
+    *data = adc_raw;
+    return ESP_OK;
+}
+
+// vim: set sw=4 ts=4 indk= et si:
@@ -0,0 +1,174 @@
+#include "sim_private.h"
+
+#include <esp_timer.h>
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Every timer has its own thread, it's simpler than a dispatcher, and there are only a few of them.
+ *
+ * The periodic ones keep their phase, like the hw timer does, so a slow callback doesn't make them drift.
+ */
+
+struct sim_timer {
+    esp_timer_create_args_t args;
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+    pthread_t thread;
+    bool armed, periodic, deleted;
+    uint64_t period_us;
+    int64_t next_us;        // esp_timer time of the next expiry
+    uint32_t generation;    // incremented on every start and stop, so the thread notices them
+};
+
+static struct timespec start_ts;
+static pthread_once_t start_once = PTHREAD_ONCE_INIT;
+
+
+static void
+init_start(void) {
+    clock_gettime(CLOCK_MONOTONIC, &start_ts);
+}
+
+
+int64_t
+esp_timer_get_time(void) {
+    pthread_once(&start_once, init_start);
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec - start_ts.tv_sec) * 1000000LL + (ts.tv_nsec - start_ts.tv_nsec) / 1000;
+}
+
+
+// the CLOCK_MONOTONIC time of an esp_timer time
+static void
+to_timespec(int64_t us, struct timespec *ts) {
+    pthread_once(&start_once, init_start);
+    int64_t ns = start_ts.tv_nsec + (us % 1000000) * 1000;
+    ts->tv_sec = start_ts.tv_sec + us / 1000000 + ns / 1000000000;
+    ts->tv_nsec = ns % 1000000000;
+}
+
+
+static void *
+timer_main(void *arg) {
+    esp_timer_handle_t t = (esp_timer_handle_t)arg;
+    pthread_mutex_lock(&t->mutex);
+    while (!t->deleted) {
+        if (!t->armed) {
+            pthread_cond_wait(&t->changed, &t->mutex);
+            continue;
+        }
+        struct timespec ts;
+        to_timespec(t->next_us, &ts);
+        uint32_t generation = t->generation;
+        if (sim_cond_wait(&t->changed, &t->mutex, &ts) || (generation != t->generation) || !t->armed) {
+            continue; // restarted, stopped or deleted meanwhile
+        }
+        if (t->periodic) {
+            t->next_us += t->period_us;
+        }
+        else {
+            t->armed = false;
+        }
+        pthread_mutex_unlock(&t->mutex);
+        t->args.callback(t->args.arg);
+        pthread_mutex_lock(&t->mutex);
+    }
+    pthread_mutex_unlock(&t->mutex);
+    pthread_mutex_destroy(&t->mutex);
+    pthread_cond_destroy(&t->changed);
+    free(t);
+    return NULL;
+}
+
+
+esp_err_t
+esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *out_handle) {
+    if (!args || !args->callback || !out_handle) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_timer_handle_t t = (esp_timer_handle_t)calloc(1, sizeof(*t));
+    if (!t) {
+        return ESP_ERR_NO_MEM;
+    }
+    t->args = *args;
+    pthread_mutex_init(&t->mutex, NULL);
+    sim_cond_init(&t->changed);
+    if (pthread_create(&t->thread, NULL, timer_main, t) != 0) {
+        free(t);
+        return ESP_ERR_NO_MEM;
+    }
+    if (args->name) {
+        char name[16];
+        strncpy(name, args->name, sizeof(name) - 1);
+        name[sizeof(name) - 1] = '\0';
+        pthread_setname_np(t->thread, name);
+    }
+    pthread_detach(t->thread);
+    *out_handle = t;
+    return ESP_OK;
+}
+
+
+static esp_err_t
+start(esp_timer_handle_t t, uint64_t us, bool periodic) {
+    pthread_mutex_lock(&t->mutex);
+    if (t->armed) {
+        pthread_mutex_unlock(&t->mutex);
+        return ESP_ERR_INVALID_STATE;
+    }
+    t->armed = true;
+    t->periodic = periodic;
+    t->period_us = us;
+    t->next_us = esp_timer_get_time() + us;
+    ++t->generation;
+    pthread_cond_signal(&t->changed);
+    pthread_mutex_unlock(&t->mutex);
+    return ESP_OK;
+}
+
+
+esp_err_t
+esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+    return start(timer, timeout_us, false);
+}
+
+
+esp_err_t
+esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period_us) {
+    return start(timer, period_us, true);
+}
+
+
+esp_err_t
+esp_timer_stop(esp_timer_handle_t t) {
+    pthread_mutex_lock(&t->mutex);
+    if (!t->armed) {
+        pthread_mutex_unlock(&t->mutex);
+        return ESP_ERR_INVALID_STATE;
+    }
+    t->armed = false;
+    ++t->generation;
+    pthread_cond_signal(&t->changed);
+    pthread_mutex_unlock(&t->mutex);
+    return ESP_OK;
+}
+
+
+esp_err_t
+esp_timer_delete(esp_timer_handle_t t) {
+    pthread_mutex_lock(&t->mutex);
+    if (t->armed) {
+        pthread_mutex_unlock(&t->mutex);
+        return ESP_ERR_INVALID_STATE;
+    }
+    t->deleted = true;
+    pthread_cond_signal(&t->changed);
+    pthread_mutex_unlock(&t->mutex);
+    return ESP_OK;
+}
+
+// vim: set sw=4 ts=4 indk= et si:
@@ -0,0 +1,498 @@
+#include "sim_private.h"
+#include "sim.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/event_groups.h>
+#include <freertos/esp_freertos_hooks.h>
+#include <esp_timer.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+
+#define MAX_TASKS       16
+#define MAX_IDLE_HOOKS  4
+
+static pthread_mutex_t critical = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+
+struct timespec *
+sim_deadline(struct timespec *ts, TickType_t ticks) {
+    if (ticks == portMAX_DELAY) {
+        return NULL;
+    }
+    clock_gettime(CLOCK_MONOTONIC, ts);
+    uint64_t nsec = ts->tv_nsec + (uint64_t)ticks * portTICK_PERIOD_MS * 1000000ULL;
+    ts->tv_sec += nsec / 1000000000ULL;
+    ts->tv_nsec = nsec % 1000000000ULL;
+    return ts;
+}
+
+
+void
+sim_cond_init(pthread_cond_t *cond) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+
+bool
+sim_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *deadline) {
+    if (!deadline) {
+        pthread_cond_wait(cond, mutex);
+        return true;
+    }
+    return pthread_cond_timedwait(cond, mutex, deadline) != ETIMEDOUT;
+}
+
+
+void
+sim_sleep_us(int64_t usec) {
+    if (usec <= 0) {
+        return;
+    }
+    struct timespec ts = { .tv_sec = usec / 1000000, .tv_nsec = (usec % 1000000) * 1000 };
+    while (nanosleep(&ts, &ts) && (errno == EINTR)) {
+    }
+}
+
+
+void
+vPortEnterCritical(void) {
+    pthread_mutex_lock(&critical);
+}
+
+
+void
+vPortExitCritical(void) {
+    pthread_mutex_unlock(&critical);
+}
+
+
+/*
+ * Tasks
+ */
+
+typedef struct {
+    bool used;
+    char name[16];
+    uint32_t stack_depth;
+    UBaseType_t prio;
+    TaskFunction_t fn;
+    void *arg;
+    pthread_t thread;
+} sim_task_t;
+
+static sim_task_t tasks[MAX_TASKS];
+static pthread_mutex_t tasks_mutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread sim_task_t *current_task;
+
+
+static void *
+task_main(void *arg) {
+    current_task = (sim_task_t*)arg;
+    current_task->fn(current_task->arg);
+    // returning from a task function is an error on the target, but let it pass here
+    vTaskDelete(NULL);
+    return NULL;
+}
+
+
+BaseType_t
+xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *arg, UBaseType_t prio, TaskHandle_t *handle) {
+    pthread_mutex_lock(&tasks_mutex);
+    sim_task_t *t = NULL;
+    for (int i = 0; i < MAX_TASKS; ++i) {
+        if (!tasks[i].used) {
+            t = &tasks[i];
+            break;
+        }
+    }
+    if (!t) {
+        pthread_mutex_unlock(&tasks_mutex);
+        return pdFAIL;
+    }
+    memset(t, 0, sizeof(*t));
+    t->used = true;
+    strncpy(t->name, name, sizeof(t->name) - 1);
+    t->stack_depth = stack_depth;
+    t->prio = prio;
+    t->fn = fn;
+    t->arg = arg;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int res = pthread_create(&t->thread, &attr, task_main, t);
+    pthread_attr_destroy(&attr);
+    if (res != 0) {
+        t->used = false;
+        pthread_mutex_unlock(&tasks_mutex);
+        return pdFAIL;
+    }
+    pthread_setname_np(t->thread, t->name);
+    pthread_mutex_unlock(&tasks_mutex);
+    if (handle) {
+        *handle = t;
+    }
+    return pdPASS;
+}
+
+
+void
+vTaskDelete(TaskHandle_t task) {
+    if (task && (task != current_task)) {
+        fprintf(stderr, "vTaskDelete: only the calling task can be deleted in the sim\n");
+        abort();
+    }
+    if (current_task) {
+        pthread_mutex_lock(&tasks_mutex);
+        current_task->used = false;
+        pthread_mutex_unlock(&tasks_mutex);
+    }
+    pthread_exit(NULL);
+}
+
+
+void
+vTaskDelay(TickType_t ticks) {
+    sim_sleep_us((int64_t)ticks * portTICK_PERIOD_MS * 1000);
+}
+
+
+TickType_t
+xTaskGetTickCount(void) {
+    return esp_timer_get_time() / (portTICK_PERIOD_MS * 1000);
+}
+
+
+UBaseType_t
+uxTaskGetNumberOfTasks(void) {
+    UBaseType_t n = 0;
+    pthread_mutex_lock(&tasks_mutex);
+    for (int i = 0; i < MAX_TASKS; ++i) {
+        n += tasks[i].used;
+    }
+    pthread_mutex_unlock(&tasks_mutex);
+    return n;
+}
+
+
+void
+vTaskList(char *buf) {
+    *buf = '\0';
+    pthread_mutex_lock(&tasks_mutex);
+    for (int i = 0; i < MAX_TASKS; ++i) {
+        if (tasks[i].used) {
+            buf += sprintf(buf, "%-15s\tR\t%u\t%u\t%d\n", tasks[i].name, tasks[i].prio, tasks[i].stack_depth, i);
+        }
+    }
+    pthread_mutex_unlock(&tasks_mutex);
+}
+
+
+/*
+ * Semaphores
+ */
+
+struct sim_semaphore {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool available;
+};
+
+
+static SemaphoreHandle_t
+semaphore_create(bool available) {
+    SemaphoreHandle_t sem = (SemaphoreHandle_t)calloc(1, sizeof(*sem));
+    if (sem) {
+        pthread_mutex_init(&sem->mutex, NULL);
+        sim_cond_init(&sem->cond);
+        sem->available = available;
+    }
+    return sem;
+}
+
+
+SemaphoreHandle_t
+xSemaphoreCreateBinary(void) {
+    return semaphore_create(false);
+}
+
+
+SemaphoreHandle_t
+xSemaphoreCreateMutex(void) {
+    return semaphore_create(true);
+}
+
+
+void
+vSemaphoreDelete(SemaphoreHandle_t sem) {
+    pthread_cond_destroy(&sem->cond);
+    pthread_mutex_destroy(&sem->mutex);
+    free(sem);
+}
+
+
+BaseType_t
+xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks) {
+    struct timespec ts, *deadline = sim_deadline(&ts, ticks);
+    pthread_mutex_lock(&sem->mutex);
+    while (!sem->available) {
+        if ((ticks == 0) || !sim_cond_wait(&sem->cond, &sem->mutex, deadline)) {
+            break;
+        }
+    }
+    BaseType_t result = sem->available ? pdTRUE : pdFALSE;
+    sem->available = false;
+    pthread_mutex_unlock(&sem->mutex);
+    return result;
+}
+
+
+BaseType_t
+xSemaphoreGive(SemaphoreHandle_t sem) {
+    pthread_mutex_lock(&sem->mutex);
+    BaseType_t result = sem->available ? pdFALSE : pdTRUE;
+    sem->available = true;
+    pthread_cond_signal(&sem->cond);
+    pthread_mutex_unlock(&sem->mutex);
+    return result;
+}
+
+
+/*
+ * Queues
+ */
+
+struct sim_queue {
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty, not_full;
+    UBaseType_t length, item_size, rd, count;
+    uint8_t *items;
+};
+
+
+QueueHandle_t
+xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+    QueueHandle_t q = (QueueHandle_t)calloc(1, sizeof(*q));
+    if (!q) {
+        return NULL;
+    }
+    q->items = (uint8_t*)malloc(length * item_size);
+    if (!q->items) {
+        free(q);
+        return NULL;
+    }
+    pthread_mutex_init(&q->mutex, NULL);
+    sim_cond_init(&q->not_empty);
+    sim_cond_init(&q->not_full);
+    q->length = length;
+    q->item_size = item_size;
+    return q;
+}
+
+
+void
+vQueueDelete(QueueHandle_t q) {
+    pthread_cond_destroy(&q->not_full);
+    pthread_cond_destroy(&q->not_empty);
+    pthread_mutex_destroy(&q->mutex);
+    free(q->items);
+    free(q);
+}
+
+
+BaseType_t
+xQueueSend(QueueHandle_t q, const void *item, TickType_t ticks) {
+    struct timespec ts, *deadline = sim_deadline(&ts, ticks);
+    pthread_mutex_lock(&q->mutex);
+    while (q->count == q->length) {
+        if ((ticks == 0) || !sim_cond_wait(&q->not_full, &q->mutex, deadline)) {
+            break;
+        }
+    }
+    if (q->count == q->length) {
+        pthread_mutex_unlock(&q->mutex);
+        return pdFALSE;
+    }
+    memcpy(q->items + ((q->rd + q->count) % q->length) * q->item_size, item, q->item_size);
+    ++q->count;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->mutex);
+    return pdTRUE;
+}
+
+
+BaseType_t
+xQueueReceive(QueueHandle_t q, void *item, TickType_t ticks) {
+    struct timespec ts, *deadline = sim_deadline(&ts, ticks);
+    pthread_mutex_lock(&q->mutex);
+    while (q->count == 0) {
+        if ((ticks == 0) || !sim_cond_wait(&q->not_empty, &q->mutex, deadline)) {
+            break;
+        }
+    }
+    if (q->count == 0) {
+        pthread_mutex_unlock(&q->mutex);
+        return pdFALSE;
+    }
+    memcpy(item, q->items + q->rd * q->item_size, q->item_size);
+    q->rd = (q->rd + 1) % q->length;
+    --q->count;
+    pthread_cond_signal(&q->not_full);
+    pthread_mutex_unlock(&q->mutex);
+    return pdTRUE;
+}
+
+
+BaseType_t
+xQueueReset(QueueHandle_t q) {
+    pthread_mutex_lock(&q->mutex);
+    q->rd = q->count = 0;
+    pthread_cond_broadcast(&q->not_full);
+    pthread_mutex_unlock(&q->mutex);
+    return pdPASS;
+}
+
+
+UBaseType_t
+uxQueueMessagesWaiting(QueueHandle_t q) {
+    pthread_mutex_lock(&q->mutex);
+    UBaseType_t n = q->count;
+    pthread_mutex_unlock(&q->mutex);
+    return n;
+}
+
+
+/*
+ * Event groups
+ */
+
+struct sim_event_group {
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+    EventBits_t bits;
+};
+
+
+EventGroupHandle_t
+xEventGroupCreate(void) {
+    EventGroupHandle_t eg = (EventGroupHandle_t)calloc(1, sizeof(*eg));
+    if (eg) {
+        pthread_mutex_init(&eg->mutex, NULL);
+        sim_cond_init(&eg->changed);
+    }
+    return eg;
+}
+
+
+EventBits_t
+xEventGroupSetBits(EventGroupHandle_t eg, EventBits_t bits) {
+    pthread_mutex_lock(&eg->mutex);
+    eg->bits |= bits;
+    EventBits_t result = eg->bits;
+    pthread_cond_broadcast(&eg->changed);
+    pthread_mutex_unlock(&eg->mutex);
+    return result;
+}
+
+
+EventBits_t
+xEventGroupClearBits(EventGroupHandle_t eg, EventBits_t bits) {
+    pthread_mutex_lock(&eg->mutex);
+    EventBits_t result = eg->bits;
+    eg->bits &= ~bits;
+    pthread_mutex_unlock(&eg->mutex);
+    return result;
+}
+
+
+EventBits_t
+xEventGroupGetBits(EventGroupHandle_t eg) {
+    pthread_mutex_lock(&eg->mutex);
+    EventBits_t result = eg->bits;
+    pthread_mutex_unlock(&eg->mutex);
+    return result;
+}
+
+
+EventBits_t
+xEventGroupWaitBits(EventGroupHandle_t eg, EventBits_t bits, BaseType_t clear_on_exit, BaseType_t wait_for_all, TickType_t ticks) {
+    struct timespec ts, *deadline = sim_deadline(&ts, ticks);
+    pthread_mutex_lock(&eg->mutex);
+    for (;;) {
+        EventBits_t set = eg->bits & bits;
+        if (wait_for_all ? (set == bits) : (set != 0)) {
+            EventBits_t result = eg->bits;
+            if (clear_on_exit) {
+                eg->bits &= ~bits;
+            }
+            pthread_mutex_unlock(&eg->mutex);
+            return result;
+        }
+        if ((ticks == 0) || !sim_cond_wait(&eg->changed, &eg->mutex, deadline)) {
+            break;
+        }
+    }
+    EventBits_t result = eg->bits;
+    pthread_mutex_unlock(&eg->mutex);
+    return result;
+}
+
+
+/*
+ * Idle hooks
+ */
+
+static esp_freertos_idle_cb_t idle_hooks[MAX_IDLE_HOOKS];
+
+
+esp_err_t
+esp_register_freertos_idle_hook(esp_freertos_idle_cb_t cb) {
+    taskENTER_CRITICAL();
+    for (int i = 0; i < MAX_IDLE_HOOKS; ++i) {
+        if (!idle_hooks[i]) {
+            idle_hooks[i] = cb;
+            taskEXIT_CRITICAL();
+            return ESP_OK;
+        }
+    }
+    taskEXIT_CRITICAL();
+    return ESP_ERR_NO_MEM;
+}
+
+
+static void *
+idle_main(void *arg) {
+    struct sched_param param = { .sched_priority = 0 };
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+    for (;;) {
+        for (int i = 0; i < MAX_IDLE_HOOKS; ++i) {
+            if (idle_hooks[i]) {
+                idle_hooks[i]();
+            }
+        }
+        vTaskDelay(1);
+    }
+    return NULL;
+}
+
+
+void
+sim_freertos_init(void) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, idle_main, NULL) == 0) {
+        pthread_setname_np(thread, "IDLE");
+        pthread_detach(thread);
+    }
+}
+
+// vim: set sw=4 ts=4 indk= et si:
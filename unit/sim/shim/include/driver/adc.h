@@ -0,0 +1,24 @@
+#ifndef ADC_H
+#define ADC_H
+
+#include <esp_err.h>
+
+#include <stdint.h>
+
+typedef enum {
+    ADC_READ_TOUT_MODE = 0,
+    ADC_READ_VDD_MODE,
+    ADC_READ_MAX_MODE
+} adc_mode_t;
+
+typedef struct {
+    adc_mode_t mode;
+    uint8_t clk_div;
+} adc_config_t;
+
+esp_err_t adc_init(adc_config_t *config);
+// the value set by sim_adc_set_raw()
+esp_err_t adc_read(uint16_t *data);
+
+#endif // ADC_H
+// vim: set sw=4 ts=4 indk= et si:
@@ -0,0 +1,88 @@
+#ifndef UART_H
+#define UART_H
+
+#include <esp_err.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* UART0 on the source given to sim_uart_open(), with the events and the ring buffer of the SDK driver.
+ *
+ * The rx fifo of the target is modelled as well: an UART_DATA is posted when UART_SIM_FIFO_FULL bytes have arrived,
+ * or UART_SIM_RX_TOUT char times after the last one, just as the defaults of uart_driver_install() do. On the tx side
+ * the bytes leave at the baud rate through a hw fifo of UART_SIM_TX_FIFO.
+ */
+
+#define UART_SIM_FIFO_FULL  120
+#define UART_SIM_RX_TOUT    10
+#define UART_SIM_TX_FIFO    128
+
+typedef enum {
+    UART_NUM_0 = 0,
+    UART_NUM_1,
+    UART_NUM_MAX,
+} uart_port_t;
+
+typedef enum {
+    UART_DATA_5_BITS,
+    UART_DATA_6_BITS,
+    UART_DATA_7_BITS,
+    UART_DATA_8_BITS,
+} uart_word_length_t;
+
+typedef enum {
+    UART_PARITY_DISABLE,
+    UART_PARITY_EVEN = 2,
+    UART_PARITY_ODD,
+} uart_parity_t;
+
+typedef enum {
+    UART_STOP_BITS_1 = 1,
+    UART_STOP_BITS_1_5,
+    UART_STOP_BITS_2,
+} uart_stop_bits_t;
+
+typedef enum {
+    UART_HW_FLOWCTRL_DISABLE,
+    UART_HW_FLOWCTRL_RTS,
+    UART_HW_FLOWCTRL_CTS,
+    UART_HW_FLOWCTRL_CTS_RTS,
+} uart_hw_flowcontrol_t;
+
+typedef struct {
+    int baud_rate;
+    uart_word_length_t data_bits;
+    uart_parity_t parity;
+    uart_stop_bits_t stop_bits;
+    uart_hw_flowcontrol_t flow_ctrl;
+    uint8_t rx_flow_ctrl_thresh;
+} uart_config_t;
+
+typedef enum {
+    UART_DATA,
+    UART_BUFFER_FULL,
+    UART_FIFO_OVF,
+    UART_FRAME_ERR,
+    UART_PARITY_ERR,
+    UART_EVENT_MAX,
+} uart_event_type_t;
+
+typedef struct {
+    uart_event_type_t type;
+    size_t size;
+} uart_event_t;
+
+esp_err_t uart_param_config(uart_port_t uart_num, uart_config_t *uart_conf);
+esp_err_t uart_set_baudrate(uart_port_t uart_num, uint32_t baudrate);
+esp_err_t uart_driver_install(uart_port_t uart_num, int rx_buffer_size, int tx_buffer_size, int queue_size, QueueHandle_t *uart_queue, int no_use);
+esp_err_t uart_driver_delete(uart_port_t uart_num);
+int uart_read_bytes(uart_port_t uart_num, uint8_t *buf, uint32_t length, TickType_t ticks_to_wait);
+int uart_write_bytes(uart_port_t uart_num, const char *src, size_t size);
+esp_err_t uart_wait_tx_done(uart_port_t uart_num, TickType_t ticks_to_wait);
+esp_err_t uart_flush_input(uart_port_t uart_num);
+esp_err_t uart_get_buffered_data_len(uart_port_t uart_num, size_t *size);
+
+#endif // UART_H
+// vim: set sw=4 ts=4 indk= et si:
@@ -0,0 +1,23 @@
+#ifndef SIM_ENDIAN_H
+#define SIM_ENDIAN_H
+
+/* The newlib of the SDK has the BSD style little and big endian codecs in <endian.h>, the glibc has only the
+ * byte order macros there.
+ */
+
+#include_next <endian.h>
+
+#include <stdint.h>
+
+static inline uint16_t le16dec(const void *pp) { const uint8_t *p = pp; return p[0] | ((uint16_t)p[1] << 8); }
+static inline uint32_t le32dec(const void *pp) { const uint8_t *p = pp; return le16dec(p) | ((uint32_t)le16dec(p + 2) << 16); }
+static inline uint16_t be16dec(const void *pp) { const uint8_t *p = pp; return ((uint16_t)p[0] << 8) | p[1]; }
+static inline uint32_t be32dec(const void *pp) { const uint8_t *p = pp; return ((uint32_t)be16dec(p) << 16) | be16dec(p + 2); }
+
+static inline void le16enc(void *pp, uint16_t u) { uint8_t *p = pp; p[0] = u; p[1] = u >> 8; }
+static inline void le32enc(void *pp, uint32_t u) { uint8_t *p = pp; le16enc(p, u); le16enc(p + 2, u >> 16); }
+static inline void be16enc(void *pp, uint16_t u) { uint8_t *p = pp; p[0] = u >> 8; p[1] = u; }
+static inline void be32enc(void *pp, uint32_t u) { uint8_t *p = pp; be16enc(p, u >> 16); be16enc(p + 2, u); }
+
+#endif // SIM_ENDIAN_H
+// vim: set sw=4 ts=4 indk= et si:
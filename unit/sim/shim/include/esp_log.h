@@ -0,0 +1,52 @@
+#ifndef ESP_LOG_H
+#define ESP_LOG_H
+
+#include <sdkconfig.h>
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Logging as on the target, to stderr, so the stdout of the sim is free for its results.
+ *
+ * LOG_LOCAL_LEVEL is the compile-time limit of a source file, esp_log_level_set() is the runtime one of a tag.
+ */
+
+typedef enum {
+    ESP_LOG_NONE,
+    ESP_LOG_ERROR,
+    ESP_LOG_WARN,
+    ESP_LOG_INFO,
+    ESP_LOG_DEBUG,
+    ESP_LOG_VERBOSE
+} esp_log_level_t;
+
+#ifndef LOG_LOCAL_LEVEL
+#define LOG_LOCAL_LEVEL CONFIG_LOG_DEFAULT_LEVEL
+#endif
+
+// "*" sets the level of all the tags
+void esp_log_level_set(const char *tag, esp_log_level_t level);
+uint32_t esp_log_timestamp(void);
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...) __attribute__((format(printf, 3, 4)));
+void esp_log_buffer_hexdump_internal(const char *tag, const void *buffer, uint16_t buff_len, esp_log_level_t level);
+
+#define ESP_LOG_LEVEL_LOCAL(level, letter, tag, format, ...) do { \
+        if (LOG_LOCAL_LEVEL >= (level)) { \
+            esp_log_write((level), (tag), #letter " (%u) %s: " format "\n", esp_log_timestamp(), (tag), ##__VA_ARGS__); \
+        } \
+    } while (0)
+
+#define ESP_LOGE(tag, format, ...)  ESP_LOG_LEVEL_LOCAL(ESP_LOG_ERROR,   E, tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...)  ESP_LOG_LEVEL_LOCAL(ESP_LOG_WARN,    W, tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...)  ESP_LOG_LEVEL_LOCAL(ESP_LOG_INFO,    I, tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...)  ESP_LOG_LEVEL_LOCAL(ESP_LOG_DEBUG,   D, tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...)  ESP_LOG_LEVEL_LOCAL(ESP_LOG_VERBOSE, V, tag, format, ##__VA_ARGS__)
+
+#define ESP_LOG_BUFFER_HEXDUMP(tag, buffer, buff_len, level) do { \
+        if (LOG_LOCAL_LEVEL >= (level)) { \
+            esp_log_buffer_hexdump_internal((tag), (buffer), (buff_len), (level)); \
+        } \
+    } while (0)
+
+#endif // ESP_LOG_H
+// vim: set sw=4 ts=4 indk= et si:
@@ -0,0 +1,9 @@
+#ifndef ESP_OTA_OPS_H
+#define ESP_OTA_OPS_H
+
+#include <esp_partition.h>
+
+// there are no app images in the sim, the ota component isn't part of it
+
+#endif // ESP_OTA_OPS_H
+// vim: set sw=4 ts=4 indk= et si:
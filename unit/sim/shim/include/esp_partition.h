@@ -0,0 +1,39 @@
+#ifndef ESP_PARTITION_H
+#define ESP_PARTITION_H
+
+#include <esp_err.h>
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* The partitions of partitions.csv on a flash image in RAM, or in a file if one is given to sim_flash_load().
+ *
+ * It behaves like NOR flash: a write can only clear bits, only an erase of whole sectors sets them again.
+ */
+
+typedef enum {
+    ESP_PARTITION_TYPE_APP = 0x00,
+    ESP_PARTITION_TYPE_DATA = 0x01,
+} esp_partition_type_t;
+
+typedef int esp_partition_subtype_t;
+
+#define ESP_PARTITION_SUBTYPE_ANY   0xff
+
+typedef struct {
+    esp_partition_type_t type;
+    esp_partition_subtype_t subtype;
+    uint32_t address;
+    uint32_t size;
+    char label[17];
+    bool encrypted;
+} esp_partition_t;
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label);
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size);
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size);
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t start_addr, size_t size);
+
+#endif // ESP_PARTITION_H
+// vim: set sw=4 ts=4 indk= et si:
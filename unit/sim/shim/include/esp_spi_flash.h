@@ -0,0 +1,14 @@
+#ifndef ESP_SPI_FLASH_H
+#define ESP_SPI_FLASH_H
+
+#include <esp_err.h>
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SPI_FLASH_SEC_SIZE  4096
+
+size_t spi_flash_get_chip_size(void);
+
+#endif // ESP_SPI_FLASH_H
+// vim: set sw=4 ts=4 indk= et si:
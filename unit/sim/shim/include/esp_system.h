@@ -0,0 +1,23 @@
+#ifndef ESP_SYSTEM_H
+#define ESP_SYSTEM_H
+
+#include <esp_err.h>
+#include <sdkconfig.h>
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+typedef enum {
+    ESP_CPU_FREQ_80M = 80,
+    ESP_CPU_FREQ_160M = 160,
+} esp_cpu_freq_t;
+
+// only recorded, the host runs at its own speed
+void esp_set_cpu_freq(esp_cpu_freq_t freq);
+uint32_t esp_random(void);
+void esp_restart(void) __attribute__((noreturn));
+
+#endif // ESP_SYSTEM_H
+// vim: set sw=4 ts=4 indk= et si:
@@ -0,0 +1,162 @@
+#ifndef ESP_TLS_H
+#define ESP_TLS_H
+
+#include <sdkconfig.h>
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/time.h>
+
+/* The part of the mbedTLS client api that https_client uses, on plain tcp.
+ *
+ * The handshake exchanges nothing, it only takes the time set by sim_tls_set_handshake_ms(), and keeps the session
+ * bookkeeping of the real one: an offered session is resumed with its master secret, otherwise a new one is made up.
+ * So the stand-in backend speaks plain http, and the reconnect costs of the target can be reproduced on the host.
+ *
+ * Of the certificates only the CN of the subject is looked for, that's where the unit takes its name from.
+ */
+
+#ifdef CONFIG_MBEDTLS_CLIENT_SSL_SESSION_TICKETS
+#define MBEDTLS_SSL_SESSION_TICKETS
+#endif
+
+#define MBEDTLS_ERR_NET_SOCKET_FAILED           -0x0042
+#define MBEDTLS_ERR_NET_CONNECT_FAILED          -0x0044
+#define MBEDTLS_ERR_NET_RECV_FAILED             -0x004C
+#define MBEDTLS_ERR_NET_SEND_FAILED             -0x004E
+#define MBEDTLS_ERR_NET_UNKNOWN_HOST            -0x0052
+#define MBEDTLS_ERR_SSL_BAD_INPUT_DATA          -0x7100
+#define MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY       -0x7880
+#define MBEDTLS_ERR_SSL_WANT_READ               -0x6900
+#define MBEDTLS_ERR_SSL_WANT_WRITE              -0x6880
+#define MBEDTLS_ERR_X509_INVALID_FORMAT         -0x2180
+
+#define MBEDTLS_NET_PROTO_TCP                   0
+#define MBEDTLS_SSL_IS_CLIENT                   0
+#define MBEDTLS_SSL_TRANSPORT_STREAM            0
+#define MBEDTLS_SSL_PRESET_DEFAULT              0
+#define MBEDTLS_SSL_VERIFY_NONE                 0
+#define MBEDTLS_SSL_VERIFY_OPTIONAL             1
+#define MBEDTLS_SSL_VERIFY_REQUIRED             2
+#define MBEDTLS_SSL_SESSION_TICKETS_DISABLED    0
+#define MBEDTLS_SSL_SESSION_TICKETS_ENABLED     1
+#define MBEDTLS_X509_BADCERT_FUTURE             0x0200
+
+typedef struct {
+    int fd;
+} mbedtls_net_context;
+
+typedef struct {
+    int tag;
+    size_t len;
+    unsigned char *p;
+} mbedtls_asn1_buf;
+
+typedef struct mbedtls_asn1_named_data {
+    mbedtls_asn1_buf oid;
+    mbedtls_asn1_buf val;
+    struct mbedtls_asn1_named_data *next;
+    unsigned char next_merged;
+} mbedtls_x509_name;
+
+typedef struct {
+    unsigned char *raw;
+    size_t raw_len;
+    mbedtls_x509_name subject;
+} mbedtls_x509_crt;
+
+typedef struct {
+    int dummy;
+} mbedtls_x509_crt_profile;
+
+extern const mbedtls_x509_crt_profile mbedtls_x509_crt_profile_next;
+
+typedef struct {
+    int valid;
+} mbedtls_pk_context;
+
+typedef struct {
+    int dummy;
+} mbedtls_entropy_context;
+
+typedef struct {
+    uint32_t state;
+} mbedtls_ctr_drbg_context;
+
+typedef struct {
+    unsigned char master[48];
+} mbedtls_ssl_session;
+
+typedef int (*mbedtls_ssl_send_t)(void *ctx, const unsigned char *buf, size_t len);
+typedef int (*mbedtls_ssl_recv_t)(void *ctx, unsigned char *buf, size_t len);
+typedef int (*mbedtls_ssl_recv_timeout_t)(void *ctx, unsigned char *buf, size_t len, uint32_t timeout);
+
+typedef struct {
+    int authmode;
+    int tickets;
+    int (*f_rng)(void *, unsigned char *, size_t);
+    void *p_rng;
+} mbedtls_ssl_config;
+
+typedef struct {
+    const mbedtls_ssl_config *conf;
+    void *p_bio;
+    mbedtls_ssl_send_t f_send;
+    mbedtls_ssl_recv_t f_recv;
+    mbedtls_ssl_session *session;       // of the current connection, after the handshake
+    mbedtls_ssl_session session_negotiate;
+    int session_offered;
+} mbedtls_ssl_context;
+
+void mbedtls_net_init(mbedtls_net_context *ctx);
+int mbedtls_net_connect(mbedtls_net_context *ctx, const char *host, const char *port, int proto);
+int mbedtls_net_send(void *ctx, const unsigned char *buf, size_t len);
+int mbedtls_net_recv(void *ctx, unsigned char *buf, size_t len);
+void mbedtls_net_free(mbedtls_net_context *ctx);
+
+void mbedtls_x509_crt_init(mbedtls_x509_crt *crt);
+int mbedtls_x509_crt_parse_der(mbedtls_x509_crt *chain, const unsigned char *buf, size_t buflen);
+void mbedtls_x509_crt_free(mbedtls_x509_crt *crt);
+
+void mbedtls_pk_init(mbedtls_pk_context *ctx);
+int mbedtls_pk_parse_key(mbedtls_pk_context *ctx, const unsigned char *key, size_t keylen, const unsigned char *pwd, size_t pwdlen);
+void mbedtls_pk_free(mbedtls_pk_context *ctx);
+
+void mbedtls_entropy_init(mbedtls_entropy_context *ctx);
+int mbedtls_entropy_func(void *data, unsigned char *output, size_t len);
+void mbedtls_entropy_free(mbedtls_entropy_context *ctx);
+
+void mbedtls_ctr_drbg_init(mbedtls_ctr_drbg_context *ctx);
+int mbedtls_ctr_drbg_seed(mbedtls_ctr_drbg_context *ctx, int (*f_entropy)(void *, unsigned char *, size_t), void *p_entropy, const unsigned char *custom, size_t len);
+int mbedtls_ctr_drbg_random(void *p_rng, unsigned char *output, size_t output_len);
+void mbedtls_ctr_drbg_free(mbedtls_ctr_drbg_context *ctx);
+
+void mbedtls_ssl_config_init(mbedtls_ssl_config *conf);
+int mbedtls_ssl_config_defaults(mbedtls_ssl_config *conf, int endpoint, int transport, int preset);
+void mbedtls_ssl_conf_authmode(mbedtls_ssl_config *conf, int authmode);
+void mbedtls_ssl_conf_ca_chain(mbedtls_ssl_config *conf, mbedtls_x509_crt *ca_chain, void *ca_crl);
+void mbedtls_ssl_conf_rng(mbedtls_ssl_config *conf, int (*f_rng)(void *, unsigned char *, size_t), void *p_rng);
+void mbedtls_ssl_conf_cert_profile(mbedtls_ssl_config *conf, const mbedtls_x509_crt_profile *profile);
+int mbedtls_ssl_conf_own_cert(mbedtls_ssl_config *conf, mbedtls_x509_crt *own_cert, mbedtls_pk_context *pk_key);
+void mbedtls_ssl_conf_session_tickets(mbedtls_ssl_config *conf, int use_tickets);
+void mbedtls_ssl_config_free(mbedtls_ssl_config *conf);
+void mbedtls_esp_enable_debug_log(mbedtls_ssl_config *conf, int threshold);
+
+void mbedtls_ssl_init(mbedtls_ssl_context *ssl);
+int mbedtls_ssl_setup(mbedtls_ssl_context *ssl, const mbedtls_ssl_config *conf);
+int mbedtls_ssl_set_hostname(mbedtls_ssl_context *ssl, const char *hostname);
+void mbedtls_ssl_set_bio(mbedtls_ssl_context *ssl, void *p_bio, mbedtls_ssl_send_t f_send, mbedtls_ssl_recv_t f_recv, mbedtls_ssl_recv_timeout_t f_recv_timeout);
+int mbedtls_ssl_set_session(mbedtls_ssl_context *ssl, const mbedtls_ssl_session *session);
+int mbedtls_ssl_get_session(const mbedtls_ssl_context *ssl, mbedtls_ssl_session *session);
+int mbedtls_ssl_handshake(mbedtls_ssl_context *ssl);
+uint32_t mbedtls_ssl_get_verify_result(const mbedtls_ssl_context *ssl);
+int mbedtls_ssl_read(mbedtls_ssl_context *ssl, unsigned char *buf, size_t len);
+int mbedtls_ssl_write(mbedtls_ssl_context *ssl, const unsigned char *buf, size_t len);
+int mbedtls_ssl_close_notify(mbedtls_ssl_context *ssl);
+void mbedtls_ssl_free(mbedtls_ssl_context *ssl);
+
+void mbedtls_ssl_session_init(mbedtls_ssl_session *session);
+void mbedtls_ssl_session_free(mbedtls_ssl_session *session);
+
+#endif // ESP_TLS_H
+// vim: set sw=4 ts=4 indk= et si:
@@ -0,0 +1,18 @@
+#ifndef ESP_WIFI_H
+#define ESP_WIFI_H
+
+#include <esp_err.h>
+
+// the host network is always up, only the power save mode is recorded
+
+typedef enum {
+    WIFI_PS_NONE,
+    WIFI_PS_MIN_MODEM,
+    WIFI_PS_MAX_MODEM,
+} wifi_ps_type_t;
+
+esp_err_t esp_wifi_set_ps(wifi_ps_type_t type);
+esp_err_t esp_wifi_get_ps(wifi_ps_type_t *type);
+
+#endif // ESP_WIFI_H
+// vim: set sw=4 ts=4 indk= et si:
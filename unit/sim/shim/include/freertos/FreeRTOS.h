@@ -0,0 +1,59 @@
+#ifndef FREERTOS_H
+#define FREERTOS_H
+
+#include <sdkconfig.h>
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+/* The subset of the FreeRTOS API the components use, on pthreads.
+ *
+ * The tick rate is that of the sdkconfig, so the timeouts are quantized the same way as on the target. The task
+ * priorities are ignored, the host scheduler decides.
+ */
+
+typedef int32_t BaseType_t;
+typedef uint32_t UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE                 ((BaseType_t)0)
+#define pdTRUE                  ((BaseType_t)1)
+#define pdPASS                  pdTRUE
+#define pdFAIL                  pdFALSE
+
+#define configTICK_RATE_HZ      CONFIG_FREERTOS_HZ
+#define portMAX_DELAY           ((TickType_t)0xffffffffUL)
+#define portTICK_PERIOD_MS      ((TickType_t)1000 / configTICK_RATE_HZ)
+#define portTICK_RATE_MS        portTICK_PERIOD_MS
+#define pdMS_TO_TICKS(ms)       ((TickType_t)(((TickType_t)(ms) * (TickType_t)configTICK_RATE_HZ) / (TickType_t)1000))
+
+#ifndef BIT0
+#define BIT0    0x00000001
+#define BIT1    0x00000002
+#define BIT2    0x00000004
+#define BIT3    0x00000008
+#define BIT4    0x00000010
+#define BIT5    0x00000020
+#define BIT6    0x00000040
+#define BIT7    0x00000080
+#define BIT8    0x00000100
+#define BIT9    0x00000200
+#define BIT10   0x00000400
+#define BIT11   0x00000800
+#define BIT12   0x00001000
+#define BIT13   0x00002000
+#define BIT14   0x00004000
+#define BIT15   0x00008000
+#endif // BIT0
+
+// one global lock, the target is single-core
+void vPortEnterCritical(void);
+void vPortExitCritical(void);
+#define taskENTER_CRITICAL()    vPortEnterCritical()
+#define taskEXIT_CRITICAL()     vPortExitCritical()
+
+#endif // FREERTOS_H
+// vim: set sw=4 ts=4 indk= et si:
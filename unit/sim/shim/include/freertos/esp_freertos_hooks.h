@@ -0,0 +1,13 @@
+#ifndef ESP_FREERTOS_HOOKS_H
+#define ESP_FREERTOS_HOOKS_H
+
+#include <esp_err.h>
+#include <stdbool.h>
+
+typedef bool (*esp_freertos_idle_cb_t)(void);
+
+// called once per tick from a background thread of the lowest host priority
+esp_err_t esp_register_freertos_idle_hook(esp_freertos_idle_cb_t cb);
+
+#endif // ESP_FREERTOS_HOOKS_H
+// vim: set sw=4 ts=4 indk= et si:
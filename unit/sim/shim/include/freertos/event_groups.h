@@ -0,0 +1,18 @@
+#ifndef EVENT_GROUPS_H
+#define EVENT_GROUPS_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+typedef struct sim_event_group *EventGroupHandle_t;
+typedef TickType_t EventBits_t;
+
+EventGroupHandle_t xEventGroupCreate(void);
+EventBits_t xEventGroupSetBits(EventGroupHandle_t eg, EventBits_t bits);
+EventBits_t xEventGroupClearBits(EventGroupHandle_t eg, EventBits_t bits);
+EventBits_t xEventGroupGetBits(EventGroupHandle_t eg);
+// returns the bits as they were when the wait ended, before clearing them
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t eg, EventBits_t bits, BaseType_t clear_on_exit, BaseType_t wait_for_all, TickType_t ticks);
+
+#endif // EVENT_GROUPS_H
+// vim: set sw=4 ts=4 indk= et si:
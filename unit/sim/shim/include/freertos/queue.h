@@ -0,0 +1,19 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+typedef struct sim_queue *QueueHandle_t;
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+void vQueueDelete(QueueHandle_t q);
+BaseType_t xQueueSend(QueueHandle_t q, const void *item, TickType_t ticks);
+BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t ticks);
+BaseType_t xQueueReset(QueueHandle_t q);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q);
+
+#define xQueueSendToBack    xQueueSend
+
+#endif // QUEUE_H
+// vim: set sw=4 ts=4 indk= et si:
@@ -0,0 +1,17 @@
+#ifndef SEMPHR_H
+#define SEMPHR_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+typedef struct sim_semaphore *SemaphoreHandle_t;
+
+// a binary semaphore starts empty, a mutex starts available
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+void vSemaphoreDelete(SemaphoreHandle_t sem);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem);
+
+#endif // SEMPHR_H
+// vim: set sw=4 ts=4 indk= et si:
@@ -0,0 +1,18 @@
+#ifndef TASK_H
+#define TASK_H
+
+#include <freertos/FreeRTOS.h>
+
+typedef void (*TaskFunction_t)(void *);
+typedef void *TaskHandle_t;
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *arg, UBaseType_t prio, TaskHandle_t *handle);
+// only the calling task can delete itself (@task == NULL)
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount(void);
+UBaseType_t uxTaskGetNumberOfTasks(void);
+void vTaskList(char *buf);
+
+#endif // TASK_H
+// vim: set sw=4 ts=4 indk= et si:
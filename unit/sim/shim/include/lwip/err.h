@@ -0,0 +1,11 @@
+#ifndef LWIP_ERR_H
+#define LWIP_ERR_H
+
+#include <errno.h>
+
+typedef signed char err_t;
+
+#define ERR_OK  0
+
+#endif // LWIP_ERR_H
+// vim: set sw=4 ts=4 indk= et si:
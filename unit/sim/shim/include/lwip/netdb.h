@@ -0,0 +1,7 @@
+#ifndef LWIP_NETDB_H
+#define LWIP_NETDB_H
+
+#include <netdb.h>
+
+#endif // LWIP_NETDB_H
+// vim: set sw=4 ts=4 indk= et si:
@@ -0,0 +1,14 @@
+#ifndef LWIP_SOCKETS_H
+#define LWIP_SOCKETS_H
+
+// the lwip socket api is the bsd one, so it's the host's own
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <errno.h>
+
+#endif // LWIP_SOCKETS_H
+// vim: set sw=4 ts=4 indk= et si:
@@ -0,0 +1,9 @@
+#ifndef LWIP_SYS_H
+#define LWIP_SYS_H
+
+#include <lwip/err.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#endif // LWIP_SYS_H
+// vim: set sw=4 ts=4 indk= et si:
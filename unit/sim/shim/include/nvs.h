@@ -0,0 +1,61 @@
+#ifndef NVS_H
+#define NVS_H
+
+#include <esp_err.h>
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* The NVS on a RAM table, loaded from the csv of the nvs partition by sim_nvs_load().
+ *
+ * The writes are kept only for the run of the sim.
+ */
+
+#define ESP_ERR_NVS_BASE                0x1100
+#define ESP_ERR_NVS_NOT_INITIALIZED     (ESP_ERR_NVS_BASE + 0x01)
+#define ESP_ERR_NVS_NOT_FOUND           (ESP_ERR_NVS_BASE + 0x02)
+#define ESP_ERR_NVS_TYPE_MISMATCH       (ESP_ERR_NVS_BASE + 0x03)
+#define ESP_ERR_NVS_READ_ONLY           (ESP_ERR_NVS_BASE + 0x04)
+#define ESP_ERR_NVS_NOT_ENOUGH_SPACE    (ESP_ERR_NVS_BASE + 0x05)
+#define ESP_ERR_NVS_INVALID_NAME        (ESP_ERR_NVS_BASE + 0x06)
+#define ESP_ERR_NVS_INVALID_HANDLE      (ESP_ERR_NVS_BASE + 0x07)
+#define ESP_ERR_NVS_INVALID_LENGTH      (ESP_ERR_NVS_BASE + 0x0c)
+#define ESP_ERR_NVS_NO_FREE_PAGES       (ESP_ERR_NVS_BASE + 0x0d)
+
+typedef uint32_t nvs_handle;
+
+typedef enum {
+    NVS_READONLY,
+    NVS_READWRITE
+} nvs_open_mode;
+
+esp_err_t nvs_open(const char *name, nvs_open_mode open_mode, nvs_handle *out_handle);
+void nvs_close(nvs_handle handle);
+esp_err_t nvs_commit(nvs_handle handle);
+esp_err_t nvs_erase_key(nvs_handle handle, const char *key);
+
+esp_err_t nvs_get_i8(nvs_handle handle, const char *key, int8_t *out_value);
+esp_err_t nvs_get_u8(nvs_handle handle, const char *key, uint8_t *out_value);
+esp_err_t nvs_get_i16(nvs_handle handle, const char *key, int16_t *out_value);
+esp_err_t nvs_get_u16(nvs_handle handle, const char *key, uint16_t *out_value);
+esp_err_t nvs_get_i32(nvs_handle handle, const char *key, int32_t *out_value);
+esp_err_t nvs_get_u32(nvs_handle handle, const char *key, uint32_t *out_value);
+esp_err_t nvs_get_i64(nvs_handle handle, const char *key, int64_t *out_value);
+esp_err_t nvs_get_u64(nvs_handle handle, const char *key, uint64_t *out_value);
+// @out_value == NULL: only the length is returned, including the terminating nul of a string
+esp_err_t nvs_get_str(nvs_handle handle, const char *key, char *out_value, size_t *length);
+esp_err_t nvs_get_blob(nvs_handle handle, const char *key, void *out_value, size_t *length);
+
+esp_err_t nvs_set_i8(nvs_handle handle, const char *key, int8_t value);
+esp_err_t nvs_set_u8(nvs_handle handle, const char *key, uint8_t value);
+esp_err_t nvs_set_i16(nvs_handle handle, const char *key, int16_t value);
+esp_err_t nvs_set_u16(nvs_handle handle, const char *key, uint16_t value);
+esp_err_t nvs_set_i32(nvs_handle handle, const char *key, int32_t value);
+esp_err_t nvs_set_u32(nvs_handle handle, const char *key, uint32_t value);
+esp_err_t nvs_set_i64(nvs_handle handle, const char *key, int64_t value);
+esp_err_t nvs_set_u64(nvs_handle handle, const char *key, uint64_t value);
+esp_err_t nvs_set_str(nvs_handle handle, const char *key, const char *value);
+esp_err_t nvs_set_blob(nvs_handle handle, const char *key, const void *value, size_t length);
+
+#endif // NVS_H
+// vim: set sw=4 ts=4 indk= et si:
@@ -0,0 +1,11 @@
+#ifndef NVS_FLASH_H
+#define NVS_FLASH_H
+
+#include <nvs.h>
+
+// the table is loaded by sim_nvs_load(), these only check that it was
+esp_err_t nvs_flash_init(void);
+esp_err_t nvs_flash_erase(void);
+
+#endif // NVS_FLASH_H
+// vim: set sw=4 ts=4 indk= et si:
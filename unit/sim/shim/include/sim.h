@@ -0,0 +1,45 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* The knobs of the simulated platform, set up by sim_main.c before the firmware starts.
+ *
+ * Everything else below the components behaves like the ESP8266 RTOS SDK does, as far as the components can tell.
+ */
+
+// uart.c: where UART0 reads from and writes to
+// @path: a regular file is replayed at the baud rate (or at once if !@paced), "-" is stdin, "pty" opens a new pty
+bool sim_uart_open(const char *path, bool paced);
+// the input has ended (regular file or pipe), nothing more will arrive
+bool sim_uart_eof(void);
+uint64_t sim_uart_rx_bytes(void);
+// the name of the other end of the pty, NULL if UART0 isn't on one
+const char *sim_uart_pty(void);
+
+// nvs.c: load the entries from a csv of the nvs_partition_gen.py format, relative file paths are taken from @base_dir
+bool sim_nvs_load(const char *csv_path, const char *base_dir);
+// "namespace.key=value", the type is that of the existing entry, or string if it's a new one
+bool sim_nvs_override(const char *assignment);
+
+// partition.c: the partition table csv, and the image file of the flash (NULL: in RAM only, starts erased)
+bool sim_flash_load(const char *partitions_csv, const char *image_path);
+// lose the power at the @ops-th write or erase from now: only the first half of that one is done, and it and all the
+// later ones fail; sim_flash_power_cut(0) powers it on again
+void sim_flash_power_cut(unsigned ops);
+bool sim_flash_power_is_cut(void);
+
+// mbedtls.c: the time the handshakes would take on the target, the connections themselves are plain tcp
+void sim_tls_set_handshake_ms(uint32_t full_ms, uint32_t resumed_ms);
+void sim_tls_get_stats(uint32_t *connects, uint32_t *full, uint32_t *resumed, uint32_t *failed);
+
+// esp_system.c
+void sim_adc_set_raw(uint16_t raw);
+
+// freertos.c: run the idle hooks in the background
+void sim_freertos_init(void);
+
+#endif // SIM_H
+// vim: set sw=4 ts=4 indk= et si:
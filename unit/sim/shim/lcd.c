@@ -0,0 +1,42 @@
+#include "oled_stdout.h"
+
+// there is no display, what the firmware shows on it is in the log anyway
+
+void
+lcd_putchar(int col, int row, char c) {
+}
+
+
+void
+lcd_puts(int col, int row, const char *s) {
+}
+
+
+int
+lcd_write(void *cookie, const char *buf, int n) {
+    return n;
+}
+
+
+void
+lcd_gotoxy(int col, int row) {
+}
+
+
+void
+lcd_clear(void) {
+}
+
+
+esp_err_t
+lcd_init(int port) {
+    return ESP_OK;
+}
+
+
+esp_err_t
+lcd_qr(const uint8_t *input, ssize_t input_length) {
+    return ESP_OK;
+}
+
+// vim: set sw=4 ts=4 indk= et si:
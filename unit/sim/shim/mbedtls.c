@@ -0,0 +1,430 @@
+#include "sim_private.h"
+#include "sim.h"
+
+#include <esp_tls.h>
+#include <esp_system.h>
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+/* The mbedTLS client on plain tcp
+ *
+ * The handshake only takes its time, and decides whether the offered session is resumed: it is, if the tickets are
+ * enabled, otherwise a new session gets a fresh master secret, just like a server that doesn't know it would do.
+ */
+
+const mbedtls_x509_crt_profile mbedtls_x509_crt_profile_next = { 0 };
+
+static uint32_t handshake_full_ms = 0, handshake_resumed_ms = 0;
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t n_connects, n_full, n_resumed, n_failed;
+
+
+void
+sim_tls_set_handshake_ms(uint32_t full_ms, uint32_t resumed_ms) {
+    handshake_full_ms = full_ms;
+    handshake_resumed_ms = resumed_ms;
+}
+
+
+void
+sim_tls_get_stats(uint32_t *connects, uint32_t *full, uint32_t *resumed, uint32_t *failed) {
+    pthread_mutex_lock(&stats_mutex);
+    *connects = n_connects;
+    *full = n_full;
+    *resumed = n_resumed;
+    *failed = n_failed;
+    pthread_mutex_unlock(&stats_mutex);
+}
+
+
+static void
+count(uint32_t *counter) {
+    pthread_mutex_lock(&stats_mutex);
+    ++*counter;
+    pthread_mutex_unlock(&stats_mutex);
+}
+
+
+/*
+ * net
+ */
+
+void
+mbedtls_net_init(mbedtls_net_context *ctx) {
+    ctx->fd = -1;
+}
+
+
+int
+mbedtls_net_connect(mbedtls_net_context *ctx, const char *host, const char *port, int proto) {
+    count(&n_connects);
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM, .ai_protocol = IPPROTO_TCP };
+    struct addrinfo *addrs;
+    if (getaddrinfo(host, port, &hints, &addrs) != 0) {
+        count(&n_failed);
+        return MBEDTLS_ERR_NET_UNKNOWN_HOST;
+    }
+    int res = MBEDTLS_ERR_NET_CONNECT_FAILED;
+    for (struct addrinfo *a = addrs; a; a = a->ai_next) {
+        int fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd < 0) {
+            res = MBEDTLS_ERR_NET_SOCKET_FAILED;
+            continue;
+        }
+        if (connect(fd, a->ai_addr, a->ai_addrlen) == 0) {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            ctx->fd = fd;
+            res = 0;
+            break;
+        }
+        close(fd);
+        res = MBEDTLS_ERR_NET_CONNECT_FAILED;
+    }
+    freeaddrinfo(addrs);
+    if (res) {
+        count(&n_failed);
+    }
+    return res;
+}
+
+
+int
+mbedtls_net_send(void *ctx, const unsigned char *buf, size_t len) {
+    int fd = ((mbedtls_net_context*)ctx)->fd;
+    if (fd < 0) {
+        return MBEDTLS_ERR_NET_SEND_FAILED;
+    }
+    ssize_t res = send(fd, buf, len, MSG_NOSIGNAL);
+    if (res < 0) {
+        return (errno == EINTR) ? MBEDTLS_ERR_SSL_WANT_WRITE : MBEDTLS_ERR_NET_SEND_FAILED;
+    }
+    return res;
+}
+
+
+int
+mbedtls_net_recv(void *ctx, unsigned char *buf, size_t len) {
+    int fd = ((mbedtls_net_context*)ctx)->fd;
+    if (fd < 0) {
+        return MBEDTLS_ERR_NET_RECV_FAILED;
+    }
+    ssize_t res = recv(fd, buf, len, 0);
+    if (res < 0) {
+        return (errno == EINTR) ? MBEDTLS_ERR_SSL_WANT_READ : MBEDTLS_ERR_NET_RECV_FAILED;
+    }
+    return res;
+}
+
+
+void
+mbedtls_net_free(mbedtls_net_context *ctx) {
+    if (ctx->fd >= 0) {
+        close(ctx->fd);
+        ctx->fd = -1;
+    }
+}
+
+
+/*
+ * x509, pk: only the subject CN is taken
+ */
+
+void
+mbedtls_x509_crt_init(mbedtls_x509_crt *crt) {
+    memset(crt, 0, sizeof(*crt));
+}
+
+
+int
+mbedtls_x509_crt_parse_der(mbedtls_x509_crt *chain, const unsigned char *buf, size_t buflen) {
+    if (!buf || (buflen < 2) || (buf[0] != 0x30)) {
+        return MBEDTLS_ERR_X509_INVALID_FORMAT;
+    }
+    free(chain->raw);
+    chain->raw = (unsigned char*)malloc(buflen);
+    if (!chain->raw) {
+        return MBEDTLS_ERR_X509_INVALID_FORMAT;
+    }
+    memcpy(chain->raw, buf, buflen);
+    chain->raw_len = buflen;
+    memset(&chain->subject, 0, sizeof(chain->subject));
+
+    // the issuer comes before the subject, so the last CN is the one of the subject
+    const unsigned char *p = chain->raw;
+    for (size_t i = 0; (i + 7) <= buflen; ++i) {
+        if ((p[i] == 0x06) && (p[i + 1] == 0x03) && (p[i + 2] == 0x55) && (p[i + 3] == 0x04) && (p[i + 4] == 0x03) &&
+            !(p[i + 6] & 0x80) && ((i + 7 + p[i + 6]) <= buflen)) {
+            chain->subject.oid.tag = p[i];
+            chain->subject.oid.len = 3;
+            chain->subject.oid.p = chain->raw + i + 2;
+            chain->subject.val.tag = p[i + 5];
+            chain->subject.val.len = p[i + 6];
+            chain->subject.val.p = chain->raw + i + 7;
+        }
+    }
+    return 0;
+}
+
+
+void
+mbedtls_x509_crt_free(mbedtls_x509_crt *crt) {
+    free(crt->raw);
+    memset(crt, 0, sizeof(*crt));
+}
+
+
+void
+mbedtls_pk_init(mbedtls_pk_context *ctx) {
+    ctx->valid = 0;
+}
+
+
+int
+mbedtls_pk_parse_key(mbedtls_pk_context *ctx, const unsigned char *key, size_t keylen, const unsigned char *pwd, size_t pwdlen) {
+    ctx->valid = (key && keylen);
+    return ctx->valid ? 0 : MBEDTLS_ERR_X509_INVALID_FORMAT;
+}
+
+
+void
+mbedtls_pk_free(mbedtls_pk_context *ctx) {
+    ctx->valid = 0;
+}
+
+
+/*
+ * rng
+ */
+
+void
+mbedtls_entropy_init(mbedtls_entropy_context *ctx) {
+}
+
+
+int
+mbedtls_entropy_func(void *data, unsigned char *output, size_t len) {
+    for (size_t i = 0; i < len; ++i) {
+        output[i] = esp_random();
+    }
+    return 0;
+}
+
+
+void
+mbedtls_entropy_free(mbedtls_entropy_context *ctx) {
+}
+
+
+void
+mbedtls_ctr_drbg_init(mbedtls_ctr_drbg_context *ctx) {
+    ctx->state = 0;
+}
+
+
+int
+mbedtls_ctr_drbg_seed(mbedtls_ctr_drbg_context *ctx, int (*f_entropy)(void *, unsigned char *, size_t), void *p_entropy, const unsigned char *custom, size_t len) {
+    return f_entropy(p_entropy, (unsigned char*)&ctx->state, sizeof(ctx->state));
+}
+
+
+int
+mbedtls_ctr_drbg_random(void *p_rng, unsigned char *output, size_t output_len) {
+    return mbedtls_entropy_func(NULL, output, output_len);
+}
+
+
+void
+mbedtls_ctr_drbg_free(mbedtls_ctr_drbg_context *ctx) {
+}
+
+
+/*
+ * ssl config
+ */
+
+void
+mbedtls_ssl_config_init(mbedtls_ssl_config *conf) {
+    memset(conf, 0, sizeof(*conf));
+}
+
+
+int
+mbedtls_ssl_config_defaults(mbedtls_ssl_config *conf, int endpoint, int transport, int preset) {
+    conf->authmode = MBEDTLS_SSL_VERIFY_REQUIRED;
+    conf->tickets = MBEDTLS_SSL_SESSION_TICKETS_DISABLED;
+    return 0;
+}
+
+
+void
+mbedtls_ssl_conf_authmode(mbedtls_ssl_config *conf, int authmode) {
+    conf->authmode = authmode;
+}
+
+
+void
+mbedtls_ssl_conf_ca_chain(mbedtls_ssl_config *conf, mbedtls_x509_crt *ca_chain, void *ca_crl) {
+}
+
+
+void
+mbedtls_ssl_conf_rng(mbedtls_ssl_config *conf, int (*f_rng)(void *, unsigned char *, size_t), void *p_rng) {
+    conf->f_rng = f_rng;
+    conf->p_rng = p_rng;
+}
+
+
+void
+mbedtls_ssl_conf_cert_profile(mbedtls_ssl_config *conf, const mbedtls_x509_crt_profile *profile) {
+}
+
+
+int
+mbedtls_ssl_conf_own_cert(mbedtls_ssl_config *conf, mbedtls_x509_crt *own_cert, mbedtls_pk_context *pk_key) {
+    return 0;
+}
+
+
+void
+mbedtls_ssl_conf_session_tickets(mbedtls_ssl_config *conf, int use_tickets) {
+    conf->tickets = use_tickets;
+}
+
+
+void
+mbedtls_ssl_config_free(mbedtls_ssl_config *conf) {
+    memset(conf, 0, sizeof(*conf));
+}
+
+
+void
+mbedtls_esp_enable_debug_log(mbedtls_ssl_config *conf, int threshold) {
+}
+
+
+/*
+ * ssl context
+ */
+
+void
+mbedtls_ssl_init(mbedtls_ssl_context *ssl) {
+    memset(ssl, 0, sizeof(*ssl));
+}
+
+
+int
+mbedtls_ssl_setup(mbedtls_ssl_context *ssl, const mbedtls_ssl_config *conf) {
+    memset(ssl, 0, sizeof(*ssl));
+    ssl->conf = conf;
+    return 0;
+}
+
+
+int
+mbedtls_ssl_set_hostname(mbedtls_ssl_context *ssl, const char *hostname) {
+    return 0;
+}
+
+
+void
+mbedtls_ssl_set_bio(mbedtls_ssl_context *ssl, void *p_bio, mbedtls_ssl_send_t f_send, mbedtls_ssl_recv_t f_recv, mbedtls_ssl_recv_timeout_t f_recv_timeout) {
+    ssl->p_bio = p_bio;
+    ssl->f_send = f_send;
+    ssl->f_recv = f_recv;
+}
+
+
+int
+mbedtls_ssl_set_session(mbedtls_ssl_context *ssl, const mbedtls_ssl_session *session) {
+    if (!ssl->conf || !session) {
+        return MBEDTLS_ERR_SSL_BAD_INPUT_DATA;
+    }
+    ssl->session_negotiate = *session;
+    ssl->session_offered = 1;
+    return 0;
+}
+
+
+int
+mbedtls_ssl_get_session(const mbedtls_ssl_context *ssl, mbedtls_ssl_session *session) {
+    if (!ssl->session || !session) {
+        return MBEDTLS_ERR_SSL_BAD_INPUT_DATA;
+    }
+    *session = *ssl->session;
+    return 0;
+}
+
+
+int
+mbedtls_ssl_handshake(mbedtls_ssl_context *ssl) {
+    if (!ssl->conf || !ssl->p_bio || (((mbedtls_net_context*)ssl->p_bio)->fd < 0)) {
+        count(&n_failed);
+        return MBEDTLS_ERR_SSL_BAD_INPUT_DATA;
+    }
+    bool resumed = ssl->session_offered && (ssl->conf->tickets == MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+    if (resumed) {
+        sim_sleep_us(handshake_resumed_ms * 1000LL);
+        count(&n_resumed);
+    }
+    else {
+        ssl->conf->f_rng(ssl->conf->p_rng, ssl->session_negotiate.master, sizeof(ssl->session_negotiate.master));
+        sim_sleep_us(handshake_full_ms * 1000LL);
+        count(&n_full);
+    }
+    ssl->session = &ssl->session_negotiate;
+    return 0;
+}
+
+
+uint32_t
+mbedtls_ssl_get_verify_result(const mbedtls_ssl_context *ssl) {
+    return 0;
+}
+
+
+int
+mbedtls_ssl_read(mbedtls_ssl_context *ssl, unsigned char *buf, size_t len) {
+    return ssl->f_recv(ssl->p_bio, buf, len);
+}
+
+
+int
+mbedtls_ssl_write(mbedtls_ssl_context *ssl, const unsigned char *buf, size_t len) {
+    return ssl->f_send(ssl->p_bio, buf, len);
+}
+
+
+int
+mbedtls_ssl_close_notify(mbedtls_ssl_context *ssl) {
+    return 0;
+}
+
+
+void
+mbedtls_ssl_free(mbedtls_ssl_context *ssl) {
+    memset(ssl, 0, sizeof(*ssl));
+}
+
+
+void
+mbedtls_ssl_session_init(mbedtls_ssl_session *session) {
+    memset(session, 0, sizeof(*session));
+}
+
+
+void
+mbedtls_ssl_session_free(mbedtls_ssl_session *session) {
+    memset(session, 0, sizeof(*session));
+}
+
+// vim: set sw=4 ts=4 indk= et si:
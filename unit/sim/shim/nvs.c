@@ -0,0 +1,483 @@
+#include "sim.h"
+
+#include <nvs.h>
+#include <nvs_flash.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+
+#define KEY_MAX         16      // including the nul, as on the target
+#define MAX_NAMESPACES  16
+#define LINE_MAX_LEN    1024
+
+typedef enum {
+    T_U8, T_I8, T_U16, T_I16, T_U32, T_I32, T_U64, T_I64, T_STR, T_BLOB
+} entry_type_t;
+
+static const char *type_names[] = { "u8", "i8", "u16", "i16", "u32", "i32", "u64", "i64", "string", "blob" };
+
+typedef struct entry {
+    char ns[KEY_MAX];
+    char key[KEY_MAX];
+    entry_type_t type;
+    uint64_t num;           // the integers, sign extended
+    uint8_t *data;          // strings (with their nul) and blobs
+    size_t len;
+    struct entry *next;
+} entry_t;
+
+static entry_t *entries = NULL;
+static char namespaces[MAX_NAMESPACES][KEY_MAX]; // the handles are the indices + 1
+static bool loaded = false;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+static entry_t *
+find(const char *ns, const char *key) {
+    for (entry_t *e = entries; e; e = e->next) {
+        if (!strcmp(e->ns, ns) && !strcmp(e->key, key)) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+
+static entry_t *
+find_or_add(const char *ns, const char *key, bool *created) {
+    entry_t *e = find(ns, key);
+    if (created) {
+        *created = !e;
+    }
+    if (!e) {
+        e = (entry_t*)calloc(1, sizeof(*e));
+        snprintf(e->ns, KEY_MAX, "%s", ns);
+        snprintf(e->key, KEY_MAX, "%s", key);
+        e->next = entries;
+        entries = e;
+    }
+    return e;
+}
+
+
+static void
+set_data(entry_t *e, entry_type_t type, const void *data, size_t len) {
+    free(e->data);
+    e->type = type;
+    e->data = (uint8_t*)malloc(len ? len : 1);
+    memcpy(e->data, data, len);
+    e->len = len;
+}
+
+
+static bool
+ns_exists(const char *ns) {
+    for (int i = 0; i < MAX_NAMESPACES; ++i) {
+        if (!strcmp(namespaces[i], ns)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+static int
+ns_handle(const char *ns, bool create) {
+    int free_idx = -1;
+    for (int i = 0; i < MAX_NAMESPACES; ++i) {
+        if (!strcmp(namespaces[i], ns)) {
+            return i + 1;
+        }
+        if ((free_idx < 0) && !namespaces[i][0]) {
+            free_idx = i;
+        }
+    }
+    if (!create || (free_idx < 0)) {
+        return 0;
+    }
+    snprintf(namespaces[free_idx], KEY_MAX, "%s", ns);
+    return free_idx + 1;
+}
+
+
+/*
+ * Loading the csv
+ */
+
+static int
+parse_type(const char *s) {
+    for (int i = T_U8; i <= T_I64; ++i) {
+        if (!strcmp(s, type_names[i])) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+static bool
+set_number(entry_t *e, entry_type_t type, const char *s) {
+    char *end;
+    long long x = strtoll(s, &end, 0);
+    if ((end == s) || *end) {
+        return false;
+    }
+    e->type = type;
+    e->num = (uint64_t)x;
+    return true;
+}
+
+
+static uint8_t *
+read_file(const char *path, const char *base_dir, size_t *len) {
+    char full[PATH_MAX];
+    if ((path[0] != '/') && base_dir) {
+        snprintf(full, sizeof(full), "%s/%s", base_dir, path);
+        path = full;
+    }
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    *len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *buf = (uint8_t*)malloc(*len + 1);
+    if (fread(buf, 1, *len, f) != *len) {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(f);
+    return buf;
+}
+
+
+// the value of a "data" or "file" entry
+static bool
+set_value(entry_t *e, const char *kind, const char *encoding, const char *value, const char *base_dir) {
+    int t = parse_type(encoding);
+    if (t >= 0) {
+        return set_number(e, (entry_type_t)t, value);
+    }
+    size_t len = strlen(value);
+    uint8_t *file_data = NULL;
+    if (!strcmp(kind, "file")) {
+        file_data = read_file(value, base_dir, &len);
+        if (!file_data) {
+            fprintf(stderr, "nvs: cannot read '%s' for %s.%s\n", value, e->ns, e->key);
+            return false;
+        }
+        value = (const char*)file_data;
+    }
+    bool ok = true;
+    if (!strcmp(encoding, "string")) {
+        uint8_t *s = (uint8_t*)malloc(len + 1);
+        memcpy(s, value, len);
+        s[len] = '\0';
+        set_data(e, T_STR, s, len + 1);
+        free(s);
+    }
+    else if (!strcmp(encoding, "binary")) {
+        set_data(e, T_BLOB, value, len);
+    }
+    else if (!strcmp(encoding, "hex2bin")) {
+        uint8_t *b = (uint8_t*)malloc(len / 2 + 1);
+        size_t n = 0;
+        for (size_t i = 0; ok && (i + 1 < len); i += 2) {
+            unsigned int x;
+            ok = (sscanf(value + i, "%2x", &x) == 1);
+            b[n++] = x;
+        }
+        if (ok) {
+            set_data(e, T_BLOB, b, n);
+        }
+        free(b);
+    }
+    else {
+        fprintf(stderr, "nvs: unsupported encoding '%s' of %s.%s\n", encoding, e->ns, e->key);
+        ok = false;
+    }
+    free(file_data);
+    return ok;
+}
+
+
+static char *
+trim(char *s) {
+    while (isspace((unsigned char)*s)) {
+        ++s;
+    }
+    char *end = s + strlen(s);
+    while ((end > s) && isspace((unsigned char)end[-1])) {
+        *(--end) = '\0';
+    }
+    return s;
+}
+
+
+bool
+sim_nvs_load(const char *csv_path, const char *base_dir) {
+    FILE *f = fopen(csv_path, "r");
+    if (!f) {
+        perror(csv_path);
+        return false;
+    }
+    char line[LINE_MAX_LEN], ns[KEY_MAX] = "";
+    bool ok = true;
+    pthread_mutex_lock(&mutex);
+    for (int lineno = 1; fgets(line, sizeof(line), f); ++lineno) {
+        char *field[4] = { "", "", "", "" }, *p = line;
+        for (int i = 0; (i < 4) && p; ++i) {
+            char *sep = (i < 3) ? strchr(p, ',') : NULL; // the value may contain commas
+            if (sep) {
+                *(sep++) = '\0';
+            }
+            field[i] = trim(p);
+            p = sep;
+        }
+        if (!field[0][0] || (field[0][0] == '#') || (lineno == 1 && !strcmp(field[0], "key"))) {
+            continue;
+        }
+        if (!strcmp(field[1], "namespace")) {
+            snprintf(ns, KEY_MAX, "%s", field[0]);
+            ns_handle(ns, true);
+            continue;
+        }
+        if (!ns[0] || !set_value(find_or_add(ns, field[0], NULL), field[1], field[2], field[3], base_dir)) {
+            fprintf(stderr, "%s:%d: invalid entry\n", csv_path, lineno);
+            ok = false;
+        }
+    }
+    fclose(f);
+    loaded = true;
+    pthread_mutex_unlock(&mutex);
+    return ok;
+}
+
+
+bool
+sim_nvs_override(const char *assignment) {
+    const char *dot = strchr(assignment, '.'), *eq = strchr(assignment, '=');
+    if (!dot || !eq || (eq < dot) || ((dot - assignment) >= KEY_MAX) || ((eq - dot - 1) >= KEY_MAX)) {
+        return false;
+    }
+    char ns[KEY_MAX] = "", key[KEY_MAX] = "";
+    memcpy(ns, assignment, dot - assignment);
+    memcpy(key, dot + 1, eq - dot - 1);
+    pthread_mutex_lock(&mutex);
+    ns_handle(ns, true);
+    bool is_new;
+    entry_t *e = find_or_add(ns, key, &is_new);
+    const char *encoding = (is_new || (e->type == T_STR)) ? "string" : (e->type == T_BLOB) ? "hex2bin" : type_names[e->type];
+    bool ok = set_value(e, "data", encoding, eq + 1, NULL);
+    pthread_mutex_unlock(&mutex);
+    return ok;
+}
+
+
+/*
+ * The api
+ */
+
+esp_err_t
+nvs_flash_init(void) {
+    return loaded ? ESP_OK : ESP_ERR_NVS_NO_FREE_PAGES;
+}
+
+
+esp_err_t
+nvs_flash_erase(void) {
+    pthread_mutex_lock(&mutex);
+    while (entries) {
+        entry_t *next = entries->next;
+        free(entries->data);
+        free(entries);
+        entries = next;
+    }
+    memset(namespaces, 0, sizeof(namespaces));
+    loaded = true;
+    pthread_mutex_unlock(&mutex);
+    return ESP_OK;
+}
+
+
+esp_err_t
+nvs_open(const char *name, nvs_open_mode open_mode, nvs_handle *out_handle) {
+    if (!loaded) {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+    if (strlen(name) >= KEY_MAX) {
+        return ESP_ERR_NVS_INVALID_NAME;
+    }
+    pthread_mutex_lock(&mutex);
+    int h = ((open_mode == NVS_READONLY) && !ns_exists(name)) ? 0 : ns_handle(name, true);
+    pthread_mutex_unlock(&mutex);
+    if (!h) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    // the mode is kept in the high bit
+    *out_handle = h | ((open_mode == NVS_READONLY) ? 0x80000000 : 0);
+    return ESP_OK;
+}
+
+
+void
+nvs_close(nvs_handle handle) {
+}
+
+
+esp_err_t
+nvs_commit(nvs_handle handle) {
+    return ESP_OK;
+}
+
+
+static const char *
+handle_ns(nvs_handle handle) {
+    uint32_t idx = (handle & 0x7fffffff) - 1;
+    return (idx < MAX_NAMESPACES) && namespaces[idx][0] ? namespaces[idx] : NULL;
+}
+
+
+// with the mutex held
+static esp_err_t
+lookup(nvs_handle handle, const char *key, entry_type_t type, entry_t **out) {
+    const char *ns = handle_ns(handle);
+    if (!ns) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    entry_t *e = find(ns, key);
+    // the type is part of the key on the target, so a mismatching one isn't found
+    if (!e || (e->type != type)) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    *out = e;
+    return ESP_OK;
+}
+
+
+static esp_err_t
+set_entry(nvs_handle handle, const char *key, entry_type_t type, uint64_t num, const void *data, size_t len) {
+    if (handle & 0x80000000) {
+        return ESP_ERR_NVS_READ_ONLY;
+    }
+    if (strlen(key) >= KEY_MAX) {
+        return ESP_ERR_NVS_INVALID_NAME;
+    }
+    pthread_mutex_lock(&mutex);
+    const char *ns = handle_ns(handle);
+    if (!ns) {
+        pthread_mutex_unlock(&mutex);
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    entry_t *e = find_or_add(ns, key, NULL);
+    if (data) {
+        set_data(e, type, data, len);
+    }
+    else {
+        free(e->data);
+        e->data = NULL;
+        e->type = type;
+        e->num = num;
+    }
+    pthread_mutex_unlock(&mutex);
+    return ESP_OK;
+}
+
+
+esp_err_t
+nvs_erase_key(nvs_handle handle, const char *key) {
+    if (handle & 0x80000000) {
+        return ESP_ERR_NVS_READ_ONLY;
+    }
+    pthread_mutex_lock(&mutex);
+    const char *ns = handle_ns(handle);
+    for (entry_t **pe = &entries; ns && *pe; pe = &(*pe)->next) {
+        if (!strcmp((*pe)->ns, ns) && !strcmp((*pe)->key, key)) {
+            entry_t *e = *pe;
+            *pe = e->next;
+            free(e->data);
+            free(e);
+            pthread_mutex_unlock(&mutex);
+            return ESP_OK;
+        }
+    }
+    pthread_mutex_unlock(&mutex);
+    return ESP_ERR_NVS_NOT_FOUND;
+}
+
+
+#define NVS_INT(name, ctype, etype) \
+    esp_err_t \
+    nvs_get_##name(nvs_handle handle, const char *key, ctype *out_value) { \
+        entry_t *e; \
+        pthread_mutex_lock(&mutex); \
+        esp_err_t res = lookup(handle, key, etype, &e); \
+        if (res == ESP_OK) { \
+            *out_value = (ctype)e->num; \
+        } \
+        pthread_mutex_unlock(&mutex); \
+        return res; \
+    } \
+    esp_err_t \
+    nvs_set_##name(nvs_handle handle, const char *key, ctype value) { \
+        return set_entry(handle, key, etype, (uint64_t)value, NULL, 0); \
+    }
+
+NVS_INT(u8, uint8_t, T_U8)
+NVS_INT(i8, int8_t, T_I8)
+NVS_INT(u16, uint16_t, T_U16)
+NVS_INT(i16, int16_t, T_I16)
+NVS_INT(u32, uint32_t, T_U32)
+NVS_INT(i32, int32_t, T_I32)
+NVS_INT(u64, uint64_t, T_U64)
+NVS_INT(i64, int64_t, T_I64)
+
+
+static esp_err_t
+get_data(nvs_handle handle, const char *key, entry_type_t type, void *out_value, size_t *length) {
+    entry_t *e;
+    pthread_mutex_lock(&mutex);
+    esp_err_t res = lookup(handle, key, type, &e);
+    if (res == ESP_OK) {
+        if (out_value && (*length < e->len)) {
+            res = ESP_ERR_NVS_INVALID_LENGTH;
+        }
+        else if (out_value) {
+            memcpy(out_value, e->data, e->len);
+        }
+        *length = e->len;
+    }
+    pthread_mutex_unlock(&mutex);
+    return res;
+}
+
+
+esp_err_t
+nvs_get_str(nvs_handle handle, const char *key, char *out_value, size_t *length) {
+    return get_data(handle, key, T_STR, out_value, length);
+}
+
+
+esp_err_t
+nvs_get_blob(nvs_handle handle, const char *key, void *out_value, size_t *length) {
+    return get_data(handle, key, T_BLOB, out_value, length);
+}
+
+
+esp_err_t
+nvs_set_str(nvs_handle handle, const char *key, const char *value) {
+    return set_entry(handle, key, T_STR, 0, value, strlen(value) + 1);
+}
+
+
+esp_err_t
+nvs_set_blob(nvs_handle handle, const char *key, const void *value, size_t length) {
+    return set_entry(handle, key, T_BLOB, 0, value, length);
+}
+
+// vim: set sw=4 ts=4 indk= et si:
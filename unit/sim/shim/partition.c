@@ -0,0 +1,212 @@
+#include "sim.h"
+
+#include <esp_partition.h>
+#include <esp_spi_flash.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define MAX_PARTITIONS  16
+#define LINE_MAX_LEN    256
+
+static esp_partition_t partitions[MAX_PARTITIONS];
+static int num_partitions;
+static uint8_t *flash = NULL;
+static size_t flash_size;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned power_cut_in; // 0: no power cut pending
+static bool power_is_cut;
+
+
+static int
+parse_subtype(const char *s) {
+    static const struct { const char *name; int subtype; } names[] = {
+        { "factory", 0x00 }, { "ota", 0x00 }, { "phy", 0x01 }, { "nvs", 0x02 }, { "coredump", 0x03 },
+    };
+    if (!strncmp(s, "ota_", 4) && isdigit((unsigned char)s[4])) {
+        return 0x10 + atoi(s + 4);
+    }
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+        if (!strcmp(s, names[i].name)) {
+            return names[i].subtype;
+        }
+    }
+    return strtol(s, NULL, 0);
+}
+
+
+bool
+sim_flash_load(const char *partitions_csv, const char *image_path) {
+    FILE *f = fopen(partitions_csv, "r");
+    if (!f) {
+        perror(partitions_csv);
+        return false;
+    }
+    char line[LINE_MAX_LEN];
+    flash_size = 0;
+    num_partitions = 0;
+    while (fgets(line, sizeof(line), f) && (num_partitions < MAX_PARTITIONS)) {
+        char *hash = strchr(line, '#');
+        if (hash) {
+            *hash = '\0';
+        }
+        char name[17], type[16], subtype[16];
+        unsigned int offset, size;
+        if (sscanf(line, " %16[^, ] , %15[^, ] , %15[^, ] , %i , %i", name, type, subtype, &offset, &size) != 5) {
+            continue;
+        }
+        esp_partition_t *p = &partitions[num_partitions++];
+        memset(p, 0, sizeof(*p));
+        strcpy(p->label, name);
+        p->type = strcmp(type, "app") ? ESP_PARTITION_TYPE_DATA : ESP_PARTITION_TYPE_APP;
+        p->subtype = parse_subtype(subtype);
+        p->address = offset;
+        p->size = size;
+        if (flash_size < (offset + size)) {
+            flash_size = offset + size;
+        }
+    }
+    fclose(f);
+
+    if (image_path) {
+        int fd = open(image_path, O_RDWR | O_CREAT, 0644);
+        if (fd < 0) {
+            perror(image_path);
+            return false;
+        }
+        off_t old_size = lseek(fd, 0, SEEK_END);
+        if (old_size < (off_t)flash_size) {
+            // what's beyond the old end is erased
+            uint8_t erased[SPI_FLASH_SEC_SIZE];
+            memset(erased, 0xff, sizeof(erased));
+            for (off_t pos = old_size; pos < (off_t)flash_size; pos += sizeof(erased)) {
+                size_t n = ((flash_size - pos) < sizeof(erased)) ? (flash_size - pos) : sizeof(erased);
+                if (pwrite(fd, erased, n, pos) != (ssize_t)n) {
+                    perror(image_path);
+                    close(fd);
+                    return false;
+                }
+            }
+        }
+        flash = (uint8_t*)mmap(NULL, flash_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+    }
+    else {
+        flash = (uint8_t*)mmap(NULL, flash_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (flash != MAP_FAILED) {
+            memset(flash, 0xff, flash_size);
+        }
+    }
+    if (flash == MAP_FAILED) {
+        perror("mmap");
+        flash = NULL;
+        return false;
+    }
+    return true;
+}
+
+
+void
+sim_flash_power_cut(unsigned ops) {
+    pthread_mutex_lock(&mutex);
+    power_cut_in = ops;
+    power_is_cut = false;
+    pthread_mutex_unlock(&mutex);
+}
+
+
+bool
+sim_flash_power_is_cut(void) {
+    return power_is_cut;
+}
+
+
+// called with the mutex held: how much of an operation of @size bytes is done before the power is lost
+static size_t
+powered_part(size_t size) {
+    if (power_is_cut) {
+        return 0;
+    }
+    if ((power_cut_in == 0) || (--power_cut_in > 0)) {
+        return size;
+    }
+    power_is_cut = true;
+    return size / 2;
+}
+
+
+size_t
+spi_flash_get_chip_size(void) {
+    return flash_size;
+}
+
+
+const esp_partition_t *
+esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label) {
+    for (int i = 0; flash && (i < num_partitions); ++i) {
+        esp_partition_t *p = &partitions[i];
+        if ((p->type == type) && ((subtype == ESP_PARTITION_SUBTYPE_ANY) || (p->subtype == subtype)) && (!label || !strcmp(p->label, label))) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+
+static bool
+in_range(const esp_partition_t *partition, size_t offset, size_t size) {
+    return (offset <= partition->size) && (size <= (partition->size - offset));
+}
+
+
+esp_err_t
+esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size) {
+    if (!in_range(partition, src_offset, size)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    pthread_mutex_lock(&mutex);
+    memcpy(dst, flash + partition->address + src_offset, size);
+    pthread_mutex_unlock(&mutex);
+    return ESP_OK;
+}
+
+
+esp_err_t
+esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size) {
+    if (!in_range(partition, dst_offset, size)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    pthread_mutex_lock(&mutex);
+    size_t done = powered_part(size);
+    uint8_t *p = flash + partition->address + dst_offset;
+    const uint8_t *s = (const uint8_t*)src;
+    for (size_t i = 0; i < done; ++i) {
+        p[i] &= s[i]; // nor flash: programming can only clear bits
+    }
+    pthread_mutex_unlock(&mutex);
+    return (done == size) ? ESP_OK : ESP_FAIL;
+}
+
+
+esp_err_t
+esp_partition_erase_range(const esp_partition_t *partition, size_t start_addr, size_t size) {
+    if (!in_range(partition, start_addr, size)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if ((start_addr % SPI_FLASH_SEC_SIZE) || (size % SPI_FLASH_SEC_SIZE)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&mutex);
+    size_t done = powered_part(size);
+    memset(flash + partition->address + start_addr, 0xff, done);
+    pthread_mutex_unlock(&mutex);
+    return (done == size) ? ESP_OK : ESP_FAIL;
+}
+
+// vim: set sw=4 ts=4 indk= et si:
@@ -0,0 +1,17 @@
+#ifndef SIM_PRIVATE_H
+#define SIM_PRIVATE_H
+
+#include <freertos/FreeRTOS.h>
+
+#include <pthread.h>
+#include <time.h>
+
+// the deadline of a wait of @ticks on CLOCK_MONOTONIC, NULL for portMAX_DELAY
+struct timespec *sim_deadline(struct timespec *ts, TickType_t ticks);
+// pthread_cond_timedwait() or pthread_cond_wait(), as @deadline says; returns false on timeout
+bool sim_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *deadline);
+void sim_cond_init(pthread_cond_t *cond);
+void sim_sleep_us(int64_t usec);
+
+#endif // SIM_PRIVATE_H
+// vim: set sw=4 ts=4 indk= et si:
@@ -0,0 +1,384 @@
+#include "sim_private.h"
+#include "sim.h"
+
+#include <driver/uart.h>
+#include <esp_timer.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* UART0, fed from a regular file, a pipe or a pty
+ *
+ * A regular file is a recording: it's replayed back-to-back at the baud rate, as if the receiver were streaming
+ * without a pause, or, if it isn't paced, as fast as the ring buffer is emptied (so it's never overflowed).
+ * A pipe or a pty is live: the bytes are taken when they arrive, but not faster than the baud rate, and the writes of
+ * the firmware go to the pty.
+ *
+ * Like the real driver, the bytes are moved into the ring buffer and an UART_DATA is posted when UART_SIM_FIFO_FULL
+ * of them have arrived, or UART_SIM_RX_TOUT char times after the last one.
+ *
+ * The writes take their time on the wire too: without a tx buffer a write returns when the rest of it fits into the
+ * hw fifo, and uart_wait_tx_done() waits until the last byte is out.
+ */
+
+#define READ_CHUNK  256
+
+static int fd_in = -1, fd_out = -1;
+static bool is_file, paced;
+static volatile bool eof = false;
+static volatile uint64_t rx_bytes = 0;
+static volatile uint32_t baud_rate = 9600;
+static char pty_name[64];
+static int64_t tx_done_ns; // when the last byte written leaves the wire
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t changed;
+static pthread_t reader;
+static bool installed = false;
+static volatile bool stopping = false;
+static QueueHandle_t event_queue = NULL;
+static uint8_t *ring = NULL;
+static size_t ring_size, ring_start, ring_len;
+
+
+bool
+sim_uart_open(const char *path, bool want_paced) {
+    paced = want_paced;
+    if (!strcmp(path, "-")) {
+        fd_in = STDIN_FILENO;
+    }
+    else if (!strcmp(path, "pty")) {
+        int master, slave;
+        if (openpty(&master, &slave, pty_name, NULL, NULL) < 0) {
+            perror("openpty");
+            return false;
+        }
+        struct termios tio;
+        tcgetattr(slave, &tio);
+        cfmakeraw(&tio);
+        tcsetattr(slave, TCSANOW, &tio);
+        // the slave is kept open, so the master doesn't get a hangup when a feeder closes it
+        fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+        fd_in = fd_out = master;
+        fprintf(stderr, "UART0 is on %s\n", pty_name);
+    }
+    else {
+        fd_in = open(path, O_RDONLY);
+        if (fd_in < 0) {
+            perror(path);
+            return false;
+        }
+        struct stat st;
+        is_file = !fstat(fd_in, &st) && S_ISREG(st.st_mode);
+    }
+    return true;
+}
+
+
+bool
+sim_uart_eof(void) {
+    return eof;
+}
+
+
+uint64_t
+sim_uart_rx_bytes(void) {
+    return rx_bytes;
+}
+
+
+const char *
+sim_uart_pty(void) {
+    return pty_name[0] ? pty_name : NULL;
+}
+
+
+static int64_t
+char_ns(void) {
+    return 10 * 1000000000LL / baud_rate; // 8n1 is 10 bits per char
+}
+
+
+// move the bytes of the 'rx fifo' into the ring and post the event
+static void
+rx_fifo_flush(const uint8_t *data, size_t len) {
+    if (!len) {
+        return;
+    }
+    pthread_mutex_lock(&mutex);
+    if (!paced && is_file) {
+        // flow control: wait for the room instead of overflowing
+        while (!stopping && ((ring_size - ring_len) < len)) {
+            pthread_cond_wait(&changed, &mutex);
+        }
+    }
+    uart_event_t event = { .type = UART_DATA, .size = len };
+    if ((ring_size - ring_len) < len) {
+        event.type = UART_BUFFER_FULL;
+    }
+    else {
+        for (size_t i = 0; i < len; ++i) {
+            ring[(ring_start + ring_len + i) % ring_size] = data[i];
+        }
+        ring_len += len;
+        pthread_cond_broadcast(&changed);
+    }
+    rx_bytes += len;
+    pthread_mutex_unlock(&mutex);
+    xQueueSend(event_queue, &event, 0);
+}
+
+
+static void
+replay_file(void) {
+    uint8_t fifo[UART_SIM_FIFO_FULL];
+    int64_t next_ns = esp_timer_get_time() * 1000;
+    ssize_t n;
+    while (!stopping && ((n = read(fd_in, fifo, sizeof(fifo))) > 0)) {
+        if (paced) {
+            // the last of these bytes arrives n char times later than the previous chunk
+            next_ns += n * char_ns();
+            if (n < UART_SIM_FIFO_FULL) {
+                next_ns += UART_SIM_RX_TOUT * char_ns();
+            }
+            sim_sleep_us(next_ns / 1000 - esp_timer_get_time());
+        }
+        rx_fifo_flush(fifo, n);
+    }
+}
+
+
+static void
+receive_live(void) {
+    uint8_t fifo[UART_SIM_FIFO_FULL];
+    size_t fifo_len = 0;
+    int64_t wire_ns = 0; // when the last byte read has arrived through the wire
+    while (!stopping) {
+        struct pollfd pfd = { .fd = fd_in, .events = POLLIN };
+        // with bytes in the fifo the rx timeout is running, otherwise just check for stopping now and then
+        int timeout_ms = fifo_len ? (int)((UART_SIM_RX_TOUT * char_ns() + 999999) / 1000000) : 100;
+        int res = poll(&pfd, 1, timeout_ms);
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("uart poll");
+            break;
+        }
+        if (res == 0) {
+            rx_fifo_flush(fifo, fifo_len); // rx timeout
+            fifo_len = 0;
+            continue;
+        }
+        uint8_t buf[READ_CHUNK];
+        ssize_t n = read(fd_in, buf, sizeof(buf));
+        if (n <= 0) {
+            if ((n < 0) && ((errno == EINTR) || (errno == EAGAIN))) {
+                continue;
+            }
+            break;
+        }
+        // what is written to the pipe at once still comes through the wire one by one
+        int64_t now_ns = esp_timer_get_time() * 1000;
+        if (wire_ns < now_ns) {
+            wire_ns = now_ns;
+        }
+        for (ssize_t i = 0; i < n; ++i) {
+            fifo[fifo_len++] = buf[i];
+            wire_ns += char_ns();
+            if (fifo_len == UART_SIM_FIFO_FULL) {
+                sim_sleep_us(wire_ns / 1000 - esp_timer_get_time());
+                rx_fifo_flush(fifo, fifo_len);
+                fifo_len = 0;
+            }
+        }
+    }
+    rx_fifo_flush(fifo, fifo_len);
+}
+
+
+static void *
+reader_main(void *arg) {
+    if (fd_in >= 0) {
+        if (is_file) {
+            replay_file();
+        }
+        else {
+            receive_live();
+        }
+    }
+    eof = true;
+    return NULL;
+}
+
+
+esp_err_t
+uart_param_config(uart_port_t uart_num, uart_config_t *uart_conf) {
+    if ((uart_num != UART_NUM_0) || !uart_conf || (uart_conf->baud_rate <= 0)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    baud_rate = uart_conf->baud_rate;
+    return ESP_OK;
+}
+
+
+esp_err_t
+uart_set_baudrate(uart_port_t uart_num, uint32_t baudrate) {
+    if ((uart_num != UART_NUM_0) || !baudrate) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    baud_rate = baudrate;
+    return ESP_OK;
+}
+
+
+esp_err_t
+uart_driver_install(uart_port_t uart_num, int rx_buffer_size, int tx_buffer_size, int queue_size, QueueHandle_t *uart_queue, int no_use) {
+    if ((uart_num != UART_NUM_0) || (rx_buffer_size <= 0) || (queue_size && !uart_queue)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (installed) {
+        return ESP_FAIL;
+    }
+    ring = (uint8_t*)malloc(rx_buffer_size);
+    if (!ring) {
+        return ESP_ERR_NO_MEM;
+    }
+    ring_size = rx_buffer_size;
+    ring_start = ring_len = 0;
+    sim_cond_init(&changed);
+    event_queue = xQueueCreate(queue_size ? queue_size : 1, sizeof(uart_event_t));
+    if (uart_queue) {
+        *uart_queue = event_queue;
+    }
+    stopping = false;
+    if (pthread_create(&reader, NULL, reader_main, NULL) != 0) {
+        free(ring);
+        ring = NULL;
+        return ESP_FAIL;
+    }
+    pthread_setname_np(reader, "uart0");
+    installed = true;
+    return ESP_OK;
+}
+
+
+esp_err_t
+uart_driver_delete(uart_port_t uart_num) {
+    if ((uart_num != UART_NUM_0) || !installed) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&mutex);
+    stopping = true;
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&mutex);
+    pthread_join(reader, NULL);
+    vQueueDelete(event_queue);
+    event_queue = NULL;
+    free(ring);
+    ring = NULL;
+    installed = false;
+    return ESP_OK;
+}
+
+
+int
+uart_read_bytes(uart_port_t uart_num, uint8_t *buf, uint32_t length, TickType_t ticks_to_wait) {
+    if ((uart_num != UART_NUM_0) || !installed) {
+        return -1;
+    }
+    struct timespec ts, *deadline = sim_deadline(&ts, ticks_to_wait);
+    pthread_mutex_lock(&mutex);
+    while ((ring_len < length) && sim_cond_wait(&changed, &mutex, deadline)) {
+    }
+    size_t n = (ring_len < length) ? ring_len : length;
+    for (size_t i = 0; i < n; ++i) {
+        buf[i] = ring[(ring_start + i) % ring_size];
+    }
+    ring_start = (ring_start + n) % ring_size;
+    ring_len -= n;
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&mutex);
+    return n;
+}
+
+
+int
+uart_write_bytes(uart_port_t uart_num, const char *src, size_t size) {
+    if (uart_num != UART_NUM_0) {
+        return -1;
+    }
+    int64_t now_ns = esp_timer_get_time() * 1000;
+    pthread_mutex_lock(&mutex);
+    if (tx_done_ns < now_ns) {
+        tx_done_ns = now_ns;
+    }
+    tx_done_ns += size * char_ns();
+    int64_t fits_ns = tx_done_ns - UART_SIM_TX_FIFO * char_ns();
+    pthread_mutex_unlock(&mutex);
+    sim_sleep_us(fits_ns / 1000 - esp_timer_get_time());
+    if (fd_out >= 0) {
+        // nobody may be reading the pty, the commands to the receiver are not worth blocking for
+        for (size_t done = 0; done < size; ) {
+            ssize_t n = write(fd_out, src + done, size - done);
+            if (n <= 0) {
+                break;
+            }
+            done += n;
+        }
+    }
+    return size;
+}
+
+
+esp_err_t
+uart_wait_tx_done(uart_port_t uart_num, TickType_t ticks_to_wait) {
+    if (uart_num != UART_NUM_0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&mutex);
+    int64_t wait_us = tx_done_ns / 1000 - esp_timer_get_time();
+    pthread_mutex_unlock(&mutex);
+    if ((ticks_to_wait != portMAX_DELAY) && (wait_us > (int64_t)ticks_to_wait * portTICK_PERIOD_MS * 1000)) {
+        sim_sleep_us((int64_t)ticks_to_wait * portTICK_PERIOD_MS * 1000);
+        return ESP_ERR_TIMEOUT;
+    }
+    sim_sleep_us(wait_us);
+    return ESP_OK;
+}
+
+
+esp_err_t
+uart_flush_input(uart_port_t uart_num) {
+    if ((uart_num != UART_NUM_0) || !installed) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&mutex);
+    ring_start = ring_len = 0;
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&mutex);
+    return ESP_OK;
+}
+
+
+esp_err_t
+uart_get_buffered_data_len(uart_port_t uart_num, size_t *size) {
+    if ((uart_num != UART_NUM_0) || !installed) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&mutex);
+    *size = ring_len;
+    pthread_mutex_unlock(&mutex);
+    return ESP_OK;
+}
+
+// vim: set sw=4 ts=4 indk= et si:
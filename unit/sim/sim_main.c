@@ -0,0 +1,189 @@
+#include "main.h"
+#include "sim.h"
+#include "gps.h"
+#include "location_reporter.h"
+#include "clock_sync.h"
+#include "power_mgmt.h"
+#include "dns_server.h"
+#include "misc.h"
+#include "https_client.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/event_groups.h>
+#include <nvs_flash.h>
+
+#undef LOG_LOCAL_LEVEL
+#define LOG_LOCAL_LEVEL ESP_LOG_DEBUG
+#include <esp_log.h>
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static const char *TAG = "sim";
+
+EventGroupHandle_t main_event_group;
+
+#define MAX_OVERRIDES   32
+
+static volatile sig_atomic_t interrupted = 0;
+
+
+static void
+usage(const char *argv0) {
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  -s <source>      UART0 input: a file, '-' for stdin, or 'pty' (default: -)\n"
+        "  -f               replay a file as fast as it's processed, not at the baud rate\n"
+        "  -n <nvs.csv>     the NVS content (default: nvs.csv)\n"
+        "  -o <ns.key=val>  override an NVS entry, may be repeated\n"
+        "  -p <part.csv>    the partition table (default: partitions.csv)\n"
+        "  -F <image>       keep the flash in this file, so the report queue survives (default: in RAM)\n"
+        "  -t <full,res>    TLS handshake times in ms, full and resumed (default: 0,0)\n"
+        "  -d               run the DNS server of the admin mode (needs UDP port 53)\n"
+        "  -g <sec>         keep running this long after the input has ended (default: 10)\n"
+        "  -b <raw>         the ADC reading of the battery voltage (default: 1000)\n"
+        "  -v <level>       log level 0..5 (default: from sdkconfig)\n",
+        argv0);
+}
+
+
+static bool
+dns_policy(dns_buf_t *out, const char *name, dns_type_t type, dns_class_t _class, uint32_t *ttl) {
+    if ((type == DNS_TYPE_A) && (_class == DNS_CLASS_IN)) {
+        dns_write_u32be(out, 0x7f000001);
+        return true;
+    }
+    return false;
+}
+
+
+static void
+on_signal(int sig) {
+    interrupted = 1;
+}
+
+
+static void
+print_stats(void) {
+    gps_stats_t gps;
+    gps_get_stats(&gps);
+    fprintf(stderr, "gps: fixes=%u, coarse=%u, poor=%u, dropped=%u, uart_overflows=%u, bad_frames=%u, latency avg=%u us, max=%u us, rx=%llu bytes\n",
+        gps.fixes, gps.coarse_fixes, gps.poor_fixes, gps.dropped, gps.uart_overflows, gps.bad_frames,
+        gps.latency_avg_us, gps.latency_max_us, (unsigned long long)sim_uart_rx_bytes());
+
+    clock_sync_stats_t clk;
+    clock_sync_get_stats(&clk);
+    fprintf(stderr, "clock: locked=%d, freq=%d ppb, samples=%u, steps=%u, offset min=%d, max=%d, rms=%d us\n",
+        clk.locked, clk.freq_ppb, clk.samples, clk.steps, clk.offset_min_us, clk.offset_max_us, clk.offset_rms_us);
+
+    power_stats_t pwr;
+    power_get_stats(&pwr);
+    fprintf(stderr, "power: reports=%u", pwr.reports);
+    for (int i = 0; i < POWER_STATE_MAX; ++i) {
+        fprintf(stderr, ", %s=%llu ms", power_state_names[i], (unsigned long long)(pwr.state_usec[i] / 1000));
+    }
+    fprintf(stderr, ", gps_ps=%llu ms\n", (unsigned long long)(pwr.gps_ps_usec / 1000));
+
+    uint32_t connects, full, resumed, failed;
+    sim_tls_get_stats(&connects, &full, &resumed, &failed);
+    fprintf(stderr, "tls: connects=%u, full=%u, resumed=%u, failed=%u\n", connects, full, resumed, failed);
+}
+
+
+int
+main(int argc, char **argv) {
+    const char *source = "-", *nvs_csv = "nvs.csv", *partitions_csv = "partitions.csv", *flash_image = NULL;
+    const char *overrides[MAX_OVERRIDES];
+    int num_overrides = 0, grace_sec = 10, log_level = -1;
+    bool paced = true, run_dns = false;
+    unsigned int full_ms = 0, resumed_ms = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:fn:o:p:F:t:dg:b:v:h")) != -1) {
+        switch (opt) {
+            case 's': source = optarg; break;
+            case 'f': paced = false; break;
+            case 'n': nvs_csv = optarg; break;
+            case 'o':
+                if (num_overrides >= MAX_OVERRIDES) {
+                    fprintf(stderr, "Too many overrides\n");
+                    return 1;
+                }
+                overrides[num_overrides++] = optarg;
+                break;
+            case 'p': partitions_csv = optarg; break;
+            case 'F': flash_image = optarg; break;
+            case 't':
+                if (sscanf(optarg, "%u,%u", &full_ms, &resumed_ms) != 2) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'd': run_dns = true; break;
+            case 'g': grace_sec = atoi(optarg); break;
+            case 'b': sim_adc_set_raw(atoi(optarg)); break;
+            case 'v': log_level = atoi(optarg); break;
+            default:
+                usage(argv[0]);
+                return (opt == 'h') ? 0 : 1;
+        }
+    }
+
+    if (log_level >= 0) {
+        esp_log_level_set("*", log_level);
+    }
+    if (!sim_nvs_load(nvs_csv, ".") || !sim_flash_load(partitions_csv, flash_image) || !sim_uart_open(source, paced)) {
+        return 1;
+    }
+    for (int i = 0; i < num_overrides; ++i) {
+        if (!sim_nvs_override(overrides[i])) {
+            fprintf(stderr, "Invalid override '%s'\n", overrides[i]);
+            return 1;
+        }
+    }
+    sim_tls_set_handshake_ms(full_ms, resumed_ms);
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    // what app_main does, without the display, the ota and the wifi: the host is always online
+    ESP_LOGI(TAG, "main start, FW %u", source_date_epoch);
+    sim_freertos_init();
+    idle_start();
+    esp_err_t res = nvs_flash_init();
+    if (res != ESP_OK) {
+        ESP_LOGW(TAG, "NVS failed: %d", res);
+    }
+    main_event_group = xEventGroupCreate();
+    https_client_init();
+    xEventGroupSetBits(main_event_group, WIFI_CONNECTED_BIT | OTA_CHECK_DONE_BIT);
+    if (run_dns) {
+        dns_server_start(dns_policy);
+    }
+    location_reporter_start();
+    wait_idle();
+    gps_start();
+    ESP_LOGI(TAG, "Up and running");
+
+    int64_t eof_since = -1;
+    while (!interrupted) {
+        vTaskDelay(pdMS_TO_TICKS(100));
+        if (!sim_uart_eof()) {
+            continue;
+        }
+        if (eof_since < 0) {
+            ESP_LOGI(TAG, "End of input, stopping in %d s", grace_sec);
+            eof_since = xTaskGetTickCount();
+        }
+        else if ((xTaskGetTickCount() - eof_since) >= pdMS_TO_TICKS(grace_sec * 1000)) {
+            break;
+        }
+    }
+    print_stats();
+    return 0;
+}
+
+// vim: set sw=4 ts=4 indk= et si:
@@ -0,0 +1,249 @@
+#include "test.h"
+#include "sim.h"
+
+#include <gps.h>
+#include <main.h>
+#include <esp_log.h>
+#include <freertos/event_groups.h>
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* A full AGPS load injected into a fake receiver on the other end of the uart pty
+ *
+ * The load is an AID-INI, 32 AID-EPH, 32 AID-ALM and an AID-HUI, fed in chunks of random sizes, as they come from the
+ * server. The receiver acks the CFG messages, and either acks the AID ones too (u-blox 7 and up, after ackAiding), or
+ * NAKs the CFG-NAVX5 and stays silent (neo-6), or acks some of them and then stops. In each case the whole load must
+ * arrive intact, in order, in well under 3 s. The uart takes the wire time of the bytes, at the 230400 baud of the gps.
+ */
+
+#define AID_EPH         32
+#define AID_ALM         32
+#define LOAD_MAX        8192
+#define AID_PROCESS_US  2000    // the receiver's time to take an AID message
+#define TARGET_MS       3000
+
+typedef enum {
+    RX_ACKS,        // acks the CFG-NAVX5 and the AID messages
+    RX_SILENT,      // NAKs the CFG-NAVX5, doesn't ack the AID messages
+    RX_ACKS_STOP,   // acks the CFG-NAVX5 and the first ACKS_BEFORE_STOP AID messages only
+} rx_mode_t;
+
+#define ACKS_BEFORE_STOP 10
+
+EventGroupHandle_t main_event_group;
+
+static int rx_fd;
+static pthread_mutex_t rx_mutex = PTHREAD_MUTEX_INITIALIZER;
+static volatile rx_mode_t rx_mode;
+static volatile bool rx_configured;     // the CFG-RXM at the end of the reinit of the gps has arrived
+static volatile unsigned rx_acked, rx_bad;
+static uint8_t rx_aid[LOAD_MAX];
+static volatile size_t rx_aid_len;
+
+static uint8_t load[LOAD_MAX];
+static size_t load_len;
+
+
+static size_t
+ubx_frame(uint8_t *msg, uint8_t cls, uint8_t id, const uint8_t *payload, uint16_t payload_len) {
+    msg[0] = 0xb5;
+    msg[1] = 0x62;
+    msg[2] = cls;
+    msg[3] = id;
+    msg[4] = payload_len & 0xff;
+    msg[5] = payload_len >> 8;
+    memcpy(msg + 6, payload, payload_len);
+    uint8_t ck_a = 0, ck_b = 0;
+    for (size_t i = 2; i < (6 + payload_len); ++i) {
+        ck_a += msg[i];
+        ck_b += ck_a;
+    }
+    msg[6 + payload_len] = ck_a;
+    msg[7 + payload_len] = ck_b;
+    return 8 + payload_len;
+}
+
+
+static void
+rx_send(uint8_t cls, uint8_t id, const uint8_t *payload, uint16_t payload_len) {
+    uint8_t msg[8 + 64];
+    size_t len = ubx_frame(msg, cls, id, payload, payload_len);
+    pthread_mutex_lock(&rx_mutex);
+    if (write(rx_fd, msg, len) != (ssize_t)len) {
+        perror("fake receiver");
+    }
+    pthread_mutex_unlock(&rx_mutex);
+}
+
+
+static void
+rx_ack(bool ack, uint8_t cls, uint8_t id) {
+    uint8_t payload[2] = { cls, id };
+    rx_send(0x05, ack ? 0x01 : 0x00, payload, sizeof(payload));
+}
+
+
+static void
+rx_got(const uint8_t *msg, size_t len) {
+    uint8_t cls = msg[2], id = msg[3];
+    if (cls == 0x06) {
+        rx_ack((id != 0x24) || (rx_mode != RX_SILENT), cls, id);
+        if (id == 0x11) {
+            rx_configured = true;
+        }
+    }
+    else if (cls == 0x0b) {
+        memcpy(rx_aid + rx_aid_len, msg, len);
+        rx_aid_len += len;
+        usleep(AID_PROCESS_US);
+        if ((rx_mode == RX_ACKS) || ((rx_mode == RX_ACKS_STOP) && (rx_acked < ACKS_BEFORE_STOP))) {
+            rx_ack(true, cls, id);
+            ++rx_acked;
+        }
+    }
+}
+
+
+// frames the UBX messages from the unit, anything else is counted as bad
+static void *
+rx_main(void *arg) {
+    static uint8_t msg[8 + 0xffff];
+    size_t len = 0;
+    uint8_t buf[256];
+    ssize_t n;
+    while ((n = read(rx_fd, buf, sizeof(buf))) > 0) {
+        for (ssize_t i = 0; i < n; ++i) {
+            uint8_t c = buf[i];
+            if (((len == 0) && (c != 0xb5)) || ((len == 1) && (c != 0x62))) {
+                ++rx_bad;
+                len = 0;
+                continue;
+            }
+            msg[len++] = c;
+            if ((len < 6) || (len < 8 + (msg[4] | (msg[5] << 8)))) {
+                continue;
+            }
+            uint8_t ck_a = 0, ck_b = 0;
+            for (size_t j = 2; j < (len - 2); ++j) {
+                ck_a += msg[j];
+                ck_b += ck_a;
+            }
+            if ((ck_a == msg[len - 2]) && (ck_b == msg[len - 1]) && ((rx_aid_len + len) <= sizeof(rx_aid))) {
+                rx_got(msg, len);
+            }
+            else {
+                ++rx_bad;
+            }
+            len = 0;
+        }
+    }
+    return NULL;
+}
+
+
+// a real receiver sends its nav messages, without anything coming the gps task would reinit it
+static void *
+keepalive_main(void *arg) {
+    uint8_t payload[4] = { 0 };
+    for (;;) {
+        usleep(500000);
+        rx_send(0x0a, 0x09, payload, sizeof(payload)); // MON-HW, not processed
+    }
+    return NULL;
+}
+
+
+static void
+make_load(void) {
+    uint8_t payload[104];
+    load_len = 0;
+    for (size_t i = 0; i < sizeof(payload); ++i) {
+        payload[i] = rand();
+    }
+    load_len += ubx_frame(load + load_len, 0x0b, 0x01, payload, 48); // AID-INI
+    for (int sv = 1; sv <= AID_EPH; ++sv) {
+        payload[0] = sv;
+        load_len += ubx_frame(load + load_len, 0x0b, 0x31, payload, 104); // AID-EPH
+    }
+    for (int sv = 1; sv <= AID_ALM; ++sv) {
+        payload[0] = sv;
+        load_len += ubx_frame(load + load_len, 0x0b, 0x30, payload, 40); // AID-ALM
+    }
+    load_len += ubx_frame(load + load_len, 0x0b, 0x02, payload, 72); // AID-HUI
+}
+
+
+static void
+inject(rx_mode_t mode, const char *name) {
+    rx_mode = mode;
+    rx_acked = 0;
+    rx_aid_len = 0;
+    unsigned bad_before = rx_bad;
+
+    uint64_t t0 = test_now_ns();
+    gps_agps_feeder_t feeder;
+    gps_agps_feed_init(&feeder);
+    bool acked_at_start = feeder.acked;
+    bool ok = true;
+    for (size_t pos = 0; ok && (pos < load_len); ) {
+        size_t n = 1 + rand() % 600;
+        if (n > (load_len - pos)) {
+            n = load_len - pos;
+        }
+        ok = (gps_agps_feed(&feeder, load + pos, n) == ESP_OK);
+        pos += n;
+    }
+    ok = ok && (gps_agps_feed_end(&feeder) == ESP_OK);
+    double ms = (test_now_ns() - t0) / 1e6;
+
+    // the last bytes may still be on their way
+    for (int i = 0; (i < 100) && (rx_aid_len < load_len); ++i) {
+        usleep(10000);
+    }
+    printf("  %-12s %zu bytes, %u messages: %.0f ms, paced by %s\n", name, load_len, (unsigned)feeder.count, ms,
+        feeder.acked ? "acks" : (acked_at_start ? "acks, then time" : "time"));
+    CHECK_MSG(ok, "%s", name);
+    CHECK_MSG(acked_at_start == (mode != RX_SILENT), "%s", name);
+    CHECK_MSG(feeder.count == 2 + AID_EPH + AID_ALM, "%s: %u messages", name, (unsigned)feeder.count);
+    CHECK_MSG(feeder.naks == 0, "%s: %u NAKs", name, (unsigned)feeder.naks);
+    CHECK_MSG((rx_aid_len == load_len) && !memcmp(rx_aid, load, load_len), "%s: %zu of %zu bytes", name, rx_aid_len, load_len);
+    CHECK_MSG(rx_bad == bad_before, "%s: %u bad bytes or frames", name, rx_bad - bad_before);
+    CHECK_MSG(ms < TARGET_MS, "%s: %.0f ms", name, ms);
+}
+
+
+int
+main(int argc, char **argv) {
+    esp_log_level_set("*", ESP_LOG_NONE);
+    srand(1);
+    main_event_group = xEventGroupCreate();
+    if (!sim_uart_open("pty", true)) {
+        return 1;
+    }
+    rx_fd = open(sim_uart_pty(), O_RDWR | O_NOCTTY);
+    if (rx_fd < 0) {
+        perror(sim_uart_pty());
+        return 1;
+    }
+    pthread_t rx_thread, keepalive_thread;
+    pthread_create(&rx_thread, NULL, rx_main, NULL);
+    pthread_create(&keepalive_thread, NULL, keepalive_main, NULL);
+
+    CHECK(gps_start() == ESP_OK);
+    for (int i = 0; (i < 500) && !rx_configured; ++i) {
+        usleep(10000);
+    }
+    CHECK(rx_configured);
+
+    make_load();
+    inject(RX_ACKS, "acks");
+    inject(RX_SILENT, "no acks");
+    inject(RX_ACKS_STOP, "acks stop");
+    return test_result("agps");
+}
+
+// vim: set sw=4 ts=4 indk= et si:
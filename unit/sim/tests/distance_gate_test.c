@@ -0,0 +1,172 @@
+#include "test.h"
+
+#include <distance_gate.h>
+#include <esp_log.h>
+
+#include <stdlib.h>
+#include <math.h>
+
+/* The distance gate against a reference haversine in double, at several latitudes and distances, and its throughput
+ *
+ * The reference uses the same earth radius, so only the approximations of the gate are measured: the flat earth, the
+ * cached cos, and the fixed-point arithmetic.
+ */
+
+#define R_Earth     6.371009e6
+#define RAD_PER_E7  (M_PI / 180.0 / 1e7)
+#define PAIRS       200000
+
+static double
+ref_distance(int32_t lat1, int32_t lon1, int32_t lat2, int32_t lon2) {
+    double phi1 = lat1 * RAD_PER_E7, phi2 = lat2 * RAD_PER_E7;
+    double dlon = (double)lon2 - lon1;
+    if (dlon >= 1.8e9) {
+        dlon -= 3.6e9;
+    }
+    else if (dlon < -1.8e9) {
+        dlon += 3.6e9;
+    }
+    double s_dphi = sin((phi2 - phi1) / 2), s_dlambda = sin(dlon * RAD_PER_E7 / 2);
+    double a = s_dphi * s_dphi + cos(phi1) * cos(phi2) * s_dlambda * s_dlambda;
+    return 2 * R_Earth * asin(sqrt(fmin(a, 1)));
+}
+
+
+// a point about @dist_m away from @lat, @lon, in the direction @azi_rad
+static void
+offset(int32_t lat, int32_t lon, double dist_m, double azi_rad, int32_t *lat2, int32_t *lon2) {
+    double dy = dist_m * cos(azi_rad) / R_Earth / RAD_PER_E7;
+    double dx = dist_m * sin(azi_rad) / R_Earth / RAD_PER_E7 / cos(lat * RAD_PER_E7);
+    *lat2 = lat + lround(dy);
+    double l = lon + dx;
+    *lon2 = lround((l >= 1.8e9) ? (l - 3.6e9) : ((l < -1.8e9) ? (l + 3.6e9) : l));
+}
+
+
+static double
+uniform(double lo, double hi) {
+    return lo + (hi - lo) * (rand() / (double)RAND_MAX);
+}
+
+
+// the error of the distances up to @max_m around the latitude @lat_deg
+static void
+accuracy(double lat_deg, double max_m, double max_rel_err, double max_abs_err) {
+    distance_gate_t gate;
+    distance_gate_init(&gate, 100);
+    double worst_rel = 0, worst_abs = 0;
+    for (int i = 0; i < 20000; ++i) {
+        int32_t lat = lround(uniform(lat_deg - 0.5, lat_deg + 0.5) * 1e7), lon = lround(uniform(-180, 180) * 1e7);
+        int32_t lat2, lon2;
+        offset(lat, lon, uniform(0, max_m), uniform(0, 2 * M_PI), &lat2, &lon2);
+        distance_gate_set_ref(&gate, lat, lon);
+        double ref = ref_distance(lat, lon, lat2, lon2);
+        double err = fabs(distance_gate_distance(&gate, lat2, lon2) - ref);
+        worst_abs = fmax(worst_abs, err);
+        // the distance is in whole metres, so the relative error means something only for the longer ones
+        if (ref > 100) {
+            worst_rel = fmax(worst_rel, (err - 0.5) / ref);
+        }
+    }
+    printf("  lat %+5.1f, up to %6.0f m: max error %.2f m, %.4f %%\n", lat_deg, max_m, worst_abs, worst_rel * 100);
+    CHECK_MSG(worst_rel <= max_rel_err, "lat %.1f, %.0f m: %.5f", lat_deg, max_m, worst_rel);
+    CHECK_MSG(worst_abs <= max_abs_err, "lat %.1f, %.0f m: %.2f m", lat_deg, max_m, worst_abs);
+}
+
+
+// the decisions of the gate, for the pairs that are not within 1 % (+1 m rounding) of the threshold
+static void
+decisions(uint32_t trshld_m) {
+    distance_gate_t gate;
+    distance_gate_init(&gate, trshld_m);
+    unsigned wrong = 0, total = 0;
+    for (int i = 0; i < 20000; ++i) {
+        int32_t lat = lround(uniform(-60, 60) * 1e7), lon = lround(uniform(-180, 180) * 1e7);
+        int32_t lat2, lon2;
+        offset(lat, lon, uniform(0, 3 * trshld_m), uniform(0, 2 * M_PI), &lat2, &lon2);
+        distance_gate_set_ref(&gate, lat, lon);
+        double ref = ref_distance(lat, lon, lat2, lon2);
+        if (fabs(ref - trshld_m) <= (trshld_m * 0.01 + 1)) {
+            continue;
+        }
+        ++total;
+        wrong += distance_gate_passed(&gate, lat2, lon2) != (ref > trshld_m);
+    }
+    CHECK_MSG(wrong == 0, "threshold %u m: %u of %u wrong", trshld_m, wrong, total);
+}
+
+
+static void
+special_cases(void) {
+    distance_gate_t gate;
+    distance_gate_init(&gate, 20);
+    CHECK(distance_gate_passed(&gate, 0, 0)); // no reference yet
+
+    // across the antimeridian, 0.0001 deg is 11 m
+    distance_gate_set_ref(&gate, 0, 1799999500);
+    CHECK_MSG(distance_gate_distance(&gate, 0, -1799999500) == 11, "%u m", distance_gate_distance(&gate, 0, -1799999500));
+    CHECK(!distance_gate_passed(&gate, 0, -1799999500));
+    CHECK(distance_gate_passed(&gate, 0, -1799998000));
+
+    // long jumps go by haversine
+    distance_gate_set_ref(&gate, 251234567, 552123456);
+    double ref = ref_distance(251234567, 552123456, 405000000, -740000000);
+    CHECK_MSG(fabs(distance_gate_distance(&gate, 405000000, -740000000) - ref) < 1, "%.1f m", ref);
+
+    // the cos is recalculated only when the reference latitude has moved enough
+    distance_gate_set_ref(&gate, 250000000, 550000000);
+    uint32_t cos_q16 = gate.cos_q16;
+    distance_gate_set_ref(&gate, 250000000 + DISTANCE_GATE_COS_STEP, 550000000);
+    CHECK(gate.cos_q16 == cos_q16);
+    distance_gate_set_ref(&gate, 250000000 + 2 * DISTANCE_GATE_COS_STEP, 550000000);
+    CHECK(gate.cos_q16 != cos_q16);
+}
+
+
+static void
+throughput(void) {
+    static int32_t pts[PAIRS][4];
+    for (int i = 0; i < PAIRS; ++i) {
+        pts[i][0] = lround(uniform(24.9, 25.3) * 1e7);
+        pts[i][1] = lround(uniform(55.0, 55.5) * 1e7);
+        offset(pts[i][0], pts[i][1], uniform(0, 100), uniform(0, 2 * M_PI), &pts[i][2], &pts[i][3]);
+    }
+    distance_gate_t gate;
+    distance_gate_init(&gate, 30);
+    distance_gate_set_ref(&gate, pts[0][0], pts[0][1]);
+    volatile unsigned sink = 0;
+    uint64_t t0 = test_now_ns();
+    for (int i = 0; i < PAIRS; ++i) {
+        gate.ref_lat = pts[i][0];
+        gate.ref_lon = pts[i][1];
+        sink += distance_gate_passed(&gate, pts[i][2], pts[i][3]);
+    }
+    uint64_t t1 = test_now_ns();
+    for (int i = 0; i < PAIRS; ++i) {
+        sink += ref_distance(pts[i][0], pts[i][1], pts[i][2], pts[i][3]) > 30;
+    }
+    uint64_t t2 = test_now_ns();
+    printf("  distance_gate_passed %.1f ns, haversine %.1f ns per fix\n", (t1 - t0) / (double)PAIRS, (t2 - t1) / (double)PAIRS);
+}
+
+
+int
+main(int argc, char **argv) {
+    esp_log_level_set("*", ESP_LOG_NONE);
+    srand(1);
+    // the flat approximation is good to 0.1 % within a few km, and 0.5 % up to its limit of 1 deg
+    accuracy(0, 300, 0.001, 1);
+    accuracy(25, 300, 0.001, 1);
+    accuracy(25, 5000, 0.001, 5);
+    accuracy(-33.9, 5000, 0.001, 5);
+    accuracy(60, 5000, 0.001, 5);
+    accuracy(25, 100000, 0.005, 500);
+    decisions(10);
+    decisions(30);
+    decisions(200);
+    special_cases();
+    throughput();
+    return test_result("distance_gate");
+}
+
+// vim: set sw=4 ts=4 indk= et si:
@@ -0,0 +1,154 @@
+#include "test.h"
+#include "gpx.h"
+
+#include <distance_gate.h>
+#include <report_queue.h>
+#include <esp_log.h>
+
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+
+/* The fix in UBX fixed-point units against the float one it replaced, on the reporter's threshold path
+ *
+ * Both paths take the integers of NAV-POSLLH and NAV-VELNED, decide whether the fix is far enough from the last
+ * reported one, and if so, fill the report record. The float one is the code before the change, kept here as the
+ * reference. On the host the float operations are done by the FPU, on the lx106 they are soft-float library calls,
+ * so the difference on the unit is larger than the one measured here.
+ */
+
+#define ROUNDS      200
+#define TRSHLD_M    10
+#define R_Earth     6.371009e6
+
+typedef struct {
+    float latitude, longitude, speed_kph, azimuth;
+} float_fix_t;
+
+static float last_latitude, last_longitude, trshld_deg2;
+static distance_gate_t gate;
+
+
+static bool
+float_path(const gpx_point_t *p, int32_t heading, report_record_t *rec) {
+    // got_NAV_POSLLH(), got_NAV_VELNED()
+    float_fix_t fix = {
+        .latitude = p->lat * 1e-7f,
+        .longitude = p->lon * 1e-7f,
+        .speed_kph = (p->speed / 10) * 0.036f,
+        .azimuth = heading * 1e-5f,
+    };
+    // location_reporter_task()
+    float delta_lat = fix.latitude - last_latitude;
+    float delta_lon = fix.longitude - last_longitude;
+    if ((delta_lat * delta_lat + delta_lon * delta_lon) <= trshld_deg2) {
+        return false;
+    }
+    last_latitude = fix.latitude;
+    last_longitude = fix.longitude;
+    rec->lat = fix.latitude * 1e7;
+    rec->lon = fix.longitude * 1e7;
+    rec->azi = fix.azimuth * 1e2;
+    rec->spd = fix.speed_kph / 0.036;
+    return true;
+}
+
+
+static bool
+fixed_path(const gpx_point_t *p, int32_t heading, report_record_t *rec) {
+    if (!distance_gate_passed(&gate, p->lat, p->lon)) {
+        return false;
+    }
+    distance_gate_set_ref(&gate, p->lat, p->lon);
+    rec->lat = p->lat;
+    rec->lon = p->lon;
+    rec->azi = heading / 1000;
+    rec->spd = p->speed / 10;
+    return true;
+}
+
+
+static void
+reset(void) {
+    last_latitude = 90;
+    last_longitude = 0;
+    trshld_deg2 = 180.0 / M_PI * TRSHLD_M / R_Earth;
+    trshld_deg2 *= trshld_deg2;
+    distance_gate_init(&gate, TRSHLD_M);
+}
+
+
+int
+main(int argc, char **argv) {
+    esp_log_level_set("*", ESP_LOG_NONE);
+    gpx_point_t *all = NULL;
+    size_t num = 0;
+    for (const char **track = gpx_tracks; *track; ++track) {
+        gpx_point_t *points;
+        int n = gpx_load(*track, &points);
+        CHECK(n > 0);
+        if (n > 0) {
+            all = (gpx_point_t*)realloc(all, (num + n) * sizeof(gpx_point_t));
+            memcpy(all + num, points, n * sizeof(gpx_point_t));
+            num += n;
+            free(points);
+        }
+    }
+    int32_t *heading = (int32_t*)malloc(num * sizeof(int32_t));
+    for (size_t i = 0; i < num; ++i) {
+        heading[i] = (int32_t)((i * 7919) % 36000000); // deg * 1e5, the tracks have none
+    }
+
+    // the precision of the records
+    double float_err_m = 0;
+    unsigned float_sent = 0, fixed_sent = 0, fixed_exact = 0;
+    reset();
+    for (size_t i = 0; i < num; ++i) {
+        report_record_t rec;
+        if (float_path(&all[i], heading[i], &rec)) {
+            ++float_sent;
+            double dy = (rec.lat - all[i].lat) * 1e-7 * M_PI / 180 * R_Earth;
+            double dx = (rec.lon - all[i].lon) * 1e-7 * M_PI / 180 * R_Earth * cos(all[i].lat * 1e-7 * M_PI / 180);
+            float_err_m = fmax(float_err_m, hypot(dx, dy));
+        }
+        if (fixed_path(&all[i], heading[i], &rec)) {
+            ++fixed_sent;
+            fixed_exact += (rec.lat == all[i].lat) && (rec.lon == all[i].lon) && (rec.azi == heading[i] / 1000) &&
+                (rec.spd == all[i].speed / 10);
+        }
+    }
+    CHECK(num > 1000);
+    CHECK(fixed_sent > 0);
+    CHECK_MSG(fixed_exact == fixed_sent, "%u of %u exact", fixed_exact, fixed_sent);
+    // a float has 24 bits of mantissa, that's 0.4 m at lon 55
+    CHECK_MSG(float_err_m > 0.1, "float error %.3f m", float_err_m);
+
+    // the time per fix
+    volatile unsigned sink = 0;
+    report_record_t rec;
+    reset();
+    uint64_t t0 = test_now_ns();
+    for (int r = 0; r < ROUNDS; ++r) {
+        for (size_t i = 0; i < num; ++i) {
+            sink += float_path(&all[i], heading[i], &rec);
+        }
+    }
+    uint64_t t1 = test_now_ns();
+    for (int r = 0; r < ROUNDS; ++r) {
+        for (size_t i = 0; i < num; ++i) {
+            sink += fixed_path(&all[i], heading[i], &rec);
+        }
+    }
+    uint64_t t2 = test_now_ns();
+    double per_fix = (double)num * ROUNDS;
+    printf("  %zu fixes, threshold %u m: float path %.1f ns/fix, %u sent, max error %.2f m\n",
+        num, TRSHLD_M, (t1 - t0) / per_fix, float_sent, float_err_m);
+    printf("  %zu fixes, threshold %u m: fixed path %.1f ns/fix, %u sent, exact\n",
+        num, TRSHLD_M, (t2 - t1) / per_fix, fixed_sent);
+
+    free(heading);
+    free(all);
+    return test_result("gps_fix");
+}
+
+// vim: set sw=4 ts=4 indk= et si:
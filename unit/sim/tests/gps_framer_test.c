@@ -0,0 +1,305 @@
+#include "test.h"
+
+#include <gps_framer.h>
+#include <esp_log.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The framer on a mixed stream of UBX and NMEA frames, clean, corrupted, and pure noise, and its throughput
+ *
+ * In the corrupted streams bytes are flipped, dropped and inserted at random. A corruption may take the frames within
+ * a buffer's length after it down with it (a bad length that still fits), but every frame farther from any of them
+ * must come out intact.
+ */
+
+#define STREAM_FRAMES   20000
+#define STREAM_MAX      (STREAM_FRAMES * (8 + 400))
+#define NOISE_LEN       (4 << 20)
+#define ROUNDS          20
+
+typedef struct {
+    size_t start, len;  // in the clean stream
+    bool is_ubx;
+    bool found;
+} orig_frame_t;
+
+static uint8_t clean[STREAM_MAX], dirty[2 * STREAM_MAX];
+static size_t clean_len, dirty_len;
+static orig_frame_t frames[STREAM_FRAMES];
+static bool hit[STREAM_MAX]; // a corruption at this position of the clean stream
+
+
+static size_t
+make_ubx_id(uint8_t *msg, uint8_t cls, uint8_t id, uint16_t payload_len) {
+    msg[0] = 0xb5;
+    msg[1] = 0x62;
+    msg[2] = cls;
+    msg[3] = id;
+    msg[4] = payload_len & 0xff;
+    msg[5] = payload_len >> 8;
+    for (size_t i = 0; i < payload_len; ++i) {
+        msg[6 + i] = rand();
+    }
+    uint8_t ck_a = 0, ck_b = 0;
+    for (size_t i = 2; i < (6 + payload_len); ++i) {
+        ck_a += msg[i];
+        ck_b += ck_a;
+    }
+    msg[6 + payload_len] = ck_a;
+    msg[7 + payload_len] = ck_b;
+    return 8 + payload_len;
+}
+
+
+static size_t
+make_ubx(uint8_t *msg, uint16_t payload_len) {
+    return make_ubx_id(msg, rand(), rand(), payload_len);
+}
+
+
+static size_t
+make_nmea(uint8_t *msg) {
+    size_t len = 0;
+    msg[len++] = '$';
+    for (size_t n = 10 + rand() % 70; n > 0; --n) {
+        char c = 0x20 + rand() % 0x5f;
+        msg[len++] = (c == '$') ? ',' : c;
+    }
+    msg[len++] = '\r';
+    msg[len++] = '\n';
+    return len;
+}
+
+
+static void
+make_stream(void) {
+    clean_len = 0;
+    for (int i = 0; i < STREAM_FRAMES; ++i) {
+        orig_frame_t *f = &frames[i];
+        f->start = clean_len;
+        f->is_ubx = (rand() % 4) != 0;
+        // mostly the short nav messages, some up to the size of an NAV-SVINFO
+        f->len = f->is_ubx ? make_ubx(clean + clean_len, (rand() % 8) ? (rand() % 60) : (rand() % 400)) : make_nmea(clean + clean_len);
+        clean_len += f->len;
+    }
+}
+
+
+// flip, drop or insert a byte at about every @one_in-th position
+static void
+corrupt(unsigned one_in) {
+    dirty_len = 0;
+    memset(hit, 0, clean_len);
+    for (size_t i = 0; i < clean_len; ++i) {
+        if ((rand() % one_in) != 0) {
+            dirty[dirty_len++] = clean[i];
+            continue;
+        }
+        hit[i] = true;
+        switch (rand() % 3) {
+            case 0: // flip
+                dirty[dirty_len++] = clean[i] ^ (1 << (rand() % 8));
+                break;
+            case 1: // drop
+                break;
+            case 2: // insert
+                dirty[dirty_len++] = (rand() % 4) ? rand() : 0xb5;
+                dirty[dirty_len++] = clean[i];
+                break;
+        }
+    }
+}
+
+
+// push @stream, match the frames coming out to the originals; returns the number of UBX frames that match none (the
+// checksum of the NMEA ones is checked only later)
+static unsigned
+replay(gps_framer_t *framer, const uint8_t *stream, size_t len) {
+    unsigned unknown = 0;
+    size_t next = 0;
+    for (int i = 0; i < STREAM_FRAMES; ++i) {
+        frames[i].found = false;
+    }
+    for (size_t i = 0; i < len; ++i) {
+        gps_frame_t frame = gps_framer_push(framer, stream[i]);
+        if (framer->len > GPS_FRAMER_BUF_SIZE) {
+            CHECK_MSG(false, "len=%zu at %zu", framer->len, i);
+            return unknown;
+        }
+        if (frame == GPS_FRAME_NONE) {
+            continue;
+        }
+        // the NMEA frames are without the "\r\n"
+        size_t flen = framer->len + ((frame == GPS_FRAME_NMEA) ? 2 : 0);
+        bool found = false;
+        for (size_t j = next; !found && (j < STREAM_FRAMES) && (j < next + 64); ++j) {
+            if ((frames[j].len == flen) && !memcmp(clean + frames[j].start, framer->buf, framer->len)) {
+                frames[j].found = found = true;
+                next = j + 1;
+            }
+        }
+        unknown += !found && (frame == GPS_FRAME_UBX);
+    }
+    return unknown;
+}
+
+
+static void
+test_clean(void) {
+    gps_framer_t framer;
+    gps_framer_init(&framer);
+    CHECK(replay(&framer, clean, clean_len) == 0);
+    unsigned missing = 0;
+    for (int i = 0; i < STREAM_FRAMES; ++i) {
+        missing += !frames[i].found;
+    }
+    CHECK_MSG(missing == 0, "%u missing", missing);
+    CHECK(framer.frames == STREAM_FRAMES);
+    CHECK(framer.junk == 0);
+    CHECK((framer.ck_errors == 0) && (framer.oversized == 0));
+}
+
+
+static void
+test_corrupted(unsigned one_in) {
+    unsigned lost = 0, at_risk = 0, must = 0, unknown_ubx = 0;
+    for (int round = 0; round < ROUNDS; ++round) {
+        corrupt(one_in);
+        gps_framer_t framer;
+        gps_framer_init(&framer);
+        unknown_ubx += replay(&framer, dirty, dirty_len);
+        for (int i = 0; i < STREAM_FRAMES; ++i) {
+            const orig_frame_t *f = &frames[i];
+            size_t from = (f->start > GPS_FRAMER_BUF_SIZE) ? (f->start - GPS_FRAMER_BUF_SIZE) : 0;
+            bool clear = true;
+            for (size_t p = from; clear && (p < f->start + f->len); ++p) {
+                clear = !hit[p];
+            }
+            if (clear) {
+                ++must;
+                lost += !f->found;
+            }
+            else {
+                at_risk += !f->found;
+            }
+        }
+    }
+    printf("  1 in %5u bytes corrupted: %u frames clear of them, %u lost; %u lost near one, %u false ubx\n",
+        one_in, must, lost, at_risk, unknown_ubx);
+    CHECK_MSG(lost == 0, "1 in %u: %u clear frames lost", one_in, lost);
+}
+
+
+// a length field that doesn't fit costs only its own frame, the next one is found right after the sync chars
+static void
+test_bad_length(void) {
+    gps_framer_t framer;
+    gps_framer_init(&framer);
+    uint8_t stream[64] = { 0xb5, 0x62, 0x01, 0x02, 0xff, 0xff };
+    size_t len = 6 + make_ubx(stream + 6, 10);
+    unsigned got = 0;
+    for (size_t i = 0; i < len; ++i) {
+        got += gps_framer_push(&framer, stream[i]) == GPS_FRAME_UBX;
+    }
+    CHECK(got == 1);
+    CHECK(framer.oversized == 1);
+
+    // a stray sync pair just before a NAV-PVT: the bogus header is b5 62 01 07, a length of 0x0701, and the real
+    // frame starts in it
+    stream[0] = 0xb5;
+    stream[1] = 0x62;
+    len = 2 + make_ubx_id(stream + 2, 0x01, 0x07, 40);
+    got = 0;
+    for (size_t i = 0; i < len; ++i) {
+        got += gps_framer_push(&framer, stream[i]) == GPS_FRAME_UBX;
+    }
+    CHECK_MSG(got == 1, "got %u", got);
+    CHECK(framer.oversized == 2);
+    CHECK(framer.len == 48);
+}
+
+
+// the uart lost the end of a frame: after the reset the next one is found, the statistics are kept
+static void
+test_reset(void) {
+    gps_framer_t framer;
+    gps_framer_init(&framer);
+    uint8_t msg[64];
+    size_t len = make_ubx(msg, 40);
+    for (size_t i = 0; i < len; ++i) {
+        gps_framer_push(&framer, msg[i]);
+    }
+    for (size_t i = 0; i < len / 2; ++i) {
+        gps_framer_push(&framer, msg[i]);
+    }
+    gps_framer_reset(&framer);
+    unsigned got = 0;
+    for (size_t i = 0; i < len; ++i) {
+        got += gps_framer_push(&framer, msg[i]) == GPS_FRAME_UBX;
+    }
+    CHECK(got == 1);
+    CHECK(framer.frames == 2);
+    CHECK(framer.junk == len / 2);
+    CHECK(framer.ck_errors == 0);
+}
+
+
+static void
+test_noise(void) {
+    static uint8_t noise[NOISE_LEN];
+    for (size_t i = 0; i < NOISE_LEN; ++i) {
+        // plenty of sync chars, so the headers and the lengths get exercised
+        noise[i] = (rand() % 16) ? rand() : ((rand() % 2) ? 0xb5 : 0x62);
+    }
+    gps_framer_t framer;
+    gps_framer_init(&framer);
+    unsigned ubx = 0;
+    for (size_t i = 0; i < NOISE_LEN; ++i) {
+        ubx += gps_framer_push(&framer, noise[i]) == GPS_FRAME_UBX;
+        if (framer.len > GPS_FRAMER_BUF_SIZE) {
+            CHECK_MSG(false, "len=%zu at %zu", framer.len, i);
+            break;
+        }
+    }
+    printf("  %u MB of noise: %u ubx frames passed the checksum, %u oversized, %u checksum errors\n",
+        NOISE_LEN >> 20, ubx, framer.oversized, framer.ck_errors);
+    CHECK(framer.oversized > 0);
+}
+
+
+static void
+throughput(void) {
+    gps_framer_t framer;
+    gps_framer_init(&framer);
+    volatile unsigned sink = 0;
+    uint64_t t0 = test_now_ns();
+    for (int r = 0; r < ROUNDS; ++r) {
+        for (size_t i = 0; i < clean_len; ++i) {
+            sink += gps_framer_push(&framer, clean[i]);
+        }
+    }
+    double ns = (test_now_ns() - t0) / ((double)clean_len * ROUNDS);
+    // 230400 baud is 23040 bytes/s
+    printf("  %.2f ns/byte, %.0f MB/s, %.4f %% of a cpu at 230400 baud\n", ns, 1e3 / ns, ns * 23040 / 1e7);
+}
+
+
+int
+main(int argc, char **argv) {
+    esp_log_level_set("*", ESP_LOG_NONE);
+    srand(1);
+    make_stream();
+    test_clean();
+    test_corrupted(100000);
+    test_corrupted(10000);
+    test_corrupted(1000);
+    test_bad_length();
+    test_reset();
+    test_noise();
+    throughput();
+    return test_result("gps_framer");
+}
+
+// vim: set sw=4 ts=4 indk= et si:
@@ -0,0 +1,350 @@
+#include "test.h"
+#include "gpx.h"
+
+#include <gps_kalman.h>
+#include <distance_gate.h>
+#include <esp_log.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/* The Kalman filter of the fixes on the tracks with simulated receiver noise, its gating and its resets
+ *
+ * Each track is resampled to 1 Hz, with STAND_SEC of standing before and after it. The noise of the positions is a
+ * slow random walk, as the receivers' is, plus a white one, and the velocities get a white noise of their own. The
+ * filtered and the raw fixes both go through the reporter's distance gate: while standing the filtered ones must
+ * hardly pass it, while moving about as often as the raw ones, and they must be closer to the truth. (The walk is a
+ * bias the filter can't tell from the movement, it can only take the white noise off.)
+ */
+
+#define R_Earth         6.371009e6
+#define M_PER_E7        (R_Earth * M_PI / 180.0 / 1e7)
+#define STAND_SEC       900
+#define WALK_SIGMA_M    1.0     // the stationary sigma of the random walk
+#define WALK_TAU_SEC    60.0    // and its correlation time
+#define WHITE_SIGMA_M   3.0
+#define VEL_SIGMA_MS    0.1
+#define HACC_MM         5000
+#define SACC_CMS        20
+#define GATE_M          15
+#define ITOW_START      100000000
+#define ROUNDS          100
+
+typedef struct {
+    int32_t lat, lon;       // deg * 1e7
+    double vel_n, vel_e;    // m/s
+} truth_t;
+
+static truth_t *truth;
+static size_t num_truth, moving_from, moving_to;
+
+
+static double
+gauss(double sigma) {
+    // Box-Muller
+    double u1 = (rand() + 1.0) / (RAND_MAX + 2.0), u2 = rand() / (RAND_MAX + 1.0);
+    return sigma * sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+}
+
+
+static double
+m_per_e7_lon(int32_t lat) {
+    return M_PER_E7 * cos(lat * M_PI / 180 / 1e7);
+}
+
+
+static double
+distance_m(int32_t lat1, int32_t lon1, int32_t lat2, int32_t lon2) {
+    return hypot((lat2 - lat1) * M_PER_E7, (lon2 - lon1) * m_per_e7_lon(lat1));
+}
+
+
+// the track at 1 Hz, standing at its ends
+static bool
+load(const char *path) {
+    gpx_point_t *points;
+    int n = gpx_load(path, &points);
+    CHECK_MSG(n > 1, "%s", path);
+    if (n <= 1) {
+        if (n > 0) {
+            free(points);
+        }
+        return false;
+    }
+    size_t secs = points[n - 1].time - points[0].time;
+    num_truth = STAND_SEC + secs + STAND_SEC;
+    truth = (truth_t*)realloc(truth, num_truth * sizeof(truth_t));
+    size_t k = 0;
+    for (size_t i = 0; i < STAND_SEC; ++i) {
+        truth[k++] = (truth_t) { .lat = points[0].lat, .lon = points[0].lon };
+    }
+    moving_from = k;
+    int j = 0;
+    for (uint32_t t = points[0].time; t < points[n - 1].time; ++t) {
+        while ((j < n - 2) && (points[j + 1].time <= t)) {
+            ++j;
+        }
+        const gpx_point_t *a = &points[j], *b = &points[j + 1];
+        double dt = (double)b->time - a->time, r = (dt > 0) ? ((t - a->time) / dt) : 0;
+        truth_t *p = &truth[k++];
+        p->lat = lround(a->lat + r * ((double)b->lat - a->lat));
+        p->lon = lround(a->lon + r * ((double)b->lon - a->lon));
+        p->vel_n = (dt > 0) ? (((double)b->lat - a->lat) * M_PER_E7 / dt) : 0;
+        p->vel_e = (dt > 0) ? (((double)b->lon - a->lon) * m_per_e7_lon(a->lat) / dt) : 0;
+    }
+    moving_to = k;
+    for (size_t i = 0; i < STAND_SEC; ++i) {
+        truth[k++] = (truth_t) { .lat = points[n - 1].lat, .lon = points[n - 1].lon };
+    }
+    num_truth = k;
+    free(points);
+    return true;
+}
+
+
+typedef struct {
+    double err_sq_sum, err_max;
+    unsigned n;
+    unsigned sent_standing, sent_moving;
+} track_stats_t;
+
+
+static void
+account(track_stats_t *stats, distance_gate_t *gate, size_t i, int32_t lat, int32_t lon) {
+    double err = distance_m(truth[i].lat, truth[i].lon, lat, lon);
+    bool moving = (moving_from <= i) && (i < moving_to);
+    if (moving) {
+        stats->err_sq_sum += err * err;
+        stats->err_max = fmax(stats->err_max, err);
+        ++stats->n;
+    }
+    if (distance_gate_passed(gate, lat, lon)) {
+        distance_gate_set_ref(gate, lat, lon);
+        if (moving) {
+            ++stats->sent_moving;
+        }
+        else {
+            ++stats->sent_standing;
+        }
+    }
+}
+
+
+static void
+check_track(const char *path) {
+    track_stats_t raw = { 0 }, filtered = { 0 };
+    distance_gate_t raw_gate, filtered_gate;
+    distance_gate_init(&raw_gate, GATE_M);
+    distance_gate_init(&filtered_gate, GATE_M);
+    gps_kalman_t kalman;
+    gps_kalman_init(&kalman);
+    // first-order Gauss-Markov, per axis
+    double walk_n = gauss(WALK_SIGMA_M), walk_e = gauss(WALK_SIGMA_M);
+    double a = exp(-1 / WALK_TAU_SEC), b = WALK_SIGMA_M * sqrt(1 - a * a);
+    for (size_t i = 0; i < num_truth; ++i) {
+        const truth_t *p = &truth[i];
+        uint32_t iTOW = ITOW_START + 1000 * i;
+        walk_n = a * walk_n + gauss(b);
+        walk_e = a * walk_e + gauss(b);
+        int32_t lat = p->lat + lround((walk_n + gauss(WHITE_SIGMA_M)) / M_PER_E7);
+        int32_t lon = p->lon + lround((walk_e + gauss(WHITE_SIGMA_M)) / m_per_e7_lon(p->lat));
+        int32_t vel_n = lround((p->vel_n + gauss(VEL_SIGMA_MS)) * 100), vel_e = lround((p->vel_e + gauss(VEL_SIGMA_MS)) * 100);
+
+        gps_kalman_position(&kalman, iTOW, lat, lon, HACC_MM);
+        gps_kalman_velocity(&kalman, iTOW, vel_n, vel_e, SACC_CMS);
+        int32_t f_lat, f_lon, heading;
+        uint32_t speed;
+        CHECK(gps_kalman_get(&kalman, &f_lat, &f_lon, &speed, &heading));
+
+        account(&raw, &raw_gate, i, lat, lon);
+        account(&filtered, &filtered_gate, i, f_lat, f_lon);
+    }
+    double raw_rms = sqrt(raw.err_sq_sum / raw.n), filtered_rms = sqrt(filtered.err_sq_sum / filtered.n);
+    printf("  %-20s standing %2u -> %u sent, moving %3u -> %3u sent, error rms %.1f -> %.1f m, max %.1f -> %.1f m, "
+        "%u rejected, %u resets\n", path + sizeof("../misc/simulated/gpx/") - 1,
+        raw.sent_standing, filtered.sent_standing, raw.sent_moving, filtered.sent_moving, raw_rms, filtered_rms,
+        raw.err_max, filtered.err_max, kalman.rejected, kalman.resets);
+    // the first fix is always sent, and the first one after the track
+    CHECK_MSG(filtered.sent_standing <= 3, "%s: %u sent while standing", path, filtered.sent_standing);
+    CHECK_MSG((filtered.sent_moving * 10 >= raw.sent_moving * 9) && (filtered.sent_moving * 10 <= raw.sent_moving * 11),
+        "%s: %u vs %u sent while moving", path, filtered.sent_moving, raw.sent_moving);
+    CHECK_MSG(filtered_rms < raw_rms, "%s: rms %.1f vs %.1f m", path, filtered_rms, raw_rms);
+    // the lag in the turns and at the stops stays within the gate
+    CHECK_MSG(filtered.err_max < GATE_M, "%s: max %.1f m", path, filtered.err_max);
+    // nothing in these is an outlier
+    CHECK_MSG(kalman.resets == 1, "%s: %u resets", path, kalman.resets);
+}
+
+
+// a fix @dist_m north of @lat, @lon
+static int32_t
+north(int32_t lat, double dist_m) {
+    return lat + lround(dist_m / M_PER_E7);
+}
+
+
+static void
+feed_still(gps_kalman_t *kalman, uint32_t *iTOW, int32_t lat, int32_t lon, int epochs) {
+    for (int i = 0; i < epochs; ++i) {
+        *iTOW += 1000;
+        gps_kalman_position(kalman, *iTOW, north(lat, gauss(1)), lon, 2000);
+        gps_kalman_velocity(kalman, *iTOW, 0, 0, 10);
+    }
+}
+
+
+// single outliers are dropped, a real jump starts the filter over after GPS_KALMAN_REJECT_MAX fixes
+static void
+test_gating(void) {
+    gps_kalman_t kalman;
+    gps_kalman_init(&kalman);
+    uint32_t iTOW = ITOW_START;
+    int32_t lat = 251234567, lon = 552345678, f_lat, f_lon, heading;
+    uint32_t speed;
+    feed_still(&kalman, &iTOW, lat, lon, 30);
+    CHECK((kalman.resets == 1) && (kalman.rejected == 0));
+
+    for (int n = 1; n < GPS_KALMAN_REJECT_MAX; ++n) {
+        // @n outliers in a row, then good fixes again
+        for (int i = 0; i < n; ++i) {
+            iTOW += 1000;
+            gps_kalman_position(&kalman, iTOW, north(lat, 300), lon, 2000);
+        }
+        CHECK(gps_kalman_get(&kalman, &f_lat, &f_lon, &speed, &heading));
+        CHECK_MSG(distance_m(lat, lon, f_lat, f_lon) < 3, "%d outliers: %.1f m", n, distance_m(lat, lon, f_lat, f_lon));
+        feed_still(&kalman, &iTOW, lat, lon, 5);
+        CHECK(kalman.rejects == 0);
+    }
+    CHECK_MSG((kalman.resets == 1) && (kalman.rejected == 1 + 2), "%u resets, %u rejected", kalman.resets, kalman.rejected);
+
+    // the unit was carried away with the receiver off: the fixes are right, it's the state that's wrong
+    int32_t lat2 = north(lat, 2000);
+    for (int i = 0; i < GPS_KALMAN_REJECT_MAX; ++i) {
+        iTOW += 1000;
+        gps_kalman_position(&kalman, iTOW, lat2, lon, 2000);
+    }
+    CHECK(kalman.resets == 2);
+    CHECK(gps_kalman_get(&kalman, &f_lat, &f_lon, &speed, &heading));
+    CHECK_MSG(distance_m(lat2, lon, f_lat, f_lon) < 1, "%.1f m", distance_m(lat2, lon, f_lat, f_lon));
+
+    // the gate widens with hAcc: the same jump with a poor fix is taken
+    feed_still(&kalman, &iTOW, lat2, lon, 10);
+    unsigned rejected = kalman.rejected;
+    iTOW += 1000;
+    gps_kalman_position(&kalman, iTOW, north(lat2, 100), lon, 50000);
+    CHECK(kalman.rejected == rejected);
+}
+
+
+// a gap longer than GPS_KALMAN_GAP_MAX_MS or a time going backwards starts over, a velocity alone can't start it
+static void
+test_resets(void) {
+    gps_kalman_t kalman;
+    gps_kalman_init(&kalman);
+    int32_t f_lat, f_lon, heading;
+    uint32_t speed;
+    uint32_t iTOW = ITOW_START;
+    gps_kalman_velocity(&kalman, iTOW, 100, 0, 10);
+    CHECK(!gps_kalman_get(&kalman, &f_lat, &f_lon, &speed, &heading));
+
+    int32_t lat = -339000000, lon = 184000000;
+    feed_still(&kalman, &iTOW, lat, lon, 10);
+    CHECK(kalman.resets == 1);
+    iTOW += GPS_KALMAN_GAP_MAX_MS;
+    gps_kalman_position(&kalman, iTOW, lat, lon, 2000);
+    CHECK_MSG(kalman.resets == 1, "a gap of just GPS_KALMAN_GAP_MAX_MS: %u resets", kalman.resets);
+    iTOW += GPS_KALMAN_GAP_MAX_MS + 1000;
+    gps_kalman_position(&kalman, iTOW, north(lat, 500), lon, 2000);
+    CHECK(kalman.resets == 2);
+    CHECK(gps_kalman_get(&kalman, &f_lat, &f_lon, &speed, &heading));
+    CHECK((f_lat == north(lat, 500)) && (f_lon == lon) && (speed == 0));
+
+    gps_kalman_position(&kalman, iTOW - 1000, lat, lon, 2000);
+    CHECK(kalman.resets == 3);
+    CHECK((kalman.iTOW == iTOW - 1000) && !kalman.hold && (kalman.rejects == 0));
+
+    // and the statistics are kept, only gps_kalman_init() clears them
+    CHECK(kalman.updates > 0);
+}
+
+
+// standing: held after GPS_KALMAN_STILL_EPOCHS, released by the speed, or by the position if it drifts away
+static void
+test_hold(void) {
+    gps_kalman_t kalman;
+    gps_kalman_init(&kalman);
+    int32_t f_lat, f_lon, heading;
+    uint32_t speed;
+    uint32_t iTOW = ITOW_START;
+    int32_t lat = 600000000, lon = 100000000;
+    feed_still(&kalman, &iTOW, lat, lon, 20);
+    CHECK(kalman.hold && (kalman.holds == 1));
+    CHECK(gps_kalman_get(&kalman, &f_lat, &f_lon, &speed, &heading));
+    CHECK((f_lat == kalman.hold_lat) && (f_lon == kalman.hold_lon) && (speed == 0));
+
+    // drives off east at 5 m/s
+    for (int i = 1; i <= 5; ++i) {
+        iTOW += 1000;
+        gps_kalman_velocity(&kalman, iTOW, 0, 500, 10);
+        gps_kalman_position(&kalman, iTOW, lat, lon + lround(5.0 * i / m_per_e7_lon(lat)), 2000);
+    }
+    CHECK(!kalman.hold);
+    CHECK(gps_kalman_get(&kalman, &f_lat, &f_lon, &speed, &heading));
+    CHECK_MSG((4000 < speed) && (speed < 6000), "%u mm/s", speed);
+    CHECK_MSG(labs(heading - 9000000) < 500000, "heading %d", heading);
+
+    // stops again: held, and the heading is the last one while moving
+    int32_t lon2 = lon + lround(25.0 / m_per_e7_lon(lat));
+    feed_still(&kalman, &iTOW, lat, lon2, 20);
+    CHECK(kalman.hold && (kalman.holds == 2));
+    CHECK(gps_kalman_get(&kalman, &f_lat, &f_lon, &speed, &heading));
+    CHECK_MSG(labs(heading - 9000000) < 500000, "heading %d", heading);
+
+    // creeps away too slowly for the speed to tell
+    for (int i = 1; (i <= 60) && kalman.hold; ++i) {
+        iTOW += 1000;
+        gps_kalman_position(&kalman, iTOW, north(lat, 0.2 * i), lon2, 2000);
+        gps_kalman_velocity(&kalman, iTOW, 20, 0, 10);
+    }
+    CHECK_MSG(!kalman.hold, "still held after 12 m");
+}
+
+
+static void
+throughput(void) {
+    gps_kalman_t kalman;
+    gps_kalman_init(&kalman);
+    uint64_t t0 = test_now_ns();
+    for (int r = 0; r < ROUNDS; ++r) {
+        for (size_t i = 0; i < num_truth; ++i) {
+            uint32_t iTOW = ITOW_START + 1000 * i;
+            gps_kalman_position(&kalman, iTOW, truth[i].lat, truth[i].lon, HACC_MM);
+            gps_kalman_velocity(&kalman, iTOW, truth[i].vel_n * 100, truth[i].vel_e * 100, SACC_CMS);
+        }
+    }
+    printf("  %.1f ns per epoch, position and velocity\n", (test_now_ns() - t0) / ((double)num_truth * ROUNDS));
+}
+
+
+int
+main(int argc, char **argv) {
+    esp_log_level_set("*", ESP_LOG_NONE);
+    srand(1);
+    for (const char **track = gpx_tracks; *track; ++track) {
+        if (load(*track)) {
+            check_track(*track);
+        }
+    }
+    test_gating();
+    test_resets();
+    test_hold();
+    // on the last track
+    if (truth) {
+        throughput();
+    }
+    free(truth);
+    return test_result("gps_kalman");
+}
+
+// vim: set sw=4 ts=4 indk= et si:
@@ -0,0 +1,103 @@
+#include "gpx.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+const char *gpx_tracks[] = {
+    "../misc/simulated/gpx/20200930-173651.gpx",
+    "../misc/simulated/gpx/20201003-090957.gpx",
+    "../misc/simulated/gpx/20201003-092331.gpx",
+    "../misc/simulated/gpx/20201003-095239.gpx",
+    NULL
+};
+
+
+static char *
+read_all(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *text = (char*)malloc(len + 1);
+    if (text && (fread(text, 1, len, f) != (size_t)len)) {
+        free(text);
+        text = NULL;
+    }
+    fclose(f);
+    if (text) {
+        text[len] = '\0';
+    }
+    return text;
+}
+
+
+// the unix time of a utc date, without timegm(), as the firmware has its own (in misc.c)
+static uint32_t
+utc_time(int year, int mon, int mday, int hour, int min, int sec) {
+    // days from 1970-01-01, by http://howardhinnant.github.io/date_algorithms.html#days_from_civil
+    year -= (mon <= 2);
+    int era = year / 400;
+    int yoe = year - era * 400;
+    int doy = (153 * (mon + ((mon > 2) ? -3 : 9)) + 2) / 5 + mday - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    int days = era * 146097 + doe - 719468;
+    return days * 86400u + hour * 3600 + min * 60 + sec;
+}
+
+
+// the text of the element @tag within [@from, @to), or NULL
+static const char *
+element(const char *from, const char *to, const char *tag) {
+    char open[32];
+    snprintf(open, sizeof(open), "<%s>", tag);
+    const char *p = strstr(from, open);
+    return (p && (p < to)) ? (p + strlen(open)) : NULL;
+}
+
+
+int
+gpx_load(const char *path, gpx_point_t **points) {
+    char *text = read_all(path);
+    if (!text) {
+        return -1;
+    }
+    size_t num = 0, alloc = 1024;
+    gpx_point_t *result = (gpx_point_t*)malloc(alloc * sizeof(gpx_point_t));
+    for (const char *p = strstr(text, "<trkpt "); p; ) {
+        const char *next = strstr(p + 1, "<trkpt ");
+        const char *end = next ? next : (p + strlen(p));
+        double lat, lon;
+        const char *lat_attr = strstr(p, "lat=\""), *lon_attr = strstr(p, "lon=\"");
+        if (!lat_attr || !lon_attr || (sscanf(lat_attr, "lat=\"%lf\"", &lat) != 1) || (sscanf(lon_attr, "lon=\"%lf\"", &lon) != 1)) {
+            break;
+        }
+        gpx_point_t pt = { .lat = lround(lat * 1e7), .lon = lround(lon * 1e7) };
+        const char *t = element(p, end, "time");
+        int year, mon, mday, hour, min, sec;
+        if (t && (sscanf(t, "%d-%d-%dT%d:%d:%d", &year, &mon, &mday, &hour, &min, &sec) == 6)) {
+            pt.time = utc_time(year, mon, mday, hour, min, sec);
+        }
+        const char *s = element(p, end, "speed");
+        double speed;
+        if (s && (sscanf(s, "%lf", &speed) == 1)) {
+            pt.speed = lround(speed * 1000);
+        }
+        if (num == alloc) {
+            alloc *= 2;
+            result = (gpx_point_t*)realloc(result, alloc * sizeof(gpx_point_t));
+        }
+        result[num++] = pt;
+        p = next;
+    }
+    free(text);
+    *points = result;
+    return num;
+}
+
+// vim: set sw=4 ts=4 indk= et si:
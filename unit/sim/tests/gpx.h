@@ -0,0 +1,21 @@
+#ifndef GPX_H
+#define GPX_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// the track points of a gpx file, in the units of gps_fix_t
+typedef struct {
+    int32_t lat, lon;       // deg * 1e7
+    uint32_t time;          // unix time, sec
+    uint32_t speed;         // mm/s, 0 if the file doesn't have it
+} gpx_point_t;
+
+// reads all the <trkpt> of @path, returns their number, or -1 on error; *@points is to be freed
+int gpx_load(const char *path, gpx_point_t **points);
+
+// the tracks in misc/simulated/gpx, relative to unit/, where the tests run
+extern const char *gpx_tracks[];
+
+#endif // GPX_H
+// vim: set sw=4 ts=4 indk= et si:
@@ -0,0 +1,161 @@
+#include "test.h"
+#include "sim.h"
+
+#include <https_client.h>
+#include <main.h>
+#include <esp_log.h>
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/* The reconnects of the https client to a stand-in server, with and without the resumption of the TLS session
+ *
+ * The handshakes take the time set by sim_tls_set_handshake_ms(), a tenth of the ones measured on the unit, so what is
+ * tested here is that the client does offer the cached session, and that the servers' sessions are kept apart, also
+ * when two tasks connect at the same time.
+ */
+
+#define FULL_MS     250
+#define RESUMED_MS  30
+#define RECONNECTS  8
+
+// misc.c, for source_date_epoch, refers to it; it's sim_main.c that defines it
+EventGroupHandle_t main_event_group;
+
+typedef struct {
+    int fd;
+    char port[8];
+} server_t;
+
+
+// accepts the connections and closes them, the handshake of the shim needs nothing from the server
+static void *
+server_main(void *arg) {
+    server_t *server = (server_t*)arg;
+    int fd;
+    while ((fd = accept(server->fd, NULL, NULL)) >= 0) {
+        close(fd);
+    }
+    return NULL;
+}
+
+
+static void
+server_start(server_t *server) {
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t addrlen = sizeof(addr);
+    server->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if ((server->fd < 0) || bind(server->fd, (struct sockaddr*)&addr, addrlen) || listen(server->fd, 8) ||
+        getsockname(server->fd, (struct sockaddr*)&addr, &addrlen)) {
+        perror("server");
+        exit(1);
+    }
+    snprintf(server->port, sizeof(server->port), "%u", ntohs(addr.sin_port));
+    pthread_t thread;
+    pthread_create(&thread, NULL, server_main, server);
+    pthread_detach(thread);
+}
+
+
+// the time of each connect, in ms
+static void
+reconnect(const server_t *server, bool tickets, double *ms) {
+    https_conn_context_t ctx;
+    CHECK(https_init(&ctx));
+    if (!tickets) {
+        mbedtls_ssl_conf_session_tickets(&ctx.conf, MBEDTLS_SSL_SESSION_TICKETS_DISABLED);
+    }
+    for (int i = 0; i < RECONNECTS; ++i) {
+        uint64_t t0 = test_now_ns();
+        bool ok = https_connect(&ctx, "127.0.0.1", server->port);
+        ms[i] = (test_now_ns() - t0) / 1e6;
+        CHECK_MSG(ok, "connect %d", i);
+        if (ok) {
+            https_disconnect(&ctx);
+        }
+    }
+    https_destroy(&ctx);
+}
+
+
+static void
+test_resumption(void) {
+    server_t with, without;
+    server_start(&with);
+    server_start(&without);
+    double ms_with[RECONNECTS], ms_without[RECONNECTS];
+    uint32_t connects, full, resumed, failed;
+
+    reconnect(&without, false, ms_without);
+    sim_tls_get_stats(&connects, &full, &resumed, &failed);
+    CHECK_MSG((full == RECONNECTS) && (resumed == 0), "full=%u, resumed=%u", full, resumed);
+
+    reconnect(&with, true, ms_with);
+    sim_tls_get_stats(&connects, &full, &resumed, &failed);
+    // only the first one is full
+    CHECK_MSG((full == RECONNECTS + 1) && (resumed == RECONNECTS - 1), "full=%u, resumed=%u", full, resumed);
+    CHECK(failed == 0);
+
+    double sum_with = 0, sum_without = 0;
+    for (int i = 0; i < RECONNECTS; ++i) {
+        sum_with += ms_with[i];
+        sum_without += ms_without[i];
+        if (i > 0) {
+            CHECK_MSG(ms_with[i] < (FULL_MS + RESUMED_MS) / 2, "resumed %d: %.1f ms", i, ms_with[i]);
+        }
+        CHECK_MSG(ms_without[i] >= FULL_MS, "full %d: %.1f ms", i, ms_without[i]);
+    }
+    printf("  %d connects, handshake %u/%u ms: without resumption %.1f ms, with %.1f ms (first %.1f, then %.1f)\n",
+        RECONNECTS, FULL_MS, RESUMED_MS, sum_without / RECONNECTS, sum_with / RECONNECTS, ms_with[0],
+        (sum_with - ms_with[0]) / (RECONNECTS - 1));
+    close(with.fd);
+    close(without.fd);
+}
+
+
+static void *
+reconnect_main(void *arg) {
+    double ms[RECONNECTS];
+    reconnect((const server_t*)arg, true, ms);
+    return NULL;
+}
+
+
+// two tasks reconnecting at the same time, to two servers: each gets its own session resumed
+static void
+test_concurrent(void) {
+    server_t servers[2];
+    pthread_t threads[2];
+    uint32_t connects, full0, resumed0, full, resumed, failed;
+    sim_tls_get_stats(&connects, &full0, &resumed0, &failed);
+    for (int i = 0; i < 2; ++i) {
+        server_start(&servers[i]);
+        pthread_create(&threads[i], NULL, reconnect_main, &servers[i]);
+    }
+    for (int i = 0; i < 2; ++i) {
+        pthread_join(threads[i], NULL);
+        close(servers[i].fd);
+    }
+    sim_tls_get_stats(&connects, &full, &resumed, &failed);
+    CHECK_MSG((full - full0 == 2) && (resumed - resumed0 == 2 * (RECONNECTS - 1)), "full=%u, resumed=%u",
+        full - full0, resumed - resumed0);
+    CHECK(failed == 0);
+}
+
+
+int
+main(int argc, char **argv) {
+    esp_log_level_set("*", ESP_LOG_NONE);
+    sim_tls_set_handshake_ms(FULL_MS, RESUMED_MS);
+    https_client_init();
+    test_resumption();
+    test_concurrent();
+    return test_result("https_resume");
+}
+
+// vim: set sw=4 ts=4 indk= et si:
@@ -0,0 +1,322 @@
+#include "test.h"
+#include "sim.h"
+
+#include <report_queue.h>
+#include <esp_spi_flash.h>
+#include <esp_log.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* The report queue on a small flash: the order of draining, the wraparound of the flash log, and the recovery after
+ * power losses, both between the operations and in the middle of a flash write or erase.
+ */
+
+#define SECTORS             4
+#define SLOTS_PER_SECTOR    (SPI_FLASH_SEC_SIZE / 32)
+#define NUM_SLOTS           (SECTORS * SLOTS_PER_SECTOR)
+#define TIME_BASE           1600000000
+
+static const char *partitions_csv;
+
+
+// every record is made from its id, so a record read back can be checked to be the very same one
+static report_record_t
+make_rec(uint32_t id) {
+    report_record_t rec = {
+        .time = TIME_BASE + id,
+        .lat = 251234567 + id * 3,
+        .lon = 552123456 - id,
+        .azi = id % 36000,
+        .spd = id & 0xffff,
+        .bat = 3000 + id % 1000,
+        .flags = REPORT_HAS_FIX | REPORT_HAS_MS | ((id % 1000) << REPORT_MS_SHIFT),
+        .acc = (id & 1) ? REPORT_ACC_UNKNOWN : (id % 1000),
+    };
+    return rec;
+}
+
+
+// the id of the record at @idx of the queue, or -1 if there is none or it's not one of make_rec()
+static int64_t
+peek_id(size_t idx) {
+    report_record_t rec;
+    if (!report_queue_peek(idx, &rec)) {
+        return -1;
+    }
+    report_record_t e = make_rec(rec.time - TIME_BASE);
+    bool same = (rec.lat == e.lat) && (rec.lon == e.lon) && (rec.azi == e.azi) && (rec.spd == e.spd) && (rec.bat == e.bat) &&
+        (rec.flags == e.flags) && (rec.acc == e.acc);
+    return same ? (int64_t)(rec.time - TIME_BASE) : -1;
+}
+
+
+static const char *
+write_partitions(void) {
+    static char path[] = "/tmp/lrepq-test-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        exit(1);
+    }
+    dprintf(fd, "# Name, Type, SubType, Offset, Size\nlrepq, data, 0x40, 0x10000, 0x%x\n", SECTORS * SPI_FLASH_SEC_SIZE);
+    close(fd);
+    return path;
+}
+
+
+// a new, erased flash
+static void
+fresh_flash(void) {
+    sim_flash_power_cut(0);
+    CHECK(sim_flash_load(partitions_csv, NULL));
+    CHECK(report_queue_init());
+}
+
+
+// power loss: the RAM part of the queue is lost, the flash is recovered
+static void
+reboot(void) {
+    sim_flash_power_cut(0);
+    CHECK(report_queue_init());
+}
+
+
+static void
+test_ram_only(void) {
+    CHECK(!report_queue_init()); // no flash loaded
+    for (uint32_t id = 0; id < 10; ++id) {
+        report_record_t rec = make_rec(id);
+        report_queue_push(&rec);
+    }
+    CHECK(report_queue_count() == 10);
+    report_queue_pop(3);
+    for (uint32_t id = 10; id < 20; ++id) {
+        report_record_t rec = make_rec(id);
+        report_queue_push(&rec);
+    }
+    // the oldest one is dropped when the RAM is full
+    CHECK(report_queue_count() == REPORT_QUEUE_RAM_LEN);
+    for (size_t i = 0; i < REPORT_QUEUE_RAM_LEN; ++i) {
+        CHECK(peek_id(i) == (int64_t)(4 + i));
+    }
+    CHECK(peek_id(REPORT_QUEUE_RAM_LEN) == -1);
+    report_queue_pop(100);
+    CHECK(report_queue_count() == 0);
+}
+
+
+static void
+test_drain_order(void) {
+    fresh_flash();
+    for (uint32_t id = 0; id < 300; ++id) {
+        report_record_t rec = make_rec(id);
+        report_queue_push(&rec);
+    }
+    CHECK(report_queue_count() == 300);
+    // everything in flash comes before everything in RAM
+    for (size_t i = 0; i < 300; ++i) {
+        CHECK(peek_id(i) == (int64_t)i);
+    }
+    uint32_t next = 0;
+    while (report_queue_count() > 0) {
+        size_t n = 1 + next % 7;
+        CHECK(peek_id(0) == (int64_t)next);
+        report_queue_pop(n);
+        next += n;
+    }
+    CHECK(next >= 300);
+    CHECK(peek_id(0) == -1);
+}
+
+
+static void
+test_wraparound(void) {
+    fresh_flash();
+    uint32_t total = 3 * NUM_SLOTS + 17;
+    for (uint32_t id = 0; id < total; ++id) {
+        report_record_t rec = make_rec(id);
+        report_queue_push(&rec);
+    }
+    // the oldest sectors were sacrificed, at most one sector short of full
+    size_t count = report_queue_count();
+    CHECK_MSG(count <= NUM_SLOTS + REPORT_QUEUE_RAM_LEN, "count=%zu", count);
+    CHECK_MSG(count > NUM_SLOTS - SLOTS_PER_SECTOR + REPORT_QUEUE_RAM_LEN, "count=%zu", count);
+    // what's left is the newest ones, in order
+    int64_t first = peek_id(0);
+    CHECK(first == (int64_t)(total - count));
+    for (size_t i = 0; i < count; ++i) {
+        CHECK(peek_id(i) == first + (int64_t)i);
+    }
+
+    // and it survives a reboot, without the ones in RAM
+    reboot();
+    CHECK(report_queue_count() == count - REPORT_QUEUE_RAM_LEN);
+    CHECK(peek_id(0) == first);
+    uint32_t popped = 0;
+    while (report_queue_count() > 0) {
+        CHECK(peek_id(0) == first + popped);
+        report_queue_pop(1);
+        ++popped;
+    }
+    CHECK(popped == count - REPORT_QUEUE_RAM_LEN);
+}
+
+
+static void
+test_reboot(void) {
+    fresh_flash();
+    for (uint32_t id = 0; id < 200; ++id) {
+        report_record_t rec = make_rec(id);
+        report_queue_push(&rec);
+    }
+    report_queue_pop(50);
+    reboot();
+    // the newest ones were still in RAM
+    CHECK(report_queue_count() == 200 - 50 - REPORT_QUEUE_RAM_LEN);
+    CHECK(peek_id(0) == 50);
+    // a second reboot without doing anything in between changes nothing
+    reboot();
+    CHECK(report_queue_count() == 200 - 50 - REPORT_QUEUE_RAM_LEN);
+    CHECK(peek_id(0) == 50);
+    report_queue_pop(report_queue_count());
+    reboot();
+    CHECK(report_queue_count() == 0);
+}
+
+
+/* Random pushes, pops and reboots over many rounds of the flash log, compared with a model of the queue
+ *
+ * The queue is kept below the size of the flash, so nothing is dropped, and a reboot loses exactly the newest records
+ * that were in RAM. The delivered ids must be strictly increasing: a consumed record must never come again.
+ */
+static void
+test_random_reboots(void) {
+    static uint32_t model[NUM_SLOTS + REPORT_QUEUE_RAM_LEN];
+    size_t model_len = 0;
+    size_t model_ram = 0; // the newest ones are in RAM, they are spilled to flash only when it's full
+    uint32_t next_id = 0;
+    int64_t last_delivered = -1;
+    unsigned reboots = 0;
+    bool ok = true;
+
+    fresh_flash();
+    srand(1);
+    for (int step = 0; (step < 20000) && ok; ++step) {
+        int op = rand() % 20;
+        if (op == 0) {
+            reboot();
+            ++reboots;
+            model_len -= model_ram;
+            model_ram = 0;
+        }
+        else if ((op < 10) && (model_len + 60 < NUM_SLOTS - SLOTS_PER_SECTOR)) {
+            for (int n = 1 + rand() % 60; n > 0; --n) {
+                report_record_t rec = make_rec(next_id);
+                report_queue_push(&rec);
+                model[model_len++] = next_id++;
+                if (model_ram < REPORT_QUEUE_RAM_LEN) {
+                    ++model_ram;
+                }
+            }
+        }
+        else {
+            size_t n = 1 + rand() % 40;
+            if (n > model_len) {
+                n = model_len;
+            }
+            for (size_t i = 0; i < n; ++i) {
+                int64_t id = peek_id(i);
+                ok = ok && (id > last_delivered);
+                last_delivered = id;
+            }
+            report_queue_pop(n);
+            memmove(model, model + n, (model_len - n) * sizeof(model[0]));
+            model_len -= n;
+            if (model_ram > model_len) {
+                model_ram = model_len;
+            }
+        }
+        ok = ok && (report_queue_count() == model_len);
+        // a peek reads the flash from the oldest one on, so only some of them are checked
+        if ((op == 0) && (model_len > 0)) {
+            for (size_t i = 0; ok && (i < model_len); i += 1 + model_len / 8) {
+                ok = (peek_id(i) == model[i]);
+            }
+            ok = ok && (peek_id(model_len - 1) == model[model_len - 1]);
+        }
+        else if (ok && (model_len > 0)) {
+            ok = (peek_id(0) == model[0]);
+        }
+        CHECK_MSG(ok, "step %d, len=%zu, count=%zu", step, model_len, report_queue_count());
+    }
+    CHECK_MSG(next_id > 10 * NUM_SLOTS, "only %u records", next_id);
+    CHECK(reboots > 100);
+}
+
+
+/* The power is lost in the middle of each flash operation of a busy sequence in turn
+ *
+ * After the recovery the queue must have only intact records, in order, without any that were popped before the power
+ * loss, and it must keep working.
+ */
+static void
+test_torn_writes(void) {
+    for (unsigned cut = 1; cut < 400; cut += 3) {
+        fresh_flash();
+        uint32_t next_id = 0;
+        int64_t acked = -1; // the newest popped one, of the pops done before the power loss
+        sim_flash_power_cut(cut);
+        for (int round = 0; (round < 40) && !sim_flash_power_is_cut(); ++round) {
+            for (int i = 0; i < 30; ++i) {
+                report_record_t rec = make_rec(next_id++);
+                report_queue_push(&rec);
+            }
+            size_t n = 11 + round % 13;
+            int64_t newest = peek_id(n - 1);
+            report_queue_pop(n);
+            if (!sim_flash_power_is_cut()) {
+                acked = newest;
+            }
+        }
+
+        reboot();
+        size_t count = report_queue_count();
+        int64_t prev = acked;
+        for (size_t i = 0; i < count; ++i) {
+            int64_t id = peek_id(i);
+            CHECK_MSG(id > prev, "cut=%u, idx=%zu, id=%lld, prev=%lld", cut, i, (long long)id, (long long)prev);
+            prev = id;
+        }
+
+        // and goes on as usual
+        for (int i = 0; i < 50; ++i) {
+            report_record_t rec = make_rec(next_id++);
+            report_queue_push(&rec);
+        }
+        CHECK(report_queue_count() == count + 50);
+        CHECK(peek_id(count + 49) == (int64_t)(next_id - 1));
+        report_queue_pop(count + 50);
+        CHECK(report_queue_count() == 0);
+    }
+}
+
+
+int
+main(int argc, char **argv) {
+    // the power cuts and the full queues are logged thousands of times
+    esp_log_level_set("*", ESP_LOG_NONE);
+    partitions_csv = write_partitions();
+    test_ram_only();
+    test_drain_order();
+    test_wraparound();
+    test_reboot();
+    test_random_reboots();
+    test_torn_writes();
+    unlink(partitions_csv);
+    return test_result("report_queue");
+}
+
+// vim: set sw=4 ts=4 indk= et si:
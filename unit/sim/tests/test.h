@@ -0,0 +1,49 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+/* The checks of the host tests
+ *
+ * A failed check is printed and counted, the test goes on, and test_result() is its exit code.
+ */
+
+static int test_checks, test_failures;
+
+#define CHECK(cond) do { \
+    ++test_checks; \
+    if (!(cond)) { \
+        ++test_failures; \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+    } \
+} while (0)
+
+// the same, with the values that are compared
+#define CHECK_MSG(cond, ...) do { \
+    ++test_checks; \
+    if (!(cond)) { \
+        ++test_failures; \
+        fprintf(stderr, "%s:%d: check failed: %s: ", __FILE__, __LINE__, #cond); \
+        fprintf(stderr, __VA_ARGS__); \
+        fprintf(stderr, "\n"); \
+    } \
+} while (0)
+
+static inline int
+test_result(const char *name) {
+    printf("%-24s %s, %d checks, %d failed\n", name, test_failures ? "FAIL" : "ok", test_checks, test_failures);
+    return test_failures ? 1 : 0;
+}
+
+// monotonic time in ns, for the throughput figures
+static inline uint64_t
+test_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+#endif // TEST_H
+// vim: set sw=4 ts=4 indk= et si:
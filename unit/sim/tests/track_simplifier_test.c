@@ -0,0 +1,168 @@
+#include "test.h"
+#include "gpx.h"
+
+#include <track_simplifier.h>
+#include <esp_log.h>
+
+#include <stdlib.h>
+#include <math.h>
+
+/* The tracks replayed through the track simplifier, at several error limits
+ *
+ * Every fix must be within the limit from where it would be at its time on the reported segment around it (the same
+ * synchronous distance the simplifier uses, here in double), and the reported points must be a subset of the fixes, in
+ * order. The reduction ratio and the time per fix are printed.
+ *
+ * A straight track at a constant speed, with several fixes a second, must come out as its two ends: the position of a
+ * fix on the segment is by its time to the ms.
+ */
+
+#define R_Earth     6.371009e6
+#define M_PER_E7    (R_Earth * M_PI / 180.0 / 1e7)
+#define ROUNDS      100
+// the simplifier works in float, on distances from the anchor of up to a few km
+#define FLOAT_SLACK 0.1
+
+static report_record_t *recs, *out;
+static size_t num_recs, num_out;
+
+
+static void
+load(const char *path) {
+    gpx_point_t *points;
+    int n = gpx_load(path, &points);
+    CHECK_MSG(n > 0, "%s", path);
+    recs = (report_record_t*)realloc(recs, (n > 0 ? n : 1) * sizeof(report_record_t));
+    out = (report_record_t*)realloc(out, (n > 0 ? n : 1) * sizeof(report_record_t));
+    num_recs = (n > 0) ? n : 0;
+    for (size_t i = 0; i < num_recs; ++i) {
+        recs[i] = (report_record_t) {
+            .time = points[i].time,
+            .lat = points[i].lat,
+            .lon = points[i].lon,
+            .spd = points[i].speed / 10,
+            .bat = i, // the index of the fix, to find it again
+        };
+    }
+    if (n > 0) {
+        free(points);
+    }
+}
+
+
+static void
+simplify(uint32_t max_err_m) {
+    track_simplifier_t simplifier;
+    track_simplifier_init(&simplifier, max_err_m);
+    num_out = 0;
+    for (size_t i = 0; i < num_recs; ++i) {
+        num_out += track_simplifier_add(&simplifier, &recs[i], &out[num_out]);
+    }
+    num_out += track_simplifier_flush(&simplifier, &out[num_out]);
+}
+
+
+static double
+time_ms(const report_record_t *rec) {
+    return 1000.0 * rec->time + ((rec->flags & REPORT_HAS_MS) ? report_ms(rec) : 0);
+}
+
+
+// the distance of @q from where it would be at its time on the @a -> @b segment
+static double
+sed(const report_record_t *a, const report_record_t *b, const report_record_t *q) {
+    double span = time_ms(b) - time_ms(a);
+    double ratio = (span != 0) ? ((time_ms(q) - time_ms(a)) / span) : 0;
+    double dy = ((double)q->lat - a->lat - ratio * ((double)b->lat - a->lat)) * M_PER_E7;
+    double dx = ((double)q->lon - a->lon - ratio * ((double)b->lon - a->lon)) * M_PER_E7 * cos(a->lat * M_PI / 180 / 1e7);
+    return hypot(dx, dy);
+}
+
+
+static void
+check_track(const char *path, uint32_t max_err_m) {
+    simplify(max_err_m);
+    CHECK_MSG(num_out >= 2, "%s, %u m: %zu points", path, max_err_m, num_out);
+    CHECK_MSG((out[0].bat == 0) && (out[num_out - 1].bat == num_recs - 1), "%s, %u m: the ends are missing", path, max_err_m);
+    double worst = 0;
+    for (size_t k = 1; k < num_out; ++k) {
+        size_t from = out[k - 1].bat, to = out[k].bat;
+        CHECK_MSG(to > from, "%s, %u m: point %zu out of order", path, max_err_m, k);
+        if (to <= from) {
+            return;
+        }
+        for (size_t i = from + 1; i < to; ++i) {
+            worst = fmax(worst, sed(&out[k - 1], &out[k], &recs[i]));
+        }
+    }
+    printf("  %-28s %2u m: %4zu -> %4zu points, 1:%.1f, max error %.2f m\n",
+        path + sizeof("../misc/simulated/gpx/") - 1, max_err_m, num_recs, num_out, (double)num_recs / num_out, worst);
+    CHECK_MSG(worst <= max_err_m + FLOAT_SLACK, "%s, %u m: %.2f m", path, max_err_m, worst);
+    if (max_err_m == 0) {
+        CHECK(num_out == num_recs);
+    }
+    else {
+        // at least a few fixes per point, but never more than the window
+        CHECK_MSG(num_out * 4 < num_recs, "%s, %u m: %zu of %zu", path, max_err_m, num_out, num_recs);
+        CHECK(num_out * TRACK_SIMPLIFIER_WINDOW >= num_recs);
+    }
+}
+
+
+// 5 Hz fixes going north at 20 m/s, as many as fit in the window: by the whole seconds alone, the fixes within a
+// second would be up to 16 m off
+static void
+check_subsecond(void) {
+    num_recs = TRACK_SIMPLIFIER_WINDOW;
+    recs = (report_record_t*)realloc(recs, num_recs * sizeof(report_record_t));
+    out = (report_record_t*)realloc(out, num_recs * sizeof(report_record_t));
+    for (size_t i = 0; i < num_recs; ++i) {
+        uint32_t ms = i * 200;
+        recs[i] = (report_record_t) {
+            .time = 1600000000 + ms / 1000,
+            .lat = 251000000 + (int32_t)lround(20e-3 * ms / M_PER_E7),
+            .lon = 552000000,
+            .spd = 2000,
+            .bat = i,
+            .flags = REPORT_HAS_FIX | REPORT_HAS_MS | ((ms % 1000) << REPORT_MS_SHIFT),
+        };
+    }
+    simplify(1);
+    CHECK_MSG(num_out == 2, "5 Hz: %zu points", num_out);
+    CHECK((out[0].bat == 0) && (out[num_out - 1].bat == num_recs - 1));
+}
+
+
+static void
+throughput(uint32_t max_err_m) {
+    uint64_t t0 = test_now_ns();
+    for (int r = 0; r < ROUNDS; ++r) {
+        simplify(max_err_m);
+    }
+    uint64_t t1 = test_now_ns();
+    printf("  %u m: %.1f ns/fix\n", max_err_m, (t1 - t0) / ((double)num_recs * ROUNDS));
+}
+
+
+int
+main(int argc, char **argv) {
+    esp_log_level_set("*", ESP_LOG_NONE);
+    static const uint32_t max_errs[] = { 0, 5, 10, 25 };
+    for (const char **track = gpx_tracks; *track; ++track) {
+        load(*track);
+        if (num_recs == 0) {
+            continue;
+        }
+        for (size_t e = 0; e < sizeof(max_errs) / sizeof(max_errs[0]); ++e) {
+            check_track(*track, max_errs[e]);
+        }
+    }
+    // the time per fix, on the last track
+    throughput(10);
+    check_subsecond();
+    free(recs);
+    free(out);
+    return test_result("track_simplifier");
+}
+
+// vim: set sw=4 ts=4 indk= et si:
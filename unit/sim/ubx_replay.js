@@ -0,0 +1,262 @@
+// Generates the UBX stream of a u-blox receiver that follows a GPX track, for the UART0 of the sim
+//
+// node ubx_replay.js [options] <track.gpx> | build/gps-unit-sim -s -
+//
+// Every navigation epoch is NAV-TIMEUTC (on whole seconds only), NAV-POSLLH, NAV-DOP, NAV-SOL and NAV-VELNED, in the
+// order of their IDs, as the receiver sends them. The position is interpolated along the track, the velocity comes from its neighbours.
+
+const fs = require("fs");
+
+const GPS_EPOCH_MS = Date.UTC(1980, 0, 6);
+const GPS_LEAP_SEC = 18;
+const WEEK_MS = 7 * 24 * 3600 * 1000;
+const M_PER_DEG = 111319.5;
+
+function usage() {
+    console.error("Usage: node ubx_replay.js [options] <track.gpx>");
+    console.error("  --rate <hz>      navigation rate (default: 1)");
+    console.error("  --speed <x>      replay speed, 0 for as fast as it's read (default: 1)");
+    console.error("  --park <sec>     standing still before and after the track (default: 0)");
+    console.error("  --acc <m>        the hAcc of the fixes (default: 5)");
+    console.error("  --noise <m>      sigma of the position noise (default: 0)");
+    console.error("  --dop <x>        the hDOP and pDOP of the fixes (default: 1.2)");
+    console.error("  --loop <n>       replay the track this many times (default: 1)");
+    console.error("  --original <0|1> keep the times of the track, otherwise it starts now (default: 0)");
+    process.exit(1);
+}
+
+function parse_args(argv) {
+    let opts = { rate: 1, speed: 1, park: 0, acc: 5, noise: 0, dop: 1.2, loop: 1, original: 0, gpx: null };
+    for (let i = 0; i < argv.length; ++i) {
+        let a = argv[i];
+        if (a.startsWith("--")) {
+            let k = a.substr(2);
+            if (!(k in opts) || (k === "gpx") || (i + 1 >= argv.length)) {
+                usage();
+            }
+            opts[k] = parseFloat(argv[++i]);
+            if (isNaN(opts[k])) {
+                usage();
+            }
+        }
+        else {
+            opts.gpx = a;
+        }
+    }
+    if (!opts.gpx || (opts.rate < 1) || (opts.rate > 5) || (opts.speed < 0)) {
+        usage();
+    }
+    return opts;
+}
+
+// the track points, with strictly increasing times (ms)
+function load_gpx(path) {
+    let track = [];
+    let re = /<trkpt\s+lat="([-\d.]+)"\s+lon="([-\d.]+)"\s*>(.*?)<\/trkpt>/gs;
+    let gpx = fs.readFileSync(path, "utf8");
+    let m;
+    while ((m = re.exec(gpx)) !== null) {
+        let t = /<time>([^<]+)<\/time>/.exec(m[3]);
+        if (!t) {
+            continue;
+        }
+        let p = { time: new Date(t[1]).getTime(), lat: parseFloat(m[1]), lon: parseFloat(m[2]) };
+        if ((track.length === 0) || (p.time > track[track.length - 1].time)) {
+            track.push(p);
+        }
+    }
+    return track;
+}
+
+// the position at @t, interpolated between the surrounding points
+function position_at(track, t) {
+    if (t <= track[0].time) {
+        return { lat: track[0].lat, lon: track[0].lon };
+    }
+    let last = track[track.length - 1];
+    if (t >= last.time) {
+        return { lat: last.lat, lon: last.lon };
+    }
+    let lo = 0, hi = track.length - 1;
+    while (hi - lo > 1) {
+        let mid = (lo + hi) >> 1;
+        if (track[mid].time <= t) {
+            lo = mid;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    let a = track[lo], b = track[hi];
+    let f = (t - a.time) / (b.time - a.time);
+    return { lat: a.lat + (b.lat - a.lat) * f, lon: a.lon + (b.lon - a.lon) * f };
+}
+
+function gauss() {
+    let u = 1 - Math.random(), v = Math.random();
+    return Math.sqrt(-2 * Math.log(u)) * Math.cos(2 * Math.PI * v);
+}
+
+function ubx(cls, id, payload) {
+    let msg = Buffer.alloc(8 + payload.length);
+    msg[0] = 0xb5;
+    msg[1] = 0x62;
+    msg[2] = cls;
+    msg[3] = id;
+    msg.writeUInt16LE(payload.length, 4);
+    payload.copy(msg, 6);
+    let ck_a = 0, ck_b = 0;
+    for (let i = 2; i < 6 + payload.length; ++i) {
+        ck_a = (ck_a + msg[i]) & 0xff;
+        ck_b = (ck_b + ck_a) & 0xff;
+    }
+    msg[6 + payload.length] = ck_a;
+    msg[7 + payload.length] = ck_b;
+    return msg;
+}
+
+// all the messages of the epoch at @utc_ms
+function epoch(opts, utc_ms, pos, vel) {
+    let iTOW = (utc_ms + GPS_LEAP_SEC * 1000 - GPS_EPOCH_MS) % WEEK_MS;
+    let acc_mm = Math.round(opts.acc * 1000);
+    let dop = Math.round(opts.dop * 100);
+    let lat = pos.lat, lon = pos.lon;
+    if (opts.noise > 0) {
+        lat += gauss() * opts.noise / M_PER_DEG;
+        lon += gauss() * opts.noise / (M_PER_DEG * Math.cos(pos.lat * Math.PI / 180));
+    }
+    let msgs = [];
+
+    if ((utc_ms % 1000) === 0) {
+        let p = Buffer.alloc(20);
+        let d = new Date(utc_ms);
+        p.writeUInt32LE(iTOW, 0);
+        p.writeUInt32LE(30, 4); // tAcc, ns
+        p.writeInt32LE(0, 8); // nano
+        p.writeUInt16LE(d.getUTCFullYear(), 12);
+        p[14] = d.getUTCMonth() + 1;
+        p[15] = d.getUTCDate();
+        p[16] = d.getUTCHours();
+        p[17] = d.getUTCMinutes();
+        p[18] = d.getUTCSeconds();
+        p[19] = 0x07; // validTOW, validWKN, validUTC
+        msgs.push(ubx(0x01, 0x21, p));
+    }
+    {
+        let p = Buffer.alloc(28);
+        p.writeUInt32LE(iTOW, 0);
+        p.writeInt32LE(Math.round(lon * 1e7), 4);
+        p.writeInt32LE(Math.round(lat * 1e7), 8);
+        p.writeInt32LE(150000, 12); // height, mm
+        p.writeInt32LE(110000, 16); // hMSL, mm
+        p.writeUInt32LE(acc_mm, 20);
+        p.writeUInt32LE(acc_mm * 2, 24);
+        msgs.push(ubx(0x01, 0x02, p));
+    }
+    {
+        let p = Buffer.alloc(18);
+        p.writeUInt32LE(iTOW, 0);
+        p.writeUInt16LE(dop, 4); // gDOP
+        p.writeUInt16LE(dop, 6); // pDOP
+        p.writeUInt16LE(dop, 8); // tDOP
+        p.writeUInt16LE(dop, 10); // vDOP
+        p.writeUInt16LE(dop, 12); // hDOP
+        p.writeUInt16LE(dop, 14); // nDOP
+        p.writeUInt16LE(dop, 16); // eDOP
+        msgs.push(ubx(0x01, 0x04, p));
+    }
+    {
+        let p = Buffer.alloc(52);
+        p.writeUInt32LE(iTOW, 0);
+        p.writeInt32LE(0, 4); // fTOW
+        p.writeInt16LE(Math.floor((utc_ms + GPS_LEAP_SEC * 1000 - GPS_EPOCH_MS) / WEEK_MS), 8);
+        p[10] = 0x03; // gpsFix: 3D
+        p[11] = 0x0d; // flags: gpsFixOK, WKNSET, TOWSET
+        p.writeUInt32LE(Math.round(acc_mm / 10), 24); // pAcc, cm
+        p.writeUInt16LE(dop, 44);
+        p[47] = 9; // numSV
+        msgs.push(ubx(0x01, 0x06, p));
+    }
+    {
+        let p = Buffer.alloc(36);
+        let vn = Math.round(vel.n * 100), ve = Math.round(vel.e * 100); // cm/s
+        let gspeed = Math.round(Math.hypot(vel.n, vel.e) * 100);
+        let heading = Math.round(((Math.atan2(vel.e, vel.n) * 180 / Math.PI + 360) % 360) * 1e5);
+        p.writeUInt32LE(iTOW, 0);
+        p.writeInt32LE(vn, 4);
+        p.writeInt32LE(ve, 8);
+        p.writeInt32LE(0, 12); // velD
+        p.writeUInt32LE(gspeed, 16);
+        p.writeUInt32LE(gspeed, 20);
+        p.writeInt32LE(heading, 24);
+        p.writeUInt32LE(50, 28); // sAcc, cm/s
+        p.writeUInt32LE(gspeed > 50 ? 5 * 1e5 : 180 * 1e5, 32); // cAcc, deg * 1e5
+        msgs.push(ubx(0x01, 0x12, p));
+    }
+    return Buffer.concat(msgs);
+}
+
+function sleep(ms) {
+    return new Promise(r => setTimeout(r, ms));
+}
+
+function write(buf) {
+    return new Promise((resolve, reject) => {
+        if (process.stdout.write(buf)) {
+            resolve();
+        }
+        else {
+            process.stdout.once("drain", resolve);
+        }
+    });
+}
+
+async function main() {
+    let opts = parse_args(process.argv.slice(2));
+    let track = load_gpx(opts.gpx);
+    if (track.length < 2) {
+        console.error("There are less than 2 timed track points in " + opts.gpx);
+        process.exit(1);
+    }
+    if (!opts.original) {
+        // the firmware takes no time earlier than its build for valid, so the track is moved to the present
+        let shift = Math.ceil(Date.now() / 1000) * 1000 - track[0].time;
+        track.forEach(p => { p.time += shift; });
+    }
+    let step = 1000 / opts.rate;
+    let t0 = Math.ceil(track[0].time / 1000) * 1000 - opts.park * 1000;
+    let t1 = track[track.length - 1].time + opts.park * 1000;
+    let duration = t1 - t0;
+    console.error("Replaying " + track.length + " points, " + Math.round(duration / 1000) + " s at " + opts.rate + " Hz, speed x" + opts.speed);
+
+    let started = Date.now();
+    let n = 0;
+    for (let lap = 0; lap < opts.loop; ++lap) {
+        for (let t = t0; t <= t1; t += step, ++n) {
+            let pos = position_at(track, t);
+            let prev = position_at(track, t - 1000), next = position_at(track, t + 1000);
+            let vel = {
+                n: (next.lat - prev.lat) / 2 * M_PER_DEG,
+                e: (next.lon - prev.lon) / 2 * M_PER_DEG * Math.cos(pos.lat * Math.PI / 180),
+            };
+            // the receiver time goes on through the laps
+            let utc_ms = t + lap * (duration + step);
+            if (opts.speed > 0) {
+                await sleep(started + n * step / opts.speed - Date.now());
+            }
+            await write(epoch(opts, utc_ms, pos, vel));
+        }
+    }
+    console.error("Replayed " + n + " epochs");
+}
+
+process.stdout.on("error", err => {
+    if (err.code === "EPIPE") {
+        process.exit(0);
+    }
+    throw err;
+});
+
+main();
+
+// vim: set sw=4 ts=4 et: